@@ -3,125 +3,33 @@
 #include <ctype.h>
 #include <string.h>
 
-void readppm(unsigned char *buffer, int *bufferlen, 
-             char *header, int *headerlen,
-             unsigned *rows, unsigned *cols, unsigned *chans,
-             char *file)
-{
-    char *aline=NULL;  size_t linelen; FILE *filep;
-    char magic[2]; unsigned col, row, sat, channels=3;
-    int nread=0, toread=0, fd=0;
-    *headerlen=0;
-
-    filep=fopen(file, "r");
-
-    // read and validate header
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    strcat(header, aline);
-    sscanf(aline, "%s", magic);
-    if(strncmp(magic, "P6", 2) == 0) channels=3; else channels=1;
-
-    // ignore comment line or print for debug
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    strcat(header, aline);
-
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    sscanf(aline, "%u %u", &col, &row);
-    strcat(header, aline);
-    *bufferlen=row*col*channels;  toread=*bufferlen;
-    *rows=row, *cols=col, *chans=channels;
-
-    if((*headerlen += getline(&aline, &linelen, filep)) < 0)
-        {perror("getline"); exit(-1);}
-    sscanf(aline, "%u", &sat);
-    strcat(header, aline);
-
-    printf("%s", header);
-
-    printf("read %d bytes, buffer=%p, toread=%d\n", nread, buffer, toread);
-
-    do
-    {
-        if((nread=fread(buffer, 1, (col*row*channels), filep)) == 0)
-        { 
-            if(feof(filep))
-                { printf("completed readppm\n"); break; }
-            else
-                { perror("readppm"); exit(-1); }
-        }
-
-        buffer+=nread;
-        toread=toread-nread;
-        printf("read %d bytes, buffer=%p, toread=%d\n", nread, buffer, toread);
-    } while(toread > 0 && (!feof(filep)));
-
-    printf("readppm done\n\n");
-    close(filep);
-}
-
-
-void writeppm(unsigned char *buffer, int bufferlen,
-              char *header, int headerlen,
-              char *file)
-{
-    FILE *filep;
-    int nwritten=0, towrite=0;
-
-    filep=fopen(file, "w");
-
-    printf("wrote %d bytes, header=%p, towrite=%d\n", nwritten, header, towrite);
-
-    do
-    {
-        if((nwritten=fwrite(header, 1, headerlen, filep)) == 0)
-        { 
-            if(feof(filep))
-                { printf("completed writeppm header\n"); break; }
-            else
-                { perror("writeppm header"); exit(-1); }
-        }
-
-        header+=nwritten;
-        towrite=towrite-nwritten;
-        printf("wrote %d bytes, header=%p, towrite=%d\n", nwritten, header, towrite);
-    } while(towrite > 0);
-    towrite=0; nwritten=0;
-
-    printf("wrote %d bytes, buffer=%p, towrite=%d\n", nwritten, buffer, towrite);
-    do
-    {
-        if((nwritten=fwrite(buffer, 1, bufferlen, filep)) == 0)
-        { 
-            if(feof(filep))
-                { printf("completed writeppm\n"); break; }
-            else
-                { perror("writeppm"); exit(-1); }
-        }
-
-        buffer+=nwritten;
-        towrite=towrite-nwritten;
-        printf("wrote %d bytes, buffer=%p, towrite=%d\n", nwritten, buffer, towrite);
-    } while(towrite > 0);
-
-    close(filep);
-}
-
+#include "pnm_io.h"
 
 #define PIXIDX ((i*col*chan)+(j*chan)+k)
 #define SAT (255)
 
 void main(int argc, char *argv[])
 {
-  char header[512];
-  unsigned char img[640*480*3], newimg[640*480*3];
-  int bufflen, hdrlen; unsigned row=0, col=0, chan=0, pix; int i, j, k;
+  struct pnm_image in, out;
+  unsigned char *img, *newimg;
+  unsigned row=0, col=0, chan=0, pix; int i, j, k;
   double alpha=1.25;  unsigned char beta=25;
 
-  header[0]='\0';
-  readppm(img, &bufflen, header, &hdrlen, &row, &col, &chan, argv[1]);
+  if(argc < 2)
+    { printf("Usage: brighten input_file.ppm [output_file.ppm]\n"); exit(-1); }
+
+  // any size of P5 or P6, mapped rather than read
+  if(pnm_open(&in, argv[1]) != 0)
+    exit(-1);
+  if(in.maxval > 255)
+    { printf("%s is not 8-bit\n", argv[1]); exit(-1); }
+  row=in.height; col=in.width; chan=in.channels;
+  printf("%.*s", (int)in.header_len, in.header);
+
+  // brightened straight from the input mapping into the output mapping
+  if(pnm_create_like(&out, (argc > 2) ? argv[2] : "brighter.ppm", &in) != 0)
+    exit(-1);
+  img=in.pixels; newimg=out.pixels;
 
   for(i=0; i < row; i++)
     for(j=0; j < col; j++)
@@ -130,5 +38,6 @@ void main(int argc, char *argv[])
           newimg[PIXIDX] = (pix=(unsigned)((img[PIXIDX])*alpha)+beta) > SAT ? SAT : pix;
       }
 
-  writeppm(newimg, bufflen, header, hdrlen, "brighter.ppm");
+  pnm_close(&out);
+  pnm_close(&in);
 }
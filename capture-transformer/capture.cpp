@@ -33,9 +33,15 @@
 
 #include <time.h>
 
+#include <atomic>
+
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 
+#include "yuv_convert.h"
+#include "frame_source.h"
+#include "capture_format.h"
+
 using namespace cv;
 
 
@@ -45,10 +51,9 @@ using namespace cv;
 #define CANNY_TRANSFORM
 #define DISPLAY_CANNY_TRANSFORM
 
+// default resolution, -S WxH and -P choose the format at run time
 #define HRES 1280
 #define VRES 960
-#define HRES_STR "1280"
-#define VRES_STR "960"
 
 // Format is used by a number of functions, so made as a file global
 static struct v4l2_format fmt;
@@ -79,7 +84,13 @@ struct buffer          *buffers;
 static unsigned int     n_buffers;
 static int              out_buf;
 static int              force_format=1;
+static int              hres=HRES, vres=VRES;
+static unsigned int     pixfmt=V4L2_PIX_FMT_YUYV;
+static struct work_pool work;           // working buffers, sized once the format is negotiated
 static int              frame_count = 1000;
+static char            *source_spec;
+static struct frame_source *source;    // replaces the device when set
+static int              zero_copy=0;
 
 int lowThreshold;
 int const max_lowThreshold = 100;
@@ -106,22 +117,19 @@ static int xioctl(int fh, int request, void *arg)
         return r;
 }
 
-char ppm_header[]="P6\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255 \n";
+char ppm_header[64];
 char ppm_dumpname[]="test00000000.ppm";
 
 static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
    
     snprintf(&ppm_dumpname[4], 9, "%08d", tag);
     strncat(&ppm_dumpname[12], ".ppm", 5);
     dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&ppm_header[14], " sec ", 5);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&ppm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-    written=write(dumpfd, ppm_header, sizeof(ppm_header));
+    hlen=capture_pnm_header(ppm_header, sizeof(ppm_header), 1, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
+    written=write(dumpfd, ppm_header, hlen);
 
     total=0;
 
@@ -149,22 +157,19 @@ static void cvdump_pgm(Mat img, unsigned int tag)
 }
 
 
-char pgm_header[]="P5\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255 \n";
+char pgm_header[64];
 char pgm_dumpname[]="test00000000.pgm";
 
 static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
    
     snprintf(&pgm_dumpname[4], 9, "%08d", tag);
     strncat(&pgm_dumpname[12], ".pgm", 5);
     dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&pgm_header[14], " sec ", 5);
-    snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&pgm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-    written=write(dumpfd, pgm_header, sizeof(pgm_header));
+    hlen=capture_pnm_header(pgm_header, sizeof(pgm_header), 0, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
+    written=write(dumpfd, pgm_header, hlen);
 
     total=0;
 
@@ -214,6 +219,9 @@ void yuv2rgb_float(float y, float u, float v,
 //      YUV422, which we assume here, where there are 2 bytes for each pixel, with two Y samples for one U & V,
 //              or as the name implies, 4Y and 2 UV pairs
 //      YUV420, where for every 4 Ys, there is a single UV pair, 1.5 bytes for each pixel or 36 bytes for 24 pixels
+//
+// The vector kernels in capture_common/yuv_convert.c used by process_image() are bit-exact
+// with this function.
 
 void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b)
 {
@@ -244,8 +252,8 @@ void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned c
 
 
 unsigned int framecnt=0;
-unsigned char bigbuffer[(2560*1920*3)];
-Mat timg(VRES, HRES, CV_8UC3, bigbuffer);
+unsigned char *bigbuffer;    // from work, sized for the negotiated format
+Mat timg;        // over bigbuffer, made by alloc_work_buffers()
 Mat timg_gray;
 Mat timg_grad;
 
@@ -254,7 +262,8 @@ Mat detected_edges;
 int edgeThresh = 1;
 int ratio = 3;
 
-void CannyThreshold(int, void*)
+// Canny edges of timg_gray, used as a mask over src into timg_grad
+static void cannyMask(const Mat &src)
 {
     /// Reduce noise with a kernel 3x3
     blur( timg_gray, detected_edges, Size(3,3) );
@@ -263,9 +272,15 @@ void CannyThreshold(int, void*)
     Canny( detected_edges, detected_edges, lowThreshold, lowThreshold*ratio, kernel_size );
 
     /// Using Canny's output as a mask, we display our result
+    timg_grad.create( src.size(), src.type() );
     timg_grad = Scalar::all(0);
 
-    timg.copyTo( timg_grad, detected_edges);
+    src.copyTo( timg_grad, detected_edges);
+}
+
+void CannyThreshold(int, void*)
+{
+    cannyMask(timg);
 
 #if defined(DISPLAY_CANNY_TRANSFORM)
     imshow( timg_window_name, timg_grad );
@@ -276,9 +291,8 @@ void CannyThreshold(int, void*)
 
 static void process_image(const void *p, int size)
 {
-    int i, newi, newsize=0;
+    int newsize=0;
     struct timespec frame_time;
-    int y_temp, y2_temp, u_temp, v_temp;
     unsigned char *pptr = (unsigned char *)p;
 
 
@@ -314,12 +328,7 @@ static void process_image(const void *p, int size)
         // Pixels are YU and YV alternating, so YUYV which is 4 bytes
         // We want RGB, so RGBRGB which is 6 bytes
         //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+6)
-        {
-            y_temp=(int)pptr[i]; u_temp=(int)pptr[i+1]; y2_temp=(int)pptr[i+2]; v_temp=(int)pptr[i+3];
-            yuv2rgb(y_temp, u_temp, v_temp, &bigbuffer[newi], &bigbuffer[newi+1], &bigbuffer[newi+2]);
-            yuv2rgb(y2_temp, u_temp, v_temp, &bigbuffer[newi+3], &bigbuffer[newi+4], &bigbuffer[newi+5]);
-        }
+        yuyv_to_rgb24(pptr, bigbuffer, size/2);
 
 #if defined(SOBEL_TRANSFORM)
         GaussianBlur( timg, timg, Size(3,3), 0, 0, BORDER_DEFAULT );
@@ -372,12 +381,7 @@ static void process_image(const void *p, int size)
         // Pixels are YU and YV alternating, so YUYV which is 4 bytes
         // We want Y, so YY which is 2 bytes
         //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+2)
-        {
-            // Y1=first byte and Y2=third byte
-            bigbuffer[newi]=pptr[i];
-            bigbuffer[newi+1]=pptr[i+2];
-        }
+        yuyv_to_y8(pptr, bigbuffer, size/2);
 
         dump_pgm(bigbuffer, (size/2), framecnt, &frame_time);
 #endif
@@ -389,6 +393,16 @@ static void process_image(const void *p, int size)
         printf("Dump RGB as-is size %d\n", size);
         dump_ppm(p, size, framecnt, &frame_time);
     }
+
+    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG)
+    {
+        printf("Decode MJPEG size %d\n", size);
+
+        // decode into bigbuffer through timg, then RGB order for the PPM
+        imdecode(Mat(1, size, CV_8UC1, pptr), IMREAD_COLOR, &timg);
+        cvtColor(timg, timg, COLOR_BGR2RGB);
+        dump_ppm(timg.data, timg.total() * 3, framecnt, &frame_time);
+    }
     else
     {
         printf("ERROR - unknown dump format\n");
@@ -400,11 +414,142 @@ static void process_image(const void *p, int size)
 }
 
 
+// Zero-copy frame references
+//
+// With -z the transforms work directly on the mmap'd driver buffer through a
+// Mat header instead of on a converted copy in bigbuffer.  Each dequeued
+// buffer carries a reference count and goes back to the driver with
+// VIDIOC_QBUF only when the last FrameRef to it is released, so a consumer
+// may keep a frame (or hand it to another thread) for as long as it needs it.
+// Holding more than n_buffers-2 frames will starve the driver.
+
+static std::atomic<int> *buffer_refs;
+
+static void buffer_release(unsigned int index)
+{
+    struct v4l2_buffer buf;
+
+    if(buffer_refs[index].fetch_sub(1) != 1)
+        return;
+
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+
+    if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+            errno_exit("VIDIOC_QBUF");
+}
+
+class FrameRef
+{
+public:
+    // takes the reference the driver handed over with VIDIOC_DQBUF
+    FrameRef(unsigned int index, int bytesused) : idx(index), used(bytesused) { buffer_refs[idx].store(1); }
+    FrameRef(const FrameRef &other) : idx(other.idx), used(other.used) { buffer_refs[idx].fetch_add(1); }
+    ~FrameRef() { buffer_release(idx); }
+
+    unsigned char *data() const { return (unsigned char *)buffers[idx].start; }
+    int size() const { return used; }
+
+    // Mat header over the YUYV driver buffer, only valid while this reference is held
+    Mat yuyv() const { return Mat(fmt.fmt.pix.height, fmt.fmt.pix.width, CV_8UC2, data(), fmt.fmt.pix.bytesperline); }
+
+private:
+    FrameRef &operator=(const FrameRef &);
+
+    unsigned int idx;
+    int used;
+};
+
+Mat zc_blur;
+
+static void process_frame(const FrameRef &frame)
+{
+    struct timespec frame_time;
+    Mat yuyv = frame.yuyv();
+
+#if defined(SOBEL_TRANSFORM)
+    // Used for Sobel transform
+    int scale = 1;
+    int delta = 0;
+    int ddepth = CV_16S;
+#endif
+
+    // record when process was called
+    clock_gettime(CLOCK_REALTIME, &frame_time);    
+
+    framecnt++;
+    printf("frame %d: zero-copy %dx%d size %d\n", framecnt, yuyv.cols, yuyv.rows, frame.size());
+
+    if(fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV)
+    {
+        printf("ERROR - zero-copy transform needs YUYV\n");
+        return;
+    }
+
+    // luma comes straight out of the driver buffer, no RGB staging copy
+    cvtColor(yuyv, timg_gray, COLOR_YUV2GRAY_YUYV);
+
+#if defined(SOBEL_TRANSFORM)
+    GaussianBlur( timg_gray, zc_blur, Size(3,3), 0, 0, BORDER_DEFAULT );
+    Mat grad_x, grad_y;
+    Mat abs_grad_x, abs_grad_y;
+
+    Sobel( zc_blur, grad_x, ddepth, 1, 0, 3, scale, delta, BORDER_DEFAULT );
+    convertScaleAbs( grad_x, abs_grad_x );
+
+    Sobel( zc_blur, grad_y, ddepth, 0, 1, 3, scale, delta, BORDER_DEFAULT );
+    convertScaleAbs( grad_y, abs_grad_y );
+
+    addWeighted( abs_grad_x, 0.5, abs_grad_y, 0.5, 0, timg_grad );
+
+#if defined(DISPLAY_SOBEL_TRANSFORM)
+    imshow( timg_window_name, timg_grad );
+    waitKey(10);
+#else
+    cvdump_pgm(timg_grad, framecnt);
+#endif
+
+#endif
+
+#if defined(CANNY_TRANSFORM)
+
+    // the edges mask the luma already taken from the driver buffer rather than
+    // a colour copy of the frame, the dump is a PGM either way
+    cannyMask(timg_gray);
+
+#if defined(DISPLAY_CANNY_TRANSFORM)
+    imshow( timg_window_name, timg_grad );
+    waitKey(10);
+#else
+    cvdump_pgm(timg_grad, framecnt);
+#endif
+
+#endif
+
+    fflush(stdout);
+}
+
+
 static int read_frame(void)
 {
     struct v4l2_buffer buf;
     unsigned int i;
 
+    if(source)
+    {
+        const void *p;
+        unsigned int size;
+        struct timespec timestamp;
+
+        if(!frame_source_read(source, &p, &size, &timestamp))
+            return 0;
+
+        process_image(p, size);
+        return 1;
+    }
+
     switch (io)
     {
 
@@ -458,6 +603,15 @@ static int read_frame(void)
 
             assert(buf.index < n_buffers);
 
+            if(zero_copy)
+            {
+                // requeued when the last reference to the frame is released
+                FrameRef frame(buf.index, buf.bytesused);
+
+                process_frame(frame);
+                break;
+            }
+
             process_image(buffers[buf.index].start, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -526,13 +680,15 @@ static void mainloop(void)
             int r;
 
             FD_ZERO(&fds);
-            FD_SET(fd, &fds);
+            if(!source)
+                FD_SET(fd, &fds);
 
             /* Timeout. */
             tv.tv_sec = 2;
             tv.tv_usec = 0;
 
-            r = select(fd + 1, &fds, NULL, NULL, &tv);
+            // replayed frames have no descriptor, the source paces them
+            r = source ? 1 : select(fd + 1, &fds, NULL, NULL, &tv);
 
             if (-1 == r)
             {
@@ -649,6 +805,7 @@ static void uninit_device(void)
                 for (i = 0; i < n_buffers; ++i)
                         if (-1 == munmap(buffers[i].start, buffers[i].length))
                                 errno_exit("munmap");
+                delete [] buffer_refs;
                 break;
 
         case IO_METHOD_USERPTR:
@@ -717,7 +874,11 @@ static void init_mmap(void)
                 exit(EXIT_FAILURE);
         }
 
+        buffer_refs = new std::atomic<int>[req.count];
+
         for (n_buffers = 0; n_buffers < req.count; ++n_buffers) {
+                buffer_refs[n_buffers].store(0);
+
                 struct v4l2_buffer buf;
 
                 CLEAR(buf);
@@ -869,13 +1030,13 @@ static void init_device(void)
     if (force_format)
     {
         printf("FORCING FORMAT\n");
-        fmt.fmt.pix.width       = HRES;
-        fmt.fmt.pix.height      = VRES;
+        fmt.fmt.pix.width       = hres;
+        fmt.fmt.pix.height      = vres;
 
         // Specify the Pixel Coding Formate here
 
-        // This one work for Logitech C200
-        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        // YUYV works for Logitech C200, -P asks for another
+        fmt.fmt.pix.pixelformat = pixfmt;
 
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_VYUY;
@@ -891,6 +1052,11 @@ static void init_device(void)
                 errno_exit("VIDIOC_S_FMT");
 
         /* Note VIDIOC_S_FMT may change width and height. */
+        if((fmt.fmt.pix.width != (unsigned int)hres) || (fmt.fmt.pix.height != (unsigned int)vres) ||
+           (fmt.fmt.pix.pixelformat != pixfmt))
+            printf("Driver chose %ux%u %s instead of %dx%d %s\n",
+                   fmt.fmt.pix.width, fmt.fmt.pix.height, capture_pixfmt_name(fmt.fmt.pix.pixelformat),
+                   hres, vres, capture_pixfmt_name(pixfmt));
     }
     else
     {
@@ -908,6 +1074,9 @@ static void init_device(void)
     if (fmt.fmt.pix.sizeimage < min)
             fmt.fmt.pix.sizeimage = min;
 
+    printf("negotiated %ux%u, %u bytes per line, %u bytes per frame\n",
+           fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.bytesperline, fmt.fmt.pix.sizeimage);
+
     switch (io)
     {
         case IO_METHOD_READ:
@@ -957,6 +1126,40 @@ static void open_device(void)
         }
 }
 
+static void open_source(void)
+{
+    if(!(source = frame_source_open(source_spec, hres, vres)))
+        exit(EXIT_FAILURE);
+
+    // what init_device() would have negotiated with the camera
+    CLEAR(fmt);
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    frame_source_format(source, &fmt.fmt.pix);
+
+    if(pixfmt != V4L2_PIX_FMT_YUYV)
+        printf("Frame sources are YUYV, -P %s ignored\n", capture_pixfmt_name(pixfmt));
+
+    printf("Replaying %s as %dx%d YUYV\n", frame_source_name(source),
+           fmt.fmt.pix.width, fmt.fmt.pix.height);
+}
+
+// Working buffers are sized from the negotiated format, after init_device() or open_source()
+static void alloc_work_buffers(void)
+{
+    size_t bytes = capture_work_bytes(&fmt.fmt.pix);
+
+    if((work_pool_init(&work, bytes) != 0) || !(bigbuffer = (unsigned char *)work_pool_alloc(&work, bytes)))
+    {
+        fprintf(stderr, "Out of memory for %zu byte working buffer\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    timg = Mat(fmt.fmt.pix.height, fmt.fmt.pix.width, CV_8UC3, bigbuffer);
+
+    printf("Capturing %ux%u %s, %zu byte working buffer\n", fmt.fmt.pix.width, fmt.fmt.pix.height,
+           capture_pixfmt_name(fmt.fmt.pix.pixelformat), bytes);
+}
+
 static void usage(FILE *fp, int argc, char **argv)
 {
         fprintf(fp,
@@ -969,13 +1172,23 @@ static void usage(FILE *fp, int argc, char **argv)
                  "-r | --read          Use read() calls\n"
                  "-u | --userp         Use application allocated buffers\n"
                  "-o | --output        Outputs stream to stdout\n"
-                 "-f | --format        Force format to 640x480 GREY\n"
+                 "-f | --format        Force the -S/-P format on the device [default]\n"
                  "-c | --count         Number of frames to grab [%i]\n"
+                 "-s | --source spec   Replay frames instead of a device:\n"
+                 "                     raw:file[@fps], dir:directory[@fps],\n"
+                 "                     synth[:bars|ramp|noise|box][@fps]\n"
+                 "-z | --zerocopy      Transform mmap'd driver buffers in place\n"
+                 "-S | --size WxH      Resolution to request [%dx%d]\n"
+                 "-P | --pixfmt name   yuyv, grey, rgb24 or mjpeg [%s]\n"
+                 "\n"
+                 "Without a camera, load the virtual driver (modprobe vivid) and\n"
+                 "pass its node with -d, the format negotiated is used for -z.\n"
                  "",
-                 argv[0], dev_name, frame_count);
+                 argv[0], dev_name, frame_count,
+                 hres, vres, capture_pixfmt_name(pixfmt));
 }
 
-static const char short_options[] = "d:hmruofc:";
+static const char short_options[] = "d:hmruofc:zs:S:P:";
 
 static const struct option
 long_options[] = {
@@ -987,6 +1200,10 @@ long_options[] = {
         { "output", no_argument,       NULL, 'o' },
         { "format", no_argument,       NULL, 'f' },
         { "count",  required_argument, NULL, 'c' },
+        { "source", required_argument, NULL, 's' },
+        { "size",   required_argument, NULL, 'S' },
+        { "pixfmt", required_argument, NULL, 'P' },
+        { "zerocopy", no_argument,     NULL, 'z' },
         { 0, 0, 0, 0 }
 };
 
@@ -1060,19 +1277,72 @@ int main(int argc, char **argv)
                         errno_exit(optarg);
                 break;
 
+            case 's':
+                source_spec = optarg;
+                break;
+
+            case 'S':
+                if(capture_parse_size(optarg, &hres, &vres) != 0)
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'P':
+                if(!(pixfmt = capture_parse_pixfmt(optarg)))
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'z':
+                zero_copy++;
+                break;
+
             default:
                 usage(stderr, argc, argv);
                 exit(EXIT_FAILURE);
         }
     }
 
-    open_device();
-    init_device();
-    start_capturing();
+    if(zero_copy && ((io != IO_METHOD_MMAP) || source_spec))
+    {
+        fprintf(stderr, "-z needs memory mapped driver buffers, not -r, -u or -s\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if(source_spec)
+        open_source();
+    else
+    {
+        open_device();
+        init_device();
+
+        // otherwise every frame would be refused in process_frame()
+        if(zero_copy && (fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV))
+        {
+            fprintf(stderr, "-z needs YUYV, %s negotiated\n", capture_pixfmt_name(fmt.fmt.pix.pixelformat));
+            exit(EXIT_FAILURE);
+        }
+
+        start_capturing();
+    }
+
+    alloc_work_buffers();
+
     mainloop();
-    stop_capturing();
-    uninit_device();
-    close_device();
+
+    if(source)
+        frame_source_close(source);
+    else
+    {
+        stop_capturing();
+        uninit_device();
+        close_device();
+    }
+    work_pool_destroy(&work);
     fprintf(stderr, "\n");
     return 0;
 }
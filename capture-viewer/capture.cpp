@@ -38,15 +38,19 @@
 #include "opencv2/imgproc/imgproc.hpp"
 #include "opencv2/highgui/highgui.hpp"
 
+#include "yuv_convert.h"
+#include "frame_source.h"
+#include "capture_format.h"
+
 using namespace cv;
 
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 #define COLOR_CONVERT
+
+// default resolution, -S WxH and -P choose the format at run time
 #define HRES 320
 #define VRES 240
-#define HRES_STR "320"
-#define VRES_STR "240"
 
 // Format is used by a number of functions, so made as a file global
 static struct v4l2_format fmt;
@@ -76,7 +80,12 @@ struct buffer          *buffers;
 static unsigned int     n_buffers;
 static int              out_buf;
 static int              force_format=1;
+static int              hres=HRES, vres=VRES;
+static unsigned int     pixfmt=V4L2_PIX_FMT_YUYV;
+static struct work_pool work;           // working buffers, sized once the format is negotiated
 static int              frame_count = 30;
+static char            *source_spec;
+static struct frame_source *source;    // replaces the device when set
 
 static void errno_exit(const char *s)
 {
@@ -97,22 +106,19 @@ static int xioctl(int fh, int request, void *arg)
         return r;
 }
 
-char ppm_header[]="P6\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
+char ppm_header[64];
 char ppm_dumpname[]="test00000000.ppm";
 
 static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
    
     snprintf(&ppm_dumpname[4], 9, "%08d", tag);
     strncat(&ppm_dumpname[12], ".ppm", 5);
     dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&ppm_header[14], " sec ", 5);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&ppm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-    written=write(dumpfd, ppm_header, sizeof(ppm_header));
+    hlen=capture_pnm_header(ppm_header, sizeof(ppm_header), 1, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
+    written=write(dumpfd, ppm_header, hlen);
 
     total=0;
 
@@ -129,22 +135,19 @@ static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec
 }
 
 
-char pgm_header[]="P5\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
+char pgm_header[64];
 char pgm_dumpname[]="test00000000.pgm";
 
 static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
    
     snprintf(&pgm_dumpname[4], 9, "%08d", tag);
     strncat(&pgm_dumpname[12], ".pgm", 5);
     dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&pgm_header[14], " sec ", 5);
-    snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&pgm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-    written=write(dumpfd, pgm_header, sizeof(pgm_header));
+    hlen=capture_pnm_header(pgm_header, sizeof(pgm_header), 0, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
+    written=write(dumpfd, pgm_header, hlen);
 
     total=0;
 
@@ -194,6 +197,9 @@ void yuv2rgb_float(float y, float u, float v,
 //      YUV422, which we assume here, where there are 2 bytes for each pixel, with two Y samples for one U & V,
 //              or as the name implies, 4Y and 2 UV pairs
 //      YUV420, where for every 4 Ys, there is a single UV pair, 1.5 bytes for each pixel or 36 bytes for 24 pixels
+//
+// The vector kernels in capture_common/yuv_convert.c used by process_image() are bit-exact
+// with this function.
 
 void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b)
 {
@@ -224,15 +230,14 @@ void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned c
 
 
 unsigned int framecnt=0;
-unsigned char bigbuffer[(2560*1920*3)];
+unsigned char *bigbuffer;    // from work, sized for the negotiated format
 
 static void process_image(const void *p, int size)
 {
-    int i, newi, newsize=0;
+    int newsize=0;
     struct timespec frame_time;
-    int y_temp, y2_temp, u_temp, v_temp;
     unsigned char *pptr = (unsigned char *)p;
-    Mat dispimg(VRES, HRES, CV_8UC3, bigbuffer);
+    Mat dispimg(fmt.fmt.pix.height, fmt.fmt.pix.width, CV_8UC3, bigbuffer);
 
     // record when process was called
     clock_gettime(CLOCK_REALTIME, &frame_time);    
@@ -259,12 +264,7 @@ static void process_image(const void *p, int size)
         // Pixels are YU and YV alternating, so YUYV which is 4 bytes
         // We want RGB, so RGBRGB which is 6 bytes
         //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+6)
-        {
-            y_temp=(int)pptr[i]; u_temp=(int)pptr[i+1]; y2_temp=(int)pptr[i+2]; v_temp=(int)pptr[i+3];
-            yuv2rgb(y_temp, u_temp, v_temp, &bigbuffer[newi], &bigbuffer[newi+1], &bigbuffer[newi+2]);
-            yuv2rgb(y2_temp, u_temp, v_temp, &bigbuffer[newi+3], &bigbuffer[newi+4], &bigbuffer[newi+5]);
-        }
+        yuyv_to_rgb24(pptr, bigbuffer, size/2);
 
         imshow(disp_window_name, dispimg);
         waitKey(10);
@@ -276,12 +276,7 @@ static void process_image(const void *p, int size)
         // Pixels are YU and YV alternating, so YUYV which is 4 bytes
         // We want Y, so YY which is 2 bytes
         //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+2)
-        {
-            // Y1=first byte and Y2=third byte
-            bigbuffer[newi]=pptr[i];
-            bigbuffer[newi+1]=pptr[i+2];
-        }
+        yuyv_to_y8(pptr, bigbuffer, size/2);
 
         imshow(disp_window_name, dispimg);
         waitKey(10);
@@ -296,6 +291,16 @@ static void process_image(const void *p, int size)
         printf("Dump RGB as-is size %d\n", size);
         dump_ppm(p, size, framecnt, &frame_time);
     }
+
+    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG)
+    {
+        printf("Decode MJPEG size %d\n", size);
+
+        // decodes into bigbuffer through dispimg, BGR as imshow expects
+        imdecode(Mat(1, size, CV_8UC1, pptr), IMREAD_COLOR, &dispimg);
+        imshow(disp_window_name, dispimg);
+        waitKey(10);
+    }
     else
     {
         printf("ERROR - unknown dump format\n");
@@ -312,6 +317,19 @@ static int read_frame(void)
     struct v4l2_buffer buf;
     unsigned int i;
 
+    if(source)
+    {
+        const void *p;
+        unsigned int size;
+        struct timespec timestamp;
+
+        if(!frame_source_read(source, &p, &size, &timestamp))
+            return 0;
+
+        process_image(p, size);
+        return 1;
+    }
+
     switch (io)
     {
 
@@ -430,13 +448,15 @@ static void mainloop(void)
             int r;
 
             FD_ZERO(&fds);
-            FD_SET(fd, &fds);
+            if(!source)
+                FD_SET(fd, &fds);
 
             /* Timeout. */
             tv.tv_sec = 2;
             tv.tv_usec = 0;
 
-            r = select(fd + 1, &fds, NULL, NULL, &tv);
+            // replayed frames have no descriptor, the source paces them
+            r = source ? 1 : select(fd + 1, &fds, NULL, NULL, &tv);
 
             if (-1 == r)
             {
@@ -769,13 +789,13 @@ static void init_device(void)
     if (force_format)
     {
         printf("FORCING FORMAT\n");
-        fmt.fmt.pix.width       = HRES;
-        fmt.fmt.pix.height      = VRES;
+        fmt.fmt.pix.width       = hres;
+        fmt.fmt.pix.height      = vres;
 
         // Specify the Pixel Coding Formate here
 
-        // This one work for Logitech C200
-        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        // YUYV works for Logitech C200, -P asks for another
+        fmt.fmt.pix.pixelformat = pixfmt;
 
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_VYUY;
@@ -791,6 +811,11 @@ static void init_device(void)
                 errno_exit("VIDIOC_S_FMT");
 
         /* Note VIDIOC_S_FMT may change width and height. */
+        if((fmt.fmt.pix.width != (unsigned int)hres) || (fmt.fmt.pix.height != (unsigned int)vres) ||
+           (fmt.fmt.pix.pixelformat != pixfmt))
+            printf("Driver chose %ux%u %s instead of %dx%d %s\n",
+                   fmt.fmt.pix.width, fmt.fmt.pix.height, capture_pixfmt_name(fmt.fmt.pix.pixelformat),
+                   hres, vres, capture_pixfmt_name(pixfmt));
     }
     else
     {
@@ -857,6 +882,38 @@ static void open_device(void)
         }
 }
 
+static void open_source(void)
+{
+    if(!(source = frame_source_open(source_spec, hres, vres)))
+        exit(EXIT_FAILURE);
+
+    // what init_device() would have negotiated with the camera
+    CLEAR(fmt);
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    frame_source_format(source, &fmt.fmt.pix);
+
+    if(pixfmt != V4L2_PIX_FMT_YUYV)
+        printf("Frame sources are YUYV, -P %s ignored\n", capture_pixfmt_name(pixfmt));
+
+    printf("Replaying %s as %dx%d YUYV\n", frame_source_name(source),
+           fmt.fmt.pix.width, fmt.fmt.pix.height);
+}
+
+// Working buffers are sized from the negotiated format, after init_device() or open_source()
+static void alloc_work_buffers(void)
+{
+    size_t bytes = capture_work_bytes(&fmt.fmt.pix);
+
+    if((work_pool_init(&work, bytes) != 0) || !(bigbuffer = (unsigned char *)work_pool_alloc(&work, bytes)))
+    {
+        fprintf(stderr, "Out of memory for %zu byte working buffer\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Capturing %ux%u %s, %zu byte working buffer\n", fmt.fmt.pix.width, fmt.fmt.pix.height,
+           capture_pixfmt_name(fmt.fmt.pix.pixelformat), bytes);
+}
+
 static void usage(FILE *fp, int argc, char **argv)
 {
         fprintf(fp,
@@ -869,13 +926,19 @@ static void usage(FILE *fp, int argc, char **argv)
                  "-r | --read          Use read() calls\n"
                  "-u | --userp         Use application allocated buffers\n"
                  "-o | --output        Outputs stream to stdout\n"
-                 "-f | --format        Force format to 640x480 GREY\n"
+                 "-f | --format        Force the -S/-P format on the device [default]\n"
                  "-c | --count         Number of frames to grab [%i]\n"
+                 "-s | --source spec   Replay frames instead of a device:\n"
+                 "                     raw:file[@fps], dir:directory[@fps],\n"
+                 "                     synth[:bars|ramp|noise|box][@fps]\n"
+                 "-S | --size WxH      Resolution to request [%dx%d]\n"
+                 "-P | --pixfmt name   yuyv, grey, rgb24 or mjpeg [%s]\n"
                  "",
-                 argv[0], dev_name, frame_count);
+                 argv[0], dev_name, frame_count,
+                 hres, vres, capture_pixfmt_name(pixfmt));
 }
 
-static const char short_options[] = "d:hmruofc:";
+static const char short_options[] = "d:hmruofc:s:S:P:";
 
 static const struct option
 long_options[] = {
@@ -887,6 +950,9 @@ long_options[] = {
         { "output", no_argument,       NULL, 'o' },
         { "format", no_argument,       NULL, 'f' },
         { "count",  required_argument, NULL, 'c' },
+        { "source", required_argument, NULL, 's' },
+        { "size",   required_argument, NULL, 'S' },
+        { "pixfmt", required_argument, NULL, 'P' },
         { 0, 0, 0, 0 }
 };
 
@@ -950,19 +1016,54 @@ int main(int argc, char **argv)
                         errno_exit(optarg);
                 break;
 
+            case 's':
+                source_spec = optarg;
+                break;
+
+            case 'S':
+                if(capture_parse_size(optarg, &hres, &vres) != 0)
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'P':
+                if(!(pixfmt = capture_parse_pixfmt(optarg)))
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
             default:
                 usage(stderr, argc, argv);
                 exit(EXIT_FAILURE);
         }
     }
 
-    open_device();
-    init_device();
-    start_capturing();
+    if(source_spec)
+        open_source();
+    else
+    {
+        open_device();
+        init_device();
+        start_capturing();
+    }
+
+    alloc_work_buffers();
+
     mainloop();
-    stop_capturing();
-    uninit_device();
-    close_device();
+
+    if(source)
+        frame_source_close(source);
+    else
+    {
+        stop_capturing();
+        uninit_device();
+        close_device();
+    }
+    work_pool_destroy(&work);
     fprintf(stderr, "\n");
     return 0;
 }
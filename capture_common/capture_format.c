@@ -0,0 +1,113 @@
+/*
+ *  Runtime capture format selection and working buffers, see capture_format.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "capture_format.h"
+
+#define WORK_POOL_ALIGN (64)
+
+static const struct
+{
+    const char   *name;
+    unsigned int  pixelformat;
+} pixfmts[] = {
+    { "yuyv",  V4L2_PIX_FMT_YUYV },
+    { "grey",  V4L2_PIX_FMT_GREY },
+    { "rgb24", V4L2_PIX_FMT_RGB24 },
+    { "mjpeg", V4L2_PIX_FMT_MJPEG },
+};
+
+
+int capture_parse_size(const char *s, int *width, int *height)
+{
+    int w, h;
+
+    if((sscanf(s, "%dx%d", &w, &h) != 2) || (w < 2) || (h < 2))
+        return -1;
+
+    *width = w;
+    *height = h;
+    return 0;
+}
+
+unsigned int capture_parse_pixfmt(const char *s)
+{
+    unsigned int i;
+
+    for(i=0; i < sizeof(pixfmts)/sizeof(pixfmts[0]); i++)
+        if(strcasecmp(s, pixfmts[i].name) == 0)
+            return pixfmts[i].pixelformat;
+
+    // accept the gray spelling too
+    if(strcasecmp(s, "gray") == 0)
+        return V4L2_PIX_FMT_GREY;
+
+    return 0;
+}
+
+const char *capture_pixfmt_name(unsigned int pixelformat)
+{
+    unsigned int i;
+
+    for(i=0; i < sizeof(pixfmts)/sizeof(pixfmts[0]); i++)
+        if(pixfmts[i].pixelformat == pixelformat)
+            return pixfmts[i].name;
+
+    return "unknown";
+}
+
+size_t capture_work_bytes(const struct v4l2_pix_format *pix)
+{
+    size_t rgb = (size_t)pix->width * pix->height * 3;
+    size_t frame = (size_t)pix->sizeimage * 3 / 2;
+
+    return (frame > rgb) ? frame : rgb;
+}
+
+int capture_pnm_header(char *buf, size_t len, int ppm, const struct timespec *time,
+                       int width, int height)
+{
+    return snprintf(buf, len, "P%c\n#%010d sec %010d msec \n%d %d\n255\n", ppm ? '6' : '5',
+                    (int)time->tv_sec, (int)(time->tv_nsec / 1000000), width, height);
+}
+
+
+int work_pool_init(struct work_pool *pool, size_t bytes)
+{
+    pool->used = 0;
+    pool->bytes = (bytes + WORK_POOL_ALIGN - 1) & ~(size_t)(WORK_POOL_ALIGN - 1);
+
+    if(posix_memalign((void **)&pool->base, WORK_POOL_ALIGN, pool->bytes) != 0)
+    {
+        pool->base = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void *work_pool_alloc(struct work_pool *pool, size_t bytes)
+{
+    void *p;
+
+    bytes = (bytes + WORK_POOL_ALIGN - 1) & ~(size_t)(WORK_POOL_ALIGN - 1);
+
+    if(!pool->base || (pool->used + bytes > pool->bytes))
+        return NULL;
+
+    p = pool->base + pool->used;
+    pool->used += bytes;
+
+    return p;
+}
+
+void work_pool_destroy(struct work_pool *pool)
+{
+    free(pool->base);
+    pool->base = NULL;
+    pool->bytes = pool->used = 0;
+}
@@ -0,0 +1,58 @@
+/*
+ *  Runtime capture format selection and working buffers
+ *
+ *  Resolution and pixel format come from the command line (-S WxH, -P name)
+ *  rather than HRES/VRES macros, and every buffer the processing needs is
+ *  carved from one work_pool allocated after VIDIOC_S_FMT/G_FMT, so it is
+ *  sized for the format the driver actually negotiated.
+ */
+#ifndef CAPTURE_FORMAT_H
+#define CAPTURE_FORMAT_H
+
+#include <stddef.h>
+#include <time.h>
+#include <linux/videodev2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// "640x480", 0 or -1 if it does not parse
+int capture_parse_size(const char *s, int *width, int *height);
+
+// yuyv, grey, rgb24 or mjpeg (any case) to a V4L2 fourcc, 0 if unknown
+unsigned int capture_parse_pixfmt(const char *s);
+
+const char *capture_pixfmt_name(unsigned int pixelformat);
+
+// Bytes for the largest image processing makes from a frame: RGB24 at the
+// negotiated size, or a whole frame of YUYV converted to RGB24 if that is
+// bigger, as it is when bytesperline pads the rows
+size_t capture_work_bytes(const struct v4l2_pix_format *pix);
+
+// PPM (P6) or PGM (P5) header with the frame time as a comment, as the capture
+// examples have always written it.  Returns the header length, no terminator.
+int capture_pnm_header(char *buf, size_t len, int ppm, const struct timespec *time,
+                       int width, int height);
+
+
+struct work_pool
+{
+    unsigned char *base;
+    size_t         bytes;
+    size_t         used;
+};
+
+// 0, or -1 if the pool cannot be allocated
+int work_pool_init(struct work_pool *pool, size_t bytes);
+
+// 64 byte aligned buffer from the pool, NULL once it is used up
+void *work_pool_alloc(struct work_pool *pool, size_t bytes);
+
+void work_pool_destroy(struct work_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
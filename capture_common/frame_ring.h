@@ -0,0 +1,215 @@
+/*
+ *  Single-producer / single-consumer ring of pre-allocated frame slots.
+ *
+ *  Used to hand frames between pipeline stages (acquire -> convert -> write)
+ *  without locks or per-frame allocation.  Each ring has exactly one producer
+ *  thread and one consumer thread.  The producer fills the slot returned by
+ *  frame_ring_producer_slot() and makes it visible with frame_ring_publish();
+ *  the consumer reads the slot returned by frame_ring_consumer_slot() and hands
+ *  it back with frame_ring_release().
+ *
+ *  Head and tail are free running counters, so nslots must be a power of 2.
+ */
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+
+#define FRAME_RING_CACHE_LINE 64
+
+struct frame_slot
+{
+    unsigned char   *data;          // pre-allocated, cache line aligned
+    size_t           capacity;      // bytes allocated at data
+    size_t           size;          // bytes valid at data
+    unsigned int     tag;           // frame number
+    unsigned int     pixelformat;   // V4L2 fourcc of data
+    struct timespec  frame_time;    // CLOCK_REALTIME when acquired, for headers
+    struct timespec  acquired;      // CLOCK_MONOTONIC when acquired
+    struct timespec  enqueued;      // CLOCK_MONOTONIC when published to this ring
+};
+
+struct frame_ring
+{
+    struct frame_slot *slots;
+    unsigned int       nslots;
+    unsigned int       mask;
+
+    // producer and consumer indices on their own cache lines to avoid false sharing
+    _Alignas(FRAME_RING_CACHE_LINE) atomic_uint head;
+    _Alignas(FRAME_RING_CACHE_LINE) atomic_uint tail;
+    _Alignas(FRAME_RING_CACHE_LINE) atomic_int  eos;
+
+    // queue depth statistics, only updated by the producer
+    unsigned int       max_depth;
+    unsigned long long depth_sum;
+    unsigned long      depth_samples;
+};
+
+
+static inline int frame_ring_init(struct frame_ring *r, unsigned int nslots, size_t slot_bytes)
+{
+    unsigned int i;
+
+    if((nslots == 0) || (nslots & (nslots - 1)))
+        return -1;
+
+    memset(r, 0, sizeof(*r));
+
+    if(!(r->slots = (struct frame_slot *)calloc(nslots, sizeof(struct frame_slot))))
+        return -1;
+
+    for(i=0; i<nslots; i++)
+    {
+        if(posix_memalign((void **)&r->slots[i].data, FRAME_RING_CACHE_LINE, slot_bytes) != 0)
+        {
+            while(i > 0)
+                free(r->slots[--i].data);
+            free(r->slots);
+            r->slots = NULL;
+            return -1;
+        }
+        r->slots[i].capacity = slot_bytes;
+    }
+
+    r->nslots = nslots;
+    r->mask = nslots - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->eos, 0);
+
+    return 0;
+}
+
+
+static inline void frame_ring_destroy(struct frame_ring *r)
+{
+    unsigned int i;
+
+    if(!r->slots)
+        return;
+
+    for(i=0; i<r->nslots; i++)
+        free(r->slots[i].data);
+
+    free(r->slots);
+    r->slots = NULL;
+}
+
+
+static inline unsigned int frame_ring_depth(struct frame_ring *r)
+{
+    return atomic_load_explicit(&r->head, memory_order_acquire) -
+           atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+
+// Producer side: returns the next free slot or NULL when the ring is full
+static inline struct frame_slot *frame_ring_producer_slot(struct frame_ring *r)
+{
+    unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if((head - tail) == r->nslots)
+        return NULL;
+
+    return &r->slots[head & r->mask];
+}
+
+
+// Producer side: make the slot returned by frame_ring_producer_slot() visible
+static inline void frame_ring_publish(struct frame_ring *r)
+{
+    unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned int depth;
+
+    clock_gettime(CLOCK_MONOTONIC, &r->slots[head & r->mask].enqueued);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+    depth = (head + 1) - atomic_load_explicit(&r->tail, memory_order_acquire);
+    if(depth > r->max_depth) r->max_depth = depth;
+    r->depth_sum += depth;
+    r->depth_samples++;
+}
+
+
+// Consumer side: returns the oldest published slot or NULL when the ring is empty
+static inline struct frame_slot *frame_ring_consumer_slot(struct frame_ring *r)
+{
+    unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    if(head == tail)
+        return NULL;
+
+    return &r->slots[tail & r->mask];
+}
+
+
+// Consumer side: hand the slot returned by frame_ring_consumer_slot() back to the producer
+static inline void frame_ring_release(struct frame_ring *r)
+{
+    unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+
+// Producer side: no more frames will be published
+static inline void frame_ring_close(struct frame_ring *r)
+{
+    atomic_store_explicit(&r->eos, 1, memory_order_release);
+}
+
+
+// Producer side: block with a short spin then sleep backoff until a free slot
+// is available, used by intermediate stages to apply back-pressure upstream
+static inline struct frame_slot *frame_ring_wait_space(struct frame_ring *r)
+{
+    struct frame_slot *slot;
+    struct timespec backoff = {0, 50000};
+    int spins = 0;
+
+    while(!(slot = frame_ring_producer_slot(r)))
+    {
+        if(spins++ < 64)
+            sched_yield();
+        else
+            nanosleep(&backoff, NULL);
+    }
+
+    return slot;
+}
+
+
+// Consumer side: block with a short spin then sleep backoff until a slot is
+// available, returns NULL once the producer has closed the ring and it is drained
+static inline struct frame_slot *frame_ring_wait(struct frame_ring *r)
+{
+    struct frame_slot *slot;
+    struct timespec backoff = {0, 50000};
+    int spins = 0;
+
+    for(;;)
+    {
+        if((slot = frame_ring_consumer_slot(r)))
+            return slot;
+
+        if(atomic_load_explicit(&r->eos, memory_order_acquire))
+        {
+            // re-check after seeing eos, the last publish may have raced with it
+            return frame_ring_consumer_slot(r);
+        }
+
+        if(spins++ < 64)
+            sched_yield();
+        else
+            nanosleep(&backoff, NULL);
+    }
+}
+
+#endif
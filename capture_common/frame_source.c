@@ -0,0 +1,476 @@
+/*
+ *  Replayable frame sources, see frame_source.h
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "frame_source.h"
+
+enum source_type
+{
+    SOURCE_RAW,
+    SOURCE_DIR,
+    SOURCE_SYNTH
+};
+
+enum synth_pattern
+{
+    SYNTH_BARS,
+    SYNTH_RAMP,
+    SYNTH_NOISE,
+    SYNTH_BOX
+};
+
+struct frame_source
+{
+    enum source_type    type;
+    char                name[256];
+    int                 width;
+    int                 height;
+    unsigned int        frame_bytes;
+
+    // raw file, mapped read only
+    unsigned char      *map;
+    size_t              map_bytes;
+
+    // directory frames, converted when opened, or the synthetic frame
+    unsigned char      *frames;
+    unsigned int        nframes;
+    enum synth_pattern  pattern;
+
+    unsigned long       sequence;
+    struct timespec     period;     // zero when unpaced
+    struct timespec     deadline;
+};
+
+
+static void timespec_add(struct timespec *t, const struct timespec *d)
+{
+    t->tv_sec += d->tv_sec;
+    t->tv_nsec += d->tv_nsec;
+    if(t->tv_nsec >= 1000000000L)
+    {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+// BT.601 studio swing, the inverse of yuv2rgb() in the capture examples
+static void rgb_to_yuv(int r, int g, int b, int *y, int *u, int *v)
+{
+    *y = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+    *u = ((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128;
+    *v = ((112 * r - 94 * g - 18 * b + 128) >> 8) + 128;
+}
+
+// One row of RGB24 to YUYV, chroma is the average of the pixel pair
+static void rgb24_row_to_yuyv(const unsigned char *rgb, unsigned char *yuyv, int width)
+{
+    int x, y0, u0, v0, y1, u1, v1;
+
+    for(x=0; x < width-1; x+=2, rgb+=6, yuyv+=4)
+    {
+        rgb_to_yuv(rgb[0], rgb[1], rgb[2], &y0, &u0, &v0);
+        rgb_to_yuv(rgb[3], rgb[4], rgb[5], &y1, &u1, &v1);
+        yuyv[0] = y0;
+        yuyv[1] = (u0 + u1 + 1) >> 1;
+        yuyv[2] = y1;
+        yuyv[3] = (v0 + v1 + 1) >> 1;
+    }
+}
+
+
+// Skip whitespace and # comments in a PNM header, the capture examples write
+// their timestamp as a comment
+static int pnm_number(FILE *fp)
+{
+    int c, value;
+
+    while((c = fgetc(fp)) != EOF)
+    {
+        if(c == '#')
+            while(((c = fgetc(fp)) != EOF) && (c != '\n'));
+        else if((c != ' ') && (c != '\t') && (c != '\n') && (c != '\r'))
+            break;
+    }
+
+    ungetc(c, fp);
+    if(fscanf(fp, "%d", &value) != 1)
+        return -1;
+
+    return value;
+}
+
+// Load a P5 or P6 file into frame as YUYV, cropping or padding with black
+static int load_pnm(struct frame_source *src, const char *path, unsigned char *frame)
+{
+    FILE *fp;
+    int magic, w, h, maxval, channels, row, x, copy_w, copy_h;
+    unsigned char *line;
+
+    if(!(fp = fopen(path, "rb")))
+        return -1;
+
+    if((fgetc(fp) != 'P') || (((magic = fgetc(fp)) != '5') && (magic != '6')))
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    w = pnm_number(fp);
+    h = pnm_number(fp);
+    maxval = pnm_number(fp);
+    fgetc(fp);      // single whitespace before the pixels
+
+    if((w <= 0) || (h <= 0) || (maxval != 255))
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    channels = (magic == '6') ? 3 : 1;
+    copy_w = (w < src->width) ? w : src->width;
+    copy_h = (h < src->height) ? h : src->height;
+
+    if(!(line = malloc((size_t)w * 3 + 6)))
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    // black in YUYV is Y=16, U=V=128
+    for(x=0; x < (int)src->frame_bytes; x+=2)
+    {
+        frame[x] = 16;
+        frame[x+1] = 128;
+    }
+
+    for(row=0; row < copy_h; row++)
+    {
+        unsigned char *out = frame + (size_t)row * src->width * 2;
+
+        if(fread(line, channels, w, fp) != (size_t)w)
+        {
+            free(line);
+            fclose(fp);
+            return -1;
+        }
+
+        if(channels == 3)
+            rgb24_row_to_yuyv(line, out, copy_w);
+        else
+            for(x=0; x < (copy_w & ~1); x++)
+                out[2*x] = line[x];
+    }
+
+    free(line);
+    fclose(fp);
+
+    return 0;
+}
+
+static int pnm_filter(const struct dirent *d)
+{
+    const char *ext = strrchr(d->d_name, '.');
+
+    return ext && ((strcmp(ext, ".ppm") == 0) || (strcmp(ext, ".pgm") == 0));
+}
+
+static int open_dir(struct frame_source *src, const char *dir)
+{
+    struct dirent **list;
+    char path[4096];
+    int n, i;
+
+    if((n = scandir(dir, &list, pnm_filter, alphasort)) < 0)
+    {
+        perror(dir);
+        return -1;
+    }
+
+    if(n == 0)
+    {
+        fprintf(stderr, "%s: no .ppm or .pgm frames\n", dir);
+        free(list);
+        return -1;
+    }
+
+    if(!(src->frames = malloc((size_t)n * src->frame_bytes)))
+    {
+        fprintf(stderr, "Out of memory for %d frames\n", n);
+        exit(EXIT_FAILURE);
+    }
+
+    for(i=0; i<n; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, list[i]->d_name);
+
+        if(load_pnm(src, path, src->frames + (size_t)src->nframes * src->frame_bytes) == 0)
+            src->nframes++;
+        else
+            fprintf(stderr, "%s: not an 8 bit P5/P6 image, skipped\n", path);
+
+        free(list[i]);
+    }
+    free(list);
+
+    return (src->nframes > 0) ? 0 : -1;
+}
+
+static int open_raw(struct frame_source *src, const char *file)
+{
+    struct stat st;
+    int fd;
+
+    if((fd = open(file, O_RDONLY)) < 0)
+    {
+        perror(file);
+        return -1;
+    }
+
+    if(fstat(fd, &st) < 0)
+    {
+        perror(file);
+        close(fd);
+        return -1;
+    }
+
+    src->nframes = st.st_size / src->frame_bytes;
+    if(src->nframes == 0)
+    {
+        fprintf(stderr, "%s: smaller than one %dx%d YUYV frame\n", file, src->width, src->height);
+        close(fd);
+        return -1;
+    }
+
+    src->map_bytes = (size_t)src->nframes * src->frame_bytes;
+    src->map = mmap(NULL, src->map_bytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+
+    if(src->map == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+// Fill the synthetic frame for this sequence number, the pattern moves so
+// every frame differs and motion or edge stages have work to do
+static void synth_frame(struct frame_source *src)
+{
+    static const unsigned char bars[8][3] = {
+        {235, 128, 128}, {210, 16, 146}, {170, 166, 16}, {145, 54, 34},
+        {106, 202, 222}, {81, 90, 240}, {41, 240, 110}, {16, 128, 128}
+    };
+    unsigned char *p = src->frames;
+    int x, row, shift = (int)(src->sequence % src->width) & ~1;
+    unsigned int seed = src->sequence;
+
+    for(row=0; row < src->height; row++)
+    {
+        for(x=0; x < src->width; x+=2, p+=4)
+        {
+            switch(src->pattern)
+            {
+                case SYNTH_BARS:
+                {
+                    const unsigned char *c = bars[(((x + shift) % src->width) * 8) / src->width];
+                    p[0] = c[0]; p[1] = c[1]; p[2] = c[0]; p[3] = c[2];
+                    break;
+                }
+
+                case SYNTH_RAMP:
+                    p[0] = (x * 256) / src->width;
+                    p[2] = ((x+1) * 256) / src->width;
+                    p[1] = (row * 256) / src->height;
+                    p[3] = 255 - p[1];
+                    break;
+
+                case SYNTH_NOISE:
+                    // deterministic, the same sequence number gives the same frame
+                    seed = seed * 1103515245 + 12345;
+                    p[0] = seed >> 24; p[1] = seed >> 16; p[2] = seed >> 8; p[3] = seed;
+                    break;
+
+                case SYNTH_BOX:
+                {
+                    // a quarter of the shorter side, so it fits a tall or tiny frame
+                    int side = (src->width < src->height) ? src->width : src->height;
+                    int size = (side >= 4) ? side / 4 : 1;
+                    int bx = (int)((src->sequence * 4) % (src->width - size));
+                    int by = (int)((src->sequence * 3) % (src->height - size));
+                    int in = (x >= bx) && (x < bx + size) && (row >= by) && (row < by + size);
+
+                    p[0] = p[2] = in ? 235 : 16;
+                    p[1] = p[3] = 128;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+
+int frame_source_is_spec(const char *spec)
+{
+    return (strncmp(spec, "raw:", 4) == 0) || (strncmp(spec, "dir:", 4) == 0) ||
+           (strncmp(spec, "synth", 5) == 0);
+}
+
+struct frame_source *frame_source_open(const char *spec, int width, int height)
+{
+    struct frame_source *src;
+    char arg[4096], *at;
+    double fps = 0.0;
+    int rc = -1;
+
+    if(!frame_source_is_spec(spec) || (width < 2) || (height < 2))
+    {
+        fprintf(stderr, "%s: not a frame source\n", spec);
+        return NULL;
+    }
+
+    if(!(src = calloc(1, sizeof(*src))))
+        return NULL;
+
+    src->width = width & ~1;
+    src->height = height;
+    src->frame_bytes = src->width * src->height * 2;
+    snprintf(src->name, sizeof(src->name), "%s", spec);
+
+    // type:argument@fps, or synth@fps with no argument
+    if(strchr(spec, ':'))
+        snprintf(arg, sizeof(arg), "%s", strchr(spec, ':') + 1);
+    else
+        snprintf(arg, sizeof(arg), "%s", strchr(spec, '@') ? strchr(spec, '@') : "");
+    if((at = strrchr(arg, '@')) != NULL)
+    {
+        *at = '\0';
+        fps = atof(at + 1);
+    }
+
+    if(strncmp(spec, "raw:", 4) == 0)
+    {
+        src->type = SOURCE_RAW;
+        rc = open_raw(src, arg);
+    }
+    else if(strncmp(spec, "dir:", 4) == 0)
+    {
+        src->type = SOURCE_DIR;
+        rc = open_dir(src, arg);
+    }
+    else
+    {
+        src->type = SOURCE_SYNTH;
+        src->nframes = 1;
+
+        if((arg[0] == '\0') || (strcmp(arg, "bars") == 0)) src->pattern = SYNTH_BARS;
+        else if(strcmp(arg, "ramp") == 0)  src->pattern = SYNTH_RAMP;
+        else if(strcmp(arg, "noise") == 0) src->pattern = SYNTH_NOISE;
+        else if(strcmp(arg, "box") == 0)   src->pattern = SYNTH_BOX;
+        else
+            fprintf(stderr, "synth: unknown pattern %s\n", arg);
+
+        if((src->frames = malloc(src->frame_bytes)) != NULL)
+            rc = 0;
+    }
+
+    if(rc != 0)
+    {
+        frame_source_close(src);
+        return NULL;
+    }
+
+    if(fps > 0.0)
+    {
+        double period = 1.0 / fps;
+
+        src->period.tv_sec = (time_t)period;
+        src->period.tv_nsec = (long)((period - (double)src->period.tv_sec) * 1000000000.0);
+        clock_gettime(CLOCK_MONOTONIC, &src->deadline);
+    }
+
+    return src;
+}
+
+void frame_source_format(struct frame_source *src, struct v4l2_pix_format *pix)
+{
+    memset(pix, 0, sizeof(*pix));
+    pix->width = src->width;
+    pix->height = src->height;
+    pix->pixelformat = V4L2_PIX_FMT_YUYV;
+    pix->field = V4L2_FIELD_NONE;
+    pix->bytesperline = src->width * 2;
+    pix->sizeimage = src->frame_bytes;
+    pix->colorspace = V4L2_COLORSPACE_SMPTE170M;
+}
+
+int frame_source_read(struct frame_source *src, const void **p, unsigned int *size,
+                      struct timespec *timestamp)
+{
+    unsigned int index = src->sequence % src->nframes;
+
+    if(src->period.tv_sec || src->period.tv_nsec)
+    {
+        // absolute deadlines, so time spent processing does not add drift
+        timespec_add(&src->deadline, &src->period);
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &src->deadline, NULL) == EINTR);
+        *timestamp = src->deadline;
+    }
+    else
+        clock_gettime(CLOCK_MONOTONIC, timestamp);
+
+    switch(src->type)
+    {
+        case SOURCE_RAW:
+            *p = src->map + (size_t)index * src->frame_bytes;
+            break;
+
+        case SOURCE_DIR:
+            *p = src->frames + (size_t)index * src->frame_bytes;
+            break;
+
+        case SOURCE_SYNTH:
+            synth_frame(src);
+            *p = src->frames;
+            break;
+    }
+
+    *size = src->frame_bytes;
+    src->sequence++;
+
+    return 1;
+}
+
+void frame_source_close(struct frame_source *src)
+{
+    if(src->map && (src->map != MAP_FAILED))
+        munmap(src->map, src->map_bytes);
+
+    free(src->frames);
+    free(src);
+}
+
+const char *frame_source_name(struct frame_source *src)
+{
+    return src->name;
+}
+
+int frame_source_paced(struct frame_source *src)
+{
+    return src->period.tv_sec || src->period.tv_nsec;
+}
@@ -0,0 +1,66 @@
+/*
+ *  Replayable frame sources for the V4L2 capture examples
+ *
+ *  A frame source stands in for the camera so the conversion and transform
+ *  stages can be run and timed without hardware.  Every source delivers YUYV
+ *  frames of the size the program would have forced on the device, and loops
+ *  forever so the program's frame count decides when to stop.
+ *
+ *  Sources are selected with a spec string:
+ *
+ *    raw:file[@fps]        raw YUYV frames at the program's size, back to back
+ *    dir:directory[@fps]   PPM (P6) and PGM (P5) files in name order, converted
+ *                          to YUYV and cropped or padded to size when loaded
+ *    synth[:pattern][@fps] generated frames, pattern is bars (default), ramp,
+ *                          noise or box; bars and box move every frame
+ *
+ *  None of the capture programs write raw files.  Record one from a camera
+ *  with v4l2-ctl --set-fmt-video=width=320,height=240,pixelformat=YUYV
+ *  --stream-mmap --stream-count=300 --stream-to=frames.yuyv, or convert a
+ *  video with ffmpeg -i in.mp4 -s 320x240 -f rawvideo -pix_fmt yuyv422
+ *  frames.yuyv.
+ *
+ *  With @fps each frame_source_read() waits for the next absolute deadline on
+ *  CLOCK_MONOTONIC; without it frames are delivered as fast as they are read.
+ *  Anything else (for example /dev/video1 of the vivid test driver) is not a
+ *  frame source and is opened with the program's usual V4L2 code.
+ */
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include <time.h>
+#include <linux/videodev2.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct frame_source;
+
+// 1 if spec names a frame source rather than a device
+int frame_source_is_spec(const char *spec);
+
+// NULL with a message on stderr if the source cannot be opened
+struct frame_source *frame_source_open(const char *spec, int width, int height);
+
+// YUYV format as VIDIOC_G_FMT would have returned it
+void frame_source_format(struct frame_source *src, struct v4l2_pix_format *pix);
+
+// Same contract as read_frame(): 1 with the next frame in *p, valid until the
+// next call, 0 if no frame is ready.  timestamp is the CLOCK_MONOTONIC deadline
+// for paced sources, or the time the frame was read.
+int frame_source_read(struct frame_source *src, const void **p, unsigned int *size,
+                      struct timespec *timestamp);
+
+void frame_source_close(struct frame_source *src);
+
+const char *frame_source_name(struct frame_source *src);
+
+// 1 if the spec had @fps, so frame_source_read() does its own pacing
+int frame_source_paced(struct frame_source *src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
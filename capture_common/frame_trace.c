@@ -0,0 +1,209 @@
+/*
+ *  Per-frame timing trace, see frame_trace.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "frame_trace.h"
+
+#define JITTER_BINS (12)
+
+// upper edges in ms of the (interval - period) histogram, the last bin is open
+static const double jitter_edge[JITTER_BINS-1] = {-10.0, -5.0, -2.0, -1.0, -0.5, 0.0, 0.5, 1.0, 2.0, 5.0, 10.0};
+
+struct running_stats
+{
+    unsigned long n;
+    double        min, max, sum, sumsq;
+    unsigned long hist[JITTER_BINS];
+};
+
+
+static void stats_add(struct running_stats *s, double ms, double period_ms)
+{
+    int bin;
+
+    if(s->n == 0 || ms < s->min) s->min = ms;
+    if(s->n == 0 || ms > s->max) s->max = ms;
+    s->sum += ms;
+    s->sumsq += ms * ms;
+    s->n++;
+
+    for(bin=0; (bin < JITTER_BINS-1) && ((ms - period_ms) >= jitter_edge[bin]); bin++);
+    s->hist[bin]++;
+}
+
+static void stats_print(const char *name, struct running_stats *s)
+{
+    double mean, var;
+
+    if(s->n == 0)
+    {
+        printf("%-10s %8s\n", name, "-");
+        return;
+    }
+
+    mean = s->sum / s->n;
+    var = (s->sumsq / s->n) - (mean * mean);
+
+    printf("%-10s %8lu %9.3lf %9.3lf %9.3lf %10.3lf\n", name, s->n, s->min, mean, s->max,
+           sqrt(var > 0.0 ? var : 0.0));
+}
+
+
+int frame_trace_init(struct frame_trace *t, uint32_t capacity, int64_t period_ns)
+{
+    memset(t, 0, sizeof(*t));
+    memcpy(t->hdr.magic, FRAME_TRACE_MAGIC, sizeof(FRAME_TRACE_MAGIC));
+    t->hdr.record_bytes = sizeof(struct frame_trace_record);
+    t->hdr.period_ns = period_ns;
+    t->capacity = capacity;
+
+    // touch every record now so page faults are not taken during capture
+    if(!(t->rec = calloc(capacity, sizeof(struct frame_trace_record))))
+        return -1;
+    memset(t->rec, 0, (size_t)capacity * sizeof(struct frame_trace_record));
+
+    return 0;
+}
+
+int frame_trace_write(struct frame_trace *t, const char *path)
+{
+    FILE *fp;
+
+    if(!(fp = fopen(path, "wb")))
+    {
+        perror(path);
+        return -1;
+    }
+
+    if((fwrite(&t->hdr, sizeof(t->hdr), 1, fp) != 1) ||
+       (fwrite(t->rec, sizeof(struct frame_trace_record), t->hdr.count, fp) != t->hdr.count))
+    {
+        perror(path);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int frame_trace_read(struct frame_trace *t, const char *path)
+{
+    FILE *fp;
+
+    memset(t, 0, sizeof(*t));
+
+    if(!(fp = fopen(path, "rb")))
+    {
+        perror(path);
+        return -1;
+    }
+
+    if((fread(&t->hdr, sizeof(t->hdr), 1, fp) != 1) ||
+       (memcmp(t->hdr.magic, FRAME_TRACE_MAGIC, sizeof(FRAME_TRACE_MAGIC)) != 0) ||
+       (t->hdr.record_bytes != sizeof(struct frame_trace_record)))
+    {
+        fprintf(stderr, "%s: not a frame trace\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    t->capacity = t->hdr.count;
+    if(!(t->rec = calloc(t->capacity ? t->capacity : 1, sizeof(struct frame_trace_record))) ||
+       (fread(t->rec, sizeof(struct frame_trace_record), t->hdr.count, fp) != t->hdr.count))
+    {
+        fprintf(stderr, "%s: truncated\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+void frame_trace_free(struct frame_trace *t)
+{
+    free(t->rec);
+    t->rec = NULL;
+    t->capacity = t->hdr.count = 0;
+}
+
+
+void frame_trace_print_stats(struct frame_trace *t)
+{
+    struct running_stats driver, dequeue, process, response;
+    struct frame_trace_record *prev = NULL, *r;
+    double period_ms = (double)t->hdr.period_ns / 1000000.0;
+    unsigned long late = 0, skipped = 0;
+    uint32_t i;
+    int bin;
+
+    memset(&driver, 0, sizeof(driver));
+    memset(&dequeue, 0, sizeof(dequeue));
+    memset(&process, 0, sizeof(process));
+    memset(&response, 0, sizeof(response));
+
+    for(i=0; i < t->hdr.count; i++)
+    {
+        r = &t->rec[i];
+
+        // start up frames settle the camera, they are traced but not counted
+        if(r->frame < 0)
+            continue;
+
+        if(r->process_ns)
+            stats_add(&process, (double)(r->process_ns - r->dequeue_ns) / 1000000.0, period_ms);
+
+        if(r->write_ns)
+        {
+            double ms = (double)(r->write_ns - r->dequeue_ns) / 1000000.0;
+
+            stats_add(&response, ms, period_ms);
+            if(ms > period_ms)
+                late++;
+        }
+
+        if(prev)
+        {
+            double ms = (double)(r->dequeue_ns - prev->dequeue_ns) / 1000000.0;
+
+            stats_add(&dequeue, ms, period_ms);
+            if(ms > 1.5 * period_ms)
+                skipped++;
+
+            if(r->driver_ns && prev->driver_ns)
+                stats_add(&driver, (double)(r->driver_ns - prev->driver_ns) / 1000000.0, period_ms);
+        }
+
+        prev = r;
+    }
+
+    printf("\nFrame timing, %u records, period %.3lf ms\n", t->hdr.count, period_ms);
+    printf("%-10s %8s %9s %9s %9s %10s\n", "ms", "frames", "min", "mean", "max", "stddev");
+    stats_print("driver", &driver);
+    stats_print("dequeue", &dequeue);
+    stats_print("process", &process);
+    stats_print("write", &response);
+
+    printf("\ninterval - period ms   driver  dequeue\n");
+    for(bin=0; bin < JITTER_BINS; bin++)
+    {
+        char label[32];
+
+        if(bin == 0)
+            snprintf(label, sizeof(label), "< %.1lf", jitter_edge[0]);
+        else if(bin == JITTER_BINS-1)
+            snprintf(label, sizeof(label), ">= %.1lf", jitter_edge[JITTER_BINS-2]);
+        else
+            snprintf(label, sizeof(label), "%.1lf to %.1lf", jitter_edge[bin-1], jitter_edge[bin]);
+
+        printf("%-20s %8lu %8lu\n", label, driver.hist[bin], dequeue.hist[bin]);
+    }
+
+    printf("\nmissed deadlines: %lu frames written more than one period after dequeue, "
+           "%lu intervals over 1.5 periods\n", late, skipped);
+}
@@ -0,0 +1,90 @@
+/*
+ *  Per-frame timing trace
+ *
+ *  Records are preallocated and filled with a few stores per frame, nothing
+ *  is printed or written until the run is over, so the trace does not disturb
+ *  the timing it measures.  All times are CLOCK_MONOTONIC nanoseconds; V4L2
+ *  drivers timestamp buffers on the same clock (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC).
+ *
+ *  The binary file is a struct frame_trace_header followed by count records,
+ *  frame_trace_dump prints one as CSV along with the statistics.
+ */
+#ifndef FRAME_TRACE_H
+#define FRAME_TRACE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_TRACE_MAGIC "FTRACE1"
+
+struct frame_trace_record
+{
+    int32_t  frame;             // frame number, negative for start up frames
+    uint32_t sequence;          // driver sequence number
+    int64_t  driver_ns;         // driver capture timestamp, 0 if there is none
+    int64_t  dequeue_ns;        // buffer dequeued
+    int64_t  process_ns;        // processing done, write started
+    int64_t  write_ns;          // write done (or queued to the frame writer)
+};
+
+struct frame_trace_header
+{
+    char     magic[8];          // FRAME_TRACE_MAGIC
+    uint32_t record_bytes;      // sizeof(struct frame_trace_record)
+    uint32_t count;
+    int64_t  period_ns;         // configured frame period
+};
+
+struct frame_trace
+{
+    struct frame_trace_header  hdr;
+    struct frame_trace_record *rec;
+    uint32_t                   capacity;
+};
+
+static inline int64_t frame_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Next record, zeroed, or NULL once capacity frames have been traced
+static inline struct frame_trace_record *frame_trace_next(struct frame_trace *t)
+{
+    struct frame_trace_record *r;
+
+    if(t->hdr.count >= t->capacity)
+        return NULL;
+
+    r = &t->rec[t->hdr.count++];
+    r->frame = 0; r->sequence = 0;
+    r->driver_ns = r->dequeue_ns = r->process_ns = r->write_ns = 0;
+
+    return r;
+}
+
+// 0, or -1 if the records cannot be allocated
+int frame_trace_init(struct frame_trace *t, uint32_t capacity, int64_t period_ns);
+
+int frame_trace_write(struct frame_trace *t, const char *path);
+
+// Loads a trace written by frame_trace_write(), free with frame_trace_free()
+int frame_trace_read(struct frame_trace *t, const char *path);
+
+// Interval, jitter histogram, latency and deadline miss statistics over the
+// frames numbered 0 and up
+void frame_trace_print_stats(struct frame_trace *t);
+
+void frame_trace_free(struct frame_trace *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ *  Print a binary frame trace as CSV, followed by its statistics
+ *
+ *  Usage: frame_trace_dump trace.bin [-s]     -s prints only the statistics
+ *
+ *  Times in the CSV are ms since the first dequeue.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frame_trace.h"
+
+
+int main(int argc, char *argv[])
+{
+    struct frame_trace trace;
+    struct frame_trace_record *r;
+    int64_t base;
+    uint32_t i;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "Usage: %s trace.bin [-s]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(frame_trace_read(&trace, argv[1]) != 0)
+        exit(EXIT_FAILURE);
+
+    if((argc < 3) || (strcmp(argv[2], "-s") != 0))
+    {
+        base = trace.hdr.count ? trace.rec[0].dequeue_ns : 0;
+
+        printf("frame,sequence,driver_ms,dequeue_ms,process_ms,write_ms\n");
+        for(i=0; i < trace.hdr.count; i++)
+        {
+            r = &trace.rec[i];
+            printf("%d,%u,%.3lf,%.3lf,%.3lf,%.3lf\n", r->frame, r->sequence,
+                   r->driver_ns ? (double)(r->driver_ns - base) / 1000000.0 : 0.0,
+                   (double)(r->dequeue_ns - base) / 1000000.0,
+                   r->process_ns ? (double)(r->process_ns - base) / 1000000.0 : 0.0,
+                   r->write_ns ? (double)(r->write_ns - base) / 1000000.0 : 0.0);
+        }
+    }
+
+    frame_trace_print_stats(&trace);
+    frame_trace_free(&trace);
+
+    return EXIT_SUCCESS;
+}
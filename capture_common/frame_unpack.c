@@ -0,0 +1,96 @@
+/*
+ *  Split a frame_writer container back into one PPM/PGM file per frame
+ *
+ *  Usage: frame_unpack container [output directory]
+ *
+ *  With no output directory the records are only listed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "frame_writer.h"
+
+
+int main(int argc, char *argv[])
+{
+    struct frame_record rec;
+    unsigned char *image = NULL;
+    size_t image_bytes = 0;
+    char path[512];
+    const char *base;
+    long long offset = 0;
+    int count = 0;
+    FILE *in, *out;
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "Usage: %s container [output directory]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!(in = fopen(argv[1], "rb")))
+    {
+        perror(argv[1]);
+        exit(EXIT_FAILURE);
+    }
+
+    while(fread(&rec, sizeof(rec), 1, in) == 1)
+    {
+        // O_DIRECT containers may be padded out with zeros past the last record
+        if(memcmp(rec.magic, FRAME_RECORD_MAGIC, 4) != 0)
+        {
+            if(rec.magic[0] != '\0')
+                fprintf(stderr, "bad record magic at offset %lld\n", offset);
+            break;
+        }
+
+        rec.name[sizeof(rec.name) - 1] = '\0';
+
+        if(rec.length > image_bytes)
+        {
+            image_bytes = rec.length;
+            if(!(image = realloc(image, image_bytes)))
+            {
+                fprintf(stderr, "Out of memory\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if(fread(image, 1, rec.length, in) != rec.length)
+        {
+            fprintf(stderr, "truncated record %s at offset %lld\n", rec.name, offset);
+            break;
+        }
+
+        printf("%6u %-24s %10" PRIu64 " bytes  queued %" PRId64 ".%09" PRId64 "\n",
+               rec.tag, rec.name, rec.length, rec.queued_sec, rec.queued_nsec);
+
+        if(argc > 2)
+        {
+            // keep only the file name, the frames/ directory it was captured to may not exist here
+            base = strrchr(rec.name, '/') ? strrchr(rec.name, '/') + 1 : rec.name;
+            snprintf(path, sizeof(path), "%s/%s", argv[2], base);
+
+            if(!(out = fopen(path, "wb")) || (fwrite(image, 1, rec.length, out) != rec.length))
+            {
+                perror(path);
+                exit(EXIT_FAILURE);
+            }
+            fclose(out);
+        }
+
+        offset += rec.record_bytes;
+        if(fseek(in, offset, SEEK_SET) != 0)
+            break;
+        count++;
+    }
+
+    printf("%d frames\n", count);
+
+    free(image);
+    fclose(in);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,608 @@
+/*
+ *  Asynchronous batched frame writer, see frame_writer.h
+ *
+ *  The capture thread only copies the frame into a preallocated buffer and
+ *  links it on a queue.  Writer threads take up to cfg.batch frames at a time:
+ *
+ *    io_uring  one thread preps a write (linked to an fdatasync when sync is
+ *              on) per frame, submits the whole batch with one io_uring_submit()
+ *              and reaps the completions
+ *
+ *    pwritev   cfg.threads threads each pwritev() a batch and, for a container,
+ *              fdatasync() once for the whole batch
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#if defined(USE_IO_URING)
+#include <liburing.h>
+#endif
+
+#include "frame_writer.h"
+
+#define FW_ALIGN        (4096)
+#define FW_RECORD_ALIGN (64)
+
+struct fw_req
+{
+    unsigned char   *buf;           // FW_ALIGN aligned, header prefix + image
+    size_t           prefix;        // frame_record bytes ahead of the image, container only
+    size_t           length;        // image bytes
+    size_t           io_bytes;      // bytes written, including padding
+    off_t            offset;
+    int              fd;
+    int              error;
+    unsigned int     tag;
+    char             name[64];
+    struct timespec  queued;
+    struct fw_req   *next;
+};
+
+struct frame_writer
+{
+    struct frame_writer_config cfg;
+
+    struct fw_req    *reqs;
+    struct fw_req    *free_list;
+    struct fw_req    *queue_head;
+    struct fw_req    *queue_tail;
+    int               queued;
+    int               stopping;
+
+    pthread_mutex_t   lock;
+    pthread_cond_t    work;         // queue non-empty or stopping
+
+    pthread_t        *threads;
+    int               nthreads;
+
+    int               container_fd;
+    off_t             container_offset;
+
+#if defined(USE_IO_URING)
+    struct io_uring   ring;
+#endif
+
+    // statistics, under lock
+    unsigned long     written;
+    unsigned long     dropped;
+    unsigned long     errors;
+    unsigned long     batches;
+    unsigned long long bytes;
+    double            lat_min_ms;
+    double            lat_max_ms;
+    double            lat_sum_ms;
+    unsigned long     lat_hist[8];  // <1, <2, <5, <10, <20, <50, <100, >=100 ms
+};
+
+static const double fw_hist_bound[7] = {1.0, 2.0, 5.0, 10.0, 20.0, 50.0, 100.0};
+
+
+static double fw_elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((double)(now.tv_sec - start->tv_sec) * 1000.0) +
+           ((double)(now.tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+static size_t fw_round_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+static size_t fw_io_align(struct frame_writer *w)
+{
+    if(w->cfg.direct)
+        return FW_ALIGN;
+
+    return w->cfg.container ? FW_RECORD_ALIGN : 1;
+}
+
+
+// Called by writer threads once a request is durable (or failed)
+static void fw_complete(struct frame_writer *w, struct fw_req *req)
+{
+    double latency = fw_elapsed_ms(&req->queued);
+    int bin;
+
+    pthread_mutex_lock(&w->lock);
+
+    if(req->error)
+    {
+        w->errors++;
+        fprintf(stderr, "frame writer: %s: %s\n", req->name, strerror(req->error));
+    }
+    else
+    {
+        w->written++;
+        w->bytes += req->length;
+        w->lat_sum_ms += latency;
+        if(latency < w->lat_min_ms) w->lat_min_ms = latency;
+        if(latency > w->lat_max_ms) w->lat_max_ms = latency;
+
+        for(bin=0; (bin < 7) && (latency >= fw_hist_bound[bin]); bin++);
+        w->lat_hist[bin]++;
+    }
+
+    req->next = w->free_list;
+    w->free_list = req;
+
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+// Take up to cfg.batch queued requests, blocking until there is work.
+// Returns the number taken, 0 when the writer is stopping and drained.
+static int fw_take_batch(struct frame_writer *w, struct fw_req **batch)
+{
+    int n = 0;
+
+    pthread_mutex_lock(&w->lock);
+
+    while(!w->queue_head && !w->stopping)
+        pthread_cond_wait(&w->work, &w->lock);
+
+    while(w->queue_head && (n < w->cfg.batch))
+    {
+        batch[n++] = w->queue_head;
+        w->queue_head = w->queue_head->next;
+        w->queued--;
+    }
+
+    if(!w->queue_head)
+        w->queue_tail = NULL;
+
+    if(n)
+        w->batches++;
+
+    pthread_mutex_unlock(&w->lock);
+
+    return n;
+}
+
+
+// Fill in the container record ahead of the image, or open the frame's own file
+static int fw_prepare(struct frame_writer *w, struct fw_req *req)
+{
+    size_t align = fw_io_align(w);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | (w->cfg.direct ? O_DIRECT : 0);
+
+    req->error = 0;
+
+    if(w->cfg.container)
+    {
+        struct frame_record *rec = (struct frame_record *)req->buf;
+        struct timespec rt;
+
+        req->io_bytes = fw_round_up(req->prefix + req->length, align);
+
+        clock_gettime(CLOCK_REALTIME, &rt);
+        memcpy(rec->magic, FRAME_RECORD_MAGIC, 4);
+        rec->tag = req->tag;
+        rec->length = req->length;
+        rec->record_bytes = req->io_bytes;
+        rec->queued_sec = rt.tv_sec;
+        rec->queued_nsec = rt.tv_nsec;
+        strncpy(rec->name, req->name, sizeof(rec->name) - 1);
+        rec->name[sizeof(rec->name) - 1] = '\0';
+        memset(req->buf + req->prefix + req->length, 0, req->io_bytes - req->prefix - req->length);
+
+        req->fd = w->container_fd;
+        return 0;
+    }
+
+    req->io_bytes = fw_round_up(req->length, align);
+    memset(req->buf + req->length, 0, req->io_bytes - req->length);
+    req->offset = 0;
+
+    if((req->fd = open(req->name, flags, 00666)) < 0)
+    {
+        req->error = errno;
+        return -1;
+    }
+
+    return 0;
+}
+
+// After the write, drop the O_DIRECT padding and close a per-frame file
+static void fw_finish(struct frame_writer *w, struct fw_req *req)
+{
+    if(w->cfg.container || (req->fd < 0))
+        return;
+
+    if(!req->error && (req->io_bytes != req->length) && (ftruncate(req->fd, req->length) != 0))
+        req->error = errno;
+
+    close(req->fd);
+    req->fd = -1;
+}
+
+// Reserve space for a batch in the container so pool threads can write in parallel
+static void fw_reserve(struct frame_writer *w, struct fw_req **batch, int n)
+{
+    int i;
+
+    if(!w->cfg.container)
+        return;
+
+    pthread_mutex_lock(&w->lock);
+    for(i=0; i<n; i++)
+    {
+        batch[i]->offset = w->container_offset;
+        w->container_offset += batch[i]->io_bytes;
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+static void *fw_pwritev_thread(void *arg)
+{
+    struct frame_writer *w = (struct frame_writer *)arg;
+    struct fw_req *batch[w->cfg.batch];
+    struct iovec iov;
+    ssize_t rc;
+    int n, i;
+
+    while((n = fw_take_batch(w, batch)) > 0)
+    {
+        for(i=0; i<n; i++)
+            fw_prepare(w, batch[i]);
+
+        fw_reserve(w, batch, n);
+
+        for(i=0; i<n; i++)
+        {
+            struct fw_req *req = batch[i];
+            size_t done = 0;
+
+            if(req->error)
+                continue;
+
+            // one vector today, the header is already in front of the image
+            while(done < req->io_bytes)
+            {
+                iov.iov_base = req->buf + done;
+                iov.iov_len = req->io_bytes - done;
+
+                if((rc = pwritev(req->fd, &iov, 1, req->offset + done)) < 0)
+                {
+                    if(errno == EINTR)
+                        continue;
+                    req->error = errno;
+                    break;
+                }
+                done += rc;
+            }
+
+            // each frame file needs its own sync
+            if(!req->error && w->cfg.sync && !w->cfg.container && (fdatasync(req->fd) != 0))
+                req->error = errno;
+        }
+
+        // one sync covers the whole batch in a container
+        if(w->cfg.container && w->cfg.sync && (fdatasync(w->container_fd) != 0))
+            for(i=0; i<n; i++)
+                if(!batch[i]->error) batch[i]->error = errno;
+
+        for(i=0; i<n; i++)
+        {
+            fw_finish(w, batch[i]);
+            fw_complete(w, batch[i]);
+        }
+    }
+
+    return NULL;
+}
+
+
+#if defined(USE_IO_URING)
+
+// user_data carries the request pointer, bit 0 marks the last operation of a request
+#define FW_LAST_OP  ((uintptr_t)1)
+
+static void *fw_uring_thread(void *arg)
+{
+    struct frame_writer *w = (struct frame_writer *)arg;
+    struct fw_req *batch[w->cfg.batch];
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int n, i, ops, rc;
+
+    while((n = fw_take_batch(w, batch)) > 0)
+    {
+        ops = 0;
+
+        for(i=0; i<n; i++)
+        {
+            struct fw_req *req = batch[i];
+
+            if(fw_prepare(w, req) != 0)
+            {
+                fw_complete(w, req);
+                batch[i] = NULL;
+                continue;
+            }
+
+            if(w->cfg.container)
+                fw_reserve(w, &batch[i], 1);
+
+            sqe = io_uring_get_sqe(&w->ring);
+            io_uring_prep_write(sqe, req->fd, req->buf, req->io_bytes, req->offset);
+            io_uring_sqe_set_data(sqe, (void *)((uintptr_t)req | (w->cfg.sync ? 0 : FW_LAST_OP)));
+            ops++;
+
+            if(w->cfg.sync)
+            {
+                // runs only after the write completes, cancelled if it fails
+                sqe->flags |= IOSQE_IO_LINK;
+                sqe = io_uring_get_sqe(&w->ring);
+                io_uring_prep_fsync(sqe, req->fd, IORING_FSYNC_DATASYNC);
+                io_uring_sqe_set_data(sqe, (void *)((uintptr_t)req | FW_LAST_OP));
+                ops++;
+            }
+        }
+
+        if(ops && ((rc = io_uring_submit(&w->ring)) < 0))
+        {
+            fprintf(stderr, "io_uring_submit: %s\n", strerror(-rc));
+            exit(EXIT_FAILURE);
+        }
+
+        while(ops > 0)
+        {
+            struct fw_req *req;
+            uintptr_t data;
+
+            if((rc = io_uring_wait_cqe(&w->ring, &cqe)) < 0)
+            {
+                if(rc == -EINTR)
+                    continue;
+                fprintf(stderr, "io_uring_wait_cqe: %s\n", strerror(-rc));
+                exit(EXIT_FAILURE);
+            }
+
+            data = (uintptr_t)io_uring_cqe_get_data(cqe);
+            req = (struct fw_req *)(data & ~FW_LAST_OP);
+
+            if((cqe->res < 0) && !req->error)
+                req->error = -cqe->res;
+            else if((cqe->res >= 0) && !(data & FW_LAST_OP) && ((size_t)cqe->res != req->io_bytes))
+                req->error = EIO;   // short write, the linked fsync still runs
+
+            io_uring_cqe_seen(&w->ring, cqe);
+            ops--;
+
+            if(data & FW_LAST_OP)
+            {
+                fw_finish(w, req);
+                fw_complete(w, req);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+#endif
+
+
+const char *frame_writer_backend(struct frame_writer *w)
+{
+#if defined(USE_IO_URING)
+    return "io_uring";
+#else
+    return "pwritev";
+#endif
+}
+
+struct frame_writer *frame_writer_open(const struct frame_writer_config *cfg)
+{
+    struct frame_writer *w;
+    size_t prefix, bytes;
+    int i, rc;
+
+    if(!(w = (struct frame_writer *)calloc(1, sizeof(*w))))
+        return NULL;
+
+    w->cfg = *cfg;
+    if(w->cfg.nbuffers < 1) w->cfg.nbuffers = 16;
+    if(w->cfg.batch < 1) w->cfg.batch = 4;
+    if(w->cfg.threads < 1) w->cfg.threads = 2;
+    w->container_fd = -1;
+    w->lat_min_ms = 1.0e9;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->work, NULL);
+
+    prefix = w->cfg.container ? sizeof(struct frame_record) : 0;
+    bytes = fw_round_up(prefix + w->cfg.buffer_bytes, FW_ALIGN);
+
+    if(!(w->reqs = (struct fw_req *)calloc(w->cfg.nbuffers, sizeof(struct fw_req))))
+        goto fail;
+
+    for(i=0; i<w->cfg.nbuffers; i++)
+    {
+        if(posix_memalign((void **)&w->reqs[i].buf, FW_ALIGN, bytes) != 0)
+            goto fail;
+
+        w->reqs[i].prefix = prefix;
+        w->reqs[i].fd = -1;
+        w->reqs[i].next = w->free_list;
+        w->free_list = &w->reqs[i];
+    }
+
+    if(w->cfg.container)
+    {
+        int flags = O_WRONLY | O_CREAT | O_TRUNC | (w->cfg.direct ? O_DIRECT : 0);
+
+        if((w->container_fd = open(w->cfg.container, flags, 00666)) < 0)
+        {
+            perror(w->cfg.container);
+            goto fail;
+        }
+    }
+
+#if defined(USE_IO_URING)
+    // two entries per frame, write plus linked fdatasync
+    if((rc = io_uring_queue_init(2 * w->cfg.batch, &w->ring, 0)) < 0)
+    {
+        fprintf(stderr, "io_uring_queue_init: %s\n", strerror(-rc));
+        goto fail;
+    }
+    w->nthreads = 1;
+#else
+    w->nthreads = w->cfg.threads;
+#endif
+
+    if(!(w->threads = (pthread_t *)calloc(w->nthreads, sizeof(pthread_t))))
+        goto fail;
+
+    for(i=0; i<w->nthreads; i++)
+    {
+#if defined(USE_IO_URING)
+        rc = pthread_create(&w->threads[i], NULL, fw_uring_thread, w);
+#else
+        rc = pthread_create(&w->threads[i], NULL, fw_pwritev_thread, w);
+#endif
+        if(rc != 0)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return w;
+
+fail:
+    if(w->reqs)
+    {
+        for(i=0; i<w->cfg.nbuffers; i++)
+            free(w->reqs[i].buf);
+        free(w->reqs);
+    }
+    if(w->container_fd >= 0)
+        close(w->container_fd);
+    free(w);
+    return NULL;
+}
+
+
+int frame_writer_get(struct frame_writer *w, struct frame_writer_buf *b)
+{
+    struct fw_req *req;
+
+    pthread_mutex_lock(&w->lock);
+
+    if(!(req = w->free_list))
+    {
+        w->dropped++;
+        pthread_mutex_unlock(&w->lock);
+        return -1;
+    }
+
+    w->free_list = req->next;
+
+    pthread_mutex_unlock(&w->lock);
+
+    b->data = req->buf + req->prefix;
+    b->capacity = w->cfg.buffer_bytes;
+    b->req = req;
+
+    return 0;
+}
+
+
+void frame_writer_put(struct frame_writer *w, struct frame_writer_buf *b, const char *name,
+                      unsigned int tag, size_t length)
+{
+    struct fw_req *req = (struct fw_req *)b->req;
+
+    clock_gettime(CLOCK_MONOTONIC, &req->queued);
+    strncpy(req->name, name, sizeof(req->name) - 1);
+    req->name[sizeof(req->name) - 1] = '\0';
+    req->tag = tag;
+    req->length = length;
+    req->next = NULL;
+
+    pthread_mutex_lock(&w->lock);
+
+    if(w->queue_tail)
+        w->queue_tail->next = req;
+    else
+        w->queue_head = req;
+    w->queue_tail = req;
+    w->queued++;
+
+    // writers take whatever is queued, up to a batch, so a slow writer batches naturally
+    pthread_cond_signal(&w->work);
+
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+void frame_writer_print_stats(struct frame_writer *w)
+{
+    static const char *bins[8] = {"<1", "<2", "<5", "<10", "<20", "<50", "<100", ">=100"};
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+
+    printf("\nframe writer (%s%s%s): %lu frames, %llu bytes in %lu batches, %lu dropped, %lu errors\n",
+           frame_writer_backend(w), w->cfg.direct ? ", O_DIRECT" : "",
+           w->cfg.container ? ", container" : "", w->written, w->bytes, w->batches, w->dropped, w->errors);
+
+    if(w->written)
+    {
+        printf("queued to %s ms: min %.3lf, avg %.3lf, max %.3lf\n", w->cfg.sync ? "durable" : "written",
+               w->lat_min_ms, w->lat_sum_ms / (double)w->written, w->lat_max_ms);
+
+        for(i=0; i<8; i++)
+            printf("  %6s ms %8lu\n", bins[i], w->lat_hist[i]);
+    }
+
+    pthread_mutex_unlock(&w->lock);
+}
+
+
+void frame_writer_close(struct frame_writer *w)
+{
+    int i;
+
+    pthread_mutex_lock(&w->lock);
+    w->stopping = 1;
+    pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->lock);
+
+    for(i=0; i<w->nthreads; i++)
+        pthread_join(w->threads[i], NULL);
+
+    frame_writer_print_stats(w);
+
+#if defined(USE_IO_URING)
+    io_uring_queue_exit(&w->ring);
+#endif
+
+    if(w->container_fd >= 0)
+        close(w->container_fd);
+
+    for(i=0; i<w->cfg.nbuffers; i++)
+        free(w->reqs[i].buf);
+
+    free(w->reqs);
+    free(w->threads);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->work);
+    free(w);
+}
@@ -0,0 +1,81 @@
+/*
+ *  Asynchronous batched frame writer
+ *
+ *  Takes completed frame images (PPM/PGM header plus pixels) off the capture
+ *  thread and writes them from preallocated, page aligned buffers.  Frames are
+ *  written in batches either through io_uring (build with -DUSE_IO_URING and
+ *  -luring) or by a pool of threads using pwritev(), optionally with O_DIRECT.
+ *
+ *  Frames go to one file each, or with container set are appended as records
+ *  to a single file.  Each container record is a struct frame_record followed
+ *  by the image bytes, padded so the next record starts on a 64 byte boundary
+ *  (4096 with O_DIRECT); frame_unpack splits a container back into files.
+ *
+ *  The time from frame_writer_put() until the data is durable (fdatasync() or
+ *  IORING_FSYNC_DATASYNC complete, or the write complete when sync is off) is
+ *  recorded per frame and summarised by frame_writer_print_stats().
+ */
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FRAME_RECORD_MAGIC "FRM1"
+
+struct frame_record
+{
+    char     magic[4];          // FRAME_RECORD_MAGIC
+    uint32_t tag;               // frame number
+    uint64_t length;            // image bytes following this header
+    uint64_t record_bytes;      // header + image + padding, offset to the next record
+    int64_t  queued_sec;        // CLOCK_REALTIME when queued
+    int64_t  queued_nsec;
+    char     name[24];          // file name the image would have had
+};
+
+struct frame_writer_config
+{
+    int          nbuffers;      // preallocated frame buffers
+    size_t       buffer_bytes;  // largest frame image including its header
+    int          batch;         // frames per submission
+    int          threads;       // pwritev() pool size, ignored with io_uring
+    int          direct;        // open with O_DIRECT
+    int          sync;          // fdatasync so latency is measured to durable storage
+    const char  *container;     // append all frames to this file instead of one file each
+};
+
+struct frame_writer_buf
+{
+    unsigned char *data;        // where to put the frame image
+    size_t         capacity;
+    void          *req;         // writer private
+};
+
+struct frame_writer;
+
+struct frame_writer *frame_writer_open(const struct frame_writer_config *cfg);
+
+// 0 with a free buffer in b, or -1 if all buffers are in flight (counted as a drop)
+int frame_writer_get(struct frame_writer *w, struct frame_writer_buf *b);
+
+// queue length bytes at b->data to be written as name
+void frame_writer_put(struct frame_writer *w, struct frame_writer_buf *b, const char *name,
+                      unsigned int tag, size_t length);
+
+// waits for everything queued to be durable, prints statistics and frees the writer
+void frame_writer_close(struct frame_writer *w);
+
+void frame_writer_print_stats(struct frame_writer *w);
+
+const char *frame_writer_backend(struct frame_writer *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,392 @@
+/*
+ *  Parallel MJPEG decode pool, see mjpeg_decode.h
+ *
+ *  Slot i of the ring holds frame sequence numbers i, i+nslots, ... so the
+ *  delivery thread only ever waits on slot (next % nslots), and the submitter
+ *  only ever fills slot (submitted % nslots).  Workers take the oldest queued
+ *  slot, so frames finish close to submission order and the delivery thread
+ *  rarely waits behind a slow one.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <jpeglib.h>
+
+#include "mjpeg_decode.h"
+
+enum slot_state
+{
+    SLOT_FREE,
+    SLOT_QUEUED,
+    SLOT_DECODING,
+    SLOT_DONE
+};
+
+struct mjpeg_slot
+{
+    enum slot_state  state;
+    unsigned long    seq;
+    unsigned char   *jpeg;
+    size_t           jpeg_size;
+    unsigned char   *image;
+    int              ok;
+    unsigned int     tag;
+    struct timespec  frame_time;
+    struct timespec  submitted;
+};
+
+struct mjpeg_decoder
+{
+    struct mjpeg_decoder_config cfg;
+    mjpeg_deliver_fn  deliver;
+    void             *arg;
+    size_t            image_bytes;
+
+    struct mjpeg_slot *slots;
+    unsigned long     submitted;    // next sequence number to fill
+    unsigned long     delivered;    // next sequence number to deliver
+    int               stopping;
+
+    pthread_mutex_t   lock;
+    pthread_cond_t    queued;       // a slot was queued, or stopping
+    pthread_cond_t    done;         // a slot finished decoding, or stopping
+    pthread_t        *workers;
+    pthread_t         delivery;
+
+    // statistics, under lock
+    unsigned long     dropped;
+    unsigned long     errors;
+    unsigned long     decoded;
+    double            decode_ms;
+    double            latency_ms_max;
+    double            latency_ms_sum;
+};
+
+struct decode_error
+{
+    struct jpeg_error_mgr pub;
+    jmp_buf               env;
+};
+
+
+static double elapsed_ms(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((double)(now.tv_sec - start->tv_sec) * 1000.0) +
+           ((double)(now.tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+static void decode_error_exit(j_common_ptr cinfo)
+{
+    struct decode_error *err = (struct decode_error *)cinfo->err;
+
+    longjmp(err->env, 1);
+}
+
+// warnings for corrupt data are common with webcams and not worth a line each
+static void decode_output_message(j_common_ptr cinfo)
+{
+}
+
+// Decode one frame into slot->image, cropping or padding to the configured size
+static int decode_slot(struct mjpeg_decoder *d, struct jpeg_decompress_struct *cinfo,
+                       struct decode_error *err, struct mjpeg_slot *slot)
+{
+    JSAMPROW row;
+    unsigned char * volatile scratch = NULL;    // survives the longjmp
+    size_t stride = (size_t)d->cfg.width * d->cfg.components;
+
+    if(setjmp(err->env))
+    {
+        jpeg_abort_decompress(cinfo);
+        free(scratch);
+        return 0;
+    }
+
+    jpeg_mem_src(cinfo, slot->jpeg, slot->jpeg_size);
+    jpeg_read_header(cinfo, TRUE);
+
+    cinfo->out_color_space = (d->cfg.components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    cinfo->dct_method = JDCT_ISLOW;
+    jpeg_start_decompress(cinfo);
+
+    if(((int)cinfo->output_width != d->cfg.width) || ((int)cinfo->output_height != d->cfg.height))
+    {
+        memset(slot->image, 0, d->image_bytes);
+        scratch = malloc((size_t)cinfo->output_width * d->cfg.components);
+    }
+
+    while(cinfo->output_scanline < cinfo->output_height)
+    {
+        unsigned int y = cinfo->output_scanline;
+
+        if(!scratch)
+        {
+            row = slot->image + (size_t)y * stride;
+            jpeg_read_scanlines(cinfo, &row, 1);
+        }
+        else
+        {
+            size_t width = (size_t)cinfo->output_width * d->cfg.components;
+
+            row = scratch;
+            jpeg_read_scanlines(cinfo, &row, 1);
+            if((int)y < d->cfg.height)
+                memcpy(slot->image + (size_t)y * stride, scratch, (width < stride) ? width : stride);
+        }
+    }
+
+    jpeg_finish_decompress(cinfo);
+    free(scratch);
+
+    return 1;
+}
+
+static void *decode_worker(void *arg)
+{
+    struct mjpeg_decoder *d = (struct mjpeg_decoder *)arg;
+    struct jpeg_decompress_struct cinfo;
+    struct decode_error err;
+    struct mjpeg_slot *slot;
+    struct timespec start;
+    unsigned long seq;
+    double ms;
+    int ok;
+
+    // one decompressor per worker, reused for every frame
+    cinfo.err = jpeg_std_error(&err.pub);
+    err.pub.error_exit = decode_error_exit;
+    err.pub.output_message = decode_output_message;
+    jpeg_create_decompress(&cinfo);
+
+    pthread_mutex_lock(&d->lock);
+
+    for(;;)
+    {
+        // oldest queued frame first
+        slot = NULL;
+        for(seq = d->delivered; seq < d->submitted; seq++)
+        {
+            if(d->slots[seq % d->cfg.slots].state == SLOT_QUEUED)
+            {
+                slot = &d->slots[seq % d->cfg.slots];
+                break;
+            }
+        }
+
+        if(!slot)
+        {
+            if(d->stopping)
+                break;
+            pthread_cond_wait(&d->queued, &d->lock);
+            continue;
+        }
+
+        slot->state = SLOT_DECODING;
+        pthread_mutex_unlock(&d->lock);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        ok = decode_slot(d, &cinfo, &err, slot);
+        ms = elapsed_ms(&start);
+
+        pthread_mutex_lock(&d->lock);
+        slot->ok = ok;
+        slot->state = SLOT_DONE;
+        d->decode_ms += ms;
+        pthread_cond_broadcast(&d->done);
+    }
+
+    pthread_mutex_unlock(&d->lock);
+    jpeg_destroy_decompress(&cinfo);
+
+    return NULL;
+}
+
+static void *delivery_thread(void *arg)
+{
+    struct mjpeg_decoder *d = (struct mjpeg_decoder *)arg;
+    struct mjpeg_slot *slot;
+    double latency;
+
+    pthread_mutex_lock(&d->lock);
+
+    for(;;)
+    {
+        if(d->delivered == d->submitted)
+        {
+            if(d->stopping)
+                break;
+            pthread_cond_wait(&d->done, &d->lock);
+            continue;
+        }
+
+        slot = &d->slots[d->delivered % d->cfg.slots];
+
+        // in order: wait for this frame even if later ones are already done
+        if(slot->state != SLOT_DONE)
+        {
+            pthread_cond_wait(&d->done, &d->lock);
+            continue;
+        }
+
+        pthread_mutex_unlock(&d->lock);
+
+        if(slot->ok)
+            d->deliver(slot->image, (int)d->image_bytes, slot->tag, &slot->frame_time, d->arg);
+        latency = elapsed_ms(&slot->submitted);
+
+        pthread_mutex_lock(&d->lock);
+        if(slot->ok)
+        {
+            d->decoded++;
+            d->latency_ms_sum += latency;
+            if(latency > d->latency_ms_max)
+                d->latency_ms_max = latency;
+        }
+        else
+            d->errors++;
+
+        slot->state = SLOT_FREE;
+        d->delivered++;
+    }
+
+    pthread_mutex_unlock(&d->lock);
+
+    return NULL;
+}
+
+
+struct mjpeg_decoder *mjpeg_decoder_open(const struct mjpeg_decoder_config *cfg,
+                                         mjpeg_deliver_fn deliver, void *arg)
+{
+    struct mjpeg_decoder *d;
+    int i, rc;
+
+    if(!(d = calloc(1, sizeof(*d))))
+    {
+        fprintf(stderr, "Out of memory for the MJPEG decoder\n");
+        exit(EXIT_FAILURE);
+    }
+
+    d->cfg = *cfg;
+    if(d->cfg.workers < 1) d->cfg.workers = 1;
+    if(d->cfg.slots < d->cfg.workers + 1) d->cfg.slots = d->cfg.workers + 1;
+    if(d->cfg.components != 1) d->cfg.components = 3;
+    d->deliver = deliver;
+    d->arg = arg;
+    d->image_bytes = (size_t)d->cfg.width * d->cfg.height * d->cfg.components;
+
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->queued, NULL);
+    pthread_cond_init(&d->done, NULL);
+
+    if(!(d->slots = calloc(d->cfg.slots, sizeof(struct mjpeg_slot))) ||
+       !(d->workers = calloc(d->cfg.workers, sizeof(pthread_t))))
+    {
+        fprintf(stderr, "Out of memory for the MJPEG decoder\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(i=0; i < d->cfg.slots; i++)
+    {
+        if(!(d->slots[i].jpeg = malloc(d->cfg.max_jpeg)) || !(d->slots[i].image = malloc(d->image_bytes)))
+        {
+            fprintf(stderr, "Out of memory for the MJPEG decoder\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for(i=0; i < d->cfg.workers; i++)
+    {
+        if((rc = pthread_create(&d->workers[i], NULL, decode_worker, d)) != 0)
+        {
+            fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if((rc = pthread_create(&d->delivery, NULL, delivery_thread, d)) != 0)
+    {
+        fprintf(stderr, "pthread_create: %s\n", strerror(rc));
+        exit(EXIT_FAILURE);
+    }
+
+    return d;
+}
+
+int mjpeg_decoder_submit(struct mjpeg_decoder *d, const void *jpeg, int size, unsigned int tag,
+                         const struct timespec *frame_time)
+{
+    struct mjpeg_slot *slot;
+
+    pthread_mutex_lock(&d->lock);
+    slot = &d->slots[d->submitted % d->cfg.slots];
+
+    if((slot->state != SLOT_FREE) || (size <= 0) || ((size_t)size > d->cfg.max_jpeg))
+    {
+        d->dropped++;
+        pthread_mutex_unlock(&d->lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&d->lock);
+
+    // the slot is ours until it is queued, copy without holding the lock
+    memcpy(slot->jpeg, jpeg, size);
+    slot->jpeg_size = size;
+    slot->tag = tag;
+    slot->frame_time = *frame_time;
+    clock_gettime(CLOCK_MONOTONIC, &slot->submitted);
+
+    pthread_mutex_lock(&d->lock);
+    slot->seq = d->submitted++;
+    slot->state = SLOT_QUEUED;
+    pthread_cond_signal(&d->queued);
+    pthread_mutex_unlock(&d->lock);
+
+    return 0;
+}
+
+void mjpeg_decoder_close(struct mjpeg_decoder *d)
+{
+    int i;
+
+    pthread_mutex_lock(&d->lock);
+    d->stopping = 1;
+    pthread_cond_broadcast(&d->queued);
+    pthread_cond_broadcast(&d->done);
+    pthread_mutex_unlock(&d->lock);
+
+    for(i=0; i < d->cfg.workers; i++)
+        pthread_join(d->workers[i], NULL);
+
+    // workers have finished everything queued, wake delivery for the last of it
+    pthread_mutex_lock(&d->lock);
+    pthread_cond_broadcast(&d->done);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->delivery, NULL);
+
+    printf("\nMJPEG decode: %d workers, %lu frames, %lu corrupt, %lu dropped\n",
+           d->cfg.workers, d->decoded, d->errors, d->dropped);
+    if(d->decoded)
+        printf("decode avg %.3lf ms per frame, submit to delivered avg %.3lf ms, max %.3lf ms\n",
+               d->decode_ms / (double)(d->decoded + d->errors), d->latency_ms_sum / (double)d->decoded,
+               d->latency_ms_max);
+
+    for(i=0; i < d->cfg.slots; i++)
+    {
+        free(d->slots[i].jpeg);
+        free(d->slots[i].image);
+    }
+    free(d->slots);
+    free(d->workers);
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->queued);
+    pthread_cond_destroy(&d->done);
+    free(d);
+}
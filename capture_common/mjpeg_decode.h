@@ -0,0 +1,55 @@
+/*
+ *  Parallel MJPEG decode pool
+ *
+ *  Compressed frames are copied into a ring of slots by the capture thread and
+ *  decoded with libjpeg(-turbo) by a pool of worker threads, several frames at
+ *  a time.  A delivery thread hands the decoded images to the callback strictly
+ *  in the order they were submitted, so the processing after it sees the same
+ *  frame sequence as with a single decoder.
+ *
+ *  A frame that fails to decode (UVC cameras do send the odd corrupt one) is
+ *  counted and skipped without holding up the frames behind it.
+ */
+#ifndef MJPEG_DECODE_H
+#define MJPEG_DECODE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Called on the delivery thread with a decoded image of width*height*components bytes
+typedef void (*mjpeg_deliver_fn)(const unsigned char *image, int size, unsigned int tag,
+                                 struct timespec *frame_time, void *arg);
+
+struct mjpeg_decoder_config
+{
+    int     workers;        // decode threads
+    int     slots;          // frames in flight, at least workers
+    size_t  max_jpeg;       // largest compressed frame, sizeimage from VIDIOC_G_FMT
+    int     width;
+    int     height;
+    int     components;     // 3 for RGB24, 1 for grey
+};
+
+struct mjpeg_decoder;
+
+// Starts the workers; exits with a message if the pool cannot be allocated
+struct mjpeg_decoder *mjpeg_decoder_open(const struct mjpeg_decoder_config *cfg,
+                                         mjpeg_deliver_fn deliver, void *arg);
+
+// Copy a compressed frame in for decoding.  Returns 0, or -1 if every slot is
+// still busy, in which case the frame is dropped and counted.
+int mjpeg_decoder_submit(struct mjpeg_decoder *d, const void *jpeg, int size, unsigned int tag,
+                         const struct timespec *frame_time);
+
+// Decodes and delivers everything submitted, prints statistics and frees the pool
+void mjpeg_decoder_close(struct mjpeg_decoder *d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
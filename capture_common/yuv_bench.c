@@ -0,0 +1,195 @@
+/*
+ *  Microbenchmark and bit-exact check for the YUYV conversion kernels
+ *
+ *  Every kernel supported on this CPU is first checked against the original
+ *  yuv2rgb() from the capture examples over all 2^24 Y/U/V combinations, then
+ *  timed on a frame of the requested size.
+ *
+ *  Usage: yuv_bench [width height iterations]    default 1280 960 200
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "yuv_convert.h"
+
+
+// Reference conversion, unchanged from simple-capture/capture.c
+void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+   int r1, g1, b1;
+
+   // replaces floating point coefficients
+   int c = y-16, d = u - 128, e = v - 128;
+
+   // Conversion that avoids floating point
+   r1 = (298 * c           + 409 * e + 128) >> 8;
+   g1 = (298 * c - 100 * d - 208 * e + 128) >> 8;
+   b1 = (298 * c + 516 * d           + 128) >> 8;
+
+   // Computed values may need clipping.
+   if (r1 > 255) r1 = 255;
+   if (g1 > 255) g1 = 255;
+   if (b1 > 255) b1 = 255;
+
+   if (r1 < 0) r1 = 0;
+   if (g1 < 0) g1 = 0;
+   if (b1 < 0) b1 = 0;
+
+   *r = r1 ;
+   *g = g1 ;
+   *b = b1 ;
+}
+
+static void reference_rgb24(const unsigned char *pptr, unsigned char *out, int size)
+{
+    int i, newi;
+
+    for(i=0, newi=0; i<size; i=i+4, newi=newi+6)
+    {
+        yuv2rgb(pptr[i], pptr[i+1], pptr[i+3], &out[newi], &out[newi+1], &out[newi+2]);
+        yuv2rgb(pptr[i+2], pptr[i+1], pptr[i+3], &out[newi+3], &out[newi+4], &out[newi+5]);
+    }
+}
+
+static void reference_y8(const unsigned char *pptr, unsigned char *out, int size)
+{
+    int i, newi;
+
+    for(i=0, newi=0; i<size; i=i+4, newi=newi+2)
+    {
+        out[newi]=pptr[i];
+        out[newi+1]=pptr[i+2];
+    }
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static int compare(const char *what, int isa, const unsigned char *ref, const unsigned char *out, int n)
+{
+    int i;
+
+    for(i=0; i<n; i++)
+    {
+        if(ref[i] != out[i])
+        {
+            printf("%-7s %-6s MISMATCH at byte %d: expected %d got %d\n",
+                   yuv_isa_name(isa), what, i, ref[i], out[i]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int width=1280, height=960, iterations=200;
+    int npixels, isa, iter, i, failed=0;
+    unsigned char *sweep, *frame, *ref, *ref_y8, *out;
+    int sweep_pixels = (1 << 24) * 2;   // one macropixel per (Y, U, V), Y1 = Y0 + 1
+    double start, elapsed, ref_rgb_mps=0.0, ref_y8_mps=0.0;
+
+    if(argc > 3)
+    {
+        width=atoi(argv[1]); height=atoi(argv[2]); iterations=atoi(argv[3]);
+    }
+
+    npixels = width*height;
+
+    sweep = malloc((size_t)sweep_pixels * 2);
+    frame = malloc((size_t)npixels * 2);
+    ref = malloc((size_t)sweep_pixels * 3);
+    ref_y8 = malloc((size_t)sweep_pixels);
+    out = malloc((size_t)sweep_pixels * 3);
+
+    if(!sweep || !frame || !ref || !ref_y8 || !out)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for(i=0; i < (1 << 24); i++)
+    {
+        sweep[4*i+0] = (i >> 16) & 0xff;    // Y0
+        sweep[4*i+1] = (i >> 8) & 0xff;     // U
+        sweep[4*i+2] = ((i >> 16) + 1) & 0xff;  // Y1
+        sweep[4*i+3] = i & 0xff;            // V
+    }
+
+    srandom(5763);
+    for(i=0; i < npixels*2; i++)
+        frame[i] = random() & 0xff;
+
+    printf("%dx%d YUYV, %d iterations\n\n", width, height, iterations);
+
+    // reference timing, the per-pixel yuv2rgb() calls being replaced
+    start = now_sec();
+    for(iter=0; iter<iterations; iter++)
+        reference_rgb24(frame, out, npixels*2);
+    ref_rgb_mps = ((double)npixels * iterations) / (now_sec() - start) / 1.0e6;
+
+    start = now_sec();
+    for(iter=0; iter<iterations; iter++)
+        reference_y8(frame, out, npixels*2);
+    ref_y8_mps = ((double)npixels * iterations) / (now_sec() - start) / 1.0e6;
+
+    printf("%-7s %-6s %10.1lf MPix/s\n", "yuv2rgb", "rgb24", ref_rgb_mps);
+    printf("%-7s %-6s %10.1lf MPix/s\n", "yuv2rgb", "y8", ref_y8_mps);
+
+    reference_rgb24(sweep, ref, sweep_pixels*2);
+    reference_y8(sweep, ref_y8, sweep_pixels*2);
+
+    for(isa=0; isa<YUV_ISA_COUNT; isa++)
+    {
+        if(yuv_convert_select(isa) != 0)
+        {
+            printf("%-7s not supported\n", yuv_isa_name(isa));
+            continue;
+        }
+
+        // exhaustive check, then a length that is not a multiple of the vector width
+        memset(out, 0, (size_t)sweep_pixels * 3);
+        yuyv_to_rgb24(sweep, out, sweep_pixels);
+        failed |= compare("rgb24", isa, ref, out, sweep_pixels * 3);
+
+        yuyv_to_rgb24(sweep, out, 46);
+        failed |= compare("rgb24", isa, ref, out, 46 * 3);
+
+        yuyv_to_y8(sweep, out, sweep_pixels);
+        failed |= compare("y8", isa, ref_y8, out, sweep_pixels);
+
+        yuyv_to_y8(sweep, out, 46);
+        failed |= compare("y8", isa, ref_y8, out, 46);
+
+        start = now_sec();
+        for(iter=0; iter<iterations; iter++)
+            yuyv_to_rgb24(frame, out, npixels);
+        elapsed = now_sec() - start;
+        printf("%-7s %-6s %10.1lf MPix/s  %6.2lfx\n", yuv_isa_name(isa), "rgb24",
+               ((double)npixels * iterations) / elapsed / 1.0e6,
+               ((double)npixels * iterations) / elapsed / 1.0e6 / ref_rgb_mps);
+
+        start = now_sec();
+        for(iter=0; iter<iterations; iter++)
+            yuyv_to_y8(frame, out, npixels);
+        elapsed = now_sec() - start;
+        printf("%-7s %-6s %10.1lf MPix/s  %6.2lfx\n", yuv_isa_name(isa), "y8",
+               ((double)npixels * iterations) / elapsed / 1.0e6,
+               ((double)npixels * iterations) / elapsed / 1.0e6 / ref_y8_mps);
+    }
+
+    printf("\n%s\n", failed ? "FAILED bit-exact check" : "all kernels bit-exact with yuv2rgb()");
+
+    free(sweep); free(frame); free(ref); free(ref_y8); free(out);
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
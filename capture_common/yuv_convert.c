@@ -0,0 +1,430 @@
+/*
+ *  YUYV to RGB24 / Y8 conversion kernels with run time dispatch
+ *
+ *  All kernels compute the same 32-bit fixed point sums as yuv2rgb() and clip
+ *  with saturating packs instead of branches, so output is bit-exact with the
+ *  scalar code.  Vector kernels convert whole blocks and finish any remaining
+ *  pixels with the scalar kernel.
+ */
+#include <stddef.h>
+
+#include "yuv_convert.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define YUV_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define YUV_NEON
+#include <arm_neon.h>
+#endif
+
+
+static inline unsigned char clip8(int x)
+{
+    if (x > 255) x = 255;
+    if (x < 0) x = 0;
+
+    return (unsigned char)x;
+}
+
+static void rgb24_scalar(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    int i;
+
+    for(i=0; i < (npixels & ~1); i+=2, src+=4, dst+=6)
+    {
+        int c0 = src[0] - 16, d = src[1] - 128, c1 = src[2] - 16, e = src[3] - 128;
+
+        dst[0] = clip8((298 * c0           + 409 * e + 128) >> 8);
+        dst[1] = clip8((298 * c0 - 100 * d - 208 * e + 128) >> 8);
+        dst[2] = clip8((298 * c0 + 516 * d           + 128) >> 8);
+        dst[3] = clip8((298 * c1           + 409 * e + 128) >> 8);
+        dst[4] = clip8((298 * c1 - 100 * d - 208 * e + 128) >> 8);
+        dst[5] = clip8((298 * c1 + 516 * d           + 128) >> 8);
+    }
+}
+
+static void y8_scalar(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    int i;
+
+    for(i=0; i < npixels; i++)
+        dst[i] = src[2*i];
+}
+
+
+#if defined(YUV_X86)
+
+// Shuffle masks that interleave 16 R, 16 G and 16 B bytes into 48 bytes of RGB24
+static const signed char rgb_mask[3][3][16] __attribute__((aligned(16))) =
+{
+    {
+        { 0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1,  5},
+        {-1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1, -1},
+        {-1, -1,  0, -1, -1,  1, -1, -1,  2, -1, -1,  3, -1, -1,  4, -1}
+    },
+    {
+        {-1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10, -1},
+        { 5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1, 10},
+        {-1,  5, -1, -1,  6, -1, -1,  7, -1, -1,  8, -1, -1,  9, -1, -1}
+    },
+    {
+        {-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1},
+        {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1},
+        {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}
+    }
+};
+
+__attribute__((target("ssse3")))
+static inline void store_rgb48_ssse3(unsigned char *dst, __m128i r, __m128i g, __m128i b)
+{
+    int k;
+
+    for(k=0; k<3; k++)
+    {
+        __m128i out = _mm_or_si128(
+                          _mm_or_si128(_mm_shuffle_epi8(r, _mm_load_si128((const __m128i *)rgb_mask[k][0])),
+                                       _mm_shuffle_epi8(g, _mm_load_si128((const __m128i *)rgb_mask[k][1]))),
+                          _mm_shuffle_epi8(b, _mm_load_si128((const __m128i *)rgb_mask[k][2])));
+        _mm_storeu_si128((__m128i *)(dst + 16*k), out);
+    }
+}
+
+// Convert 8 pixels (16 bytes of YUYV) to R, G and B as 8 x int16, unclipped
+// beyond the int16 saturation that packs applies.
+//
+// pmaddwd does two 16x16 multiplies and the 32-bit add in one instruction, so
+// each channel is a dot product of interleaved (C,D) / (C,E) / (E,1) pairs.
+__attribute__((target("ssse3")))
+static inline void yuyv8_ssse3(__m128i v, __m128i *r, __m128i *g, __m128i *b)
+{
+    const __m128i lomask = _mm_set1_epi16(0x00ff);
+    const __m128i k16    = _mm_set1_epi16(16);
+    const __m128i k128   = _mm_set1_epi16(128);
+    const __m128i one    = _mm_set1_epi16(1);
+    const __m128i r32    = _mm_set1_epi32(128);
+    const __m128i kCE_R  = _mm_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409);
+    const __m128i kCD_G  = _mm_setr_epi16(298, -100, 298, -100, 298, -100, 298, -100);
+    const __m128i kE1_G  = _mm_setr_epi16(-208, 128, -208, 128, -208, 128, -208, 128);
+    const __m128i kCD_B  = _mm_setr_epi16(298, 516, 298, 516, 298, 516, 298, 516);
+    __m128i y, uv, u, w, c, d, e, lo, hi;
+
+    y  = _mm_and_si128(v, lomask);              // Y0 Y1 Y2 ... Y7
+    uv = _mm_srli_epi16(v, 8);                  // U0 V0 U1 V1 ... U3 V3
+    u  = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,2,0,0));
+    w  = _mm_shufflehi_epi16(_mm_shufflelo_epi16(uv, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+
+    c = _mm_sub_epi16(y, k16);
+    d = _mm_sub_epi16(u, k128);
+    e = _mm_sub_epi16(w, k128);
+
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, e), kCE_R), r32);
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, e), kCE_R), r32);
+    *r = _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, d), kCD_G),
+                       _mm_madd_epi16(_mm_unpacklo_epi16(e, one), kE1_G));
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, d), kCD_G),
+                       _mm_madd_epi16(_mm_unpackhi_epi16(e, one), kE1_G));
+    *g = _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+
+    lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(c, d), kCD_B), r32);
+    hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(c, d), kCD_B), r32);
+    *b = _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+}
+
+__attribute__((target("ssse3")))
+static void rgb24_ssse3(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    int i;
+    __m128i ra, ga, ba, rb, gb, bb;
+
+    for(i=0; i + 16 <= npixels; i+=16, src+=32, dst+=48)
+    {
+        yuyv8_ssse3(_mm_loadu_si128((const __m128i *)src), &ra, &ga, &ba);
+        yuyv8_ssse3(_mm_loadu_si128((const __m128i *)(src + 16)), &rb, &gb, &bb);
+
+        store_rgb48_ssse3(dst, _mm_packus_epi16(ra, rb), _mm_packus_epi16(ga, gb), _mm_packus_epi16(ba, bb));
+    }
+
+    rgb24_scalar(src, dst, npixels - i);
+}
+
+__attribute__((target("ssse3")))
+static void y8_ssse3(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    const __m128i lomask = _mm_set1_epi16(0x00ff);
+    int i;
+
+    for(i=0; i + 16 <= npixels; i+=16, src+=32, dst+=16)
+    {
+        __m128i a = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), lomask);
+        __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *)(src + 16)), lomask);
+
+        _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(a, b));
+    }
+
+    y8_scalar(src, dst, npixels - i);
+}
+
+
+// AVX2 does the same arithmetic on two 128-bit lanes at once.  All of the
+// operations used are lane local, so each lane holds 8 consecutive pixels
+// exactly as in the SSSE3 kernel.
+__attribute__((target("avx2")))
+static inline void yuyv16_avx2(__m256i v, __m256i *r, __m256i *g, __m256i *b)
+{
+    const __m256i lomask = _mm256_set1_epi16(0x00ff);
+    const __m256i k16    = _mm256_set1_epi16(16);
+    const __m256i k128   = _mm256_set1_epi16(128);
+    const __m256i one    = _mm256_set1_epi16(1);
+    const __m256i r32    = _mm256_set1_epi32(128);
+    const __m256i kCE_R  = _mm256_setr_epi16(298, 409, 298, 409, 298, 409, 298, 409,
+                                             298, 409, 298, 409, 298, 409, 298, 409);
+    const __m256i kCD_G  = _mm256_setr_epi16(298, -100, 298, -100, 298, -100, 298, -100,
+                                             298, -100, 298, -100, 298, -100, 298, -100);
+    const __m256i kE1_G  = _mm256_setr_epi16(-208, 128, -208, 128, -208, 128, -208, 128,
+                                             -208, 128, -208, 128, -208, 128, -208, 128);
+    const __m256i kCD_B  = _mm256_setr_epi16(298, 516, 298, 516, 298, 516, 298, 516,
+                                             298, 516, 298, 516, 298, 516, 298, 516);
+    __m256i y, uv, u, w, c, d, e, lo, hi;
+
+    y  = _mm256_and_si256(v, lomask);
+    uv = _mm256_srli_epi16(v, 8);
+    u  = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(2,2,0,0)), _MM_SHUFFLE(2,2,0,0));
+    w  = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(uv, _MM_SHUFFLE(3,3,1,1)), _MM_SHUFFLE(3,3,1,1));
+
+    c = _mm256_sub_epi16(y, k16);
+    d = _mm256_sub_epi16(u, k128);
+    e = _mm256_sub_epi16(w, k128);
+
+    lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(c, e), kCE_R), r32);
+    hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(c, e), kCE_R), r32);
+    *r = _mm256_packs_epi32(_mm256_srai_epi32(lo, 8), _mm256_srai_epi32(hi, 8));
+
+    lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(c, d), kCD_G),
+                          _mm256_madd_epi16(_mm256_unpacklo_epi16(e, one), kE1_G));
+    hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(c, d), kCD_G),
+                          _mm256_madd_epi16(_mm256_unpackhi_epi16(e, one), kE1_G));
+    *g = _mm256_packs_epi32(_mm256_srai_epi32(lo, 8), _mm256_srai_epi32(hi, 8));
+
+    lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(c, d), kCD_B), r32);
+    hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(c, d), kCD_B), r32);
+    *b = _mm256_packs_epi32(_mm256_srai_epi32(lo, 8), _mm256_srai_epi32(hi, 8));
+}
+
+// packus interleaves the two sources by lane, put the four 8 pixel runs back in order
+__attribute__((target("avx2")))
+static inline __m256i pack_ordered_avx2(__m256i a, __m256i b)
+{
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3,1,2,0));
+}
+
+__attribute__((target("avx2")))
+static void rgb24_avx2(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    int i;
+    __m256i ra, ga, ba, rb, gb, bb, r, g, b;
+
+    for(i=0; i + 32 <= npixels; i+=32, src+=64, dst+=96)
+    {
+        yuyv16_avx2(_mm256_loadu_si256((const __m256i *)src), &ra, &ga, &ba);
+        yuyv16_avx2(_mm256_loadu_si256((const __m256i *)(src + 32)), &rb, &gb, &bb);
+
+        r = pack_ordered_avx2(ra, rb);
+        g = pack_ordered_avx2(ga, gb);
+        b = pack_ordered_avx2(ba, bb);
+
+        store_rgb48_ssse3(dst, _mm256_castsi256_si128(r), _mm256_castsi256_si128(g), _mm256_castsi256_si128(b));
+        store_rgb48_ssse3(dst + 48, _mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1),
+                          _mm256_extracti128_si256(b, 1));
+    }
+
+    rgb24_ssse3(src, dst, npixels - i);
+}
+
+__attribute__((target("avx2")))
+static void y8_avx2(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    const __m256i lomask = _mm256_set1_epi16(0x00ff);
+    int i;
+
+    for(i=0; i + 32 <= npixels; i+=32, src+=64, dst+=32)
+    {
+        __m256i a = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)src), lomask);
+        __m256i b = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(src + 32)), lomask);
+
+        _mm256_storeu_si256((__m256i *)dst, pack_ordered_avx2(a, b));
+    }
+
+    y8_ssse3(src, dst, npixels - i);
+}
+
+#endif
+
+
+#if defined(YUV_NEON)
+
+static inline uint8x8_t neon_pack(int32x4_t lo, int32x4_t hi)
+{
+    return vqmovun_s16(vcombine_s16(vqmovn_s32(vshrq_n_s32(lo, 8)), vqmovn_s32(vshrq_n_s32(hi, 8))));
+}
+
+// 8 macropixels in, 16 RGB24 pixels out.  The chroma terms are shared by the
+// two luma samples of each macropixel, so they are computed once.
+static inline void yuyv16_neon(uint8x8_t y0, uint8x8_t u, uint8x8_t y1, uint8x8_t v, unsigned char *dst)
+{
+    const uint8x8_t  k16  = vdup_n_u8(16);
+    const uint8x8_t  k128 = vdup_n_u8(128);
+    const int32x4_t  r32  = vdupq_n_s32(128);
+    int16x8_t c0 = vreinterpretq_s16_u16(vsubl_u8(y0, k16));
+    int16x8_t c1 = vreinterpretq_s16_u16(vsubl_u8(y1, k16));
+    int16x8_t d  = vreinterpretq_s16_u16(vsubl_u8(u, k128));
+    int16x8_t e  = vreinterpretq_s16_u16(vsubl_u8(v, k128));
+    int32x4_t rv_lo, rv_hi, gu_lo, gu_hi, bu_lo, bu_hi;
+    int32x4_t y0_lo, y0_hi, y1_lo, y1_hi;
+    uint8x8x2_t r, g, b;
+    uint8x8x3_t rgb;
+
+    rv_lo = vmlal_n_s16(r32, vget_low_s16(e), 409);
+    rv_hi = vmlal_n_s16(r32, vget_high_s16(e), 409);
+    gu_lo = vmlal_n_s16(vmlal_n_s16(r32, vget_low_s16(d), -100), vget_low_s16(e), -208);
+    gu_hi = vmlal_n_s16(vmlal_n_s16(r32, vget_high_s16(d), -100), vget_high_s16(e), -208);
+    bu_lo = vmlal_n_s16(r32, vget_low_s16(d), 516);
+    bu_hi = vmlal_n_s16(r32, vget_high_s16(d), 516);
+
+    y0_lo = vmull_n_s16(vget_low_s16(c0), 298);
+    y0_hi = vmull_n_s16(vget_high_s16(c0), 298);
+    y1_lo = vmull_n_s16(vget_low_s16(c1), 298);
+    y1_hi = vmull_n_s16(vget_high_s16(c1), 298);
+
+    // even and odd pixels, zipped back into pixel order
+    r = vzip_u8(neon_pack(vaddq_s32(y0_lo, rv_lo), vaddq_s32(y0_hi, rv_hi)),
+                neon_pack(vaddq_s32(y1_lo, rv_lo), vaddq_s32(y1_hi, rv_hi)));
+    g = vzip_u8(neon_pack(vaddq_s32(y0_lo, gu_lo), vaddq_s32(y0_hi, gu_hi)),
+                neon_pack(vaddq_s32(y1_lo, gu_lo), vaddq_s32(y1_hi, gu_hi)));
+    b = vzip_u8(neon_pack(vaddq_s32(y0_lo, bu_lo), vaddq_s32(y0_hi, bu_hi)),
+                neon_pack(vaddq_s32(y1_lo, bu_lo), vaddq_s32(y1_hi, bu_hi)));
+
+    rgb.val[0] = r.val[0]; rgb.val[1] = g.val[0]; rgb.val[2] = b.val[0];
+    vst3_u8(dst, rgb);
+    rgb.val[0] = r.val[1]; rgb.val[1] = g.val[1]; rgb.val[2] = b.val[1];
+    vst3_u8(dst + 24, rgb);
+}
+
+static void rgb24_neon(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    int i;
+
+    for(i=0; i + 32 <= npixels; i+=32, src+=64, dst+=96)
+    {
+        uint8x16x4_t in = vld4q_u8(src);    // Y0, U, Y1, V planes of 16 macropixels
+
+        yuyv16_neon(vget_low_u8(in.val[0]), vget_low_u8(in.val[1]),
+                    vget_low_u8(in.val[2]), vget_low_u8(in.val[3]), dst);
+        yuyv16_neon(vget_high_u8(in.val[0]), vget_high_u8(in.val[1]),
+                    vget_high_u8(in.val[2]), vget_high_u8(in.val[3]), dst + 48);
+    }
+
+    rgb24_scalar(src, dst, npixels - i);
+}
+
+static void y8_neon(const unsigned char *src, unsigned char *dst, int npixels)
+{
+    int i;
+
+    for(i=0; i + 16 <= npixels; i+=16, src+=32, dst+=16)
+        vst1q_u8(dst, vld2q_u8(src).val[0]);
+
+    y8_scalar(src, dst, npixels - i);
+}
+
+#endif
+
+
+typedef void (*convert_fn)(const unsigned char *src, unsigned char *dst, int npixels);
+
+static const struct
+{
+    const char *name;
+    convert_fn  rgb24;
+    convert_fn  y8;
+} kernels[YUV_ISA_COUNT] =
+{
+    { "scalar", rgb24_scalar, y8_scalar },
+#if defined(YUV_X86)
+    { "ssse3",  rgb24_ssse3,  y8_ssse3 },
+    { "avx2",   rgb24_avx2,   y8_avx2 },
+#else
+    { "ssse3",  NULL, NULL },
+    { "avx2",   NULL, NULL },
+#endif
+#if defined(YUV_NEON)
+    { "neon",   rgb24_neon,   y8_neon }
+#else
+    { "neon",   NULL, NULL }
+#endif
+};
+
+static int selected_isa = -1;
+
+
+int yuv_isa_supported(int isa)
+{
+    if((isa < 0) || (isa >= YUV_ISA_COUNT) || !kernels[isa].rgb24)
+        return 0;
+
+#if defined(YUV_X86)
+    __builtin_cpu_init();
+    if(isa == YUV_ISA_SSSE3) return __builtin_cpu_supports("ssse3");
+    if(isa == YUV_ISA_AVX2)  return __builtin_cpu_supports("avx2");
+#endif
+
+    return 1;
+}
+
+int yuv_convert_select(int isa)
+{
+    if(!yuv_isa_supported(isa))
+        return -1;
+
+    selected_isa = isa;
+    return 0;
+}
+
+int yuv_convert_isa(void)
+{
+    int isa;
+
+    // benign race, every thread resolves the same answer
+    if(selected_isa < 0)
+    {
+        for(isa = YUV_ISA_COUNT - 1; isa > YUV_ISA_SCALAR; isa--)
+            if(yuv_isa_supported(isa))
+                break;
+
+        selected_isa = isa;
+    }
+
+    return selected_isa;
+}
+
+const char *yuv_isa_name(int isa)
+{
+    if((isa < 0) || (isa >= YUV_ISA_COUNT))
+        return "unknown";
+
+    return kernels[isa].name;
+}
+
+void yuyv_to_rgb24(const unsigned char *yuyv, unsigned char *rgb, int npixels)
+{
+    kernels[yuv_convert_isa()].rgb24(yuyv, rgb, npixels);
+}
+
+void yuyv_to_y8(const unsigned char *yuyv, unsigned char *y, int npixels)
+{
+    kernels[yuv_convert_isa()].y8(yuyv, y, npixels);
+}
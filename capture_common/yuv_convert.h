@@ -0,0 +1,51 @@
+/*
+ *  YUYV (YUV 4:2:2) to RGB24 and Y8 conversion kernels
+ *
+ *  Fixed point conversion bit-exact with the yuv2rgb() function used by the
+ *  capture examples:
+ *
+ *    C = Y - 16, D = U - 128, E = V - 128
+ *    R = clip((298*C           + 409*E + 128) >> 8)
+ *    G = clip((298*C - 100*D - 208*E + 128) >> 8)
+ *    B = clip((298*C + 516*D           + 128) >> 8)
+ *
+ *  yuyv_to_rgb24() and yuyv_to_y8() dispatch at run time to the fastest kernel
+ *  the CPU supports (AVX2 or SSSE3 on x86, NEON on ARM, scalar otherwise).
+ *  yuv_convert_select() forces a particular kernel, e.g. for benchmarking.
+ */
+#ifndef YUV_CONVERT_H
+#define YUV_CONVERT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum yuv_isa
+{
+    YUV_ISA_SCALAR,
+    YUV_ISA_SSSE3,
+    YUV_ISA_AVX2,
+    YUV_ISA_NEON,
+    YUV_ISA_COUNT
+};
+
+// npixels is the number of output pixels, 2 per 4 byte YUYV macropixel
+void yuyv_to_rgb24(const unsigned char *yuyv, unsigned char *rgb, int npixels);
+void yuyv_to_y8(const unsigned char *yuyv, unsigned char *y, int npixels);
+
+// returns non-zero when the kernel can run on this CPU
+int yuv_isa_supported(int isa);
+
+// returns 0 and selects isa, or -1 if it is not supported
+int yuv_convert_select(int isa);
+
+// currently selected kernel, resolving the default on first use
+int yuv_convert_isa(void);
+
+const char *yuv_isa_name(int isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
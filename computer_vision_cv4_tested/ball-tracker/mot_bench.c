@@ -0,0 +1,183 @@
+/*
+ *  mot_bench - the multi-object tracker on synthetic targets
+ *
+ *  Targets move at constant velocity with a little random acceleration in a
+ *  1920x1080 frame, bouncing off the edges, so tracks cross each other.
+ *  Each frame a target is detected with probability pd at its position
+ *  plus noise, and clutter detections are scattered uniformly.
+ *
+ *  Reports the time per mot_update(), how often a target was covered by a
+ *  confirmed track, and the id switches: a target's detection taken by a
+ *  confirmed track other than the one that had it last.
+ *
+ *  Usage: mot_bench [targets [frames [pd [clutter [noise]]]]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "mot_tracker.h"
+
+#define FRAME_W (1920.0f)
+#define FRAME_H (1080.0f)
+#define BOX (24.0f)
+
+static unsigned int rng;
+
+static float uniform(void)
+{
+    rng = rng * 1664525u + 1013904223u;
+    return (rng >> 8) * (1.0f / 16777216.0f);
+}
+
+static float gaussian(void)
+{
+    float u = uniform() + 1e-7f, v = uniform();
+
+    return sqrtf(-2.0f * logf(u)) * cosf(6.2831853f * v);
+}
+
+static double now_ms(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    int targets = (argc > 1) ? atoi(argv[1]) : 200;
+    int frames = (argc > 2) ? atoi(argv[2]) : 1000;
+    float pd = (argc > 3) ? atof(argv[3]) : 0.9f;
+    int clutter = (argc > 4) ? atoi(argv[4]) : 20;
+    float noise = (argc > 5) ? atof(argv[5]) : 2.0f;
+    struct mot_config cfg;
+    struct mot_tracker *tracker;
+    const struct mot_tracks *tracks;
+    struct mot_detection *det;
+    float *tx, *ty, *tvx, *tvy;
+    int *source, *last_id, *det_id;
+    long switches = 0, covered = 0, present = 0;
+    double start, ms, ms_max = 0.0, ms_sum = 0.0;
+    int f, i, k, n, ntracks = 0, confirmed;
+
+    if((targets <= 0) || (frames <= 0) || (clutter < 0))
+    {
+        printf("Usage: mot_bench [targets [frames [pd [clutter [noise]]]]]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    mot_defaults(&cfg);
+    cfg.max_tracks = 2 * (targets + clutter);
+    cfg.max_detections = targets + clutter;
+    cfg.meas_noise = noise * noise;
+
+    tx = malloc(targets * sizeof(float));
+    ty = malloc(targets * sizeof(float));
+    tvx = malloc(targets * sizeof(float));
+    tvy = malloc(targets * sizeof(float));
+    last_id = calloc(targets, sizeof(int));
+    det = malloc((targets + clutter) * sizeof(struct mot_detection));
+    source = malloc((targets + clutter) * sizeof(int));
+    det_id = malloc((targets + clutter) * sizeof(int));
+
+    if(!tx || !ty || !tvx || !tvy || !last_id || !det || !source || !det_id || !(tracker = mot_open(&cfg)))
+    {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    rng = 12345;
+    for(k=0; k < targets; k++)
+    {
+        tx[k] = uniform() * FRAME_W;
+        ty[k] = uniform() * FRAME_H;
+        tvx[k] = 8.0f * (uniform() - 0.5f) * 2.0f;
+        tvy[k] = 8.0f * (uniform() - 0.5f) * 2.0f;
+    }
+
+    for(f=0; f < frames; f++)
+    {
+        // move the targets, then detect them
+        n = 0;
+        for(k=0; k < targets; k++)
+        {
+            tvx[k] += 0.2f * gaussian();
+            tvy[k] += 0.2f * gaussian();
+            tx[k] += tvx[k];
+            ty[k] += tvy[k];
+            if((tx[k] < 0.0f) || (tx[k] > FRAME_W)) { tvx[k] = -tvx[k]; tx[k] += 2.0f * tvx[k]; }
+            if((ty[k] < 0.0f) || (ty[k] > FRAME_H)) { tvy[k] = -tvy[k]; ty[k] += 2.0f * tvy[k]; }
+
+            if(uniform() < pd)
+            {
+                det[n].x = tx[k] + noise * gaussian();
+                det[n].y = ty[k] + noise * gaussian();
+                det[n].w = det[n].h = BOX;
+                source[n++] = k;
+            }
+        }
+        for(i=0; i < clutter; i++)
+        {
+            det[n].x = uniform() * FRAME_W;
+            det[n].y = uniform() * FRAME_H;
+            det[n].w = det[n].h = BOX;
+            source[n++] = -1;
+        }
+
+        start = now_ms();
+        ntracks = mot_update(tracker, det, n);
+        ms = now_ms() - start;
+        ms_sum += ms;
+        if(ms > ms_max)
+            ms_max = ms;
+
+        // which confirmed track took each detection
+        tracks = mot_get_tracks(tracker);
+        for(i=0; i < n; i++)
+            det_id[i] = 0;
+        for(i=0; i < ntracks; i++)
+            if((tracks->detection[i] >= 0) && mot_confirmed(tracker, i))
+                det_id[tracks->detection[i]] = tracks->id[i];
+
+        for(i=0; i < n; i++)
+        {
+            if((k = source[i]) < 0)
+                continue;
+
+            present++;
+            if(!det_id[i])
+                continue;
+
+            covered++;
+            if(last_id[k] && (last_id[k] != det_id[i]))
+                switches++;
+            last_id[k] = det_id[i];
+        }
+    }
+
+    tracks = mot_get_tracks(tracker);
+    for(i=0, confirmed=0; i < ntracks; i++)
+        confirmed += mot_confirmed(tracker, i);
+
+    printf("%d targets, %d frames, pd %.2f, %d clutter per frame, noise %.1f px\n", targets, frames, pd, clutter,
+           noise);
+    printf("mot_update: avg %.3lf ms, max %.3lf ms\n", ms_sum / frames, ms_max);
+    printf("detections covered by a confirmed track %.2lf%%, id switches %ld (%.4lf per target per 100 frames)\n",
+           100.0 * covered / (present ? present : 1), switches, 100.0 * switches / ((double)targets * frames));
+    printf("tracks at the end %d, confirmed %d\n", ntracks, confirmed);
+
+    mot_close(tracker);
+    free(tx);
+    free(ty);
+    free(tvx);
+    free(tvy);
+    free(last_id);
+    free(det);
+    free(source);
+    free(det_id);
+
+    return 0;
+}
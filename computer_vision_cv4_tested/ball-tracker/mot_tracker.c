@@ -0,0 +1,384 @@
+/*
+ *  Multi-object tracker, see mot_tracker.h
+ *
+ *  Per axis, with dt = 1 frame and white noise acceleration of variance q:
+ *
+ *    F = | 1 1 |    Q = q | 1/4 1/2 |    H = | 1 0 |    R = r
+ *        | 0 1 |          | 1/2  1  |
+ *
+ *  predict   x += vx
+ *            P = F P F' + Q
+ *  correct   s = p00 + r, k0 = p00 / s, k1 = p01 / s, e = z - x
+ *            x += k0 e, vx += k1 e
+ *            p11 -= k1 p01, p01 *= 1 - k0, p00 *= 1 - k0
+ *
+ *  The Mahalanobis distance of a detection is (ex^2 + ey^2) / s, and pairs
+ *  are ranked by that plus 2 ln s, the negative log likelihood, so an
+ *  uncertain track does not take detections from a certain one just by
+ *  having the wider gate.
+ *
+ *  A bounce puts the detection 2 |v| off the prediction, far outside the
+ *  gate of a settled track.  So a second, greedy pass offers the detections
+ *  nobody took to the confirmed tracks nobody matched, within the gate
+ *  radius plus 2 |v|; a track that takes one restarts its filter there,
+ *  as a new track would, but keeps its id.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "mot_tracker.h"
+
+// weight of a new box size in the smoothed one
+#define SIZE_ALPHA (0.3f)
+
+struct mot_pair
+{
+    float cost;
+    int   track;
+    int   detection;
+};
+
+struct mot_tracker
+{
+    struct mot_config cfg;
+    struct mot_tracks tracks;
+    int               next_id;
+
+    // per frame scratch, allocated once
+    struct mot_pair  *pairs;            // max_tracks * max_detections
+    int              *det_track;        // max_detections
+    int              *restart;          // max_tracks
+};
+
+
+void mot_defaults(struct mot_config *cfg)
+{
+    cfg->max_tracks = 512;
+    cfg->max_detections = 512;
+    cfg->accel_noise = 1.0f;
+    cfg->meas_noise = 4.0f;
+    cfg->init_speed = 10.0f;
+    cfg->gate = 9.21f;
+    cfg->confirm_hits = 3;
+    cfg->max_misses = 10;
+}
+
+struct mot_tracker *mot_open(const struct mot_config *cfg)
+{
+    struct mot_tracker *t;
+    struct mot_tracks *s;
+    size_t n;
+
+    if((cfg->max_tracks <= 0) || (cfg->max_detections <= 0) || (cfg->meas_noise <= 0.0f))
+        return NULL;
+
+    if(!(t = calloc(1, sizeof(*t))))
+        return NULL;
+
+    t->cfg = *cfg;
+    t->next_id = 1;
+    s = &t->tracks;
+    n = cfg->max_tracks;
+
+    s->id = malloc(n * sizeof(int));
+    s->hits = malloc(n * sizeof(int));
+    s->misses = malloc(n * sizeof(int));
+    s->detection = malloc(n * sizeof(int));
+    s->x = malloc(n * sizeof(float));
+    s->y = malloc(n * sizeof(float));
+    s->vx = malloc(n * sizeof(float));
+    s->vy = malloc(n * sizeof(float));
+    s->w = malloc(n * sizeof(float));
+    s->h = malloc(n * sizeof(float));
+    s->p00 = malloc(n * sizeof(float));
+    s->p01 = malloc(n * sizeof(float));
+    s->p11 = malloc(n * sizeof(float));
+    t->pairs = malloc(n * cfg->max_detections * sizeof(struct mot_pair));
+    t->det_track = malloc(cfg->max_detections * sizeof(int));
+    t->restart = malloc(n * sizeof(int));
+
+    if(!s->id || !s->hits || !s->misses || !s->detection || !s->x || !s->y || !s->vx || !s->vy || !s->w ||
+       !s->h || !s->p00 || !s->p01 || !s->p11 || !t->pairs || !t->det_track ||
+       !t->restart)
+    {
+        mot_close(t);
+        return NULL;
+    }
+
+    return t;
+}
+
+void mot_close(struct mot_tracker *t)
+{
+    struct mot_tracks *s;
+
+    if(!t)
+        return;
+
+    s = &t->tracks;
+    free(s->id);
+    free(s->hits);
+    free(s->misses);
+    free(s->detection);
+    free(s->x);
+    free(s->y);
+    free(s->vx);
+    free(s->vy);
+    free(s->w);
+    free(s->h);
+    free(s->p00);
+    free(s->p01);
+    free(s->p11);
+    free(t->pairs);
+    free(t->det_track);
+    free(t->restart);
+    free(t);
+}
+
+const struct mot_tracks *mot_get_tracks(struct mot_tracker *t)
+{
+    return &t->tracks;
+}
+
+int mot_confirmed(struct mot_tracker *t, int i)
+{
+    return t->tracks.hits[i] >= t->cfg.confirm_hits;
+}
+
+
+// straight loops over the arrays, which the compiler vectorizes
+static void predict(struct mot_tracks *s, float q)
+{
+    float *restrict x = s->x, *restrict y = s->y, *restrict vx = s->vx, *restrict vy = s->vy;
+    float *restrict p00 = s->p00, *restrict p01 = s->p01, *restrict p11 = s->p11;
+    int i;
+
+    for(i=0; i < s->count; i++)
+    {
+        x[i] += vx[i];
+        y[i] += vy[i];
+        p00[i] += 2.0f * p01[i] + p11[i] + 0.25f * q;
+        p01[i] += p11[i] + 0.5f * q;
+        p11[i] += q;
+    }
+}
+
+static int pair_cost_cmp(const void *a, const void *b)
+{
+    float ca = ((const struct mot_pair *)a)->cost, cb = ((const struct mot_pair *)b)->cost;
+
+    return (ca > cb) - (ca < cb);
+}
+
+// the pair if both ends are still free
+static int take_pair(struct mot_tracker *t, const struct mot_pair *p)
+{
+    struct mot_tracks *s = &t->tracks;
+
+    if((s->detection[p->track] >= 0) || (t->det_track[p->detection] >= 0))
+        return 0;
+
+    s->detection[p->track] = p->detection;
+    t->det_track[p->detection] = p->track;
+    return 1;
+}
+
+// gated pairs, best first, taken while both ends are free, then the
+// leftovers; restart[i] is set for a track that needs its filter restarted
+static void associate(struct mot_tracker *t, const struct mot_detection *det, int n, int *restart)
+{
+    struct mot_tracks *s = &t->tracks;
+    float r = t->cfg.meas_noise, gate = t->cfg.gate, ex, ey, is, d2, ln_s, radius;
+    int i, j, npairs = 0;
+
+    for(i=0; i < s->count; i++)
+    {
+        is = 1.0f / (s->p00[i] + r);
+        ln_s = -2.0f * logf(is);
+        s->detection[i] = -1;
+        restart[i] = 0;
+
+        for(j=0; j < n; j++)
+        {
+            ex = det[j].x - s->x[i];
+            ey = det[j].y - s->y[i];
+            d2 = (ex * ex + ey * ey) * is;
+            if(d2 < gate)
+            {
+                t->pairs[npairs].cost = d2 + ln_s;
+                t->pairs[npairs].track = i;
+                t->pairs[npairs].detection = j;
+                npairs++;
+            }
+        }
+    }
+
+    for(j=0; j < n; j++)
+        t->det_track[j] = -1;
+
+    qsort(t->pairs, npairs, sizeof(struct mot_pair), pair_cost_cmp);
+    for(i=0; i < npairs; i++)
+        take_pair(t, &t->pairs[i]);
+
+    // the leftovers, by distance
+    npairs = 0;
+    for(i=0; i < s->count; i++)
+    {
+        if((s->detection[i] >= 0) || (s->hits[i] < t->cfg.confirm_hits))
+            continue;
+
+        radius = sqrtf(gate * (s->p00[i] + r)) + 2.0f * sqrtf(s->vx[i] * s->vx[i] + s->vy[i] * s->vy[i]);
+        for(j=0; j < n; j++)
+        {
+            if(t->det_track[j] >= 0)
+                continue;
+
+            ex = det[j].x - s->x[i];
+            ey = det[j].y - s->y[i];
+            d2 = ex * ex + ey * ey;
+            if(d2 < radius * radius)
+            {
+                t->pairs[npairs].cost = d2;
+                t->pairs[npairs].track = i;
+                t->pairs[npairs].detection = j;
+                npairs++;
+            }
+        }
+    }
+
+    qsort(t->pairs, npairs, sizeof(struct mot_pair), pair_cost_cmp);
+    for(i=0; i < npairs; i++)
+        if(take_pair(t, &t->pairs[i]))
+            restart[t->pairs[i].track] = 1;
+}
+
+// a filter at the detection, still, with the speed unknown
+static void start_filter(struct mot_tracker *t, int i, const struct mot_detection *d)
+{
+    struct mot_tracks *s = &t->tracks;
+
+    s->x[i] = d->x;
+    s->y[i] = d->y;
+    s->vx[i] = s->vy[i] = 0.0f;
+    s->p00[i] = t->cfg.meas_noise;
+    s->p01[i] = 0.0f;
+    s->p11[i] = t->cfg.init_speed * t->cfg.init_speed;
+}
+
+static void correct(struct mot_tracker *t, const struct mot_detection *det)
+{
+    struct mot_tracks *s = &t->tracks;
+    float r = t->cfg.meas_noise, is, k0, k1, ex, ey;
+    int i;
+
+    for(i=0; i < s->count; i++)
+    {
+        const struct mot_detection *d;
+
+        if(s->detection[i] < 0)
+        {
+            s->misses[i]++;
+            continue;
+        }
+
+        d = &det[s->detection[i]];
+        if(t->restart[i])
+        {
+            start_filter(t, i, d);
+            s->w[i] = d->w;
+            s->h[i] = d->h;
+            s->hits[i]++;
+            s->misses[i] = 0;
+            continue;
+        }
+
+        is = 1.0f / (s->p00[i] + r);
+        k0 = s->p00[i] * is;
+        k1 = s->p01[i] * is;
+        ex = d->x - s->x[i];
+        ey = d->y - s->y[i];
+
+        s->x[i] += k0 * ex;
+        s->y[i] += k0 * ey;
+        s->vx[i] += k1 * ex;
+        s->vy[i] += k1 * ey;
+        s->p11[i] -= k1 * s->p01[i];
+        s->p01[i] *= 1.0f - k0;
+        s->p00[i] *= 1.0f - k0;
+
+        s->w[i] += SIZE_ALPHA * (d->w - s->w[i]);
+        s->h[i] += SIZE_ALPHA * (d->h - s->h[i]);
+        s->hits[i]++;
+        s->misses[i] = 0;
+    }
+}
+
+static void copy_track(struct mot_tracks *s, int to, int from)
+{
+    s->id[to] = s->id[from];
+    s->x[to] = s->x[from];
+    s->y[to] = s->y[from];
+    s->vx[to] = s->vx[from];
+    s->vy[to] = s->vy[from];
+    s->w[to] = s->w[from];
+    s->h[to] = s->h[from];
+    s->p00[to] = s->p00[from];
+    s->p01[to] = s->p01[from];
+    s->p11[to] = s->p11[from];
+    s->hits[to] = s->hits[from];
+    s->misses[to] = s->misses[from];
+    s->detection[to] = s->detection[from];
+}
+
+// drop lost tracks and start new ones from the detections no track took
+static void manage(struct mot_tracker *t, const struct mot_detection *det, int n)
+{
+    struct mot_tracks *s = &t->tracks;
+    int i, j;
+
+    for(i=0; i < s->count; )
+    {
+        int tentative = s->hits[i] < t->cfg.confirm_hits;
+
+        if((s->misses[i] >= t->cfg.max_misses) || (tentative && s->misses[i]))
+        {
+            s->count--;
+            if(i < s->count)
+                copy_track(s, i, s->count);
+        }
+        else
+            i++;
+    }
+
+    for(j=0; (j < n) && (s->count < t->cfg.max_tracks); j++)
+    {
+        if(t->det_track[j] >= 0)
+            continue;
+
+        i = s->count++;
+        s->id[i] = t->next_id++;
+        start_filter(t, i, &det[j]);
+        s->w[i] = det[j].w;
+        s->h[i] = det[j].h;
+        s->hits[i] = 1;
+        s->misses[i] = 0;
+        s->detection[i] = j;
+    }
+}
+
+int mot_update(struct mot_tracker *t, const struct mot_detection *detections, int n)
+{
+    if(n > t->cfg.max_detections)
+        n = t->cfg.max_detections;
+    if(n < 0)
+        n = 0;
+
+    predict(&t->tracks, t->cfg.accel_noise);
+    associate(t, detections, n, t->restart);
+    correct(t, detections);
+    manage(t, detections, n);
+
+    return t->tracks.count;
+}
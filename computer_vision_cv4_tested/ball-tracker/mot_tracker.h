@@ -0,0 +1,85 @@
+/*
+ *  Multi-object tracker for the boxes tracker.cpp finds
+ *
+ *  Every track is a constant velocity Kalman filter on the box centre
+ *  (x, y, vx, vy), with the box size smoothed alongside.  Each frame:
+ *
+ *    predict    every track one frame ahead
+ *    gate       a detection is a candidate for a track when its squared
+ *               Mahalanobis distance to the prediction is below gate
+ *    associate  candidate pairs are taken greedily, best first, each track
+ *               and detection at most once (global nearest neighbour)
+ *    correct    matched tracks with their detection
+ *    manage     unmatched detections start tentative tracks, which are
+ *               confirmed after confirm_hits matches or dropped at the first
+ *               miss; confirmed tracks are dropped after max_misses frames
+ *               without a detection
+ *
+ *  With the same noise on both axes, the x and y filters run the same
+ *  covariance recursion, so one symmetric 2x2 covariance per track serves
+ *  both and the update is a handful of multiplies.  Tracks are kept as
+ *  flat arrays, one per field, dense in [0, count); a dropped track is
+ *  replaced by the last one, so a track's index can change between frames
+ *  but its id never does.  All memory is allocated by mot_open().
+ */
+#ifndef MOT_TRACKER_H
+#define MOT_TRACKER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mot_config
+{
+    int   max_tracks;
+    int   max_detections;       // per frame, more are ignored
+    float accel_noise;          // process noise, variance of the acceleration in pixels/frame^2
+    float meas_noise;           // variance of a detected centre in pixels^2
+    float init_speed;           // deviation of the speed of a new track in pixels/frame
+    float gate;                 // squared Mahalanobis distance, 9.21 keeps 99% of true matches
+    int   confirm_hits;
+    int   max_misses;           // consecutive frames without a detection that drop a confirmed track
+};
+
+struct mot_detection
+{
+    float x, y;                 // box centre
+    float w, h;
+};
+
+// struct of arrays, index i in [0, count) is one track
+struct mot_tracks
+{
+    int    count;
+    int   *id;                  // from 1, never reused
+    float *x, *y, *vx, *vy;     // state after this frame's correction
+    float *w, *h;               // smoothed box size
+    float *p00, *p01, *p11;     // covariance of (position, velocity), per axis
+    int   *hits;                // frames with a detection
+    int   *misses;              // consecutive frames without one
+    int   *detection;           // detection matched this frame, or -1
+};
+
+struct mot_tracker;
+
+// Defaults for boxes from a camera at frame rate
+void mot_defaults(struct mot_config *cfg);
+
+// NULL for bad settings or no memory
+struct mot_tracker *mot_open(const struct mot_config *cfg);
+
+// One frame of n detections.  Returns the number of tracks.
+int mot_update(struct mot_tracker *t, const struct mot_detection *detections, int n);
+
+const struct mot_tracks *mot_get_tracks(struct mot_tracker *t);
+
+// non-zero for a track that has had confirm_hits detections
+int mot_confirmed(struct mot_tracker *t, int i);
+
+void mot_close(struct mot_tracker *t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <algorithm>
 #include <fstream>
 
 #include "opencv2/opencv.hpp"
@@ -11,6 +12,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "mot_tracker.h"
+
 using namespace std;
 using namespace cv;
 
@@ -37,6 +40,12 @@ int currentMotionTrigger = 10;
 
 #define CAM_WIDTH_OFFSET 0
 
+// contours tracked per frame, the largest are kept
+#define MAX_DETECTIONS 256
+
+// show tentative tracks as well as confirmed ones
+//#define SHOW_TENTATIVE
+
 bool running = true;
 
 typedef struct 
@@ -140,6 +149,13 @@ int main (int argc, char * const argv[])
   // Bounding rectangle and contours to visually track target
   Rect boundingR;
   vector<vector<Point> > contours;
+
+  // Tracks linking the contours from frame to frame
+  struct mot_config motConfig;
+  struct mot_tracker *motTracker;
+  const struct mot_tracks *tracks;
+  vector<struct mot_detection> detections;
+  int numberOfDetections, numberOfTracks;
   
   // d1 and d2 for calculating the differences
   // result, the result of and operation, calculated on d1 and d2
@@ -206,6 +222,15 @@ int main (int argc, char * const argv[])
   
   cout << "Image Capture Resolution: " << currentFrame.cols << "x" << currentFrame.rows << endl;
 
+  mot_defaults(&motConfig);
+  motConfig.max_detections = MAX_DETECTIONS;
+  if(!(motTracker = mot_open(&motConfig)))
+  {
+    cout << "Failed to start the tracker" << endl;
+    exit(EXIT_FAILURE);
+  }
+  detections.resize(MAX_DETECTIONS);
+
   // Setup display window	
   namedWindow(WINDOW_NAME, WINDOW_AUTOSIZE | WINDOW_GUI_NORMAL); 
   createTrackbar("Threshold:", WINDOW_NAME, &currentThreshold, MAX_THRESHOLD, NULL);
@@ -243,6 +268,7 @@ int main (int argc, char * const argv[])
     
     result_saved.copyTo(resultTracked);
 
+    numberOfDetections = 0;
     if (motionDetectData.isMotion) 
     {
 
@@ -250,13 +276,45 @@ int main (int argc, char * const argv[])
 
       cout << "Contours: " << contours.size() << endl;
 
-      for( int i = 0; i < contours.size(); i++ ) 
+      // the largest contours when there are more than the tracker takes
+      if(contours.size() > MAX_DETECTIONS)
+        nth_element(contours.begin(), contours.begin() + MAX_DETECTIONS, contours.end(),
+                    [](const vector<Point> &a, const vector<Point> &b) { return a.size() > b.size(); });
+
+      for( int i = 0; (i < contours.size()) && (numberOfDetections < MAX_DETECTIONS); i++ ) 
       {
          boundingR = boundingRect(contours[i]);
-         rectangle(resultTracked, boundingR.tl(), boundingR.br(), Scalar(0, 255, 0), 2, LINE_AA , 0);
+         rectangle(resultTracked, boundingR.tl(), boundingR.br(), Scalar(0, 255, 0), 1, LINE_AA , 0);
+
+         detections[numberOfDetections].x = boundingR.x + 0.5f * boundingR.width;
+         detections[numberOfDetections].y = boundingR.y + 0.5f * boundingR.height;
+         detections[numberOfDetections].w = boundingR.width;
+         detections[numberOfDetections].h = boundingR.height;
+         numberOfDetections++;
       }
     }
 
+    // every frame, so the tracks coast through frames without motion
+    numberOfTracks = mot_update(motTracker, detections.data(), numberOfDetections);
+    tracks = mot_get_tracks(motTracker);
+
+    for( int i = 0; i < numberOfTracks; i++ )
+    {
+#ifndef SHOW_TENTATIVE
+      if(!mot_confirmed(motTracker, i)) continue;
+#endif
+      Point tl(cvRound(tracks->x[i] - 0.5f * tracks->w[i]), cvRound(tracks->y[i] - 0.5f * tracks->h[i]));
+      Point br(cvRound(tracks->x[i] + 0.5f * tracks->w[i]), cvRound(tracks->y[i] + 0.5f * tracks->h[i]));
+      // coasting tracks in yellow, tentative ones in grey
+      Scalar color = !mot_confirmed(motTracker, i) ? Scalar::all(128) :
+                     (tracks->detection[i] < 0) ? Scalar(0, 255, 255) : Scalar(255, 0, 0);
+
+      rectangle(resultTracked, tl, br, color, 2, LINE_AA, 0);
+      drawnStringStream.str("");
+      drawnStringStream << tracks->id[i];
+      putText(resultTracked, drawnStringStream.str(), Point(tl.x, tl.y - 4), FONT_HERSHEY_COMPLEX_SMALL, 1, color, 1, 8);
+    }
+
     
 #ifdef SHOW_DIFF
     cvtColor(d1, d1, COLOR_GRAY2RGB);
@@ -290,6 +348,12 @@ int main (int argc, char * const argv[])
     textOrg.y = 80;
     putText(display, drawnStringStream.str(), textOrg, FONT_HERSHEY_COMPLEX_SMALL, 1, Scalar::all(255), 2, 8);
 
+    drawnStringStream.str("");
+    drawnStringStream << "Tracks: " << numberOfTracks;
+    textOrg.x = 10;
+    textOrg.y = 110;
+    putText(display, drawnStringStream.str(), textOrg, FONT_HERSHEY_COMPLEX_SMALL, 1, Scalar::all(255), 2, 8);
+
     // save detected frames
     if (motionDetectData.isMotion) 
     {
@@ -316,6 +380,7 @@ int main (int argc, char * const argv[])
   }
   
   stream.release();
+  mot_close(motTracker);
   
   return 0;
 }
@@ -0,0 +1,247 @@
+/*
+ *  Fixed size Kalman filter, header only
+ *
+ *  fixed::KalmanFilter<NState, NMeas, T> follows cv::KalmanFilter: the same
+ *  public matrices, set up the same way, and predict() / correct() return
+ *  the state estimate just as they do there.  The dimensions are template
+ *  parameters, so every matrix is a plain array inside the filter, the
+ *  loops have constant trip counts the compiler unrolls, and nothing is
+ *  allocated after construction.  cv::KalmanFilter instead works on Mat
+ *  headers and allocates its temporaries in every call, which costs more
+ *  than the arithmetic for a filter of a few states.
+ *
+ *    predict   x' = F x
+ *              P' = F P F' + Q
+ *    correct   S = H P' H' + R
+ *              K = P' H' S^-1
+ *              x = x' + K (z - H x')
+ *              P = P' - K H P'
+ *
+ *  S is symmetric positive definite, so it is solved by Cholesky rather
+ *  than inverted.  There is no control input; cv::KalmanFilter's demo does
+ *  not use one either.
+ *
+ *  Everything the filter uses is in this header and needs no OpenCV.
+ */
+#ifndef FIXED_KALMAN_H
+#define FIXED_KALMAN_H
+
+#include <cmath>
+
+namespace fixed
+{
+
+// Row major R x C matrix of T, on the stack
+template<typename T, int R, int C>
+struct Matrix
+{
+    T val[R * C];
+
+    T &operator()(int i, int j) { return val[i * C + j]; }
+    const T &operator()(int i, int j) const { return val[i * C + j]; }
+    T &operator()(int i) { return val[i]; }
+    const T &operator()(int i) const { return val[i]; }
+
+    // like Mat::at() for the code that used one
+    T &at(int i) { return val[i]; }
+    const T &at(int i) const { return val[i]; }
+    T &at(int i, int j) { return val[i * C + j]; }
+    const T &at(int i, int j) const { return val[i * C + j]; }
+
+    static Matrix zeros()
+    {
+        Matrix m;
+        for (int i = 0; i < R * C; i++)
+            m.val[i] = T(0);
+        return m;
+    }
+
+    static Matrix eye(T value = T(1))
+    {
+        Matrix m = zeros();
+        for (int i = 0; i < R && i < C; i++)
+            m.val[i * C + i] = value;
+        return m;
+    }
+
+    Matrix<T, C, R> t() const
+    {
+        Matrix<T, C, R> m;
+        for (int i = 0; i < R; i++)
+            for (int j = 0; j < C; j++)
+                m(j, i) = (*this)(i, j);
+        return m;
+    }
+};
+
+template<typename T, int R, int C, int K>
+inline Matrix<T, R, C> operator*(const Matrix<T, R, K> &a, const Matrix<T, K, C> &b)
+{
+    Matrix<T, R, C> m;
+    for (int i = 0; i < R; i++)
+        for (int j = 0; j < C; j++) {
+            T sum = T(0);
+            for (int k = 0; k < K; k++)
+                sum += a(i, k) * b(k, j);
+            m(i, j) = sum;
+        }
+    return m;
+}
+
+// a * b', without building the transpose
+template<typename T, int R, int C, int K>
+inline Matrix<T, R, C> mulTransposed(const Matrix<T, R, K> &a, const Matrix<T, C, K> &b)
+{
+    Matrix<T, R, C> m;
+    for (int i = 0; i < R; i++)
+        for (int j = 0; j < C; j++) {
+            T sum = T(0);
+            for (int k = 0; k < K; k++)
+                sum += a(i, k) * b(j, k);
+            m(i, j) = sum;
+        }
+    return m;
+}
+
+template<typename T, int R, int C>
+inline Matrix<T, R, C> operator+(const Matrix<T, R, C> &a, const Matrix<T, R, C> &b)
+{
+    Matrix<T, R, C> m;
+    for (int i = 0; i < R * C; i++)
+        m.val[i] = a.val[i] + b.val[i];
+    return m;
+}
+
+template<typename T, int R, int C>
+inline Matrix<T, R, C> operator-(const Matrix<T, R, C> &a, const Matrix<T, R, C> &b)
+{
+    Matrix<T, R, C> m;
+    for (int i = 0; i < R * C; i++)
+        m.val[i] = a.val[i] - b.val[i];
+    return m;
+}
+
+template<typename T, int R, int C>
+inline Matrix<T, R, C> &operator+=(Matrix<T, R, C> &a, const Matrix<T, R, C> &b)
+{
+    for (int i = 0; i < R * C; i++)
+        a.val[i] += b.val[i];
+    return a;
+}
+
+// as cv::setIdentity()
+template<typename T, int R, int C>
+inline void setIdentity(Matrix<T, R, C> &m, T value = T(1))
+{
+    m = Matrix<T, R, C>::eye(value);
+}
+
+// Solves S X = B in place of B for symmetric positive definite S, by
+// Cholesky.  Returns false, leaving B alone, if S is not positive definite.
+template<typename T, int N, int C>
+inline bool solveCholesky(const Matrix<T, N, N> &s, Matrix<T, N, C> &b)
+{
+    Matrix<T, N, N> l;     // lower triangle, with the reciprocal diagonal
+    int i, j, k;
+
+    for (i = 0; i < N; i++)
+        for (j = 0; j <= i; j++) {
+            T sum = s(i, j);
+            for (k = 0; k < j; k++)
+                sum -= l(i, k) * l(j, k);
+            if (i == j) {
+                if (!(sum > T(0)))
+                    return false;
+                l(i, i) = T(1) / std::sqrt(sum);
+            }
+            else
+                l(i, j) = sum * l(j, j);
+        }
+
+    // L y = b, then L' x = y, column by column
+    for (int c = 0; c < C; c++) {
+        for (i = 0; i < N; i++) {
+            T sum = b(i, c);
+            for (k = 0; k < i; k++)
+                sum -= l(i, k) * b(k, c);
+            b(i, c) = sum * l(i, i);
+        }
+        for (i = N - 1; i >= 0; i--) {
+            T sum = b(i, c);
+            for (k = i + 1; k < N; k++)
+                sum -= l(k, i) * b(k, c);
+            b(i, c) = sum * l(i, i);
+        }
+    }
+
+    return true;
+}
+
+template<int NState, int NMeas, typename T = float>
+class KalmanFilter
+{
+public:
+    typedef Matrix<T, NState, 1> State;
+    typedef Matrix<T, NMeas, 1> Measurement;
+
+    State statePre;                                     // x' = F x
+    State statePost;                                    // x = x' + K (z - H x')
+    Matrix<T, NState, NState> transitionMatrix;         // F
+    Matrix<T, NMeas, NState> measurementMatrix;         // H
+    Matrix<T, NState, NState> processNoiseCov;          // Q
+    Matrix<T, NMeas, NMeas> measurementNoiseCov;        // R
+    Matrix<T, NState, NState> errorCovPre;              // P' = F P F' + Q
+    Matrix<T, NState, NMeas> gain;                      // K
+    Matrix<T, NState, NState> errorCovPost;             // P = P' - K H P'
+
+    // the defaults of cv::KalmanFilter::init()
+    KalmanFilter()
+    {
+        statePre = State::zeros();
+        statePost = State::zeros();
+        transitionMatrix = Matrix<T, NState, NState>::eye();
+        measurementMatrix = Matrix<T, NMeas, NState>::zeros();
+        processNoiseCov = Matrix<T, NState, NState>::eye();
+        measurementNoiseCov = Matrix<T, NMeas, NMeas>::eye();
+        errorCovPre = Matrix<T, NState, NState>::zeros();
+        gain = Matrix<T, NState, NMeas>::zeros();
+        errorCovPost = Matrix<T, NState, NState>::zeros();
+    }
+
+    const State &predict()
+    {
+        statePre = transitionMatrix * statePost;
+        errorCovPre = mulTransposed(transitionMatrix * errorCovPost, transitionMatrix);
+        errorCovPre += processNoiseCov;
+
+        // for a frame without a measurement, as cv::KalmanFilter does
+        statePost = statePre;
+        errorCovPost = errorCovPre;
+
+        return statePre;
+    }
+
+    // The state unchanged if the innovation covariance is singular
+    const State &correct(const Measurement &measurement)
+    {
+        Matrix<T, NMeas, NState> hp = measurementMatrix * errorCovPre;            // H P'
+        Matrix<T, NMeas, NMeas> s = mulTransposed(hp, measurementMatrix);       // H P' H'
+        Matrix<T, NMeas, NState> kt = hp;
+
+        s += measurementNoiseCov;
+
+        // K' = S^-1 H P', as S and P' are symmetric
+        if (!solveCholesky(s, kt))
+            return statePost;
+        gain = kt.t();
+
+        statePost = statePre + gain * (measurement - measurementMatrix * statePre);
+        errorCovPost = errorCovPre - gain * hp;
+
+        return statePost;
+    }
+};
+
+}
+
+#endif
@@ -6,6 +6,7 @@
 #include <opencv2/video/tracking.hpp>
 #include <opencv2/highgui.hpp>
 #include <stdio.h>
+#include "fixed_kalman.h"
 using namespace cv;
 static inline Point calcPoint(Point2f center, double R, double angle)
 {
@@ -13,7 +14,8 @@ static inline Point calcPoint(Point2f center, double R, double angle)
 }
 static void help()
 {
-    printf( "\nExample of c calls to OpenCV's Kalman filter.\n"
+    printf( "\nExample of a Kalman filter, fixed::KalmanFilter from fixed_kalman.h\n"
+"   set up and used as OpenCV's KalmanFilter would be.\n"
 "   Tracking of rotating point.\n"
 "   Rotation speed is constant.\n"
 "   Both state and measurements vectors are 1D (a point angle),\n"
@@ -31,33 +33,35 @@ int main(int, char**)
 {
     help();
     Mat img(500, 500, CV_8UC3);
-    KalmanFilter KF(2, 1, 0);
-    Mat state(2, 1, CV_32F); /* (phi, delta_phi) */
-    Mat processNoise(2, 1, CV_32F);
-    Mat measurement = Mat::zeros(1, 1, CV_32F);
+    fixed::KalmanFilter<2, 1> KF;
+    fixed::Matrix<float, 2, 1> state; /* (phi, delta_phi) */
+    fixed::Matrix<float, 2, 1> processNoise;
+    fixed::Matrix<float, 1, 1> measurement = fixed::Matrix<float, 1, 1>::zeros();
     char code = (char)-1;
     for(;;)
     {
-        randn( state, Scalar::all(0), Scalar::all(0.1) );
-        KF.transitionMatrix = (Mat_<float>(2, 2) << 1, 1, 0, 1);
-        setIdentity(KF.measurementMatrix);
-        setIdentity(KF.processNoiseCov, Scalar::all(1e-5));
-        setIdentity(KF.measurementNoiseCov, Scalar::all(1e-1));
-        setIdentity(KF.errorCovPost, Scalar::all(1));
-        randn(KF.statePost, Scalar::all(0), Scalar::all(0.1));
+        state(0) = (float)theRNG().gaussian(0.1);
+        state(1) = (float)theRNG().gaussian(0.1);
+        KF.transitionMatrix = {{1, 1, 0, 1}};
+        fixed::setIdentity(KF.measurementMatrix);
+        fixed::setIdentity(KF.processNoiseCov, 1e-5f);
+        fixed::setIdentity(KF.measurementNoiseCov, 1e-1f);
+        fixed::setIdentity(KF.errorCovPost, 1.0f);
+        KF.statePost(0) = (float)theRNG().gaussian(0.1);
+        KF.statePost(1) = (float)theRNG().gaussian(0.1);
         for(;;)
         {
             Point2f center(img.cols*0.5f, img.rows*0.5f);
             float R = img.cols/3.f;
-            double stateAngle = state.at<float>(0);
+            double stateAngle = state(0);
             Point statePt = calcPoint(center, R, stateAngle);
-            Mat prediction = KF.predict();
-            double predictAngle = prediction.at<float>(0);
+            fixed::Matrix<float, 2, 1> prediction = KF.predict();
+            double predictAngle = prediction(0);
             Point predictPt = calcPoint(center, R, predictAngle);
-            randn( measurement, Scalar::all(0), Scalar::all(KF.measurementNoiseCov.at<float>(0)));
+            measurement(0) = (float)theRNG().gaussian(KF.measurementNoiseCov.at(0));
             // generate measurement
             measurement += KF.measurementMatrix*state;
-            double measAngle = measurement.at<float>(0);
+            double measAngle = measurement(0);
             Point measPt = calcPoint(center, R, measAngle);
             // plot points
             #define drawCross( center, color, d )                                        \
@@ -73,7 +77,8 @@ int main(int, char**)
             line( img, statePt, predictPt, Scalar(0,255,255), 3, LINE_AA, 0 );
             if(theRNG().uniform(0,4) != 0)
                 KF.correct(measurement);
-            randn( processNoise, Scalar(0), Scalar::all(sqrt(KF.processNoiseCov.at<float>(0, 0))));
+            processNoise(0) = (float)theRNG().gaussian(sqrt(KF.processNoiseCov.at(0, 0)));
+            processNoise(1) = (float)theRNG().gaussian(sqrt(KF.processNoiseCov.at(0, 0)));
             state = KF.transitionMatrix*state + processNoise;
             imshow( "Kalman", img );
             code = (char)waitKey(100);
@@ -0,0 +1,188 @@
+// kalman_bench.cpp
+//
+// Updates per second, one predict() and one correct() each, of
+// cv::KalmanFilter and of fixed::KalmanFilter from fixed_kalman.h, for
+// many independent tracks as a multi-object tracker runs them:
+//
+//   2 states, 1 measurement    position and velocity on a line
+//   4 states, 2 measurements   the same in the image plane
+//   6 states, 2 measurements   with acceleration as well
+//
+// The tracks follow noisy random walks of the model's order, measured in
+// position only, and every fourth frame has no measurement, as in the
+// kalman demo.  Both filters see the same measurements; the largest
+// difference between their final states is printed to show they agree.
+//
+// Usage: kalman_bench [tracks [frames]]
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+
+#include <opencv2/core.hpp>
+#include <opencv2/video/tracking.hpp>
+
+#include "fixed_kalman.h"
+
+using namespace std;
+
+#define PROCESS_NOISE (1e-2f)
+#define MEASUREMENT_NOISE (1.0f)
+
+// x(k+1) = F x(k) for position, velocity, ... per axis, with dt = 1
+static float transition(int nMeas, int i, int j)
+{
+    int di = i / nMeas, dj = j / nMeas;
+    float f = 1.0f;
+
+    if ((i % nMeas) != (j % nMeas) || (dj < di))
+        return 0.0f;
+    for (int n = 2; n <= dj - di; n++)
+        f *= n;
+    return 1.0f / f;
+}
+
+// measurements[frame][track][axis] from a random walk per track, NAN on a
+// frame without one
+template<int NState, int NMeas>
+static void makeMeasurements(vector<float> &z, int tracks, int frames)
+{
+    cv::RNG rng(12345);
+    float x[NState], next[NState];
+
+    z.resize((size_t)frames * tracks * NMeas);
+    for (int t = 0; t < tracks; t++) {
+        for (int i = 0; i < NState; i++)
+            x[i] = (i < NMeas) ? rng.uniform(0.0f, 1000.0f) : rng.gaussian(1.0);
+
+        for (int f = 0; f < frames; f++) {
+            for (int i = 0; i < NState; i++) {
+                next[i] = (i >= NState - NMeas) ? rng.gaussian(sqrt(PROCESS_NOISE)) : 0.0f;
+                for (int j = 0; j < NState; j++)
+                    next[i] += transition(NMeas, i, j) * x[j];
+            }
+            for (int i = 0; i < NState; i++)
+                x[i] = next[i];
+
+            for (int i = 0; i < NMeas; i++)
+                z[((size_t)f * tracks + t) * NMeas + i] = ((f % 4) == 3) ? NAN :
+                                                           x[i] + rng.gaussian(MEASUREMENT_NOISE);
+        }
+    }
+}
+
+template<int NState, int NMeas>
+static double runOpenCV(const vector<float> &z, int tracks, int frames, vector<float> &state)
+{
+    vector<cv::KalmanFilter> kf(tracks);
+
+    for (int t = 0; t < tracks; t++) {
+        kf[t].init(NState, NMeas, 0, CV_32F);
+        for (int i = 0; i < NState; i++)
+            for (int j = 0; j < NState; j++)
+                kf[t].transitionMatrix.at<float>(i, j) = transition(NMeas, i, j);
+        cv::setIdentity(kf[t].measurementMatrix);
+        cv::setIdentity(kf[t].processNoiseCov, cv::Scalar::all(PROCESS_NOISE));
+        cv::setIdentity(kf[t].measurementNoiseCov, cv::Scalar::all(MEASUREMENT_NOISE));
+        cv::setIdentity(kf[t].errorCovPost, cv::Scalar::all(1));
+        for (int i = 0; i < NMeas; i++)
+            kf[t].statePost.at<float>(i) = z[t * NMeas + i];
+    }
+
+    int64 start = cv::getTickCount();
+    for (int f = 0; f < frames; f++)
+        for (int t = 0; t < tracks; t++) {
+            float *m = const_cast<float *>(&z[((size_t)f * tracks + t) * NMeas]);
+
+            kf[t].predict();
+            if (!std::isnan(m[0]))
+                kf[t].correct(cv::Mat(NMeas, 1, CV_32F, m));
+        }
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+    state.resize((size_t)tracks * NState);
+    for (int t = 0; t < tracks; t++)
+        for (int i = 0; i < NState; i++)
+            state[t * NState + i] = kf[t].statePost.at<float>(i);
+
+    return seconds;
+}
+
+template<int NState, int NMeas>
+static double runFixed(const vector<float> &z, int tracks, int frames, vector<float> &state)
+{
+    typedef fixed::KalmanFilter<NState, NMeas, float> Filter;
+    vector<Filter> kf(tracks);
+    typename Filter::Measurement measurement;
+
+    for (int t = 0; t < tracks; t++) {
+        for (int i = 0; i < NState; i++)
+            for (int j = 0; j < NState; j++)
+                kf[t].transitionMatrix(i, j) = transition(NMeas, i, j);
+        fixed::setIdentity(kf[t].measurementMatrix);
+        fixed::setIdentity(kf[t].processNoiseCov, PROCESS_NOISE);
+        fixed::setIdentity(kf[t].measurementNoiseCov, MEASUREMENT_NOISE);
+        fixed::setIdentity(kf[t].errorCovPost, 1.0f);
+        for (int i = 0; i < NMeas; i++)
+            kf[t].statePost(i) = z[t * NMeas + i];
+    }
+
+    int64 start = cv::getTickCount();
+    for (int f = 0; f < frames; f++)
+        for (int t = 0; t < tracks; t++) {
+            const float *m = &z[((size_t)f * tracks + t) * NMeas];
+
+            kf[t].predict();
+            if (!std::isnan(m[0])) {
+                for (int i = 0; i < NMeas; i++)
+                    measurement(i) = m[i];
+                kf[t].correct(measurement);
+            }
+        }
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+    state.resize((size_t)tracks * NState);
+    for (int t = 0; t < tracks; t++)
+        for (int i = 0; i < NState; i++)
+            state[t * NState + i] = kf[t].statePost(i);
+
+    return seconds;
+}
+
+template<int NState, int NMeas>
+static void bench(int tracks, int frames)
+{
+    vector<float> z, cvState, fixedState;
+    double updates = (double)tracks * frames, cvSeconds, fixedSeconds, diff = 0.0;
+
+    makeMeasurements<NState, NMeas>(z, tracks, frames);
+    cvSeconds = runOpenCV<NState, NMeas>(z, tracks, frames, cvState);
+    fixedSeconds = runFixed<NState, NMeas>(z, tracks, frames, fixedState);
+
+    for (size_t i = 0; i < cvState.size(); i++)
+        diff = max(diff, (double)fabs(cvState[i] - fixedState[i]));
+
+    printf("%d states, %d measurements: cv::KalmanFilter %.2f M updates/s, fixed::KalmanFilter %.2f M updates/s, "
+           "%.1fx, max state difference %g\n", NState, NMeas, updates / cvSeconds * 1e-6,
+           updates / fixedSeconds * 1e-6, cvSeconds / fixedSeconds, diff);
+}
+
+int main(int argc, char *argv[])
+{
+    int tracks = (argc > 1) ? atoi(argv[1]) : 1000;
+    int frames = (argc > 2) ? atoi(argv[2]) : 300;
+
+    if ((tracks <= 0) || (frames <= 0)) {
+        printf("Usage: kalman_bench [tracks [frames]]\n");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%d tracks, %d frames, a measurement in 3 frames of 4\n", tracks, frames);
+    bench<2, 1>(tracks, frames);
+    bench<4, 2>(tracks, frames);
+    bench<6, 2>(tracks, frames);
+
+    return 0;
+}
@@ -91,6 +91,8 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include "fast_dct.h"
+
 
 // As documented for DCT2 in Wikipedia
 //
@@ -117,8 +119,7 @@
 void dct(double macroblock[8][8], double dct2[8][8])
 {
    int u,v,x,y;
-   FILE * fp = fopen("dct2.csv", "w");
-	
+
     for (v=0; v<8; v++)
     {
         for (u=0; u<8; u++)
@@ -140,10 +141,7 @@ void dct(double macroblock[8][8], double dct2[8][8])
             }
 
             dct2[v][u] = 0.25 * Cu * Cv * z;
-            fprintf(fp, "\n %lf", dct2[v][u]);
         }
-        fprintf(fp, "\n");
-
     }
 }
 
@@ -153,7 +151,6 @@ void dct(double macroblock[8][8], double dct2[8][8])
 void idct(double dct2[8][8], double idct2[8][8])
 {
     int u,v,x,y;
-    FILE * fp = fopen("idct2.csv", "w");
 
     for (y=0; y<8; y++)
     {
@@ -178,11 +175,35 @@ void idct(double dct2[8][8], double idct2[8][8])
             }
             z /= 4.0;
             idct2[x][y] = z;
-            fprintf(fp, "\n %lf", idct2[x][y]);
         }
+    }
+}
+
+
+#ifdef DEBUG
+// Write an 8x8 block to a CSV file, one value per line with a blank line
+// after each row, for comparing the coefficients with Octave
+void dump_csv(const char *name, double block[8][8])
+{
+    int i, j;
+    FILE * fp = fopen(name, "w");
+
+    if(!fp)
+    {
+        perror(name);
+        return;
+    }
+
+    for (i=0; i<8; i++)
+    {
+        for (j=0; j<8; j++)
+            fprintf(fp, "\n %lf", block[i][j]);
         fprintf(fp, "\n");
     }
+
+    fclose(fp);
 }
+#endif
 
 
 // Test Example from class lecture notes, which can be compared to OpenCV
@@ -194,7 +215,10 @@ void idct(double dct2[8][8], double idct2[8][8])
 // images". IEICE Transactions 71 (11): 1095–1097. Which has similar performance
 // to the Cooly-Tukey DFT for the discrete Fourier transform.
 //
-// This formulation is however much easier to understand.
+// This formulation is however much easier to understand.  The AAN version
+// is fast_dct8x8() in ../image_common/fast_dct.c, checked against it here.
+//
+// Build with -DDEBUG for the dct2.csv and idct2.csv dumps.
 //
 int main()
 {
@@ -208,10 +232,38 @@ int main()
                                 { 59,  30,  33,  33,  32,  37,  45,  41} };
     double dct2[8][8];
     double idct2[8][8];
+    float block[64], fdct2[64], fidct2[64];
+    double err, max_dct_err=0.0, max_idct_err=0.0;
+    int x, y;
 
-    // Trace output I added to these dump into a CSV file
     dct(Macroblock, dct2);
     idct(dct2, idct2);
 
-    exit(0);
+#ifdef DEBUG
+    // Trace output I added to these dump into a CSV file
+    dump_csv("dct2.csv", dct2);
+    dump_csv("idct2.csv", idct2);
+#endif
+
+    // Same block through the fast AAN DCT.  Note dct() above stores
+    // coefficient (u,v) at dct2[v][u], the transpose of Octave's dct2(A).
+    for (x=0; x<8; x++)
+        for (y=0; y<8; y++)
+            block[x*8+y] = Macroblock[x][y];
+
+    fast_dct8x8(block, fdct2, 1);
+    fast_idct8x8(fdct2, fidct2, 1);
+
+    for (x=0; x<8; x++)
+    {
+        for (y=0; y<8; y++)
+        {
+            if ((err = fabs(fdct2[x*8+y] - dct2[y][x])) > max_dct_err) max_dct_err = err;
+            if ((err = fabs(fidct2[x*8+y] - Macroblock[x][y])) > max_idct_err) max_idct_err = err;
+        }
+    }
+
+    printf("DC %lf, fast DCT max error %le, fast iDCT max error %le\n", dct2[0][0], max_dct_err, max_idct_err);
+
+    exit(((max_dct_err < 1.0e-3) && (max_idct_err < 1.0e-3)) ? 0 : 1);
 }
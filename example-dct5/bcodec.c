@@ -0,0 +1,150 @@
+/*
+ *  Compress a PPM/PGM with the block transform codec, or decompress it
+ *
+ *  Usage: bcodec c input.ppm output.bcf [quality [jpeg|flat [strip_rows [threads]]]]
+ *         bcodec d input.bcf output.ppm [threads]
+ *
+ *  e.g. bcodec c Cactus-320x240.ppm Cactus.bcf 75 and bcodec d Cactus.bcf
+ *  Cactus-75.ppm, quality 75 with the JPEG tables and 4 block rows per
+ *  strip by default.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "block_codec.h"
+#include "pnm_io.h"
+
+typedef unsigned char UINT8;
+
+
+static double elapsed_ms(struct timespec *start, struct timespec *stop)
+{
+    return (stop->tv_sec - start->tv_sec) * 1000.0 + (stop->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+static int compress(int argc, char *argv[])
+{
+    struct pnm_image in;
+    struct bc_params params;
+    struct timespec start, stop;
+    UINT8 *stream;
+    size_t size;
+    FILE *fp;
+
+    memset(&params, 0, sizeof(params));
+    params.quality = (argc > 4) ? atoi(argv[4]) : 75;
+    params.table = BC_TABLE_JPEG;
+    if(argc > 5)
+    {
+        for(params.table=0; params.table < BC_TABLE_COUNT; params.table++)
+            if(strcmp(argv[5], bc_table_name(params.table)) == 0)
+                break;
+        if(params.table == BC_TABLE_COUNT)
+        {
+            printf("Unknown table %s, jpeg or flat\n", argv[5]);
+            return -1;
+        }
+    }
+    params.strip_rows = (argc > 6) ? atoi(argv[6]) : 0;
+    params.threads = (argc > 7) ? atoi(argv[7]) : 0;
+
+    if(pnm_open(&in, argv[2]) != 0)
+        return -1;
+
+    if(in.sample_bytes != 1)
+    {
+        printf("%s is not an 8-bit image\n", argv[2]);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(bc_encode(in.pixels, in.width, in.height, in.channels, in.stride, &params, &stream, &size) != 0)
+    {
+        printf("encode failed\n");
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if(!(fp = fopen(argv[3], "wb")) || (fwrite(stream, 1, size, fp) != size) || (fclose(fp) != 0))
+    {
+        perror(argv[3]);
+        return -1;
+    }
+
+    printf("%dx%d, %d channels, quality %d %s: %zu bytes, %.2lf:1, %.3lf bits per pixel, %.3lf ms\n",
+           in.width, in.height, in.channels, params.quality, bc_table_name(params.table), size,
+           (double)in.bytes / size, 8.0 * size / ((double)in.width * in.height), elapsed_ms(&start, &stop));
+
+    free(stream);
+    pnm_close(&in);
+    return 0;
+}
+
+static int decompress(int argc, char *argv[])
+{
+    struct pnm_image out;
+    struct timespec start, stop;
+    UINT8 *stream;
+    long size;
+    int width, height, channels;
+    FILE *fp;
+
+    if(!(fp = fopen(argv[2], "rb")) || (fseek(fp, 0, SEEK_END) != 0) || ((size = ftell(fp)) < 0))
+    {
+        perror(argv[2]);
+        return -1;
+    }
+    rewind(fp);
+
+    if(!(stream = malloc(size)) || (fread(stream, 1, size, fp) != (size_t)size))
+    {
+        perror(argv[2]);
+        return -1;
+    }
+    fclose(fp);
+
+    if(bc_info(stream, size, &width, &height, &channels) != 0)
+    {
+        printf("%s is not a compressed image\n", argv[2]);
+        free(stream);
+        return -1;
+    }
+
+    if(pnm_create(&out, argv[3], width, height, channels, 255, "bcodec") != 0)
+    {
+        free(stream);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(bc_decode(stream, size, out.pixels, out.stride, (argc > 4) ? atoi(argv[4]) : 0) != 0)
+    {
+        printf("%s is damaged\n", argv[2]);
+        pnm_close(&out);
+        free(stream);
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    printf("%dx%d, %d channels from %ld bytes, %.3lf ms\n", width, height, channels, size,
+           elapsed_ms(&start, &stop));
+
+    pnm_close(&out);
+    free(stream);
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if((argc < 4) || (strlen(argv[1]) != 1) || !strchr("cd", argv[1][0]))
+    {
+        printf("Usage: bcodec c input.ppm output.bcf [quality [jpeg|flat [strip_rows [threads]]]]\n");
+        printf("       bcodec d input.bcf output.ppm [threads]\n");
+        exit(-1);
+    }
+
+    exit((argv[1][0] == 'c') ? compress(argc, argv) : decompress(argc, argv));
+}
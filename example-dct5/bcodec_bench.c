@@ -0,0 +1,151 @@
+/*
+ *  Speed and quality of the block transform codec against quality setting
+ *
+ *  For quality 10 to 100 with each quantization table, encodes and decodes
+ *  each image repeatedly and reports encode and decode throughput in MB/s
+ *  of raw pixels, the compression ratio, bits per pixel and the PSNR of
+ *  the decoded image, and checks that one thread decodes the same pixels.
+ *
+ *  Usage: bcodec_bench [threads [image.ppm ...]]
+ *
+ *  Without images, Cactus-320x240.ppm, Cactus-320x240.pgm and
+ *  ../openmp-sharpen/Alaska-Bear-1280x960.ppm
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "block_codec.h"
+#include "pnm_io.h"
+
+typedef unsigned char UINT8;
+
+#define MIN_SEC (0.25)
+
+static const char *default_images[] = { "Cactus-320x240.ppm", "Cactus-320x240.pgm",
+                                        "../openmp-sharpen/Alaska-Bear-1280x960.ppm" };
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static double psnr(const UINT8 *a, const UINT8 *b, size_t n)
+{
+    double sse = 0.0, d;
+    size_t i;
+
+    for(i=0; i < n; i++)
+    {
+        d = (double)a[i] - (double)b[i];
+        sse += d * d;
+    }
+
+    return (sse == 0.0) ? INFINITY : 10.0 * log10(255.0 * 255.0 * n / sse);
+}
+
+static void bench_image(const char *name, int threads)
+{
+    struct pnm_image img;
+    struct bc_params params;
+    UINT8 *stream = NULL, *out, *check;
+    size_t size;
+    double start, enc, dec, mb;
+    int quality, runs;
+
+    if(pnm_open(&img, name) != 0)
+        exit(EXIT_FAILURE);
+    if(img.sample_bytes != 1)
+    {
+        printf("%s is not an 8-bit image\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    if(!(out = malloc(img.bytes)) || !(check = malloc(img.bytes)))
+    {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    mb = img.bytes / 1000000.0;
+
+    printf("%s %dx%d, %d channels\n", name, img.width, img.height, img.channels);
+    printf("%-5s %7s %10s %10s %9s %7s %7s %8s\n", "table", "quality", "enc MB/s", "dec MB/s", "bytes",
+           "ratio", "bpp", "PSNR dB");
+
+    memset(&params, 0, sizeof(params));
+    params.threads = threads;
+
+    for(params.table=0; params.table < BC_TABLE_COUNT; params.table++)
+    {
+        for(quality=10; quality <= 100; quality += 10)
+        {
+            params.quality = quality;
+
+            start = now_sec();
+            runs = 0;
+            do
+            {
+                free(stream);
+                if(bc_encode(img.pixels, img.width, img.height, img.channels, img.stride, &params,
+                             &stream, &size) != 0)
+                {
+                    printf("encode failed\n");
+                    exit(EXIT_FAILURE);
+                }
+                runs++;
+            } while((enc = now_sec() - start) < MIN_SEC);
+            enc /= runs;
+
+            start = now_sec();
+            runs = 0;
+            do
+            {
+                if(bc_decode(stream, size, out, img.stride, threads) != 0)
+                {
+                    printf("decode failed\n");
+                    exit(EXIT_FAILURE);
+                }
+                runs++;
+            } while((dec = now_sec() - start) < MIN_SEC);
+            dec /= runs;
+
+            // one thread must decode the same pixels
+            if((bc_decode(stream, size, check, img.stride, 1) != 0) || memcmp(out, check, img.bytes))
+            {
+                printf("single thread decode differs\n");
+                exit(EXIT_FAILURE);
+            }
+
+            printf("%-5s %7d %10.1lf %10.1lf %9zu %7.2lf %7.3lf %8.2lf\n", bc_table_name(params.table), quality,
+                   mb / enc, mb / dec, size, (double)img.bytes / size,
+                   8.0 * size / ((double)img.width * img.height), psnr(img.pixels, out, img.bytes));
+        }
+    }
+    printf("\n");
+
+    free(stream);
+    free(out);
+    free(check);
+    pnm_close(&img);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int threads = (argc > 1) ? atoi(argv[1]) : 0, i;
+
+    if(argc > 2)
+        for(i=2; i < argc; i++)
+            bench_image(argv[i], threads);
+    else
+        for(i=0; i < (int)(sizeof(default_images) / sizeof(default_images[0])); i++)
+            bench_image(default_images[i], threads);
+
+    return 0;
+}
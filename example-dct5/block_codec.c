@@ -0,0 +1,860 @@
+/*
+ *  Intra-frame block transform codec, see block_codec.h
+ *
+ *  The symbols are those of baseline JPEG (ITU T.81 F.1.2): a DC difference
+ *  is its size category then that many bits, an AC coefficient is a
+ *  (zero run, size) byte then the bits, 0xF0 for 16 zeros and 0x00 for the
+ *  end of the block.  Encoding is two passes over the quantized blocks, the
+ *  first transforms and counts symbols per strip, the second codes the
+ *  strips with Huffman codes built from the counts.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <omp.h>
+
+#include "block_codec.h"
+#include "fast_dct.h"
+
+#define BC_MAGIC "BCF1"
+#define BC_FIXED_HEADER (17)
+
+#define HUFF_DC_LUMA   (0)
+#define HUFF_AC_LUMA   (1)
+#define HUFF_DC_CHROMA (2)
+#define HUFF_AC_CHROMA (3)
+#define HUFF_TABLES    (4)
+
+#define HUFF_MAX_BITS  (16)
+#define HUFF_LOOKAHEAD (9)      // bits decoded by one table lookup
+
+#define COEF_MAX (1023)         // 10 bits plus sign, DC differences take 11
+
+// zig-zag position to natural (row major) index in the block
+static const int natural[64] =
+{
+     0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// ITU T.81 Annex K.1, natural order
+static const unsigned char jpeg_luma[64] =
+{
+    16, 11, 10, 16,  24,  40,  51,  61,
+    12, 12, 14, 19,  26,  58,  60,  55,
+    14, 13, 16, 24,  40,  57,  69,  56,
+    14, 17, 22, 29,  51,  87,  80,  62,
+    18, 22, 37, 56,  68, 109, 103,  77,
+    24, 35, 55, 64,  81, 104, 113,  92,
+    49, 64, 78, 87, 103, 121, 120, 101,
+    72, 92, 95, 98, 112, 100, 103,  99
+};
+
+static const unsigned char jpeg_chroma[64] =
+{
+    17, 18, 24, 47, 99, 99, 99, 99,
+    18, 21, 26, 66, 99, 99, 99, 99,
+    24, 26, 56, 99, 99, 99, 99, 99,
+    47, 66, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99,
+    99, 99, 99, 99, 99, 99, 99, 99
+};
+
+static const char *table_names[BC_TABLE_COUNT] = { "jpeg", "flat" };
+
+// one image being coded, shared by all strips
+struct codec
+{
+    int width, height, channels;
+    int bw, bh;                             // in blocks
+    int strip_rows, nstrips;
+    unsigned char quant[2][64];             // luma, chroma in zig-zag order
+    float recip[2][64];                     // 1/quant, natural order
+    short *coef;                            // quantized blocks in zig-zag order
+};
+
+struct huff_enc
+{
+    unsigned char bits[HUFF_MAX_BITS + 1];  // codes of each length
+    unsigned char val[256];                 // symbols in code order
+    int nvals;
+    unsigned short code[256];
+    unsigned char size[256];
+};
+
+struct huff_dec
+{
+    unsigned short look[1 << HUFF_LOOKAHEAD];  // length << 8 | symbol, 0 for a longer code
+    int mincode[HUFF_MAX_BITS + 1], maxcode[HUFF_MAX_BITS + 2], valptr[HUFF_MAX_BITS + 1];
+    unsigned char val[256];
+};
+
+struct bits_out
+{
+    unsigned char *buf;
+    size_t len, cap;
+    uint64_t acc;
+    int n, err;
+};
+
+struct bits_in
+{
+    const unsigned char *p, *end;
+    uint64_t acc;                           // next bit in the top bit
+    int n;
+    size_t over;                            // zero bytes fed past the end
+};
+
+
+const char *bc_table_name(int table)
+{
+    return ((table >= 0) && (table < BC_TABLE_COUNT)) ? table_names[table] : "unknown";
+}
+
+static int threads_or_default(int threads)
+{
+    return (threads > 0) ? threads : omp_get_max_threads();
+}
+
+static inline int nbits(int v)
+{
+    if(v < 0) v = -v;
+    return v ? 32 - __builtin_clz((unsigned)v) : 0;
+}
+
+static inline int clamp_coef(float v)
+{
+    int i = (int)(v + ((v >= 0.0f) ? 0.5f : -0.5f));
+
+    return (i > COEF_MAX) ? COEF_MAX : ((i < -COEF_MAX) ? -COEF_MAX : i);
+}
+
+static inline unsigned char clamp_pixel(float v)
+{
+    return (v <= 0.0f) ? 0 : ((v >= 255.0f) ? 255 : (unsigned char)(v + 0.5f));
+}
+
+static void put_u32(unsigned char *p, unsigned v)
+{
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static unsigned get_u32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+
+// Scaled the way libjpeg's jpeg_quality_scaling() does it
+static void make_quant(struct codec *c, int table, int quality)
+{
+    const unsigned char *base[2];
+    int scale, t, k, q;
+
+    if(table == BC_TABLE_JPEG) { base[0] = jpeg_luma; base[1] = jpeg_chroma; }
+    else { base[0] = base[1] = NULL; }
+
+    scale = (quality < 50) ? 5000 / quality : 200 - 2 * quality;
+
+    for(t=0; t < 2; t++)
+        for(k=0; k < 64; k++)
+        {
+            q = ((base[t] ? base[t][natural[k]] : 16) * scale + 50) / 100;
+            q = (q < 1) ? 1 : ((q > 255) ? 255 : q);
+            c->quant[t][k] = q;
+            c->recip[t][natural[k]] = 1.0f / q;
+        }
+}
+
+
+// RGB to level shifted JFIF YCbCr, DCT and quantize one strip of block rows,
+// work holds a row of blocks for each channel
+static void transform_strip(struct codec *c, const unsigned char *pixels, size_t stride, int by0, int by1,
+                            float *work)
+{
+    int ch = c->channels, bw = c->bw, by, bx, x, y, sx, sy, i, k;
+    const unsigned char *row, *p;
+    float r, g, b, *blk;
+    short *dst;
+
+    for(by=by0; by < by1; by++)
+    {
+        for(y=0; y < 8; y++)
+        {
+            // past the bottom or right edge repeat the last row or column
+            sy = (by * 8 + y < c->height) ? by * 8 + y : c->height - 1;
+            row = pixels + sy * stride;
+
+            for(bx=0; bx < bw; bx++)
+                for(x=0; x < 8; x++)
+                {
+                    sx = (bx * 8 + x < c->width) ? bx * 8 + x : c->width - 1;
+                    p = row + sx * ch;
+                    blk = work + bx * 64 + y * 8 + x;
+
+                    if(ch == 1)
+                        blk[0] = p[0] - 128.0f;
+                    else
+                    {
+                        r = p[0]; g = p[1]; b = p[2];
+                        blk[0]            =  0.299f    * r + 0.587f    * g + 0.114f    * b - 128.0f;
+                        blk[bw * 64]      = -0.168736f * r - 0.331264f * g + 0.5f      * b;
+                        blk[2 * bw * 64]  =  0.5f      * r - 0.418688f * g - 0.081312f * b;
+                    }
+                }
+        }
+
+        fast_dct8x8(work, work, ch * bw);
+
+        for(bx=0; bx < bw; bx++)
+            for(i=0; i < ch; i++)
+            {
+                blk = work + (i * bw + bx) * 64;
+                dst = c->coef + (((size_t)by * bw + bx) * ch + i) * 64;
+
+                for(k=0; k < 64; k++)
+                    dst[k] = clamp_coef(blk[natural[k]] * c->recip[i ? 1 : 0][natural[k]]);
+            }
+    }
+}
+
+static void count_block(const short *z, int *pred, long *dc, long *ac)
+{
+    int k, run = 0;
+
+    dc[nbits(z[0] - *pred)]++;
+    *pred = z[0];
+
+    for(k=1; k < 64; k++)
+    {
+        if(z[k] == 0)
+        {
+            run++;
+            continue;
+        }
+        for(; run > 15; run -= 16)
+            ac[0xF0]++;
+        ac[(run << 4) | nbits(z[k])]++;
+        run = 0;
+    }
+
+    if(run)
+        ac[0x00]++;
+}
+
+static void count_strip(const struct codec *c, int by0, int by1, long freq[HUFF_TABLES][257])
+{
+    int pred[3] = { 0, 0, 0 }, by, bx, i, t;
+    const short *z;
+
+    for(by=by0; by < by1; by++)
+        for(bx=0; bx < c->bw; bx++)
+            for(i=0; i < c->channels; i++)
+            {
+                z = c->coef + (((size_t)by * c->bw + bx) * c->channels + i) * 64;
+                t = i ? HUFF_DC_CHROMA : HUFF_DC_LUMA;
+                count_block(z, &pred[i], freq[t], freq[t + 1]);
+            }
+}
+
+
+// Code lengths from symbol counts as in ITU T.81 Annex K.2, limited to 16
+// bits.  Symbol 256 is held back so that no code is all ones.
+static void make_huff_enc(struct huff_enc *h, const long *counts)
+{
+    long freq[257], v;
+    int codesize[257], others[257], bits[258];
+    int i, j, c1, c2, p;
+    unsigned code;
+
+    memset(h, 0, sizeof(*h));
+    memset(codesize, 0, sizeof(codesize));
+    memset(bits, 0, sizeof(bits));
+    memcpy(freq, counts, 256 * sizeof(long));
+    freq[256] = 1;
+    for(i=0; i < 257; i++)
+        others[i] = -1;
+
+    for(;;)
+    {
+        // c1 the least frequent, c2 the next, the larger symbol on ties
+        c1 = c2 = -1;
+        for(i=0, v=0; i < 257; i++)
+            if(freq[i] && ((c1 < 0) || (freq[i] <= v))) { v = freq[i]; c1 = i; }
+        for(i=0, v=0; i < 257; i++)
+            if(freq[i] && (i != c1) && ((c2 < 0) || (freq[i] <= v))) { v = freq[i]; c2 = i; }
+        if(c2 < 0)
+            break;
+
+        freq[c1] += freq[c2];
+        freq[c2] = 0;
+
+        codesize[c1]++;
+        while(others[c1] >= 0) { c1 = others[c1]; codesize[c1]++; }
+        others[c1] = c2;
+        codesize[c2]++;
+        while(others[c2] >= 0) { c2 = others[c2]; codesize[c2]++; }
+    }
+
+    for(i=0; i < 257; i++)
+        if(codesize[i])
+            bits[codesize[i]]++;
+
+    // move pairs of the longest codes up the tree
+    for(i=256; i > HUFF_MAX_BITS; i--)
+        while(bits[i] > 0)
+        {
+            for(j=i-2; bits[j] == 0; j--)
+                ;
+            bits[i] -= 2;
+            bits[i-1]++;
+            bits[j+1] += 2;
+            bits[j]--;
+        }
+
+    // drop the held back symbol, it has the longest code
+    for(i=HUFF_MAX_BITS; (i > 0) && (bits[i] == 0); i--)
+        ;
+    if(i > 0)
+        bits[i]--;
+
+    for(i=1; i <= HUFF_MAX_BITS; i++)
+        h->bits[i] = bits[i];
+
+    for(i=1, p=0; i <= 256; i++)
+        for(j=0; j < 256; j++)
+            if(codesize[j] == i)
+                h->val[p++] = j;
+    h->nvals = p;
+
+    for(i=1, p=0, code=0; i <= HUFF_MAX_BITS; i++, code <<= 1)
+        for(j=0; j < h->bits[i]; j++, p++, code++)
+        {
+            h->code[h->val[p]] = code;
+            h->size[h->val[p]] = i;
+        }
+}
+
+// Canonical decoding tables as in ITU T.81 F.2.2.3, -1 for a table that is
+// not a prefix code
+static int make_huff_dec(struct huff_dec *h, const unsigned char *bits, const unsigned char *val, int nvals)
+{
+    int l, i, k, p = 0, fill;
+    unsigned code = 0;
+
+    memset(h, 0, sizeof(*h));
+    memcpy(h->val, val, nvals);
+
+    for(l=1; l <= HUFF_MAX_BITS; l++, code <<= 1)
+    {
+        h->valptr[l] = p;
+        h->mincode[l] = code;
+        if(code + bits[l] > (1u << l))
+            return -1;
+
+        for(i=0; i < bits[l]; i++, p++, code++)
+            if(l <= HUFF_LOOKAHEAD)
+            {
+                fill = 1 << (HUFF_LOOKAHEAD - l);
+                for(k=0; k < fill; k++)
+                    h->look[(code << (HUFF_LOOKAHEAD - l)) + k] = (l << 8) | val[p];
+            }
+
+        h->maxcode[l] = bits[l] ? (int)code - 1 : -1;
+    }
+    h->maxcode[HUFF_MAX_BITS + 1] = 0x7FFFFFFF;
+
+    return 0;
+}
+
+
+static void put_byte(struct bits_out *bo, unsigned char b)
+{
+    unsigned char *buf;
+
+    if(bo->len == bo->cap)
+    {
+        if(!(buf = realloc(bo->buf, bo->cap * 2)))
+        {
+            bo->err = 1;
+            return;
+        }
+        bo->buf = buf;
+        bo->cap *= 2;
+    }
+    bo->buf[bo->len++] = b;
+}
+
+static inline void put_bits(struct bits_out *bo, unsigned v, int size)
+{
+    bo->acc = (bo->acc << size) | (v & ((1u << size) - 1));
+    bo->n += size;
+
+    while(bo->n >= 8)
+    {
+        bo->n -= 8;
+        put_byte(bo, (unsigned char)(bo->acc >> bo->n));
+    }
+}
+
+// size bits of a coefficient, negative values one less as JPEG does
+static inline void put_value(struct bits_out *bo, int v, int size)
+{
+    if(size)
+        put_bits(bo, (v < 0) ? v - 1 : v, size);
+}
+
+static void code_block(struct bits_out *bo, const short *z, int *pred, const struct huff_enc *dc,
+                       const struct huff_enc *ac)
+{
+    int k, s, run = 0, diff = z[0] - *pred;
+
+    *pred = z[0];
+    s = nbits(diff);
+    put_bits(bo, dc->code[s], dc->size[s]);
+    put_value(bo, diff, s);
+
+    for(k=1; k < 64; k++)
+    {
+        if(z[k] == 0)
+        {
+            run++;
+            continue;
+        }
+        for(; run > 15; run -= 16)
+            put_bits(bo, ac->code[0xF0], ac->size[0xF0]);
+        s = nbits(z[k]);
+        put_bits(bo, ac->code[(run << 4) | s], ac->size[(run << 4) | s]);
+        put_value(bo, z[k], s);
+        run = 0;
+    }
+
+    if(run)
+        put_bits(bo, ac->code[0x00], ac->size[0x00]);
+}
+
+static void code_strip(const struct codec *c, const struct huff_enc *huff, int by0, int by1, struct bits_out *bo)
+{
+    int pred[3] = { 0, 0, 0 }, by, bx, i, t;
+    const short *z;
+
+    for(by=by0; by < by1; by++)
+        for(bx=0; bx < c->bw; bx++)
+            for(i=0; i < c->channels; i++)
+            {
+                z = c->coef + (((size_t)by * c->bw + bx) * c->channels + i) * 64;
+                t = i ? HUFF_DC_CHROMA : HUFF_DC_LUMA;
+                code_block(bo, z, &pred[i], &huff[t], &huff[t + 1]);
+            }
+
+    // pad the last byte with ones
+    if(bo->n)
+        put_bits(bo, 0xFF, 8 - bo->n);
+}
+
+
+int bc_encode(const unsigned char *pixels, int width, int height, int channels, size_t stride,
+              const struct bc_params *params, unsigned char **stream, size_t *size)
+{
+    struct codec c;
+    struct huff_enc huff[HUFF_TABLES];
+    struct bits_out *strips = NULL;
+    long (*freq)[HUFF_TABLES][257] = NULL, total[257];
+    unsigned char *out = NULL, *p;
+    size_t header, len;
+    int quality, table, nthreads, s, t, i, err = 0;
+
+    if((width <= 0) || (height <= 0) || ((channels != 1) && (channels != 3)) || !params)
+        return -1;
+
+    memset(&c, 0, sizeof(c));
+    c.width = width;
+    c.height = height;
+    c.channels = channels;
+    c.bw = (width + 7) / 8;
+    c.bh = (height + 7) / 8;
+    c.strip_rows = (params->strip_rows > 0) ? params->strip_rows : BC_DEFAULT_STRIP_ROWS;
+    if(c.strip_rows > c.bh) c.strip_rows = c.bh;
+    if(c.strip_rows > 0xFFFF) c.strip_rows = 0xFFFF;
+    c.nstrips = (c.bh + c.strip_rows - 1) / c.strip_rows;
+
+    quality = (params->quality < 1) ? 1 : ((params->quality > 100) ? 100 : params->quality);
+    table = ((params->table >= 0) && (params->table < BC_TABLE_COUNT)) ? params->table : BC_TABLE_JPEG;
+    make_quant(&c, table, quality);
+
+    nthreads = threads_or_default(params->threads);
+
+    if(!(c.coef = malloc((size_t)c.bw * c.bh * channels * 64 * sizeof(short))) ||
+       !(freq = calloc(c.nstrips, sizeof(*freq))) ||
+       !(strips = calloc(c.nstrips, sizeof(*strips))))
+    {
+        err = 1;
+        goto done;
+    }
+
+    // pass 1, transform and count the symbols of each strip
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1)
+    for(s=0; s < c.nstrips; s++)
+    {
+        int by0 = s * c.strip_rows, by1 = (by0 + c.strip_rows < c.bh) ? by0 + c.strip_rows : c.bh;
+        float *work = malloc((size_t)channels * c.bw * 64 * sizeof(float));
+
+        if(!work)
+        {
+            strips[s].err = 1;
+            continue;
+        }
+        transform_strip(&c, pixels, stride, by0, by1, work);
+        count_strip(&c, by0, by1, freq[s]);
+        free(work);
+    }
+
+    for(t=0; t < HUFF_TABLES; t++)
+    {
+        memset(total, 0, sizeof(total));
+        for(s=0; s < c.nstrips; s++)
+            for(i=0; i < 256; i++)
+                total[i] += freq[s][t][i];
+        make_huff_enc(&huff[t], total);
+    }
+
+    // pass 2, Huffman code each strip into its own buffer
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1)
+    for(s=0; s < c.nstrips; s++)
+    {
+        int by0 = s * c.strip_rows, by1 = (by0 + c.strip_rows < c.bh) ? by0 + c.strip_rows : c.bh;
+
+        if(strips[s].err)
+            continue;
+        strips[s].cap = (size_t)(by1 - by0) * c.bw * channels * 16 + 64;
+        if(!(strips[s].buf = malloc(strips[s].cap)))
+        {
+            strips[s].err = 1;
+            continue;
+        }
+        code_strip(&c, huff, by0, by1, &strips[s]);
+    }
+
+    header = BC_FIXED_HEADER + 2 * 64 + 4 + 4 * (size_t)c.nstrips;
+    for(t=0; t < HUFF_TABLES; t++)
+        header += HUFF_MAX_BITS + huff[t].nvals;
+    for(s=0, len=header; s < c.nstrips; s++)
+    {
+        err |= strips[s].err;
+        len += strips[s].len;
+    }
+    if(err || !(out = malloc(len)))
+    {
+        err = 1;
+        goto done;
+    }
+
+    p = out;
+    memcpy(p, BC_MAGIC, 4);
+    put_u32(p + 4, width);
+    put_u32(p + 8, height);
+    p[12] = channels;
+    p[13] = quality;
+    p[14] = table;
+    p[15] = c.strip_rows;
+    p[16] = c.strip_rows >> 8;
+    p += BC_FIXED_HEADER;
+
+    memcpy(p, c.quant, 2 * 64);
+    p += 2 * 64;
+
+    for(t=0; t < HUFF_TABLES; t++)
+    {
+        memcpy(p, huff[t].bits + 1, HUFF_MAX_BITS);
+        memcpy(p + HUFF_MAX_BITS, huff[t].val, huff[t].nvals);
+        p += HUFF_MAX_BITS + huff[t].nvals;
+    }
+
+    put_u32(p, c.nstrips);
+    p += 4;
+    for(s=0; s < c.nstrips; s++, p += 4)
+        put_u32(p, strips[s].len);
+
+    for(s=0; s < c.nstrips; s++)
+    {
+        memcpy(p, strips[s].buf, strips[s].len);
+        p += strips[s].len;
+    }
+
+    *stream = out;
+    *size = len;
+
+done:
+    if(strips)
+        for(s=0; s < c.nstrips; s++)
+            free(strips[s].buf);
+    free(strips);
+    free(freq);
+    free(c.coef);
+
+    return err ? -1 : 0;
+}
+
+
+int bc_info(const unsigned char *stream, size_t size, int *width, int *height, int *channels)
+{
+    if((size < BC_FIXED_HEADER) || memcmp(stream, BC_MAGIC, 4))
+        return -1;
+
+    *width = get_u32(stream + 4);
+    *height = get_u32(stream + 8);
+    *channels = stream[12];
+
+    if((*width <= 0) || (*height <= 0) || ((*channels != 1) && (*channels != 3)))
+        return -1;
+
+    return 0;
+}
+
+
+static inline void fill_bits(struct bits_in *bi)
+{
+    unsigned b;
+
+    while(bi->n <= 56)
+    {
+        if(bi->p < bi->end)
+            b = *bi->p++;
+        else
+        {
+            b = 0;
+            bi->over++;
+        }
+        bi->acc |= (uint64_t)b << (56 - bi->n);
+        bi->n += 8;
+    }
+}
+
+static inline unsigned get_bits(struct bits_in *bi, int size)
+{
+    unsigned v = (unsigned)(bi->acc >> (64 - size));
+
+    bi->acc <<= size;
+    bi->n -= size;
+    return v;
+}
+
+// needs 16 bits in the accumulator, -1 for a code that is not in the table
+static inline int decode_symbol(struct bits_in *bi, const struct huff_dec *h)
+{
+    unsigned e = h->look[bi->acc >> (64 - HUFF_LOOKAHEAD)];
+    int l;
+
+    if(e)
+    {
+        get_bits(bi, e >> 8);
+        return e & 0xFF;
+    }
+
+    for(l=HUFF_LOOKAHEAD+1; l <= HUFF_MAX_BITS; l++)
+        if((int)(bi->acc >> (64 - l)) <= h->maxcode[l])
+            break;
+    if(l > HUFF_MAX_BITS)
+        return -1;
+
+    e = get_bits(bi, l);
+    return h->val[h->valptr[l] + e - h->mincode[l]];
+}
+
+static inline int get_value(struct bits_in *bi, int size)
+{
+    int v;
+
+    if(!size)
+        return 0;
+    v = get_bits(bi, size);
+    return (v < (1 << (size - 1))) ? v - (1 << size) + 1 : v;
+}
+
+static int decode_block(struct bits_in *bi, const struct huff_dec *dc, const struct huff_dec *ac,
+                        const unsigned char *quant, int *pred, float *blk)
+{
+    int k, s, rs;
+
+    memset(blk, 0, 64 * sizeof(float));
+
+    fill_bits(bi);
+    if(((s = decode_symbol(bi, dc)) < 0) || (s > 11))
+        return -1;
+    *pred += get_value(bi, s);
+    blk[0] = (float)(*pred * quant[0]);
+
+    for(k=1; k < 64; k++)
+    {
+        if(bi->n < 32)
+            fill_bits(bi);
+        if((rs = decode_symbol(bi, ac)) < 0)
+            return -1;
+
+        if(!(s = rs & 0x0F))
+        {
+            if(rs != 0xF0)
+                break;
+            k += 15;
+            continue;
+        }
+
+        if((k += rs >> 4) > 63)
+            return -1;
+        blk[natural[k]] = (float)(get_value(bi, s) * quant[k]);
+    }
+
+    return (k > 64) ? -1 : 0;
+}
+
+static int decode_strip(const struct codec *c, const struct huff_dec *huff, const unsigned char *data,
+                        size_t len, int by0, int by1, unsigned char *pixels, size_t stride, float *work)
+{
+    struct bits_in bi;
+    int ch = c->channels, bw = c->bw, pred[3] = { 0, 0, 0 }, by, bx, i, t, x, y, xn, yn;
+    unsigned char *p;
+    const float *blk;
+    float Y, cb, cr;
+
+    memset(&bi, 0, sizeof(bi));
+    bi.p = data;
+    bi.end = data + len;
+
+    for(by=by0; by < by1; by++)
+    {
+        for(bx=0; bx < bw; bx++)
+            for(i=0; i < ch; i++)
+            {
+                t = i ? HUFF_DC_CHROMA : HUFF_DC_LUMA;
+                if(decode_block(&bi, &huff[t], &huff[t + 1], c->quant[i ? 1 : 0], &pred[i],
+                                work + (i * bw + bx) * 64) < 0)
+                    return -1;
+            }
+
+        fast_idct8x8(work, work, ch * bw);
+
+        yn = (by * 8 + 8 <= c->height) ? 8 : c->height - by * 8;
+        for(y=0; y < yn; y++)
+        {
+            p = pixels + (size_t)(by * 8 + y) * stride;
+
+            for(bx=0; bx < bw; bx++)
+            {
+                xn = (bx * 8 + 8 <= c->width) ? 8 : c->width - bx * 8;
+                blk = work + bx * 64 + y * 8;
+
+                for(x=0; x < xn; x++, p += ch)
+                {
+                    Y = blk[x] + 128.0f;
+                    if(ch == 1)
+                        p[0] = clamp_pixel(Y);
+                    else
+                    {
+                        cb = blk[bw * 64 + x];
+                        cr = blk[2 * bw * 64 + x];
+                        p[0] = clamp_pixel(Y + 1.402f * cr);
+                        p[1] = clamp_pixel(Y - 0.344136f * cb - 0.714136f * cr);
+                        p[2] = clamp_pixel(Y + 1.772f * cb);
+                    }
+                }
+            }
+        }
+    }
+
+    // reading into the zero padding past the end means the strip was cut short
+    return (bi.over * 8 > (size_t)bi.n) ? -1 : 0;
+}
+
+
+int bc_decode(const unsigned char *stream, size_t size, unsigned char *pixels, size_t stride, int threads)
+{
+    struct codec c;
+    struct huff_dec huff[HUFF_TABLES];
+    const unsigned char *p, *end = stream + size, *data;
+    size_t *offset = NULL, *length = NULL, pos;
+    int nthreads, nvals, s, t, i, err = 0;
+
+    memset(&c, 0, sizeof(c));
+    if(bc_info(stream, size, &c.width, &c.height, &c.channels) < 0)
+        return -1;
+
+    c.bw = (c.width + 7) / 8;
+    c.bh = (c.height + 7) / 8;
+    c.strip_rows = stream[15] | (stream[16] << 8);
+    if(c.strip_rows <= 0)
+        return -1;
+    c.nstrips = (c.bh + c.strip_rows - 1) / c.strip_rows;
+
+    p = stream + BC_FIXED_HEADER;
+    if(end - p < 2 * 64)
+        return -1;
+    memcpy(c.quant, p, 2 * 64);
+    p += 2 * 64;
+
+    for(t=0; t < HUFF_TABLES; t++)
+    {
+        unsigned char bits[HUFF_MAX_BITS + 1];
+
+        if(end - p < HUFF_MAX_BITS)
+            return -1;
+        bits[0] = 0;
+        memcpy(bits + 1, p, HUFF_MAX_BITS);
+        for(i=1, nvals=0; i <= HUFF_MAX_BITS; i++)
+            nvals += bits[i];
+        if((nvals > 256) || (end - p < HUFF_MAX_BITS + nvals) ||
+           (make_huff_dec(&huff[t], bits, p + HUFF_MAX_BITS, nvals) < 0))
+            return -1;
+        p += HUFF_MAX_BITS + nvals;
+    }
+
+    if((end - p < 4) || ((int)get_u32(p) != c.nstrips) || ((size_t)(end - p - 4) / 4 < (size_t)c.nstrips))
+        return -1;
+    p += 4;
+
+    if(!(offset = malloc(c.nstrips * sizeof(size_t))) || !(length = malloc(c.nstrips * sizeof(size_t))))
+    {
+        free(offset);
+        return -1;
+    }
+
+    data = p + 4 * (size_t)c.nstrips;
+    for(s=0, pos=0; s < c.nstrips; s++)
+    {
+        offset[s] = pos;
+        length[s] = get_u32(p + 4 * s);
+        pos += length[s];
+    }
+    if(pos > (size_t)(end - data))
+    {
+        free(offset);
+        free(length);
+        return -1;
+    }
+
+    nthreads = threads_or_default(threads);
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1) reduction(|:err)
+    for(s=0; s < c.nstrips; s++)
+    {
+        int by0 = s * c.strip_rows, by1 = (by0 + c.strip_rows < c.bh) ? by0 + c.strip_rows : c.bh;
+        float *work;
+
+        if(!(work = malloc((size_t)c.channels * c.bw * 64 * sizeof(float))))
+        {
+            err = 1;
+            continue;
+        }
+        if(decode_strip(&c, huff, data + offset[s], length[s], by0, by1, pixels, stride, work) < 0)
+            err = 1;
+        free(work);
+    }
+
+    free(offset);
+    free(length);
+
+    return err ? -1 : 0;
+}
@@ -0,0 +1,71 @@
+/*
+ *  Intra-frame block transform codec, the steps of baseline JPEG
+ *
+ *  PART 2 of the dmcomp example: after the 8x8 DCT, the rest of a codec.
+ *
+ *    encode: RGB -> YCbCr, level shift, 8x8 AAN DCT, quantize, zig-zag,
+ *            run-length (run, size) symbols, Huffman coding
+ *    decode: the same steps backwards
+ *
+ *  Any width and height: edge blocks are padded by repeating the last row
+ *  and column.  P5 gray images are coded as Y alone.
+ *
+ *  The image is cut into strips of strip_rows rows of blocks, each coded on
+ *  its own (the DC prediction restarts) into its own part of the stream, so
+ *  strips are encoded and decoded in parallel with OpenMP.  The Huffman
+ *  codes are optimal for the image, built from the symbol counts of a first
+ *  pass, and sent in the stream as JPEG does, counts per length then symbols.
+ *
+ *  Stream, all numbers little-endian:
+ *
+ *    "BCF1", width u32, height u32, channels u8, quality u8, table u8,
+ *    strip_rows u16, 64 luma and 64 chroma quantizers u8 in zig-zag order,
+ *    4 Huffman tables (luma DC, luma AC, chroma DC, chroma AC) each 16
+ *    counts u8 then the symbols u8, strip count u32, each strip's size u32,
+ *    then the strips
+ */
+#ifndef BLOCK_CODEC_H
+#define BLOCK_CODEC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum bc_table
+{
+    BC_TABLE_JPEG,      // ITU T.81 Annex K luminance and chrominance tables
+    BC_TABLE_FLAT,      // 16 for every coefficient, the same error everywhere
+    BC_TABLE_COUNT
+};
+
+struct bc_params
+{
+    int quality;        // 1 to 100, scales the table as libjpeg does, 50 is the table as is
+    int table;          // enum bc_table
+    int strip_rows;     // rows of 8x8 blocks per strip, 0 for the default
+    int threads;        // 0 for the OpenMP default
+};
+
+#define BC_DEFAULT_STRIP_ROWS (4)
+
+// Compress width x height pixels of 1 (gray) or 3 (RGB) channels, rows
+// stride bytes apart.  Returns 0 with a malloc()ed stream, or -1.
+int bc_encode(const unsigned char *pixels, int width, int height, int channels, size_t stride,
+              const struct bc_params *params, unsigned char **stream, size_t *size);
+
+// Shape of a compressed image, returns 0 or -1 if it is not a BCF1 stream
+int bc_info(const unsigned char *stream, size_t size, int *width, int *height, int *channels);
+
+// Decompress into width*channels bytes per row, stride apart.  Returns 0, or
+// -1 for a damaged stream.
+int bc_decode(const unsigned char *stream, size_t size, unsigned char *pixels, size_t stride, int threads);
+
+const char *bc_table_name(int table);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
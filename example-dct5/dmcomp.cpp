@@ -4,7 +4,14 @@
  *  a process similar to MPEG, to provide a simple example.
  *
  *  PART 1: Simple conversion of image to DCT and back with inverse DCT
- *          Shows 8x8 ROI DCT for 320x240 image (40 x 30 8x8 macroblocks)
+ *          Shows 8x8 ROI DCT, e.g. for 320x240 image (40 x 30 8x8 macroblocks)
+ *          Any image size, partial blocks at the right and bottom are left 0
+ *
+ *  PART 2: The rest of the codec, block_codec.c: color transform, DCT,
+ *          quantization, zig-zag, run-length and Huffman coding and back,
+ *          with the compressed size and PSNR at the quality given
+ *
+ *  Usage: dmcomp image.ppm [quality]
  *
  *  Based on numerous code snippets from stackoverflow.com
  *
@@ -12,10 +19,16 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
+#include <math.h>
+
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "block_codec.h"
 
 using namespace cv;
 using namespace std;
@@ -28,17 +41,31 @@ int main( int argc, char** argv )
     IplImage *bf, *gf, *rf;           // float versions
     IplImage *b_dct,*g_dct,*r_dct;    // DCT converted float versions
     IplImage *b_idct,*g_idct,*r_idct; // DCT converted float versions
-    int i, j;
+    IplImage *original, *rgb;         // input kept for PART 2, and as RGB
+    struct bc_params params;
+    unsigned char *stream;
+    size_t size;
+    double sse;
+    int i, j, width, height;
 
     // Read in command line supplied file argument for PPM, JPG, etc.
-    if( argc != 2)
+    if( argc < 2)
     {
-     cout <<" Usage: display_image ImageToLoadAndDisplay" << endl;
+     cout <<" Usage: dmcomp ImageToLoadAndDisplay [quality]" << endl;
      return -1;
     }
 
     // Read in the source image file
-    image = cvLoadImage(argv[1]);
+    if(!(image = cvLoadImage(argv[1])))
+    {
+     cout <<" Can't load " << argv[1] << endl;
+     return -1;
+    }
+    original = cvCloneImage(image);
+
+    // whole 8x8 macroblocks only
+    width = image->width & ~7;
+    height = image->height & ~7;
 
     // Allocate each color band image and set pointer
     b=cvCreateImage(cvGetSize(image),IPL_DEPTH_8U,1);
@@ -63,11 +90,13 @@ int main( int argc, char** argv )
     g_idct=cvCreateImage(cvGetSize(image),IPL_DEPTH_32F,1);
     r_dct=cvCreateImage(cvGetSize(image),IPL_DEPTH_32F,1);
     r_idct=cvCreateImage(cvGetSize(image),IPL_DEPTH_32F,1);
+    cvSetZero(b_dct); cvSetZero(g_dct); cvSetZero(r_dct);
+    cvSetZero(b_idct); cvSetZero(g_idct); cvSetZero(r_idct);
 
     // Transform B with DCT in 8x8 sub-regions
-    for(i=0; i < 320; i=i+8)
+    for(i=0; i < width; i=i+8)
     {
-        for(j=0; j < 240; j=j+8)
+        for(j=0; j < height; j=j+8)
         {
             cvSetImageROI(bf, cvRect(i,j,8,8));
             cvSetImageROI(b_dct, cvRect(i,j,8,8));
@@ -78,9 +107,9 @@ int main( int argc, char** argv )
     cvResetImageROI(b_dct);
 
     // Transform G with DCT in 8x8 sub-regions
-    for(i=0; i < 320; i=i+8)
+    for(i=0; i < width; i=i+8)
     {
-        for(j=0; j < 240; j=j+8)
+        for(j=0; j < height; j=j+8)
         {
             cvSetImageROI(gf, cvRect(i,j,8,8));
             cvSetImageROI(g_dct, cvRect(i,j,8,8));
@@ -91,9 +120,9 @@ int main( int argc, char** argv )
     cvResetImageROI(g_dct);
 
     // Transform R with DCT in 8x8 sub-regions
-    for(i=0; i < 320; i=i+8)
+    for(i=0; i < width; i=i+8)
     {
-        for(j=0; j < 240; j=j+8)
+        for(j=0; j < height; j=j+8)
         {
             cvSetImageROI(rf, cvRect(i,j,8,8));
             cvSetImageROI(r_dct, cvRect(i,j,8,8));
@@ -105,9 +134,9 @@ int main( int argc, char** argv )
 
 
     // Transform with DCT in 8x8 sub-regions
-    for(i=0; i < 320; i=i+8)
+    for(i=0; i < width; i=i+8)
     {
-        for(j=0; j < 240; j=j+8)
+        for(j=0; j < height; j=j+8)
         {
             cvSetImageROI(b_dct, cvRect(i,j,8,8));
             cvSetImageROI(b_idct, cvRect(i,j,8,8));
@@ -118,9 +147,9 @@ int main( int argc, char** argv )
     cvResetImageROI(b_idct);
 
     // Transform with DCT in 8x8 sub-regions
-    for(i=0; i < 320; i=i+8)
+    for(i=0; i < width; i=i+8)
     {
-        for(j=0; j < 240; j=j+8)
+        for(j=0; j < height; j=j+8)
         {
             cvSetImageROI(g_dct, cvRect(i,j,8,8));
             cvSetImageROI(g_idct, cvRect(i,j,8,8));
@@ -131,9 +160,9 @@ int main( int argc, char** argv )
     cvResetImageROI(g_idct);
 
     // Transform with DCT in 8x8 sub-regions
-    for(i=0; i < 320; i=i+8)
+    for(i=0; i < width; i=i+8)
     {
-        for(j=0; j < 240; j=j+8)
+        for(j=0; j < height; j=j+8)
         {
             cvSetImageROI(r_dct, cvRect(i,j,8,8));
             cvSetImageROI(r_idct, cvRect(i,j,8,8));
@@ -181,5 +210,33 @@ int main( int argc, char** argv )
     // Wait for a keystroke in the window
     waitKey(0);
 
+    // PART 2: compress and decompress the original, the codec takes RGB
+    rgb = cvCreateImage(cvGetSize(original), IPL_DEPTH_8U, 3);
+    cvCvtColor(original, rgb, CV_BGR2RGB);
+
+    memset(&params, 0, sizeof(params));
+    params.quality = (argc > 2) ? atoi(argv[2]) : 75;
+    params.table = BC_TABLE_JPEG;
+
+    if(bc_encode((unsigned char *)rgb->imageData, rgb->width, rgb->height, 3, rgb->widthStep, &params,
+                 &stream, &size) != 0 ||
+       bc_decode(stream, size, (unsigned char *)rgb->imageData, rgb->widthStep, 0) != 0)
+    {
+     cout <<" Codec failed" << endl;
+     return -1;
+    }
+    cvCvtColor(rgb, image, CV_RGB2BGR);
+
+    sse = cvNorm(original, image, CV_L2);
+    sse = sse * sse;
+    printf("quality %d: %zu bytes, %.2lf:1, PSNR %.2lf dB\n", params.quality, size,
+           (double)original->width * original->height * 3 / size,
+           10.0 * log10(255.0 * 255.0 * original->width * original->height * 3 / sse));
+    free(stream);
+
+    namedWindow("DECOMPRESSED Display window", CV_WINDOW_AUTOSIZE );
+    cvShowImage("DECOMPRESSED Display window", image);
+    waitKey(0);
+
     return 0;
 };
@@ -0,0 +1,205 @@
+/*
+ *  Fast 8x8 DCT-II and inverse, see fast_dct.h
+ *
+ *  The butterflies are the floating point AAN flow graph as in the IJG
+ *  libjpeg jfdctflt.c and jidctflt.c.  A pass transforms the 8 columns of a
+ *  block at once, lane k of every step being column k, so the loops over k
+ *  vectorize into straight-line vector code.  A block is a column pass, a
+ *  transpose, a column pass and a transposed store with the AAN scale.
+ */
+#include <string.h>
+
+#include "fast_dct.h"
+
+// AAN output scale, cos(k pi/16) * sqrt(2) for k > 0
+#define AAN_0 1.0
+#define AAN_1 1.387039845322148
+#define AAN_2 1.306562964876377
+#define AAN_3 1.175875602419359
+#define AAN_4 1.0
+#define AAN_5 0.785694958387102
+#define AAN_6 0.541196100146197
+#define AAN_7 0.275899379282943
+
+// Forward outputs come out 8 * AAN_u * AAN_v too large, inverse inputs need
+// AAN_u * AAN_v / 8, both tables built at compile time
+#define FWD(u,v) ((float)(1.0 / (8.0 * AAN_##u * AAN_##v)))
+#define INV(u,v) ((float)(AAN_##u * AAN_##v / 8.0))
+#define ROW(f,u) f(u,0), f(u,1), f(u,2), f(u,3), f(u,4), f(u,5), f(u,6), f(u,7)
+
+static const float fwd_scale[64] = { ROW(FWD,0), ROW(FWD,1), ROW(FWD,2), ROW(FWD,3),
+                                     ROW(FWD,4), ROW(FWD,5), ROW(FWD,6), ROW(FWD,7) };
+static const float inv_scale[64] = { ROW(INV,0), ROW(INV,1), ROW(INV,2), ROW(INV,3),
+                                     ROW(INV,4), ROW(INV,5), ROW(INV,6), ROW(INV,7) };
+
+// rotation constants of the flow graph
+#define C_0_707 (0.707106781f)     // cos(4 pi/16)
+#define C_0_382 (0.382683433f)     // cos(6 pi/16)
+#define C_0_541 (0.541196100f)     // cos(2 pi/16) - cos(6 pi/16)
+#define C_1_306 (1.306562965f)     // cos(2 pi/16) + cos(6 pi/16)
+#define C_1_414 (1.414213562f)
+#define C_1_847 (1.847759065f)
+#define C_1_082 (1.082392200f)
+#define C_2_613 (2.613125930f)
+
+// GCC clones the batch functions for AVX2 and picks one when the program loads
+#if defined(__GNUC__) && !defined(__clang__) && (defined(__x86_64__) || defined(__i386__))
+#define DCT_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define DCT_CLONES
+#endif
+
+
+static inline void fdct_pass(float v[8][8])
+{
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12, tmp13, z1, z2, z3, z4, z5, z11, z13;
+    int k;
+
+    for(k=0; k < 8; k++)
+    {
+        tmp0 = v[0][k] + v[7][k];
+        tmp7 = v[0][k] - v[7][k];
+        tmp1 = v[1][k] + v[6][k];
+        tmp6 = v[1][k] - v[6][k];
+        tmp2 = v[2][k] + v[5][k];
+        tmp5 = v[2][k] - v[5][k];
+        tmp3 = v[3][k] + v[4][k];
+        tmp4 = v[3][k] - v[4][k];
+
+        // even part
+        tmp10 = tmp0 + tmp3;
+        tmp13 = tmp0 - tmp3;
+        tmp11 = tmp1 + tmp2;
+        tmp12 = tmp1 - tmp2;
+
+        v[0][k] = tmp10 + tmp11;
+        v[4][k] = tmp10 - tmp11;
+
+        z1 = (tmp12 + tmp13) * C_0_707;
+        v[2][k] = tmp13 + z1;
+        v[6][k] = tmp13 - z1;
+
+        // odd part
+        tmp10 = tmp4 + tmp5;
+        tmp11 = tmp5 + tmp6;
+        tmp12 = tmp6 + tmp7;
+
+        z5 = (tmp10 - tmp12) * C_0_382;
+        z2 = C_0_541 * tmp10 + z5;
+        z4 = C_1_306 * tmp12 + z5;
+        z3 = tmp11 * C_0_707;
+
+        z11 = tmp7 + z3;
+        z13 = tmp7 - z3;
+
+        v[5][k] = z13 + z2;
+        v[3][k] = z13 - z2;
+        v[1][k] = z11 + z4;
+        v[7][k] = z11 - z4;
+    }
+}
+
+static inline void idct_pass(float v[8][8])
+{
+    float tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+    float tmp10, tmp11, tmp12, tmp13, z5, z10, z11, z12, z13;
+    int k;
+
+    for(k=0; k < 8; k++)
+    {
+        // even part
+        tmp10 = v[0][k] + v[4][k];
+        tmp11 = v[0][k] - v[4][k];
+
+        tmp13 = v[2][k] + v[6][k];
+        tmp12 = (v[2][k] - v[6][k]) * C_1_414 - tmp13;
+
+        tmp0 = tmp10 + tmp13;
+        tmp3 = tmp10 - tmp13;
+        tmp1 = tmp11 + tmp12;
+        tmp2 = tmp11 - tmp12;
+
+        // odd part
+        z13 = v[5][k] + v[3][k];
+        z10 = v[5][k] - v[3][k];
+        z11 = v[1][k] + v[7][k];
+        z12 = v[1][k] - v[7][k];
+
+        tmp7 = z11 + z13;
+        tmp11 = (z11 - z13) * C_1_414;
+
+        z5 = (z10 + z12) * C_1_847;
+        tmp10 = C_1_082 * z12 - z5;
+        tmp12 = -C_2_613 * z10 + z5;
+
+        tmp6 = tmp12 - tmp7;
+        tmp5 = tmp11 - tmp6;
+        tmp4 = tmp10 + tmp5;
+
+        v[0][k] = tmp0 + tmp7;
+        v[7][k] = tmp0 - tmp7;
+        v[1][k] = tmp1 + tmp6;
+        v[6][k] = tmp1 - tmp6;
+        v[2][k] = tmp2 + tmp5;
+        v[5][k] = tmp2 - tmp5;
+        v[4][k] = tmp3 + tmp4;
+        v[3][k] = tmp3 - tmp4;
+    }
+}
+
+static inline void transpose(float v[8][8])
+{
+    float t;
+    int i, j;
+
+    for(i=0; i < 8; i++)
+        for(j=i+1; j < 8; j++)
+        {
+            t = v[i][j];
+            v[i][j] = v[j][i];
+            v[j][i] = t;
+        }
+}
+
+DCT_CLONES
+void fast_dct8x8(const float *in, float *out, int nblocks)
+{
+    float v[8][8];
+    int b, i, j;
+
+    for(b=0; b < nblocks; b++, in += 64, out += 64)
+    {
+        memcpy(v, in, sizeof(v));
+
+        fdct_pass(v);       // down the columns, v[u][y]
+        transpose(v);
+        fdct_pass(v);       // down what were the rows, v[v][u]
+
+        for(i=0; i < 8; i++)
+            for(j=0; j < 8; j++)
+                out[i*8 + j] = v[j][i] * fwd_scale[i*8 + j];
+    }
+}
+
+DCT_CLONES
+void fast_idct8x8(const float *in, float *out, int nblocks)
+{
+    float v[8][8];
+    int b, i, j;
+
+    for(b=0; b < nblocks; b++, in += 64, out += 64)
+    {
+        for(i=0; i < 8; i++)
+            for(j=0; j < 8; j++)
+                v[i][j] = in[i*8 + j] * inv_scale[i*8 + j];
+
+        idct_pass(v);       // v[x][v]
+        transpose(v);
+        idct_pass(v);       // v[y][x]
+
+        for(i=0; i < 8; i++)
+            for(j=0; j < 8; j++)
+                out[i*8 + j] = v[j][i];
+    }
+}
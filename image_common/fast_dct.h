@@ -0,0 +1,35 @@
+/*
+ *  Fast 8x8 DCT-II and inverse (DCT-III), AAN algorithm
+ *
+ *  Same transform as dct() and idct() in dct2/dct2.c, Octave dct2() and
+ *  OpenCV cv::dct() on an 8x8 block:
+ *
+ *    F[u][v] = 1/4 C(u) C(v) sum over x, y of
+ *              f[x][y] cos((2x+1) u pi/16) cos((2y+1) v pi/16)
+ *
+ *  with C(0) = 1/sqrt(2), otherwise 1, and f[x][y] row x, column y of the
+ *  block.  Arai, Agui and Nakajima's factorization needs 5 multiplies and 29
+ *  adds per 8 points instead of 64 multiplies; the scaling it leaves in the
+ *  outputs is folded into one precomputed multiply per coefficient.
+ *
+ *  Blocks are 64 floats in row order, any number of them back to back, e.g.
+ *  all 160x120 blocks of a 1280x960 frame.  Each pass runs the butterflies
+ *  on whole rows of 8, so they map to one 8-lane (AVX) or two 4-lane (SSE,
+ *  NEON) vector operations, with an AVX2 clone picked at run time on x86.
+ *  in and out may be the same buffer.
+ */
+#ifndef FAST_DCT_H
+#define FAST_DCT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void fast_dct8x8(const float *in, float *out, int nblocks);
+void fast_idct8x8(const float *in, float *out, int nblocks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,442 @@
+/*
+ *  PPM/PGM (P6/P5) image files, memory mapped, see pnm_io.h
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pnm_io.h"
+
+
+static int is_space(int c)
+{
+    return (c == ' ') || (c == '\t') || (c == '\r') || (c == '\n') || (c == '\v') || (c == '\f');
+}
+
+// Header parser, fed a byte at a time so a header can be parsed from a buffer or a stream.
+// Returns 1 when the header is complete, 0 for more, -1 if it is not a PNM header.
+struct header_state
+{
+    int    field;       // 0 magic, 1 width, 2 height, 3 maxval
+    int    digits;
+    long   value[4];
+    int    comment;
+};
+
+static int header_byte(struct header_state *st, int c, size_t pos)
+{
+    if(pos == 0)
+        return (c == 'P') ? 0 : -1;
+    if(pos == 1)
+    {
+        if((c != '5') && (c != '6'))
+            return -1;
+        st->value[0] = c - '0';
+        st->field = 1;
+        return 0;
+    }
+
+    if(st->comment)
+    {
+        st->comment = (c != '\n') && (c != '\r');
+        return 0;
+    }
+
+    if((c >= '0') && (c <= '9'))
+    {
+        if((st->digits == 0) && (pos == 2))
+            return -1;          // whitespace must follow the magic number
+        st->value[st->field] = (st->value[st->field] * 10) + (c - '0');
+        if(++st->digits > 9)
+            return -1;
+        return 0;
+    }
+
+    if(is_space(c) || (c == '#'))
+    {
+        if(st->digits)
+        {
+            st->digits = 0;
+            // a single whitespace after maxval ends the header, even before a comment
+            if(++st->field == 4)
+                return 1;
+        }
+        st->comment = (c == '#');
+        return 0;
+    }
+
+    return -1;
+}
+
+static int header_finish(struct pnm_image *img, struct header_state *st)
+{
+    if((st->value[1] < 1) || (st->value[2] < 1) || (st->value[3] < 1) || (st->value[3] > 65535))
+        return -1;
+
+    img->channels = (st->value[0] == 6) ? 3 : 1;
+    img->width = (int)st->value[1];
+    img->height = (int)st->value[2];
+    img->maxval = (int)st->value[3];
+    img->sample_bytes = (img->maxval > 255) ? 2 : 1;
+    img->stride = (size_t)img->width * img->channels * img->sample_bytes;
+    img->bytes = img->stride * img->height;
+
+    return 0;
+}
+
+int pnm_parse_header(struct pnm_image *img, const unsigned char *buf, size_t len)
+{
+    struct header_state st;
+    size_t pos;
+    int rc;
+
+    memset(&st, 0, sizeof(st));
+
+    for(pos=0; (pos < len) && (pos < PNM_MAX_HEADER); pos++)
+    {
+        if((rc = header_byte(&st, buf[pos], pos)) < 0)
+            return -1;
+
+        if(rc == 1)
+        {
+            img->header_len = pos + 1;
+            memcpy(img->header, buf, img->header_len);
+            return header_finish(img, &st);
+        }
+    }
+
+    return -1;
+}
+
+int pnm_read_header(struct pnm_image *img, int fd)
+{
+    struct header_state st;
+    unsigned char c;
+    size_t pos;
+    int rc;
+
+    memset(&st, 0, sizeof(st));
+
+    for(pos=0; pos < PNM_MAX_HEADER; pos++)
+    {
+        // a byte at a time, so not a byte of the payload is consumed
+        if(read(fd, &c, 1) != 1)
+            return -1;
+        img->header[pos] = c;
+
+        if((rc = header_byte(&st, c, pos)) < 0)
+            return -1;
+
+        if(rc == 1)
+        {
+            img->header_len = pos + 1;
+            return header_finish(img, &st);
+        }
+    }
+
+    return -1;
+}
+
+
+static int read_all(int fd, unsigned char *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < len)
+    {
+        if((n = read(fd, buf + done, len - done)) <= 0)
+        {
+            if((n < 0) && (errno == EINTR))
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while(done < len)
+    {
+        if((n = write(fd, buf + done, len - done)) <= 0)
+        {
+            if((n < 0) && (errno == EINTR))
+                continue;
+            return -1;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+int pnm_open(struct pnm_image *img, const char *path)
+{
+    struct stat st;
+
+    memset(img, 0, sizeof(*img));
+
+    if(strcmp(path, "-") == 0)
+        img->fd = 0;
+    else if((img->fd = open(path, O_RDONLY)) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if((fstat(img->fd, &st) == 0) && S_ISREG(st.st_mode) && (st.st_size > 0))
+    {
+        img->map_len = st.st_size;
+        img->map = mmap(NULL, img->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, img->fd, 0);
+        if(img->map == MAP_FAILED)
+            img->map = NULL;
+    }
+
+    if(img->map)
+    {
+        img->mapped = 1;
+
+        if((pnm_parse_header(img, img->map, img->map_len) != 0) ||
+           (img->header_len + img->bytes > img->map_len))
+        {
+            fprintf(stderr, "%s: not a complete P5/P6 image\n", path);
+            pnm_close(img);
+            return -1;
+        }
+
+        img->pixels = (unsigned char *)img->map + img->header_len;
+        madvise(img->map, img->map_len, MADV_SEQUENTIAL);
+    }
+    else
+    {
+        // pipes and the like, read it
+        if(pnm_read_header(img, img->fd) != 0)
+        {
+            fprintf(stderr, "%s: not a P5/P6 image\n", path);
+            pnm_close(img);
+            return -1;
+        }
+
+        if(!(img->pixels = malloc(img->bytes)) || (read_all(img->fd, img->pixels, img->bytes) != 0))
+        {
+            fprintf(stderr, "%s: cannot read %zu bytes of pixels\n", path, img->bytes);
+            pnm_close(img);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int create_mapped(struct pnm_image *img, const char *path)
+{
+    struct stat st;
+
+    img->output = 1;
+    img->map_len = img->header_len + img->bytes;
+
+    if(strcmp(path, "-") == 0)
+        img->fd = 1;
+    else if((img->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0)
+    {
+        perror(path);
+        return -1;
+    }
+
+    if(((fstat(img->fd, &st) == 0) && !S_ISREG(st.st_mode)) || ((fcntl(img->fd, F_GETFL) & O_ACCMODE) != O_RDWR))
+    {
+        // e.g. a pipe, or stdout redirected to a file, which is write only and
+        // cannot be mapped: header now and pixels at close
+        if((write_all(img->fd, img->header, img->header_len) != 0) || !(img->pixels = calloc(1, img->bytes)))
+        {
+            perror(path);
+            pnm_close(img);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    if((ftruncate(img->fd, img->map_len) != 0) ||
+       ((img->map = mmap(NULL, img->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, img->fd, 0)) == MAP_FAILED))
+    {
+        img->map = NULL;
+        perror(path);
+        pnm_close(img);
+        return -1;
+    }
+
+    img->mapped = 1;
+    memcpy(img->map, img->header, img->header_len);
+    img->pixels = (unsigned char *)img->map + img->header_len;
+
+    return 0;
+}
+
+int pnm_create(struct pnm_image *img, const char *path, int width, int height, int channels,
+               int maxval, const char *comment)
+{
+    int len;
+
+    memset(img, 0, sizeof(*img));
+
+    if((width < 1) || (height < 1) || ((channels != 1) && (channels != 3)) || (maxval < 1) || (maxval > 65535))
+    {
+        fprintf(stderr, "%s: cannot create a %dx%d %d channel image with maxval %d\n",
+                path, width, height, channels, maxval);
+        return -1;
+    }
+
+    if(comment)
+        len = snprintf((char *)img->header, sizeof(img->header), "P%c\n# %s\n%d %d\n%d\n",
+                       (channels == 3) ? '6' : '5', comment, width, height, maxval);
+    else
+        len = snprintf((char *)img->header, sizeof(img->header), "P%c\n%d %d\n%d\n",
+                       (channels == 3) ? '6' : '5', width, height, maxval);
+
+    if((len < 0) || (len >= (int)sizeof(img->header)))
+    {
+        fprintf(stderr, "%s: header too long\n", path);
+        return -1;
+    }
+
+    img->header_len = len;
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+    img->maxval = maxval;
+    img->sample_bytes = (maxval > 255) ? 2 : 1;
+    img->stride = (size_t)width * channels * img->sample_bytes;
+    img->bytes = img->stride * height;
+
+    return create_mapped(img, path);
+}
+
+int pnm_create_like(struct pnm_image *img, const char *path, const struct pnm_image *src)
+{
+    memset(img, 0, sizeof(*img));
+
+    memcpy(img->header, src->header, src->header_len);
+    img->header_len = src->header_len;
+    img->width = src->width;
+    img->height = src->height;
+    img->channels = src->channels;
+    img->maxval = src->maxval;
+    img->sample_bytes = src->sample_bytes;
+    img->stride = src->stride;
+    img->bytes = src->bytes;
+
+    return create_mapped(img, path);
+}
+
+void pnm_close(struct pnm_image *img)
+{
+    if(img->map)
+        munmap(img->map, img->map_len);
+    else if(img->pixels)
+    {
+        // not mapped, an output image is written now
+        if(img->output && (write_all(img->fd, img->pixels, img->bytes) != 0))
+            perror("pnm_close");
+        free(img->pixels);
+    }
+
+    if(img->fd > 2)
+        close(img->fd);
+
+    img->map = NULL;
+    img->pixels = NULL;
+    img->fd = -1;
+}
+
+
+void pnm_to_planes(const struct pnm_image *img, unsigned char *const planes[])
+{
+    size_t i, n = (size_t)img->width * img->height;
+    const unsigned char *p = img->pixels;
+
+    if(img->channels == 1)
+    {
+        memcpy(planes[0], p, n);
+        return;
+    }
+
+    for(i=0; i < n; i++, p += 3)
+    {
+        planes[0][i] = p[0];
+        planes[1][i] = p[1];
+        planes[2][i] = p[2];
+    }
+}
+
+void pnm_from_planes(struct pnm_image *img, const unsigned char *const planes[])
+{
+    size_t i, n = (size_t)img->width * img->height;
+    unsigned char *p = img->pixels;
+
+    if(img->channels == 1)
+    {
+        memcpy(p, planes[0], n);
+        return;
+    }
+
+    for(i=0; i < n; i++, p += 3)
+    {
+        p[0] = planes[0][i];
+        p[1] = planes[1][i];
+        p[2] = planes[2][i];
+    }
+}
+
+void pnm_to_planes16(const struct pnm_image *img, uint16_t *const planes[])
+{
+    size_t i, n = (size_t)img->width * img->height;
+    const unsigned char *p = img->pixels;
+    int c;
+
+    for(i=0; i < n; i++)
+    {
+        for(c=0; c < img->channels; c++)
+        {
+            if(img->sample_bytes == 2)
+            {
+                planes[c][i] = (uint16_t)((p[0] << 8) | p[1]);
+                p += 2;
+            }
+            else
+                planes[c][i] = *p++;
+        }
+    }
+}
+
+void pnm_from_planes16(struct pnm_image *img, const uint16_t *const planes[])
+{
+    size_t i, n = (size_t)img->width * img->height;
+    unsigned char *p = img->pixels;
+    int c;
+
+    for(i=0; i < n; i++)
+    {
+        for(c=0; c < img->channels; c++)
+        {
+            if(img->sample_bytes == 2)
+            {
+                *p++ = planes[c][i] >> 8;
+                *p++ = planes[c][i] & 0xff;
+            }
+            else
+                *p++ = (unsigned char)planes[c][i];
+        }
+    }
+}
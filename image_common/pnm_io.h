@@ -0,0 +1,85 @@
+/*
+ *  PPM/PGM (P6/P5) image files, memory mapped
+ *
+ *  One header parser for every example: the full netpbm header syntax with
+ *  comments and any whitespace between fields, maxval up to 65535 (16-bit
+ *  samples are big-endian in the file).  The pixel payload is mmap()ed, not
+ *  read, so opening a 12 MP image costs page faults on first touch rather
+ *  than a copy, and an image created for output is written through its
+ *  mapping.  Pipes and other files that cannot be mapped are read instead.
+ *
+ *  The examples mostly work on planar R, G, B arrays; pnm_to_planes() and
+ *  pnm_from_planes() convert between those and the interleaved samples.
+ */
+#ifndef PNM_IO_H
+#define PNM_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PNM_MAX_HEADER (1024)
+
+struct pnm_image
+{
+    int            width;
+    int            height;
+    int            channels;        // 3 for P6, 1 for P5
+    int            maxval;          // 255 or less for 8-bit samples, up to 65535 for 16-bit
+    int            sample_bytes;    // 1 or 2
+    size_t         stride;          // bytes per row, width * channels * sample_bytes
+    size_t         bytes;           // payload bytes, stride * height
+    unsigned char *pixels;          // interleaved payload, in the mapping when mapped
+
+    unsigned char  header[PNM_MAX_HEADER];  // header as in the file, so it can be written back
+    size_t         header_len;
+
+    // private
+    void          *map;
+    size_t         map_len;
+    int            fd;
+    int            mapped;
+    int            output;
+};
+
+// Parse a header from the start of buf.  Returns 0, or -1 if it is not a
+// complete P5/P6 header.
+int pnm_parse_header(struct pnm_image *img, const unsigned char *buf, size_t len);
+
+// Read just the header from a file descriptor, leaving it at the first pixel,
+// for programs that stream the payload themselves (e.g. from stdin)
+int pnm_read_header(struct pnm_image *img, int fd);
+
+// Open an image for reading, "-" for stdin.  Pixels are a private copy-on-write mapping, so
+// they can be changed in place without touching the file.  Returns 0, or -1
+// with a message on stderr.
+int pnm_open(struct pnm_image *img, const char *path);
+
+// Create an image file of the given shape and map it for writing, "-" for stdout.  The
+// header gets the frame size and maxval, with comment as a # line if set.
+int pnm_create(struct pnm_image *img, const char *path, int width, int height, int channels,
+               int maxval, const char *comment);
+
+// Create an image with the same shape and header, comments included, as src
+int pnm_create_like(struct pnm_image *img, const char *path, const struct pnm_image *src);
+
+// Unmap and close, writing back an image from pnm_create()
+void pnm_close(struct pnm_image *img);
+
+// 8-bit images only: split into channels planes of width*height bytes, or
+// interleave them back
+void pnm_to_planes(const struct pnm_image *img, unsigned char *const planes[]);
+void pnm_from_planes(struct pnm_image *img, const unsigned char *const planes[]);
+
+// Any sample size, planes in host order
+void pnm_to_planes16(const struct pnm_image *img, uint16_t *const planes[]);
+void pnm_from_planes16(struct pnm_image *img, const uint16_t *const planes[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,151 @@
+// kmeans_bench.c
+//
+// Color quantization of a full resolution frame with the k-means engine:
+// an image is scaled up bilinearly to width x height (12 MP by default,
+// 4000x3000) and its RGB pixels clustered with plain Lloyd, Lloyd with
+// Hamerly's bounds, and mini-batch, all from the same k-means++ seeds.
+// Reports the time, iterations, share of point to centroid distances
+// actually computed, and the PSNR of the palette mapped image.
+//
+// Usage: kmeans_bench [image.ppm [k [width height [threads [max_iterations]]]]]
+//
+// e.g. kmeans_bench ../openmp-sharpen/Alaska-Bear-1280x960.ppm 16
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "kmeans_engine.h"
+#include "pnm_io.h"
+
+#define DEFAULT_IMAGE "../openmp-sharpen/Alaska-Bear-1280x960.ppm"
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+// bilinear resample of an 8-bit image to width x height floats per channel
+static float *scale_frame(const struct pnm_image *img, int width, int height)
+{
+    float *X = malloc((size_t)width * height * img->channels * sizeof(float));
+    float fx, fy, wx, wy;
+    int x, y, c, x0, y0, x1, y1, ch = img->channels;
+    const unsigned char *r0, *r1;
+
+    if(!X)
+        return NULL;
+
+    for(y=0; y < height; y++)
+    {
+        fy = (height > 1) ? (float)y * (img->height - 1) / (height - 1) : 0.0f;
+        y0 = (int)fy;
+        y1 = (y0 + 1 < img->height) ? y0 + 1 : y0;
+        wy = fy - y0;
+        r0 = img->pixels + y0 * img->stride;
+        r1 = img->pixels + y1 * img->stride;
+
+        for(x=0; x < width; x++)
+        {
+            fx = (width > 1) ? (float)x * (img->width - 1) / (width - 1) : 0.0f;
+            x0 = (int)fx;
+            x1 = (x0 + 1 < img->width) ? x0 + 1 : x0;
+            wx = fx - x0;
+
+            for(c=0; c < ch; c++)
+                X[((size_t)y * width + x) * ch + c] =
+                    (1.0f - wy) * ((1.0f - wx) * r0[x0 * ch + c] + wx * r0[x1 * ch + c]) +
+                    wy * ((1.0f - wx) * r1[x0 * ch + c] + wx * r1[x1 * ch + c]);
+        }
+    }
+
+    return X;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *name = (argc > 1) ? argv[1] : DEFAULT_IMAGE;
+    int k = (argc > 2) ? atoi(argv[2]) : 16;
+    int width = (argc > 4) ? atoi(argv[3]) : 4000, height = (argc > 4) ? atoi(argv[4]) : 3000;
+    int threads = (argc > 5) ? atoi(argv[5]) : 0, max_iterations = (argc > 6) ? atoi(argv[6]) : 100;
+    struct pnm_image img;
+    struct km_params params;
+    struct km_result result;
+    float *X, *seeds, *centroids;
+    int *labels, algorithm, n, dim;
+    double start, seed_sec, sec;
+
+    if((k <= 0) || (width <= 0) || (height <= 0))
+    {
+        printf("Usage: kmeans_bench [image.ppm [k [width height [threads [max_iterations]]]]]\n");
+        exit(-1);
+    }
+
+    if(pnm_open(&img, name) != 0)
+        exit(-1);
+    if(img.sample_bytes != 1)
+    {
+        printf("%s is not an 8-bit image\n", name);
+        exit(-1);
+    }
+
+    n = width * height;
+    dim = img.channels;
+    X = scale_frame(&img, width, height);
+    seeds = malloc(k * dim * sizeof(float));
+    centroids = malloc(k * dim * sizeof(float));
+    labels = malloc((size_t)n * sizeof(int));
+    if(!X || !seeds || !centroids || !labels)
+    {
+        perror("malloc");
+        exit(-1);
+    }
+
+    km_defaults(&params, k);
+    params.threads = threads;
+    params.max_iterations = max_iterations;
+
+    start = now_sec();
+    if(km_seed(X, n, dim, &params, seeds) != 0)
+    {
+        printf("seeding failed\n");
+        exit(-1);
+    }
+    seed_sec = now_sec() - start;
+
+    printf("%s scaled to %dx%d (%.1lf MP), %d channels, k %d, k-means++ on %d points %.3lf sec, %s kernel\n",
+           name, width, height, n / 1000000.0, dim, k, (n < params.seed_sample) ? n : params.seed_sample, seed_sec,
+           km_isa_name(km_kernel_isa()));
+    printf("%-10s %9s %6s %9s %10s %8s\n", "algorithm", "sec", "iter", "distances", "MSE", "PSNR dB");
+
+    params.seed = 0;
+    for(algorithm=0; algorithm < KM_ALGORITHM_COUNT; algorithm++)
+    {
+        params.algorithm = algorithm;
+        memcpy(centroids, seeds, k * dim * sizeof(float));
+
+        start = now_sec();
+        if(km_cluster(X, n, dim, &params, centroids, labels, &result) != 0)
+        {
+            printf("%s failed\n", km_algorithm_name(algorithm));
+            exit(-1);
+        }
+        sec = now_sec() - start;
+
+        printf("%-10s %9.3lf %6d %8.1lf%% %10.3lf %8.2lf\n", km_algorithm_name(algorithm), sec, result.iterations,
+               100.0 * result.distance_ratio, result.inertia / ((double)n * dim),
+               10.0 * log10(255.0 * 255.0 * n * dim / result.inertia));
+    }
+
+    free(X);
+    free(seeds);
+    free(centroids);
+    free(labels);
+    pnm_close(&img);
+    return 0;
+}
@@ -0,0 +1,954 @@
+// kmeans_engine.c
+//
+// Parallel k-means, see kmeans_engine.h
+//
+// The batch pass works on chunks of KM_CHUNK points, each OpenMP thread
+// with its own centroid sums and counts, added up after the pass.  The
+// centroids are also kept transposed, ct[d*kpad + j], padded to a multiple
+// of 8 clusters, so the distances from one point to 8 centroids are one
+// AVX2 or two SSE2/NEON vectors, picked at run time as in psf_kernel.c.
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <float.h>
+#include <omp.h>
+
+#include "kmeans_engine.h"
+
+#define KM_CHUNK (4096)
+#define KM_LANES (8)
+#define KM_FAR   (1.0e30f)          // padding centroid coordinate, its squared distance overflows
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KM_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define KM_NEON
+#include <arm_neon.h>
+#endif
+
+// keys are distance bit patterns with the cluster in the low bits, signed
+// ints as SSE2 has no unsigned compare, and this is above any of them
+#define KM_KEY_MAX (0x7FFFFFFF)
+
+static const char *algorithm_names[KM_ALGORITHM_COUNT] = { "lloyd", "hamerly", "minibatch" };
+
+struct km_state
+{
+    const float *X;
+    int n, dim, k, kpad;
+    unsigned imask;                 // low bits that hold a cluster number
+    int prune;                      // Hamerly bounds
+    int incremental;                // sums hold the last pass, only add the points that changed
+
+    float *cent;                    // k * dim
+    float *ct;                      // transposed, dim * kpad
+    float *half;                    // half the distance to the nearest other centroid
+    float *move;                    // how far each centroid moved in the last update
+    float move1, move2;             // largest and next largest move
+    int far;                        // the centroid that moved the most
+
+    int *labels;
+    float *upper, *lower;           // bounds on the distance to the own and any other centroid
+
+    int isa;                        // enum km_isa of the kernels
+};
+
+
+const char *km_algorithm_name(int algorithm)
+{
+    return ((algorithm >= 0) && (algorithm < KM_ALGORITHM_COUNT)) ? algorithm_names[algorithm] : "unknown";
+}
+
+void km_defaults(struct km_params *params, int k)
+{
+    memset(params, 0, sizeof(*params));
+    params->k = k;
+    params->algorithm = KM_HAMERLY;
+    params->max_iterations = 100;
+    params->tolerance = 0.0;
+    params->batch = KM_DEFAULT_BATCH;
+    params->seed = 1;
+    params->seed_sample = KM_DEFAULT_SEED_SAMPLE;
+    params->random_seed = 1;
+}
+
+static int threads_or_default(int threads)
+{
+    return (threads > 0) ? threads : omp_get_max_threads();
+}
+
+// splitmix64, the same sequence for a seed whatever the thread count
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static double random_unit(uint64_t *state)
+{
+    return (next_random(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static inline float distance_sq(const float *a, const float *b, int dim)
+{
+    float sum = 0.0f, t;
+    int d;
+
+    for(d=0; d < dim; d++)
+    {
+        t = a[d] - b[d];
+        sum += t * t;
+    }
+
+    return sum;
+}
+
+// Each nearest2_*() finds the nearest centroid to x and the squared
+// distance to it, and with want2 a lower bound on the squared distance to
+// the next nearest.  Centroids are taken KM_LANES at a time, and the two
+// smallest keys kept per lane: distance bit patterns, which order like the
+// distances for positive floats, with the cluster number in the low bits.
+// The padding centroids are far enough away to be infinitely distant.
+
+// merge the lanes, the second smallest is the smaller of the lanes' second
+// smallest and the larger of their smallest
+static inline __attribute__((always_inline))
+int merge_lanes(const struct km_state *s, const float *x, const int *m1, const int *m2, int want2,
+                float *d1, float *d2)
+{
+    int b1 = m1[0], b2 = m2[0], hi, l, best, bits;
+
+    for(l=1; l < KM_LANES; l++)
+    {
+        if(want2)
+        {
+            hi = (m1[l] > b1) ? m1[l] : b1;
+            b2 = (m2[l] < b2) ? m2[l] : b2;
+            b2 = (hi < b2) ? hi : b2;
+        }
+        b1 = (m1[l] < b1) ? m1[l] : b1;
+    }
+
+    best = b1 & s->imask;
+    *d1 = distance_sq(x, s->cent + best * s->dim, s->dim);
+
+    // truncated, so never more than the true distance
+    if(want2)
+    {
+        bits = b2 & ~s->imask;
+        memcpy(d2, &bits, sizeof(bits));
+    }
+
+    return best;
+}
+
+static inline __attribute__((always_inline))
+int nearest2_scalar(const struct km_state *s, const float *x, int want2, float *d1, float *d2)
+{
+    int m1[KM_LANES], m2[KM_LANES], bits, key, hi, d, j, l;
+    float acc[KM_LANES], t;
+    const float *row;
+
+    for(l=0; l < KM_LANES; l++)
+        m1[l] = m2[l] = KM_KEY_MAX;
+
+    for(j=0; j < s->kpad; j += KM_LANES)
+    {
+        for(l=0; l < KM_LANES; l++)
+            acc[l] = 0.0f;
+
+        for(d=0; d < s->dim; d++)
+        {
+            row = s->ct + d * s->kpad + j;
+            for(l=0; l < KM_LANES; l++)
+            {
+                t = x[d] - row[l];
+                acc[l] = acc[l] + t * t;
+            }
+        }
+
+        for(l=0; l < KM_LANES; l++)
+        {
+            memcpy(&bits, &acc[l], sizeof(bits));
+            key = (bits & ~s->imask) | (j + l);
+            if(want2)
+            {
+                hi = (key > m1[l]) ? key : m1[l];
+                m2[l] = (hi < m2[l]) ? hi : m2[l];
+            }
+            m1[l] = (key < m1[l]) ? key : m1[l];
+        }
+    }
+
+    return merge_lanes(s, x, m1, m2, want2, d1, d2);
+}
+
+#if defined(KM_X86)
+
+__attribute__((target("sse2")))
+static inline __m128i min_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+
+    return _mm_or_si128(_mm_and_si128(gt, b), _mm_andnot_si128(gt, a));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i max_epi32_sse2(__m128i a, __m128i b)
+{
+    __m128i gt = _mm_cmpgt_epi32(a, b);
+
+    return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+}
+
+__attribute__((target("sse2"), always_inline))
+static inline int nearest2_sse2(const struct km_state *s, const float *x, int want2, float *d1, float *d2)
+{
+    const __m128i mask = _mm_set1_epi32(~s->imask), four = _mm_set1_epi32(4);
+    __m128i m1lo = _mm_set1_epi32(KM_KEY_MAX), m1hi = m1lo, m2lo = m1lo, m2hi = m1lo, key;
+    __m128i idx = _mm_setr_epi32(0, 1, 2, 3);
+    __m128 lo, hi, xd, t;
+    int m1[KM_LANES], m2[KM_LANES], d, j;
+    const float *row;
+
+    for(j=0; j < s->kpad; j += KM_LANES)
+    {
+        lo = hi = _mm_setzero_ps();
+
+        for(d=0; d < s->dim; d++)
+        {
+            row = s->ct + d * s->kpad + j;
+            xd = _mm_set1_ps(x[d]);
+            t = _mm_sub_ps(xd, _mm_loadu_ps(row));
+            lo = _mm_add_ps(lo, _mm_mul_ps(t, t));
+            t = _mm_sub_ps(xd, _mm_loadu_ps(row + 4));
+            hi = _mm_add_ps(hi, _mm_mul_ps(t, t));
+        }
+
+        key = _mm_or_si128(_mm_and_si128(_mm_castps_si128(lo), mask), idx);
+        if(want2)
+            m2lo = min_epi32_sse2(m2lo, max_epi32_sse2(m1lo, key));
+        m1lo = min_epi32_sse2(m1lo, key);
+        idx = _mm_add_epi32(idx, four);
+
+        key = _mm_or_si128(_mm_and_si128(_mm_castps_si128(hi), mask), idx);
+        if(want2)
+            m2hi = min_epi32_sse2(m2hi, max_epi32_sse2(m1hi, key));
+        m1hi = min_epi32_sse2(m1hi, key);
+        idx = _mm_add_epi32(idx, four);
+    }
+
+    _mm_storeu_si128((__m128i *)m1, m1lo);
+    _mm_storeu_si128((__m128i *)(m1 + 4), m1hi);
+    _mm_storeu_si128((__m128i *)m2, m2lo);
+    _mm_storeu_si128((__m128i *)(m2 + 4), m2hi);
+
+    return merge_lanes(s, x, m1, m2, want2, d1, d2);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline int nearest2_avx2(const struct km_state *s, const float *x, int want2, float *d1, float *d2)
+{
+    const __m256i mask = _mm256_set1_epi32(~s->imask), eight = _mm256_set1_epi32(8);
+    __m256i m1v = _mm256_set1_epi32(KM_KEY_MAX), m2v = m1v, key;
+    __m256i idx = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256 acc, t;
+    int m1[KM_LANES], m2[KM_LANES], d, j;
+
+    for(j=0; j < s->kpad; j += KM_LANES)
+    {
+        acc = _mm256_setzero_ps();
+
+        // multiply then add, no FMA, to give the same sums as the other kernels
+        for(d=0; d < s->dim; d++)
+        {
+            t = _mm256_sub_ps(_mm256_set1_ps(x[d]), _mm256_loadu_ps(s->ct + d * s->kpad + j));
+            acc = _mm256_add_ps(acc, _mm256_mul_ps(t, t));
+        }
+
+        key = _mm256_or_si256(_mm256_and_si256(_mm256_castps_si256(acc), mask), idx);
+        if(want2)
+            m2v = _mm256_min_epi32(m2v, _mm256_max_epi32(m1v, key));
+        m1v = _mm256_min_epi32(m1v, key);
+        idx = _mm256_add_epi32(idx, eight);
+    }
+
+    _mm256_storeu_si256((__m256i *)m1, m1v);
+    _mm256_storeu_si256((__m256i *)m2, m2v);
+
+    return merge_lanes(s, x, m1, m2, want2, d1, d2);
+}
+
+#endif
+
+#if defined(KM_NEON)
+
+static inline __attribute__((always_inline))
+int nearest2_neon(const struct km_state *s, const float *x, int want2, float *d1, float *d2)
+{
+    const int32x4_t mask = vdupq_n_s32(~s->imask), four = vdupq_n_s32(4);
+    const int32_t first[4] = { 0, 1, 2, 3 };
+    int32x4_t m1lo = vdupq_n_s32(KM_KEY_MAX), m1hi = m1lo, m2lo = m1lo, m2hi = m1lo, key;
+    int32x4_t idx = vld1q_s32(first);
+    float32x4_t lo, hi, xd, t;
+    int m1[KM_LANES], m2[KM_LANES], d, j;
+    const float *row;
+
+    for(j=0; j < s->kpad; j += KM_LANES)
+    {
+        lo = hi = vdupq_n_f32(0.0f);
+
+        for(d=0; d < s->dim; d++)
+        {
+            row = s->ct + d * s->kpad + j;
+            xd = vdupq_n_f32(x[d]);
+            t = vsubq_f32(xd, vld1q_f32(row));
+            lo = vaddq_f32(lo, vmulq_f32(t, t));
+            t = vsubq_f32(xd, vld1q_f32(row + 4));
+            hi = vaddq_f32(hi, vmulq_f32(t, t));
+        }
+
+        key = vorrq_s32(vandq_s32(vreinterpretq_s32_f32(lo), mask), idx);
+        if(want2)
+            m2lo = vminq_s32(m2lo, vmaxq_s32(m1lo, key));
+        m1lo = vminq_s32(m1lo, key);
+        idx = vaddq_s32(idx, four);
+
+        key = vorrq_s32(vandq_s32(vreinterpretq_s32_f32(hi), mask), idx);
+        if(want2)
+            m2hi = vminq_s32(m2hi, vmaxq_s32(m1hi, key));
+        m1hi = vminq_s32(m1hi, key);
+        idx = vaddq_s32(idx, four);
+    }
+
+    vst1q_s32(m1, m1lo);
+    vst1q_s32(m1 + 4, m1hi);
+    vst1q_s32(m2, m2lo);
+    vst1q_s32(m2 + 4, m2hi);
+
+    return merge_lanes(s, x, m1, m2, want2, d1, d2);
+}
+
+#endif
+
+
+typedef int (*nearest_fn)(const struct km_state *s, const float *x, int want2, float *d1, float *d2);
+
+// One batch pass over points i0 to i1: assign, add to this thread's sums,
+// or when incremental move only the points that changed between them,
+// return how many points changed cluster
+static inline __attribute__((always_inline))
+long batch_body(const struct km_state *s, int i0, int i1, double *sum, long *count, long *evals, nearest_fn nearest)
+{
+    const float *x;
+    float u, l, m, d1, d2;
+    long changes = 0;
+    int i, d, a, b;
+
+    for(i=i0; i < i1; i++)
+    {
+        x = s->X + (size_t)i * s->dim;
+        a = s->labels[i];
+
+        if(s->prune)
+        {
+            // the centroids moved since the bounds were set
+            u = s->upper[i] + s->move[a];
+            l = s->lower[i] - ((a == s->far) ? s->move2 : s->move1);
+            m = (s->half[a] > l) ? s->half[a] : l;
+
+            if(u > m)
+            {
+                u = sqrtf(distance_sq(x, s->cent + a * s->dim, s->dim));
+                (*evals)++;
+            }
+
+            if(u > m)
+            {
+                b = nearest(s, x, 1, &d1, &d2);
+                *evals += s->k;
+                u = sqrtf(d1);
+                l = sqrtf(d2);
+            }
+            else
+                b = a;
+
+            s->upper[i] = u;
+            s->lower[i] = l;
+        }
+        else
+        {
+            b = nearest(s, x, 0, &d1, &d2);
+            *evals += s->k;
+        }
+
+        if(b != a)
+        {
+            s->labels[i] = b;
+            changes++;
+
+            if(s->incremental)
+            {
+                count[a]--;
+                count[b]++;
+                for(d=0; d < s->dim; d++)
+                {
+                    sum[a * s->dim + d] -= x[d];
+                    sum[b * s->dim + d] += x[d];
+                }
+            }
+        }
+
+        if(!s->incremental)
+        {
+            count[b]++;
+            for(d=0; d < s->dim; d++)
+                sum[b * s->dim + d] += x[d];
+        }
+    }
+
+    return changes;
+}
+
+// Label points i0 to i1 of X, return their squared distances
+static inline __attribute__((always_inline))
+double assign_body(const struct km_state *s, const float *X, int i0, int i1, int *labels, nearest_fn nearest)
+{
+    double inertia = 0.0;
+    float d1, d2;
+    int i;
+
+    for(i=i0; i < i1; i++)
+    {
+        labels[i] = nearest(s, X + (size_t)i * s->dim, 0, &d1, &d2);
+        inertia += d1;
+    }
+
+    return inertia;
+}
+
+#define KM_KERNELS(isa, target) \
+    target static long batch_##isa(const struct km_state *s, int i0, int i1, double *sum, long *count, long *evals) \
+    { return batch_body(s, i0, i1, sum, count, evals, nearest2_##isa); } \
+    target static double assign_##isa(const struct km_state *s, const float *X, int i0, int i1, int *labels) \
+    { return assign_body(s, X, i0, i1, labels, nearest2_##isa); }
+
+KM_KERNELS(scalar, )
+#if defined(KM_X86)
+KM_KERNELS(sse2, __attribute__((target("sse2"))))
+KM_KERNELS(avx2, __attribute__((target("avx2"))))
+#endif
+#if defined(KM_NEON)
+KM_KERNELS(neon, )
+#endif
+
+typedef long (*batch_fn)(const struct km_state *s, int i0, int i1, double *sum, long *count, long *evals);
+typedef double (*assign_fn)(const struct km_state *s, const float *X, int i0, int i1, int *labels);
+
+static const struct
+{
+    const char *name;
+    batch_fn    batch;
+    assign_fn   assign;
+} kernels[KM_ISA_COUNT] =
+{
+    { "scalar", batch_scalar, assign_scalar },
+#if defined(KM_X86)
+    { "sse2",   batch_sse2,   assign_sse2 },
+    { "avx2",   batch_avx2,   assign_avx2 },
+#else
+    { "sse2",   NULL,         NULL },
+    { "avx2",   NULL,         NULL },
+#endif
+#if defined(KM_NEON)
+    { "neon",   batch_neon,   assign_neon }
+#else
+    { "neon",   NULL,         NULL }
+#endif
+};
+
+static int selected_isa = -1;
+
+
+int km_isa_supported(int isa)
+{
+    if((isa < 0) || (isa >= KM_ISA_COUNT) || !kernels[isa].batch)
+        return 0;
+
+#if defined(KM_X86)
+    __builtin_cpu_init();
+    if(isa == KM_ISA_SSE2) return __builtin_cpu_supports("sse2");
+    if(isa == KM_ISA_AVX2) return __builtin_cpu_supports("avx2");
+#endif
+
+    return 1;
+}
+
+int km_kernel_select(int isa)
+{
+    if(!km_isa_supported(isa))
+        return -1;
+
+    selected_isa = isa;
+    return 0;
+}
+
+int km_kernel_isa(void)
+{
+    int isa;
+
+    if(selected_isa < 0)
+    {
+        for(isa = KM_ISA_COUNT - 1; isa > KM_ISA_SCALAR; isa--)
+            if(km_isa_supported(isa))
+                break;
+
+        selected_isa = isa;
+    }
+
+    return selected_isa;
+}
+
+const char *km_isa_name(int isa)
+{
+    if((isa < 0) || (isa >= KM_ISA_COUNT))
+        return "unknown";
+
+    return kernels[isa].name;
+}
+
+
+static void transpose_centroids(struct km_state *s)
+{
+    int d, j;
+
+    for(d=0; d < s->dim; d++)
+        for(j=0; j < s->kpad; j++)
+            s->ct[d * s->kpad + j] = (j < s->k) ? s->cent[j * s->dim + d] : KM_FAR;
+}
+
+static void half_distances(struct km_state *s)
+{
+    float m, t;
+    int i, j;
+
+    for(i=0; i < s->k; i++)
+    {
+        for(j=0, m=FLT_MAX; j < s->k; j++)
+            if((j != i) && ((t = distance_sq(s->cent + i * s->dim, s->cent + j * s->dim, s->dim)) < m))
+                m = t;
+        s->half[i] = (m == FLT_MAX) ? FLT_MAX : 0.5f * sqrtf(m);
+    }
+}
+
+// New centroids from the sums and counts of all points, returns the
+// largest move.  An empty cluster keeps its centroid.
+static double update_centroids(struct km_state *s, const double *sums, const long *counts)
+{
+    float old[KM_MAX_DIM];
+    int j, d;
+
+    s->move1 = s->move2 = 0.0f;
+    s->far = -1;
+
+    for(j=0; j < s->k; j++)
+    {
+        s->move[j] = 0.0f;
+        if(counts[j] > 0)
+        {
+            memcpy(old, s->cent + j * s->dim, s->dim * sizeof(float));
+            for(d=0; d < s->dim; d++)
+                s->cent[j * s->dim + d] = (float)(sums[j * s->dim + d] / counts[j]);
+            s->move[j] = sqrtf(distance_sq(old, s->cent + j * s->dim, s->dim));
+        }
+
+        if(s->move[j] > s->move1)
+        {
+            s->move2 = s->move1;
+            s->move1 = s->move[j];
+            s->far = j;
+        }
+        else if(s->move[j] > s->move2)
+            s->move2 = s->move[j];
+    }
+
+    transpose_centroids(s);
+    half_distances(s);
+
+    return s->move1;
+}
+
+static int init_state(struct km_state *s, const float *X, int n, int dim, int k, float *centroids)
+{
+    memset(s, 0, sizeof(*s));
+    s->X = X;
+    s->n = n;
+    s->dim = dim;
+    s->k = k;
+    s->kpad = (k + KM_LANES - 1) / KM_LANES * KM_LANES;
+    for(s->imask=1; (int)s->imask < s->kpad; s->imask <<= 1)
+        ;
+    s->imask--;
+    s->cent = centroids;
+    s->isa = km_kernel_isa();
+
+    if(!(s->ct = malloc((size_t)dim * s->kpad * sizeof(float))) ||
+       !(s->half = malloc(k * sizeof(float))) || !(s->move = calloc(k, sizeof(float))))
+        return -1;
+
+    transpose_centroids(s);
+    half_distances(s);
+    return 0;
+}
+
+static void free_state(struct km_state *s)
+{
+    free(s->ct);
+    free(s->half);
+    free(s->move);
+    free(s->upper);
+    free(s->lower);
+}
+
+
+// Label n points of X in parallel chunks, returns the inertia or -1.0
+static double assign_points(const struct km_state *s, const float *X, int n, int *labels, int nthreads)
+{
+    double inertia = 0.0;
+    int nchunks = (n + KM_CHUNK - 1) / KM_CHUNK, c;
+
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic, 1) reduction(+:inertia)
+    for(c=0; c < nchunks; c++)
+    {
+        int i1 = (c * KM_CHUNK + KM_CHUNK < n) ? c * KM_CHUNK + KM_CHUNK : n;
+
+        inertia += kernels[s->isa].assign(s, X, c * KM_CHUNK, i1, labels);
+    }
+
+    return inertia;
+}
+
+double km_assign(const float *X, int n, int dim, const float *centroids, int k, int *labels, int threads)
+{
+    struct km_state s;
+    double inertia;
+
+    if((n <= 0) || (dim <= 0) || (dim > KM_MAX_DIM) || (k <= 0))
+        return -1.0;
+
+    if(init_state(&s, X, n, dim, k, (float *)centroids) != 0)
+    {
+        free_state(&s);
+        return -1.0;
+    }
+
+    inertia = assign_points(&s, X, n, labels, threads_or_default(threads));
+    free_state(&s);
+    return inertia;
+}
+
+// sum of squared distances to the labelled centroids
+static double own_inertia(const struct km_state *s, int nthreads)
+{
+    double inertia = 0.0;
+    int i;
+
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+:inertia)
+    for(i=0; i < s->n; i++)
+        inertia += distance_sq(s->X + (size_t)i * s->dim, s->cent + s->labels[i] * s->dim, s->dim);
+
+    return inertia;
+}
+
+
+int km_seed(const float *X, int n, int dim, const struct km_params *params, float *centroids)
+{
+    uint64_t state = params->random_seed;
+    int m = (params->seed_sample > 0) ? params->seed_sample : KM_DEFAULT_SEED_SAMPLE;
+    int nthreads = threads_or_default(params->threads), c, i, pick;
+    float *sample = NULL, *d2;
+    const float *xs = X, *x;
+    double total, r;
+
+    if((n <= 0) || (dim <= 0) || (dim > KM_MAX_DIM) || (params->k <= 0) || (params->k > n))
+        return -1;
+
+    // seeding is k passes over the points, on a sample it does not grow with the frame
+    if(m < n)
+    {
+        if(!(sample = malloc((size_t)m * dim * sizeof(float))))
+            return -1;
+        for(i=0; i < m; i++)
+            memcpy(sample + (size_t)i * dim, X + (next_random(&state) % n) * dim, dim * sizeof(float));
+        xs = sample;
+    }
+    else
+        m = n;
+
+    if(!(d2 = malloc((size_t)m * sizeof(float))))
+    {
+        free(sample);
+        return -1;
+    }
+
+    pick = next_random(&state) % m;
+    memcpy(centroids, xs + (size_t)pick * dim, dim * sizeof(float));
+
+    for(c=1; c < params->k; c++)
+    {
+        x = centroids + (c - 1) * dim;
+        total = 0.0;
+
+        // squared distance to the nearest centroid so far
+#pragma omp parallel for num_threads(nthreads) schedule(static) reduction(+:total)
+        for(i=0; i < m; i++)
+        {
+            float t = distance_sq(xs + (size_t)i * dim, x, dim);
+
+            if((c == 1) || (t < d2[i]))
+                d2[i] = t;
+            total += d2[i];
+        }
+
+        // next centroid with probability proportional to that distance
+        if(total > 0.0)
+        {
+            r = random_unit(&state) * total;
+            for(pick=0; (pick < m - 1) && ((r -= d2[pick]) >= 0.0); pick++)
+                ;
+        }
+        else
+            pick = next_random(&state) % m;
+
+        memcpy(centroids + c * dim, xs + (size_t)pick * dim, dim * sizeof(float));
+    }
+
+    free(d2);
+    free(sample);
+    return 0;
+}
+
+
+// With Hamerly's bounds few points change cluster once the centroids
+// settle, so after the first pass the totals are kept and only the points
+// that changed are moved between them, instead of adding up every point.
+static int batch_kmeans(struct km_state *s, const struct km_params *params, int nthreads, struct km_result *result)
+{
+    double *sums, *total_sums, shift, inertia;
+    long *counts, *total_counts, changes = 0, evals = 0, passes = 0;
+    int nchunks = (s->n + KM_CHUNK - 1) / KM_CHUNK, it, i, c, t, ks = s->k * s->dim;
+
+    sums = malloc((size_t)nthreads * ks * sizeof(double));
+    counts = malloc((size_t)nthreads * s->k * sizeof(long));
+    total_sums = malloc((size_t)ks * sizeof(double));
+    total_counts = malloc((size_t)s->k * sizeof(long));
+
+    if(s->prune)
+    {
+        s->upper = malloc((size_t)s->n * sizeof(float));
+        s->lower = malloc((size_t)s->n * sizeof(float));
+    }
+
+    if(!sums || !counts || !total_sums || !total_counts || (s->prune && (!s->upper || !s->lower)))
+    {
+        free(sums);
+        free(counts);
+        free(total_sums);
+        free(total_counts);
+        return -1;
+    }
+
+    for(i=0; i < s->n; i++)
+        s->labels[i] = 0;
+    if(s->prune)
+        for(i=0; i < s->n; i++)
+        {
+            s->upper[i] = FLT_MAX;
+            s->lower[i] = 0.0f;
+        }
+
+    for(it=0; it < params->max_iterations; it++)
+    {
+        memset(sums, 0, (size_t)nthreads * ks * sizeof(double));
+        memset(counts, 0, (size_t)nthreads * s->k * sizeof(long));
+        changes = 0;
+        s->incremental = s->prune && (it > 0);
+
+#pragma omp parallel num_threads(nthreads) reduction(+:changes, evals)
+        {
+            int t = omp_get_thread_num();
+
+#pragma omp for schedule(dynamic, 1)
+            for(c=0; c < nchunks; c++)
+            {
+                int i1 = (c * KM_CHUNK + KM_CHUNK < s->n) ? c * KM_CHUNK + KM_CHUNK : s->n;
+
+                changes += kernels[s->isa].batch(s, c * KM_CHUNK, i1, sums + (size_t)t * ks, counts + t * s->k, &evals);
+            }
+        }
+        passes++;
+
+        if(!s->incremental)
+        {
+            memset(total_sums, 0, (size_t)ks * sizeof(double));
+            memset(total_counts, 0, (size_t)s->k * sizeof(long));
+        }
+        for(t=0; t < nthreads; t++)
+        {
+            for(i=0; i < ks; i++)
+                total_sums[i] += sums[(size_t)t * ks + i];
+            for(i=0; i < s->k; i++)
+                total_counts[i] += counts[t * s->k + i];
+        }
+
+        shift = update_centroids(s, total_sums, total_counts);
+
+        // the first pass labels everything, after that no change is convergence
+        if(((it > 0) && (changes == 0)) || (shift <= params->tolerance))
+        {
+            it++;
+            break;
+        }
+    }
+
+    // out of iterations, label with the nearest of the final centroids
+    inertia = changes ? assign_points(s, s->X, s->n, s->labels, nthreads) : own_inertia(s, nthreads);
+
+    if(result)
+    {
+        result->iterations = it;
+        result->changes = changes;
+        result->inertia = inertia;
+        result->distance_ratio = (double)evals / ((double)s->n * s->k * passes);
+    }
+
+    free(sums);
+    free(counts);
+    free(total_sums);
+    free(total_counts);
+    return (inertia < 0.0) ? -1 : 0;
+}
+
+static int minibatch_kmeans(struct km_state *s, const struct km_params *params, int nthreads,
+                            struct km_result *result)
+{
+    uint64_t state = params->random_seed ^ 0x5DEECE66DULL;
+    int b = (params->batch > 0) ? params->batch : KM_DEFAULT_BATCH, it, i, j, d;
+    float *xb, old[KM_MAX_DIM], eta, shift = 0.0f, t;
+    double inertia;
+    int *lb;
+    long *seen;
+    const float *x;
+
+    if(b > s->n)
+        b = s->n;
+
+    xb = malloc((size_t)b * s->dim * sizeof(float));
+    lb = malloc((size_t)b * sizeof(int));
+    seen = malloc((size_t)s->k * sizeof(long));
+
+    if(!xb || !lb || !seen)
+    {
+        free(xb);
+        free(lb);
+        free(seen);
+        return -1;
+    }
+
+    // the starting centroid counts as one sample
+    for(j=0; j < s->k; j++)
+        seen[j] = 1;
+
+    for(it=0; it < params->max_iterations; it++)
+    {
+        for(i=0; i < b; i++)
+            memcpy(xb + (size_t)i * s->dim, s->X + (next_random(&state) % s->n) * s->dim, s->dim * sizeof(float));
+
+        // a batch is small, one thread labels it faster than waking the others
+        kernels[s->isa].assign(s, xb, 0, b, lb);
+
+        // move each centroid towards its points with a rate of 1 / points seen
+        for(j=0; j < s->k; j++)
+            s->move[j] = 0.0f;
+        for(i=0; i < b; i++)
+        {
+            j = lb[i];
+            x = xb + (size_t)i * s->dim;
+            eta = 1.0f / ++seen[j];
+
+            memcpy(old, s->cent + j * s->dim, s->dim * sizeof(float));
+            for(d=0; d < s->dim; d++)
+                s->cent[j * s->dim + d] += eta * (x[d] - s->cent[j * s->dim + d]);
+            s->move[j] += sqrtf(distance_sq(old, s->cent + j * s->dim, s->dim));
+        }
+        transpose_centroids(s);
+
+        for(j=0, shift=0.0f; j < s->k; j++)
+            if((t = s->move[j]) > shift)
+                shift = t;
+        if(shift <= params->tolerance)
+        {
+            it++;
+            break;
+        }
+    }
+
+    free(xb);
+    free(lb);
+    free(seen);
+
+    // then every point, in parallel
+    if((inertia = assign_points(s, s->X, s->n, s->labels, nthreads)) < 0.0)
+        return -1;
+
+    if(result)
+    {
+        result->iterations = it;
+        result->changes = 0;
+        result->inertia = inertia;
+        result->distance_ratio = 1.0;
+    }
+
+    return 0;
+}
+
+
+int km_cluster(const float *X, int n, int dim, const struct km_params *params, float *centroids, int *labels,
+               struct km_result *result)
+{
+    struct km_state s;
+    int nthreads, rc;
+
+    if((n <= 0) || (dim <= 0) || (dim > KM_MAX_DIM) || !params || (params->k <= 0) || (params->k > n) ||
+       (params->algorithm < 0) || (params->algorithm >= KM_ALGORITHM_COUNT) || (params->max_iterations <= 0))
+        return -1;
+
+    if(params->seed && (km_seed(X, n, dim, params, centroids) != 0))
+        return -1;
+
+    nthreads = threads_or_default(params->threads);
+
+    if(init_state(&s, X, n, dim, params->k, centroids) != 0)
+    {
+        free_state(&s);
+        return -1;
+    }
+    s.labels = labels;
+    s.prune = (params->algorithm == KM_HAMERLY);
+
+    if(params->algorithm == KM_MINIBATCH)
+        rc = minibatch_kmeans(&s, params, nthreads, result);
+    else
+        rc = batch_kmeans(&s, params, nthreads, result);
+
+    free_state(&s);
+    return rc;
+}
@@ -0,0 +1,105 @@
+// kmeans_engine.h
+//
+// Scalable k-means for full resolution frames, e.g. color quantization of a
+// 12 MP image, rather than the 30x40 thumbnail in image.h.
+//
+//   k-means++ seeding (Arthur and Vassilvitskii 2007), on a random sample of
+//   the points when there are many
+//
+//   KM_LLOYD     plain batch iterations, every point to every centroid
+//   KM_HAMERLY   the same result, but an upper bound on the distance to the
+//                own centroid and a lower bound on the distance to any other
+//                skip most distance computations once centroids settle
+//                (Hamerly 2010); two floats per point, no n*k matrix, and
+//                only the points that changed cluster update the sums
+//   KM_MINIBATCH small random batches with per-centroid learning rates
+//                (Sculley 2010), then one pass to label every point
+//
+// Points are n rows of dim floats.  Assignment runs in parallel with OpenMP
+// over chunks of points, and the distances from a point to the centroids
+// are computed 8 centroids at a time in SIMD lanes, with the kernel for the
+// CPU picked at run time.
+//
+#ifndef KMEANS_ENGINE_H
+#define KMEANS_ENGINE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum km_algorithm
+{
+    KM_LLOYD,
+    KM_HAMERLY,
+    KM_MINIBATCH,
+    KM_ALGORITHM_COUNT
+};
+
+enum km_isa
+{
+    KM_ISA_SCALAR,
+    KM_ISA_SSE2,
+    KM_ISA_AVX2,
+    KM_ISA_NEON,
+    KM_ISA_COUNT
+};
+
+#define KM_MAX_DIM (16)
+
+struct km_params
+{
+    int      k;
+    int      algorithm;        // enum km_algorithm
+    int      max_iterations;   // batch iterations, or mini-batches
+    double   tolerance;        // stop when no centroid moves further than this
+    int      batch;            // mini-batch size, 0 for the default
+    int      seed;             // 1 for k-means++, 0 to start from the centroids passed in
+    int      seed_sample;      // k-means++ on at most this many points, 0 for the default
+    unsigned random_seed;
+    int      threads;          // 0 for the OpenMP default
+};
+
+struct km_result
+{
+    int    iterations;
+    int    changes;            // points that changed cluster in the last batch iteration
+    double inertia;            // sum of squared distances to the assigned centroids
+    double distance_ratio;     // point to centroid distances computed / (n * k * passes)
+};
+
+#define KM_DEFAULT_BATCH       (4096)
+#define KM_DEFAULT_SEED_SAMPLE (65536)
+
+// Fill params with the defaults for k clusters, Hamerly from k-means++
+void km_defaults(struct km_params *params, int k);
+
+// Cluster n points of dim floats into params->k centroids (k * dim floats,
+// in and out) and write each point's cluster to labels.  result may be
+// NULL.  Returns 0, or -1 for bad arguments or no memory.
+int km_cluster(const float *X, int n, int dim, const struct km_params *params, float *centroids, int *labels,
+               struct km_result *result);
+
+// k-means++ seeding only
+int km_seed(const float *X, int n, int dim, const struct km_params *params, float *centroids);
+
+// Label every point with its nearest centroid, returns the inertia or -1.0
+double km_assign(const float *X, int n, int dim, const float *centroids, int k, int *labels, int threads);
+
+const char *km_algorithm_name(int algorithm);
+
+// returns non-zero when the kernel can run on this CPU
+int km_isa_supported(int isa);
+
+// returns 0 and selects isa, or -1 if it is not supported
+int km_kernel_select(int isa);
+
+// currently selected kernel, the best supported unless one was selected
+int km_kernel_isa(void);
+
+const char *km_isa_name(int isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,423 @@
+// kmquant.c
+//
+// k-means color quantization and segmentation of real frames: a PPM/PGM
+// image, or a sequence of frames from one of the replayable capture
+// sources in capture_common (synth, dir: or raw:), clustered in RGB or
+// CIELAB with the parallel engine in kmeans_engine.c.
+//
+// For each frame it writes the palette mapped image, every pixel replaced
+// by its centroid, and the label map, a PGM whose samples are the cluster
+// numbers (maxval k-1, 16-bit when k > 256).  PGM input is clustered on
+// its gray level.
+//
+// On a sequence each frame starts from the previous frame's centroids, so
+// a frame that differs little from the last converges in an iteration or
+// two, and cluster j stays the same segment from frame to frame.  -c
+// seeds every frame with k-means++ instead, for comparison.  A frame has
+// converged when no centroid moves more than the -e tolerance, 0.5 by
+// default, in 0-255 RGB or Lab units.
+//
+// Usage: kmquant [-k clusters] [-s rgb|lab] [-a lloyd|hamerly|minibatch]
+//                [-i max_iterations] [-e tolerance] [-n frames]
+//                [-W width] [-H height] [-t threads] [-c] input [output_prefix]
+//
+// e.g. kmquant -k 8 -s lab ../openmp-sharpen/Alaska-Bear-1280x960.ppm bear
+//      writes bear-quant.ppm and bear-labels.pgm
+//      kmquant -k 6 -n 60 synth:box seg
+//      writes seg-0000-quant.ppm, seg-0000-labels.pgm, ... for 60 frames
+
+#include <math.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kmeans_engine.h"
+#include "pnm_io.h"
+#include "frame_source.h"
+#include "yuv_convert.h"
+
+typedef unsigned char UINT8;
+
+enum color_space
+{
+    SPACE_RGB,
+    SPACE_LAB,
+    SPACE_COUNT
+};
+
+static const char *space_names[SPACE_COUNT] = { "rgb", "lab" };
+
+// D65 white
+#define XN (0.95047f)
+#define YN (1.00000f)
+#define ZN (1.08883f)
+
+// lab_f() sampled over X/XN, Y/YN and Z/ZN of 8-bit sRGB, 0 to just above 1
+#define LAB_TABLE (4096)
+#define LAB_RANGE (1.0f + 1.0f / 64.0f)
+
+static float srgb_linear[256];
+static float lab_table[LAB_TABLE + 1];
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void usage(void)
+{
+    printf("Usage: kmquant [-k clusters] [-s rgb|lab] [-a lloyd|hamerly|minibatch]\n");
+    printf("               [-i max_iterations] [-e tolerance] [-n frames]\n");
+    printf("               [-W width] [-H height] [-t threads] [-c] input [output_prefix]\n");
+    printf("  input is a PPM/PGM file, or a frame source: synth[:pattern], dir:directory or raw:file\n");
+    exit(-1);
+}
+
+
+static float lab_f(float t)
+{
+    return (t > 216.0f / 24389.0f) ? cbrtf(t) : t * (24389.0f / 27.0f / 116.0f) + 16.0f / 116.0f;
+}
+
+static void init_tables(void)
+{
+    float c;
+    int i;
+
+    for(i=0; i < 256; i++)
+    {
+        c = i / 255.0f;
+        srgb_linear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    for(i=0; i <= LAB_TABLE; i++)
+        lab_table[i] = lab_f(i * LAB_RANGE / LAB_TABLE);
+}
+
+// lab_f() interpolated from the table, three cube roots per pixel cost more
+// than the clustering of a warm started frame
+static float lab_f_fast(float t)
+{
+    float p = t * (LAB_TABLE / LAB_RANGE), w;
+    int i;
+
+    if(p <= 0.0f)
+        return lab_table[0];
+    if(p >= (float)LAB_TABLE)
+        return lab_f(t);
+
+    i = (int)p;
+    w = p - i;
+    return lab_table[i] + w * (lab_table[i + 1] - lab_table[i]);
+}
+
+static float lab_finv(float f)
+{
+    return (f > 6.0f / 29.0f) ? f * f * f : (f - 16.0f / 116.0f) * (116.0f * 27.0f / 24389.0f);
+}
+
+static UINT8 srgb_byte(float c)
+{
+    c = (c <= 0.0031308f) ? 12.92f * c : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+    c = c * 255.0f + 0.5f;
+    return (c < 0.0f) ? 0 : (c > 255.0f) ? 255 : (UINT8)c;
+}
+
+static void rgb_to_lab(const UINT8 *rgb, float *lab)
+{
+    float r = srgb_linear[rgb[0]], g = srgb_linear[rgb[1]], b = srgb_linear[rgb[2]];
+    float fx = lab_f_fast((0.4124564f * r + 0.3575761f * g + 0.1804375f * b) / XN);
+    float fy = lab_f_fast((0.2126729f * r + 0.7151522f * g + 0.0721750f * b) / YN);
+    float fz = lab_f_fast((0.0193339f * r + 0.1191920f * g + 0.9503041f * b) / ZN);
+
+    lab[0] = 116.0f * fy - 16.0f;
+    lab[1] = 500.0f * (fx - fy);
+    lab[2] = 200.0f * (fy - fz);
+}
+
+static void lab_to_rgb(const float *lab, UINT8 *rgb)
+{
+    float fy = (lab[0] + 16.0f) / 116.0f;
+    float x = XN * lab_finv(fy + lab[1] / 500.0f);
+    float y = YN * lab_finv(fy);
+    float z = ZN * lab_finv(fy - lab[2] / 200.0f);
+
+    rgb[0] = srgb_byte( 3.2404542f * x - 1.5371385f * y - 0.4985314f * z);
+    rgb[1] = srgb_byte(-0.9692660f * x + 1.8760108f * y + 0.0415560f * z);
+    rgb[2] = srgb_byte( 0.0556434f * x - 0.2040259f * y + 1.0572252f * z);
+}
+
+// interleaved 8-bit pixels to points in the clustering space
+static void to_points(const UINT8 *pixels, int n, int channels, int space, float *X)
+{
+    int i;
+
+    if((channels == 3) && (space == SPACE_LAB))
+    {
+#pragma omp parallel for schedule(static)
+        for(i=0; i < n; i++)
+            rgb_to_lab(pixels + (size_t)i * 3, X + (size_t)i * 3);
+    }
+    else
+    {
+#pragma omp parallel for schedule(static)
+        for(i=0; i < n * channels; i++)
+            X[i] = pixels[i];
+    }
+}
+
+// centroids back to 8-bit colors
+static void make_palette(const float *centroids, int k, int channels, int space, UINT8 *palette)
+{
+    float c;
+    int j, d;
+
+    for(j=0; j < k; j++)
+    {
+        if((channels == 3) && (space == SPACE_LAB))
+            lab_to_rgb(centroids + j * 3, palette + j * 3);
+        else
+            for(d=0; d < channels; d++)
+            {
+                c = centroids[j * channels + d] + 0.5f;
+                palette[j * channels + d] = (c < 0.0f) ? 0 : (c > 255.0f) ? 255 : (UINT8)c;
+            }
+    }
+}
+
+static double psnr(const UINT8 *a, const UINT8 *palette, const int *labels, int n, int channels)
+{
+    double sse = 0.0, d;
+    int i, c;
+
+#pragma omp parallel for schedule(static) private(c, d) reduction(+:sse)
+    for(i=0; i < n; i++)
+        for(c=0; c < channels; c++)
+        {
+            d = (double)a[(size_t)i * channels + c] - (double)palette[labels[i] * channels + c];
+            sse += d * d;
+        }
+
+    return (sse == 0.0) ? INFINITY : 10.0 * log10(255.0 * 255.0 * n * channels / sse);
+}
+
+static int write_outputs(const char *prefix, int frame, int width, int height, int channels, int k,
+                         const UINT8 *palette, const int *labels)
+{
+    struct pnm_image out;
+    char name[4096];
+    int n = width * height, i, maxval = (k > 1) ? k - 1 : 1;
+
+    if(frame < 0)
+        snprintf(name, sizeof(name), "%s-quant.%s", prefix, (channels == 3) ? "ppm" : "pgm");
+    else
+        snprintf(name, sizeof(name), "%s-%04d-quant.%s", prefix, frame, (channels == 3) ? "ppm" : "pgm");
+
+    if(pnm_create(&out, name, width, height, channels, 255, "kmquant palette") != 0)
+        return -1;
+    for(i=0; i < n; i++)
+        memcpy(out.pixels + (size_t)i * channels, palette + labels[i] * channels, channels);
+    pnm_close(&out);
+
+    if(frame < 0)
+        snprintf(name, sizeof(name), "%s-labels.pgm", prefix);
+    else
+        snprintf(name, sizeof(name), "%s-%04d-labels.pgm", prefix, frame);
+
+    if(pnm_create(&out, name, width, height, 1, maxval, "kmquant labels") != 0)
+        return -1;
+    if(out.sample_bytes == 1)
+        for(i=0; i < n; i++)
+            out.pixels[i] = (UINT8)labels[i];
+    else
+        for(i=0; i < n; i++)
+        {
+            out.pixels[2 * i] = (UINT8)(labels[i] >> 8);
+            out.pixels[2 * i + 1] = (UINT8)labels[i];
+        }
+    pnm_close(&out);
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct km_params params;
+    struct km_result result;
+    struct pnm_image img;
+    struct frame_source *src = NULL;
+    struct v4l2_pix_format pix;
+    const char *input, *prefix;
+    const void *frame;
+    unsigned int size;
+    struct timespec timestamp;
+    int k = 8, space = SPACE_RGB, algorithm = KM_HAMERLY, max_iterations = 100, frames = 30, cold = 0;
+    int width = 640, height = 480, threads = 0, opt, f, n, channels, nframes, total_iterations = 0;
+    double tolerance = 0.5, start, convert_sec, cluster_sec, total_sec = 0.0;
+    UINT8 *pixels, *palette;
+    float *X, *centroids;
+    int *labels;
+
+    while((opt = getopt(argc, argv, "k:s:a:i:e:n:W:H:t:c")) != -1)
+    {
+        switch(opt)
+        {
+            case 'k': k = atoi(optarg); break;
+            case 's':
+                for(space=0; (space < SPACE_COUNT) && strcmp(optarg, space_names[space]); space++)
+                    ;
+                if(space == SPACE_COUNT)
+                    usage();
+                break;
+            case 'a':
+                for(algorithm=0; (algorithm < KM_ALGORITHM_COUNT) && strcmp(optarg, km_algorithm_name(algorithm));
+                    algorithm++)
+                    ;
+                if(algorithm == KM_ALGORITHM_COUNT)
+                    usage();
+                break;
+            case 'i': max_iterations = atoi(optarg); break;
+            case 'e': tolerance = atof(optarg); break;
+            case 'n': frames = atoi(optarg); break;
+            case 'W': width = atoi(optarg); break;
+            case 'H': height = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'c': cold = 1; break;
+            default: usage();
+        }
+    }
+
+    if((optind >= argc) || (k <= 0) || (max_iterations <= 0) || (frames <= 0) || (width <= 0) || (height <= 0))
+        usage();
+    input = argv[optind];
+    prefix = (optind + 1 < argc) ? argv[optind + 1] : NULL;
+
+    if(k > 65536)
+    {
+        printf("at most 65536 clusters for a 16-bit label map\n");
+        exit(-1);
+    }
+
+    // a frame source delivers YUYV frames of the forced size, taken as RGB here
+    if(frame_source_is_spec(input))
+    {
+        if(!(src = frame_source_open(input, width, height)))
+            exit(-1);
+        frame_source_format(src, &pix);
+        width = pix.width;
+        height = pix.height;
+        channels = 3;
+        nframes = frames;
+    }
+    else
+    {
+        if(pnm_open(&img, input) != 0)
+            exit(-1);
+        if(img.sample_bytes != 1)
+        {
+            printf("%s is not an 8-bit image\n", input);
+            exit(-1);
+        }
+        width = img.width;
+        height = img.height;
+        channels = img.channels;
+        nframes = 1;
+    }
+
+    n = width * height;
+    if(k > n)
+    {
+        printf("%d clusters for %d pixels\n", k, n);
+        exit(-1);
+    }
+
+    init_tables();
+    pixels = src ? malloc((size_t)n * 3) : img.pixels;
+    X = malloc((size_t)n * channels * sizeof(float));
+    labels = malloc((size_t)n * sizeof(int));
+    centroids = malloc((size_t)k * channels * sizeof(float));
+    palette = malloc((size_t)k * channels);
+    if(!pixels || !X || !labels || !centroids || !palette)
+    {
+        perror("malloc");
+        exit(-1);
+    }
+
+    km_defaults(&params, k);
+    params.algorithm = algorithm;
+    params.max_iterations = max_iterations;
+    params.tolerance = tolerance;
+    params.threads = threads;
+
+    printf("%s %dx%d, %d channels, k %d in %s, %s, %s kernel, %s starts\n", src ? frame_source_name(src) : input,
+           width, height, channels, k, (channels == 3) ? space_names[space] : "gray", km_algorithm_name(algorithm),
+           km_isa_name(km_kernel_isa()), cold ? "cold" : "warm");
+    printf("%5s %10s %10s %6s %8s\n", "frame", "convert ms", "cluster ms", "iter", "PSNR dB");
+
+    for(f=0; f < nframes; f++)
+    {
+        if(src)
+        {
+            if(!frame_source_read(src, &frame, &size, &timestamp))
+            {
+                f--;
+                continue;
+            }
+        }
+
+        start = now_sec();
+        if(src)
+            yuyv_to_rgb24((const UINT8 *)frame, pixels, n);
+        to_points(pixels, n, channels, space, X);
+        convert_sec = now_sec() - start;
+
+        // the first frame, or every frame when cold, is seeded with k-means++
+        params.seed = (f == 0) || cold;
+
+        start = now_sec();
+        if(km_cluster(X, n, channels, &params, centroids, labels, &result) != 0)
+        {
+            printf("clustering failed\n");
+            exit(-1);
+        }
+        cluster_sec = now_sec() - start;
+
+        make_palette(centroids, k, channels, space, palette);
+        printf("%5d %10.3lf %10.3lf %6d %8.2lf\n", f, 1000.0 * convert_sec, 1000.0 * cluster_sec,
+               result.iterations, psnr(pixels, palette, labels, n, channels));
+
+        // the first frame has no previous centroids to start from either way
+        if(f > 0)
+        {
+            total_sec += cluster_sec;
+            total_iterations += result.iterations;
+        }
+
+        if(prefix && (write_outputs(prefix, src ? f : -1, width, height, channels, k, palette, labels) != 0))
+            exit(-1);
+    }
+
+    if(nframes > 1)
+        printf("frames 1 to %d: %.2lf iterations, %.3lf ms per frame\n", nframes - 1,
+               (double)total_iterations / (nframes - 1), 1000.0 * total_sec / (nframes - 1));
+
+    if(src)
+    {
+        frame_source_close(src);
+        free(pixels);
+    }
+    else
+        pnm_close(&img);
+    free(X);
+    free(labels);
+    free(centroids);
+    free(palette);
+    return 0;
+}
@@ -0,0 +1,396 @@
+/*
+ *  Asynchronous image archiver, see image_archiver.h
+ *
+ *  Buffers are numbered slots on one of three lists: free, the pre-trigger
+ *  ring, or the write queue.  The ring belongs to the capture thread alone;
+ *  the free list and the queue are shared with the writer under the lock.
+ *  A slot is filled outside the lock, while it is on no list, so the lock is
+ *  only held to move slot numbers around.  The directory cache and the raw
+ *  files waiting for compression belong to the writer alone.
+ */
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstdio>
+#include <cstring>
+
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "image_archiver.h"
+
+using namespace std;
+using namespace cv;
+
+struct ArchiveSlot {
+  Mat image;
+  time_t captured;            // for the name, as saveImg() took it
+  struct timespec queued;
+  unsigned int sequence;
+  const char *directory;
+  bool trace;
+};
+
+struct image_archiver {
+  struct archiver_config cfg;
+  vector<ArchiveSlot> slots;
+  vector<int> params;
+  string extension, rawExtension;
+
+  // capture thread only
+  vector<int> ring;
+  int ringHead, ringCount;
+  bool inMotion;
+
+  // shared, under lock
+  pthread_mutex_t lock;
+  pthread_cond_t work;        // queue non-empty or stopping
+  vector<int> freeSlots;
+  vector<int> queue;          // FIFO of slot numbers
+  int head, count;
+  bool stopping;
+  struct archiver_stats stats;
+
+  // writer thread only
+  pthread_t thread;
+  vector<string> directories; // known to exist
+  deque<string> rawFiles;     // written raw, name without extension
+};
+
+
+static double elapsedMs(const struct timespec *start, const struct timespec *stop)
+{
+  return (stop->tv_sec - start->tv_sec) * 1000.0 + (stop->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// Create the directory unless it was seen before, in place of the opendir()
+// and mkdir() directoryExistsOrCreate() did on every save
+static void directoryCached(struct image_archiver *a, const char *directory)
+{
+  for (size_t i = 0; i < a->directories.size(); i++)
+    if (a->directories[i] == directory)
+      return;
+
+  if ((mkdir(directory, 0777) != 0) && (errno != EEXIST))
+    perror(directory);
+  a->directories.push_back(directory);
+}
+
+static void writeSlot(struct image_archiver *a, ArchiveSlot &slot)
+{
+  struct tm timeinfo;
+  char timeStr[80], base[PATH_MAX];
+  const string &extension = a->cfg.raw ? a->rawExtension : a->extension;
+  string path;
+  bool ok;
+
+  localtime_r(&slot.captured, &timeinfo);
+  strftime(timeStr, sizeof(timeStr), a->cfg.file_format, &timeinfo);
+  snprintf(base, sizeof(base), "%s%s_%u", slot.directory, timeStr, slot.sequence);
+  path = string(base) + extension;
+
+  directoryCached(a, slot.directory);
+
+  if (slot.trace)
+    cout << "Saving Image: " << path << endl;
+
+  ok = imwrite(path, slot.image, a->cfg.raw ? vector<int>() : a->params);
+  if (ok && a->cfg.raw)
+    a->rawFiles.push_back(base);
+
+  if (!ok)
+    cout << "Failed to write " << path << endl;
+
+  pthread_mutex_lock(&a->lock);
+  if (ok)
+    a->stats.written++;
+  else
+    a->stats.failed++;
+  pthread_mutex_unlock(&a->lock);
+}
+
+// One raw file to the final format, only when nothing is queued
+static void compressRaw(struct image_archiver *a)
+{
+  string base = a->rawFiles.front();
+  string raw = base + a->rawExtension;
+  Mat image;
+
+  a->rawFiles.pop_front();
+
+  image = imread(raw, IMREAD_UNCHANGED);
+  if (image.empty() || !imwrite(base + a->extension, image, a->params)) {
+    cout << "Failed to compress " << raw << endl;
+    return;
+  }
+  unlink(raw.c_str());
+
+  pthread_mutex_lock(&a->lock);
+  a->stats.compressed++;
+  pthread_mutex_unlock(&a->lock);
+}
+
+static void *writer(void *arg)
+{
+  struct image_archiver *a = (struct image_archiver *)arg;
+  struct timespec done;
+  double ms;
+  int id;
+
+  for (;;) {
+    pthread_mutex_lock(&a->lock);
+    while (!a->count && !a->stopping && a->rawFiles.empty())
+      pthread_cond_wait(&a->work, &a->lock);
+
+    // raw files are compressed one at a time so new frames come first
+    if (!a->count) {
+      pthread_mutex_unlock(&a->lock);
+      if (a->rawFiles.empty())
+        break;
+      compressRaw(a);
+      continue;
+    }
+
+    id = a->queue[a->head];
+    a->head = (a->head + 1) % (int)a->slots.size();
+    a->count--;
+    pthread_mutex_unlock(&a->lock);
+
+    writeSlot(a, a->slots[id]);
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    ms = elapsedMs(&a->slots[id].queued, &done);
+
+    pthread_mutex_lock(&a->lock);
+    a->freeSlots.push_back(id);
+    a->stats.write_ms_sum += ms;
+    if (ms > a->stats.write_ms_max)
+      a->stats.write_ms_max = ms;
+    pthread_mutex_unlock(&a->lock);
+  }
+
+  return NULL;
+}
+
+// lock held
+static void enqueue(struct image_archiver *a, int id)
+{
+  a->queue[(a->head + a->count) % (int)a->slots.size()] = id;
+  a->count++;
+  if (a->count > a->stats.max_queued)
+    a->stats.max_queued = a->count;
+  pthread_cond_signal(&a->work);
+}
+
+static int takeFree(struct image_archiver *a)
+{
+  int id = -1;
+
+  pthread_mutex_lock(&a->lock);
+  if (!a->freeSlots.empty()) {
+    id = a->freeSlots.back();
+    a->freeSlots.pop_back();
+  }
+  pthread_mutex_unlock(&a->lock);
+
+  return id;
+}
+
+static void fillSlot(ArchiveSlot &slot, const Mat &frame, const char *directory, unsigned int sequence, bool trace)
+{
+  frame.copyTo(slot.image);
+  time(&slot.captured);
+  slot.directory = directory;
+  slot.sequence = sequence;
+  slot.trace = trace;
+}
+
+static void noteSaveTime(struct image_archiver *a, const struct timespec *start)
+{
+  struct timespec stop;
+  double ms;
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  ms = elapsedMs(start, &stop);
+
+  pthread_mutex_lock(&a->lock);
+  if (ms > a->stats.save_ms_max)
+    a->stats.save_ms_max = ms;
+  pthread_mutex_unlock(&a->lock);
+}
+
+static bool save(struct image_archiver *a, const Mat &frame, const char *directory, unsigned int sequence, bool trace)
+{
+  int id = takeFree(a);
+
+  if (id < 0) {
+    pthread_mutex_lock(&a->lock);
+    a->stats.dropped++;
+    pthread_mutex_unlock(&a->lock);
+    return false;
+  }
+
+  fillSlot(a->slots[id], frame, directory, sequence, trace);
+
+  pthread_mutex_lock(&a->lock);
+  clock_gettime(CLOCK_MONOTONIC, &a->slots[id].queued);
+  enqueue(a, id);
+  a->stats.saved++;
+  pthread_mutex_unlock(&a->lock);
+
+  return true;
+}
+
+
+struct image_archiver *archiver_open(const struct archiver_config *cfg, int width, int height, int type)
+{
+  struct image_archiver *a;
+  int nslots, i;
+
+  if ((cfg->queue <= 0) || (cfg->pre_trigger < 0))
+    return NULL;
+
+  a = new image_archiver;
+  a->cfg = *cfg;
+  a->extension = cfg->extension;
+  a->rawExtension = (CV_MAT_CN(type) == 1) ? ".pgm" : ".ppm";
+  a->params.push_back(IMWRITE_PNG_COMPRESSION);
+  a->params.push_back(cfg->png_level);
+
+  // buffers for the queue plus the ring; a full ring recycles its own, so a
+  // burst filling the queue does not eat into the lead up to the next event
+  nslots = cfg->queue + cfg->pre_trigger;
+  a->slots.resize(nslots);
+  for (i = 0; i < nslots; i++) {
+    a->slots[i].image.create(height, width, type);
+    a->freeSlots.push_back(nslots - 1 - i);
+  }
+  a->queue.resize(nslots);
+  a->ring.resize(cfg->pre_trigger);
+  a->ringHead = a->ringCount = 0;
+  a->inMotion = false;
+  a->head = a->count = 0;
+  a->stopping = false;
+  memset(&a->stats, 0, sizeof(a->stats));
+
+  pthread_mutex_init(&a->lock, NULL);
+  pthread_cond_init(&a->work, NULL);
+
+  if (pthread_create(&a->thread, NULL, writer, a) != 0) {
+    perror("pthread_create");
+    pthread_mutex_destroy(&a->lock);
+    pthread_cond_destroy(&a->work);
+    delete a;
+    return NULL;
+  }
+
+  return a;
+}
+
+void archiver_frame(struct image_archiver *a, const Mat &frame, const char *directory,
+                    unsigned int sequence, bool motion, bool trace)
+{
+  struct timespec start;
+  int n = a->cfg.pre_trigger, id, i;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (motion) {
+    // the frames leading up to the event go first, oldest first
+    if (!a->inMotion && a->ringCount) {
+      pthread_mutex_lock(&a->lock);
+      for (i = 0; i < a->ringCount; i++) {
+        id = a->ring[(a->ringHead + i) % n];
+        a->slots[id].directory = directory;
+        a->slots[id].trace = trace;
+        clock_gettime(CLOCK_MONOTONIC, &a->slots[id].queued);
+        enqueue(a, id);
+      }
+      a->stats.saved += a->ringCount;
+      a->stats.pre_trigger += a->ringCount;
+      pthread_mutex_unlock(&a->lock);
+      a->ringHead = a->ringCount = 0;
+    }
+    if (!a->inMotion) {
+      pthread_mutex_lock(&a->lock);
+      a->stats.events++;
+      pthread_mutex_unlock(&a->lock);
+    }
+    a->inMotion = true;
+    save(a, frame, directory, sequence, trace);
+  } else {
+    a->inMotion = false;
+    if (n == 0)
+      return;
+
+    // a free buffer while the ring fills, then the ring's oldest
+    if ((a->ringCount == n) || ((id = takeFree(a)) < 0)) {
+      if (!a->ringCount)
+        return;
+      id = a->ring[a->ringHead];
+      a->ringHead = (a->ringHead + 1) % n;
+      a->ringCount--;
+    }
+    fillSlot(a->slots[id], frame, directory, sequence, trace);
+    a->ring[(a->ringHead + a->ringCount) % n] = id;
+    a->ringCount++;
+  }
+
+  noteSaveTime(a, &start);
+}
+
+bool archiver_save(struct image_archiver *a, const Mat &frame, const char *directory,
+                   unsigned int sequence, bool trace)
+{
+  struct timespec start;
+  bool queued;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  queued = save(a, frame, directory, sequence, trace);
+  noteSaveTime(a, &start);
+
+  return queued;
+}
+
+void archiver_get_stats(struct image_archiver *a, struct archiver_stats *stats)
+{
+  pthread_mutex_lock(&a->lock);
+  *stats = a->stats;
+  pthread_mutex_unlock(&a->lock);
+}
+
+void archiver_print_stats(struct image_archiver *a)
+{
+  struct archiver_stats s;
+
+  archiver_get_stats(a, &s);
+
+  printf("\narchiver (%s, %d buffers, %d pre-trigger): %ld events, %ld frames saved (%ld pre-trigger), "
+         "%ld written, %ld dropped, %ld failed",
+         a->cfg.raw ? "raw then PNG" : "PNG", a->cfg.queue, a->cfg.pre_trigger, s.events, s.saved,
+         s.pre_trigger, s.written, s.dropped, s.failed);
+  if (a->cfg.raw)
+    printf(", %ld compressed", s.compressed);
+  printf("\nqueued max %d, capture held up max %.3lf ms, queued to written ms: avg %.3lf, max %.3lf\n",
+         s.max_queued, s.save_ms_max, s.written ? s.write_ms_sum / s.written : 0.0, s.write_ms_max);
+}
+
+void archiver_close(struct image_archiver *a)
+{
+  pthread_mutex_lock(&a->lock);
+  a->stopping = true;
+  pthread_cond_broadcast(&a->work);
+  pthread_mutex_unlock(&a->lock);
+
+  pthread_join(a->thread, NULL);
+  archiver_print_stats(a);
+
+  pthread_mutex_destroy(&a->lock);
+  pthread_cond_destroy(&a->work);
+  delete a;
+}
@@ -0,0 +1,75 @@
+/*
+ *  Asynchronous image archiver for the motion detector
+ *
+ *  Saving a frame from the capture loop only copies it into a preallocated
+ *  buffer and queues it; one writer thread builds the name, creates the
+ *  directory the first time it is used and encodes the file.  A burst of
+ *  motion therefore costs the capture loop a memcpy per frame instead of a
+ *  PNG encode.  When every buffer is queued further saves are dropped and
+ *  counted, capture never waits for the disk.
+ *
+ *  Frames without motion go into a ring of the last pre_trigger frames, and
+ *  the first frame of a motion event queues that ring ahead of itself, so
+ *  the lead up to the event is archived too.  Ring frames keep the time and
+ *  sequence number they were captured with.
+ *
+ *  PNG is written with compression level png_level (1 is several times
+ *  faster than the default 3 for most of the size).  With raw set, frames
+ *  are written uncompressed as PPM/PGM and the writer turns them into PNG
+ *  whenever its queue is empty, so bursts go at disk speed and the
+ *  compression happens between them.
+ */
+#ifndef IMAGE_ARCHIVER_H
+#define IMAGE_ARCHIVER_H
+
+#include "opencv2/opencv.hpp"
+
+struct archiver_config
+{
+  int         queue;          // frame buffers for saves in flight
+  int         pre_trigger;    // frames before a motion event saved with it
+  int         png_level;      // IMWRITE_PNG_COMPRESSION, 0 to 9
+  int         raw;            // PPM/PGM first, PNG when the writer is idle
+  const char *file_format;    // strftime() format of the name, as FILE_FORMAT
+  const char *extension;      // as EXTENSION
+};
+
+struct archiver_stats
+{
+  long   saved;               // frames queued, including the pre-trigger ones
+  long   pre_trigger;         // frames queued from the ring
+  long   events;
+  long   dropped;             // no free buffer
+  long   written;
+  long   failed;              // imwrite() failed
+  long   compressed;          // raw files turned into PNG
+  int    max_queued;
+  double save_ms_max;         // longest a save held up the capture loop
+  double write_ms_sum;        // queued to written, over written frames
+  double write_ms_max;
+};
+
+struct image_archiver;
+
+// width x height frames of OpenCV type, NULL if out of memory or no thread
+struct image_archiver *archiver_open(const struct archiver_config *cfg, int width, int height, int type);
+
+// Every captured frame with its motion decision, from the capture loop.
+// directory must stay valid until archiver_close(); trace prints the names
+// of the frames as they are written, as saveImg() did.
+void archiver_frame(struct image_archiver *a, const cv::Mat &frame, const char *directory,
+                    unsigned int sequence, bool motion, bool trace);
+
+// Queue one frame whatever the motion, false if it was dropped
+bool archiver_save(struct image_archiver *a, const cv::Mat &frame, const char *directory,
+                   unsigned int sequence, bool trace);
+
+void archiver_get_stats(struct image_archiver *a, struct archiver_stats *stats);
+
+void archiver_print_stats(struct image_archiver *a);
+
+// Writes everything queued, compresses any raw files left, prints statistics
+// and frees the archiver
+void archiver_close(struct image_archiver *a);
+
+#endif
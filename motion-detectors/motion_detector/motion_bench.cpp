@@ -0,0 +1,229 @@
+// motion_bench.cpp
+//
+// The motion detector's per frame work done the old way, with the OpenCV
+// call chain and three copyTo() rotations, and the new way, one
+// motion_detect() pass over a ring of gray frames, on synthetic frames: a
+// noisy textured background with a box moving across it.
+//
+// Checks that every motion_core kernel gives the same mask, change count,
+// mean and standard deviation as the OpenCV chain, then reports ms per
+// frame for the core alone and for the whole per frame path.  The
+// background model has no OpenCV twin; its kernels are checked against the
+// scalar one for the same mask and model, and timed the same way.
+//
+// Usage: motion_bench [width height [frames]]
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include "opencv2/opencv.hpp"
+
+#include "motion_core.h"
+
+using namespace std;
+using namespace cv;
+
+#define THRESHOLD 5
+#define BOX 64
+
+static void makeFrames(vector<Mat> &frames, int width, int height, int count)
+{
+  Mat background(height, width, CV_8UC3), noise(height, width, CV_8UC3);
+
+  randu(background, Scalar::all(0), Scalar::all(255));
+  GaussianBlur(background, background, Size(9, 9), 3.0);
+
+  frames.resize(count);
+  for (int i = 0; i < count; i++) {
+    // main() keeps the frame at least 2 * BOX on a side, the box always fits
+    int x = (i * 7) % max(width - BOX, 1), y = max((height - BOX) / 2 + (int)(height / 4 * sin(i * 0.1)), 0);
+
+    background.copyTo(frames[i]);
+    rectangle(frames[i], Point(x, y), Point(x + BOX, y + BOX), Scalar(40, 200, 90), -1);
+    randu(noise, Scalar::all(0), Scalar::all(6));
+    frames[i] += noise;
+  }
+}
+
+// the chain motion_detector.cpp used, with the changes counted right
+static long opencvChain(const Mat &prevPrev, const Mat &prev, const Mat &current, const Mat &kernel,
+                        Mat &d1, Mat &d2, Mat &motion, Scalar &mean, Scalar &stddev)
+{
+  absdiff(prevPrev, current, d1);
+  absdiff(prev, current, d2);
+  bitwise_and(d1, d2, motion);
+  threshold(motion, motion, THRESHOLD, 255, CV_THRESH_BINARY);
+  erode(motion, motion, kernel);
+  meanStdDev(motion, mean, stddev);
+  return countNonZero(motion);
+}
+
+int main(int argc, char *argv[])
+{
+  int width = (argc > 2) ? atoi(argv[1]) : 640, height = (argc > 2) ? atoi(argv[2]) : 480;
+  int count = (argc > 3) ? atoi(argv[3]) : 300;
+  Mat kernel = getStructuringElement(MORPH_RECT, Size(2, 2));
+  Mat gray[3], d1, d2, motion, mask;
+  Mat prevPrevFrame, prevFrame, currentFrame;
+  vector<Mat> frames;
+  struct motion_core core;
+  struct motion_stats stats;
+  Scalar mean, stddev;
+  double freq = getTickFrequency(), start, ms;
+  long changes, total = 0;
+  int isa, i, row, kernels = 0;
+
+  if ((width < 2 * BOX) || (height < 2 * BOX) || (count < 3)) {
+    cout << "Usage: motion_bench [width height [frames]], at least " << 2 * BOX << "x" << 2 * BOX << endl;
+    exit(EXIT_FAILURE);
+  }
+  mask.create(height, width, CV_8UC1);
+
+  makeFrames(frames, width, height, count);
+  for (i = 0; i < 3; i++)
+    gray[i].create(height, width, CV_8UC1);
+  if (motion_core_init(&core, width, height) != 0) {
+    cout << "Failed to allocate the motion detector" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  cout << width << "x" << height << ", " << count << " frames, threshold " << THRESHOLD << endl;
+
+  // every kernel against the OpenCV chain on every frame
+  for (isa = 0; isa < MOTION_ISA_COUNT; isa++) {
+    if (motion_kernel_select(isa) != 0)
+      continue;
+    kernels++;
+
+    for (i = 2; i < count; i++) {
+      for (int j = 0; j < 3; j++)
+        cvtColor(frames[i - 2 + j], gray[j], CV_RGB2GRAY);
+
+      changes = opencvChain(gray[0], gray[1], gray[2], kernel, d1, d2, motion, mean, stddev);
+      motion_detect(&core, gray[0].data, gray[1].data, gray[2].data, (int)gray[0].step, mask.data, (int)mask.step,
+                    THRESHOLD, 0, 0, width, height, &stats);
+
+      for (row = 0; row < height; row++)
+        if (memcmp(motion.ptr(row), mask.ptr(row), width) != 0)
+          break;
+
+      if ((row < height) || (stats.changes != changes) || (fabs(stats.mean - mean[0]) > 1e-6) ||
+          (fabs(stats.stddev - stddev[0]) > 1e-6)) {
+        cout << motion_isa_name(isa) << " differs from OpenCV at frame " << i << ": row " << row
+             << ", changes " << stats.changes << " vs " << changes << ", mean " << stats.mean << " vs " << mean[0]
+             << ", stddev " << stats.stddev << " vs " << stddev[0] << endl;
+        exit(EXIT_FAILURE);
+      }
+      total += changes;
+    }
+  }
+  cout << "all kernels match OpenCV, " << total / kernels / (count - 2) << " changes per frame" << endl;
+
+  printf("%-28s %10s\n", "", "ms/frame");
+
+  // core only, the same three gray frames each time
+  for (i = 0; i < 3; i++)
+    cvtColor(frames[i], gray[i], CV_RGB2GRAY);
+
+  start = (double)getTickCount();
+  for (i = 0; i < count; i++)
+    opencvChain(gray[0], gray[1], gray[2], kernel, d1, d2, motion, mean, stddev);
+  ms = ((double)getTickCount() - start) * 1000.0 / freq / count;
+  printf("%-28s %10.3lf\n", "core, OpenCV chain", ms);
+
+  for (isa = 0; isa < MOTION_ISA_COUNT; isa++) {
+    if (motion_kernel_select(isa) != 0)
+      continue;
+
+    start = (double)getTickCount();
+    for (i = 0; i < count; i++)
+      motion_detect(&core, gray[0].data, gray[1].data, gray[2].data, (int)gray[0].step, mask.data, (int)mask.step,
+                    THRESHOLD, 0, 0, width, height, &stats);
+    ms = ((double)getTickCount() - start) * 1000.0 / freq / count;
+    printf("core, motion_detect %-8s %10.3lf\n", motion_isa_name(isa), ms);
+  }
+
+  // background model, every kernel against the scalar one over the moving box
+  {
+    struct motion_background bg[MOTION_ISA_COUNT];
+    struct motion_stats bgStats[MOTION_ISA_COUNT];
+    Mat bgMask[MOTION_ISA_COUNT];
+    size_t pixels = (size_t)width * height;
+
+    for (isa = 0; isa < MOTION_ISA_COUNT; isa++) {
+      bgMask[isa].create(height, width, CV_8UC1);
+      if (motion_background_init(&bg[isa], width, height) != 0) {
+        cout << "Failed to allocate the background model" << endl;
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    for (i = 0; i < count; i++) {
+      cvtColor(frames[i], gray[0], CV_RGB2GRAY);
+      for (isa = 0; isa < MOTION_ISA_COUNT; isa++) {
+        if (motion_kernel_select(isa) != 0)
+          continue;
+        motion_background_update(&bg[isa], gray[0].data, (int)gray[0].step, bgMask[isa].data, (int)bgMask[isa].step,
+                                 0, 0, width, height, &bgStats[isa]);
+        if ((isa > 0) && ((memcmp(bgMask[isa].data, bgMask[0].data, pixels) != 0) ||
+                          (memcmp(bg[isa].mean, bg[0].mean, pixels * sizeof(short)) != 0) ||
+                          (memcmp(bg[isa].var, bg[0].var, pixels * sizeof(short)) != 0) ||
+                          (bgStats[isa].changes != bgStats[0].changes))) {
+          cout << motion_isa_name(isa) << " background differs from scalar at frame " << i << endl;
+          exit(EXIT_FAILURE);
+        }
+      }
+    }
+
+    for (isa = 0; isa < MOTION_ISA_COUNT; isa++) {
+      if (motion_kernel_select(isa) != 0)
+        continue;
+
+      start = (double)getTickCount();
+      for (i = 0; i < count; i++)
+        motion_background_update(&bg[isa], gray[0].data, (int)gray[0].step, bgMask[isa].data, (int)bgMask[isa].step,
+                                 0, 0, width, height, &bgStats[isa]);
+      ms = ((double)getTickCount() - start) * 1000.0 / freq / count;
+      printf("background, %-16s %10.3lf\n", motion_isa_name(isa), ms);
+    }
+
+    for (isa = 0; isa < MOTION_ISA_COUNT; isa++)
+      motion_background_free(&bg[isa]);
+  }
+
+  // the whole per frame path from a color frame, the last kernel selected is the best
+  cvtColor(frames[0], prevFrame, CV_RGB2GRAY);
+  cvtColor(frames[0], currentFrame, CV_RGB2GRAY);
+
+  start = (double)getTickCount();
+  for (i = 0; i < count; i++) {
+    prevFrame.copyTo(prevPrevFrame);
+    currentFrame.copyTo(prevFrame);
+    frames[i].copyTo(currentFrame);
+    cvtColor(currentFrame, currentFrame, CV_RGB2GRAY);
+    opencvChain(prevPrevFrame, prevFrame, currentFrame, kernel, d1, d2, motion, mean, stddev);
+  }
+  ms = ((double)getTickCount() - start) * 1000.0 / freq / count;
+  printf("%-28s %10.3lf\n", "frame, copyTo + OpenCV", ms);
+
+  int current = 0, prev = 0, prevPrev = 0;
+  cvtColor(frames[0], gray[current], CV_RGB2GRAY);
+
+  start = (double)getTickCount();
+  for (i = 0; i < count; i++) {
+    prevPrev = prev;
+    prev = current;
+    current = (current + 1) % 3;
+    cvtColor(frames[i], gray[current], CV_RGB2GRAY);
+    motion_detect(&core, gray[prevPrev].data, gray[prev].data, gray[current].data, (int)gray[current].step,
+                  mask.data, (int)mask.step, THRESHOLD, 0, 0, width, height, &stats);
+  }
+  ms = ((double)getTickCount() - start) * 1000.0 / freq / count;
+  printf("frame, ring + motion_detect %10.3lf  (%s)\n", ms, motion_isa_name(motion_kernel_isa()));
+
+  motion_core_free(&core);
+  return 0;
+}
@@ -0,0 +1,710 @@
+/*
+ *  Three frame differencing core with run time dispatch, see motion_core.h
+ *
+ *  Each row is three short passes over data that stays in L1:
+ *
+ *    1. still[x] = 255 where (|prev2 - cur| & |prev - cur|) <= threshold,
+ *       the complement of the thresholded motion
+ *    2. mask[x] = ~max(still above and this row, at x - 1 and x), the 2x2
+ *       erosion with its anchor at (1,1); pixels outside the frame leave
+ *       the minimum alone, as erode() does with its default border
+ *    3. count the mask bytes in the region with sums of absolute
+ *       differences against zero
+ *
+ *  The still rows have one byte of 0 in front so x - 1 can be loaded at
+ *  x = 0, and the first row uses itself as the row above.
+ *
+ *  The background model replaces pass 1 with an update of the per pixel
+ *  mean and variance that also says which pixels are still, and shares
+ *  passes 2 and 3.  Everything is 16-bit fixed point:
+ *
+ *    mean    gray level << 7, so the difference to a new pixel fits
+ *    var     gray level^2 << 4, of the difference clipped at BG_DEV_CAP
+ *    d       = (cur << 7) - mean, ad = |d| rounded to gray levels
+ *    moving  ad^2 > sigmas^2 var, with (var * (sigmas^2 << 12)) >> 16
+ *    update  mean += d >> shift, var += ((ad^2 << 4) - var) >> shift,
+ *            rounded, shift learn_shift or hold_shift for moving pixels
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "motion_core.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOTION_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MOTION_NEON
+#include <arm_neon.h>
+#endif
+
+typedef unsigned char UINT8;
+
+// still row padding: one byte in front, and room for a vector past the end
+#define STILL_PAD (64)
+
+// largest difference the variance learns from, (45^2) << 4 still fits a short
+#define BG_DEV_CAP (45)
+
+// variance of a new model, a deviation of 10 gray levels
+#define BG_SEED_VAR ((10 * 10) << 4)
+
+// fixed point form of the background settings
+struct bg_consts
+{
+    int t2q;                    // sigmas^2 << 12
+    int vmin;                   // min_sigma^2 << 4
+    int learn, hold;            // shifts, 1 to 15
+};
+
+
+static void still_scalar(const UINT8 *a, const UINT8 *b, const UINT8 *c, UINT8 *still, int x, int width,
+                         int threshold)
+{
+    int d1, d2;
+
+    for(; x < width; x++)
+    {
+        d1 = abs(a[x] - c[x]);
+        d2 = abs(b[x] - c[x]);
+        still[x] = ((d1 & d2) > threshold) ? 0 : 255;
+    }
+}
+
+static void erode_scalar(const UINT8 *above, const UINT8 *still, UINT8 *mask, int x, int width)
+{
+    UINT8 m;
+
+    for(; x < width; x++)
+    {
+        m = (above[x - 1] > above[x]) ? above[x - 1] : above[x];
+        m = (still[x - 1] > m) ? still[x - 1] : m;
+        m = (still[x] > m) ? still[x] : m;
+        mask[x] = ~m;
+    }
+}
+
+static long count_scalar(const UINT8 *mask, int x, int x1)
+{
+    long n = 0;
+
+    for(; x < x1; x++)
+        n += mask[x];
+
+    return n;
+}
+
+static inline int sat16(int v)
+{
+    return (v > 32767) ? 32767 : (v < -32768) ? -32768 : v;
+}
+
+static void bg_still_scalar(const UINT8 *c, short *mean, short *var, UINT8 *still, int x, int width,
+                            const struct bg_consts *k)
+{
+    int d, ad, a, e, fg, s, r;
+
+    for(; x < width; x++)
+    {
+        d = (c[x] << 7) - mean[x];
+        ad = (abs(d) + 64) >> 7;
+        fg = (unsigned)(ad * ad) > (((unsigned)var[x] * k->t2q) >> 16);
+
+        a = (ad < BG_DEV_CAP) ? ad : BG_DEV_CAP;
+        e = ((a * a) << 4) - var[x];
+        s = fg ? k->hold : k->learn;
+        r = 1 << (s - 1);
+
+        mean[x] += sat16(d + r) >> s;
+        var[x] += sat16(e + r) >> s;
+        if(var[x] < k->vmin)
+            var[x] = k->vmin;
+        still[x] = fg ? 0 : 255;
+    }
+}
+
+// one row, returns the sum of the mask bytes from x0 to x1
+static long row_scalar(const UINT8 *a, const UINT8 *b, const UINT8 *c, const UINT8 *above, UINT8 *still,
+                       UINT8 *mask, int width, int threshold, int x0, int x1)
+{
+    still_scalar(a, b, c, still, 0, width, threshold);
+    erode_scalar(above, still, mask, 0, width);
+    return count_scalar(mask, x0, x1);
+}
+
+static long bg_row_scalar(const UINT8 *c, short *mean, short *var, const UINT8 *above, UINT8 *still,
+                          UINT8 *mask, int width, const struct bg_consts *k, int x0, int x1)
+{
+    bg_still_scalar(c, mean, var, still, 0, width, k);
+    erode_scalar(above, still, mask, 0, width);
+    return count_scalar(mask, x0, x1);
+}
+
+
+#if defined(MOTION_X86)
+
+// passes 2 and 3
+__attribute__((target("sse2")))
+static long erode_sse2(const UINT8 *above, const UINT8 *still, UINT8 *mask, int width, int x0, int x1)
+{
+    const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8(-1);
+    __m128i m, sum = zero;
+    int x, end = width & ~15;
+
+    for(x=0; x < end; x += 16)
+    {
+        m = _mm_max_epu8(_mm_loadu_si128((const __m128i *)(above + x - 1)),
+                         _mm_loadu_si128((const __m128i *)(above + x)));
+        m = _mm_max_epu8(m, _mm_loadu_si128((const __m128i *)(still + x - 1)));
+        m = _mm_max_epu8(m, _mm_loadu_si128((const __m128i *)(still + x)));
+        _mm_storeu_si128((__m128i *)(mask + x), _mm_xor_si128(m, ones));
+    }
+    erode_scalar(above, still, mask, x, width);
+
+    for(x=x0; x + 16 <= x1; x += 16)
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(mask + x)), zero));
+
+    return _mm_cvtsi128_si64(sum) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(sum, sum)) + count_scalar(mask, x, x1);
+}
+
+__attribute__((target("sse2")))
+static long row_sse2(const UINT8 *a, const UINT8 *b, const UINT8 *c, const UINT8 *above, UINT8 *still,
+                     UINT8 *mask, int width, int threshold, int x0, int x1)
+{
+    const __m128i zero = _mm_setzero_si128(), thr = _mm_set1_epi8((char)threshold);
+    __m128i va, vb, vc, d1, d2, m;
+    int x, end = width & ~15;
+
+    for(x=0; x < end; x += 16)
+    {
+        va = _mm_loadu_si128((const __m128i *)(a + x));
+        vb = _mm_loadu_si128((const __m128i *)(b + x));
+        vc = _mm_loadu_si128((const __m128i *)(c + x));
+        d1 = _mm_or_si128(_mm_subs_epu8(va, vc), _mm_subs_epu8(vc, va));
+        d2 = _mm_or_si128(_mm_subs_epu8(vb, vc), _mm_subs_epu8(vc, vb));
+        m = _mm_subs_epu8(_mm_and_si128(d1, d2), thr);
+        _mm_storeu_si128((__m128i *)(still + x), _mm_cmpeq_epi8(m, zero));
+    }
+    still_scalar(a, b, c, still, x, width, threshold);
+
+    return erode_sse2(above, still, mask, width, x0, x1);
+}
+
+__attribute__((target("sse2")))
+static long bg_row_sse2(const UINT8 *c, short *mean, short *var, const UINT8 *above, UINT8 *still,
+                        UINT8 *mask, int width, const struct bg_consts *k, int x0, int x1)
+{
+    const __m128i zero = _mm_setzero_si128(), ones = _mm_set1_epi8(-1), sign = _mm_set1_epi16((short)0x8000);
+    const __m128i half = _mm_set1_epi16(64), cap = _mm_set1_epi16(BG_DEV_CAP);
+    const __m128i t2q = _mm_set1_epi16((short)k->t2q), vmin = _mm_set1_epi16((short)k->vmin);
+    const __m128i rl = _mm_set1_epi16((short)(1 << (k->learn - 1))), sl = _mm_cvtsi32_si128(k->learn);
+    const __m128i rh = _mm_set1_epi16((short)(1 << (k->hold - 1))), sh = _mm_cvtsi32_si128(k->hold);
+    __m128i px, p, m, v, d, ad, a, e, fg[2];
+    int x, h, end = width & ~15;
+
+    for(x=0; x < end; x += 16)
+    {
+        px = _mm_loadu_si128((const __m128i *)(c + x));
+
+        for(h=0; h < 2; h++)
+        {
+            p = h ? _mm_unpackhi_epi8(px, zero) : _mm_unpacklo_epi8(px, zero);
+            m = _mm_loadu_si128((const __m128i *)(mean + x + 8 * h));
+            v = _mm_loadu_si128((const __m128i *)(var + x + 8 * h));
+
+            d = _mm_sub_epi16(_mm_slli_epi16(p, 7), m);
+            ad = _mm_srli_epi16(_mm_add_epi16(_mm_max_epi16(d, _mm_sub_epi16(zero, d)), half), 7);
+
+            // unsigned ad^2 > var sigmas^2, by flipping the sign bits
+            fg[h] = _mm_cmpgt_epi16(_mm_xor_si128(_mm_mullo_epi16(ad, ad), sign),
+                                    _mm_xor_si128(_mm_mulhi_epu16(v, t2q), sign));
+
+            a = _mm_min_epi16(ad, cap);
+            e = _mm_sub_epi16(_mm_slli_epi16(_mm_mullo_epi16(a, a), 4), v);
+
+            m = _mm_add_epi16(m, _mm_or_si128(_mm_and_si128(fg[h], _mm_sra_epi16(_mm_adds_epi16(d, rh), sh)),
+                                              _mm_andnot_si128(fg[h], _mm_sra_epi16(_mm_adds_epi16(d, rl), sl))));
+            v = _mm_add_epi16(v, _mm_or_si128(_mm_and_si128(fg[h], _mm_sra_epi16(_mm_adds_epi16(e, rh), sh)),
+                                              _mm_andnot_si128(fg[h], _mm_sra_epi16(_mm_adds_epi16(e, rl), sl))));
+            v = _mm_max_epi16(v, vmin);
+
+            _mm_storeu_si128((__m128i *)(mean + x + 8 * h), m);
+            _mm_storeu_si128((__m128i *)(var + x + 8 * h), v);
+        }
+
+        _mm_storeu_si128((__m128i *)(still + x), _mm_xor_si128(_mm_packs_epi16(fg[0], fg[1]), ones));
+    }
+    bg_still_scalar(c, mean, var, still, x, width, k);
+
+    return erode_sse2(above, still, mask, width, x0, x1);
+}
+
+__attribute__((target("avx2")))
+static long erode_avx2(const UINT8 *above, const UINT8 *still, UINT8 *mask, int width, int x0, int x1)
+{
+    const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi8(-1);
+    __m256i m, sum = zero;
+    __m128i s;
+    int x, end = width & ~31;
+
+    for(x=0; x < end; x += 32)
+    {
+        m = _mm256_max_epu8(_mm256_loadu_si256((const __m256i *)(above + x - 1)),
+                            _mm256_loadu_si256((const __m256i *)(above + x)));
+        m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i *)(still + x - 1)));
+        m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i *)(still + x)));
+        _mm256_storeu_si256((__m256i *)(mask + x), _mm256_xor_si256(m, ones));
+    }
+    erode_scalar(above, still, mask, x, width);
+
+    for(x=x0; x + 32 <= x1; x += 32)
+        sum = _mm256_add_epi64(sum, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i *)(mask + x)), zero));
+
+    s = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+    return _mm_cvtsi128_si64(s) + _mm_cvtsi128_si64(_mm_unpackhi_epi64(s, s)) + count_scalar(mask, x, x1);
+}
+
+__attribute__((target("avx2")))
+static long row_avx2(const UINT8 *a, const UINT8 *b, const UINT8 *c, const UINT8 *above, UINT8 *still,
+                     UINT8 *mask, int width, int threshold, int x0, int x1)
+{
+    const __m256i zero = _mm256_setzero_si256(), thr = _mm256_set1_epi8((char)threshold);
+    __m256i va, vb, vc, d1, d2, m;
+    int x, end = width & ~31;
+
+    for(x=0; x < end; x += 32)
+    {
+        va = _mm256_loadu_si256((const __m256i *)(a + x));
+        vb = _mm256_loadu_si256((const __m256i *)(b + x));
+        vc = _mm256_loadu_si256((const __m256i *)(c + x));
+        d1 = _mm256_or_si256(_mm256_subs_epu8(va, vc), _mm256_subs_epu8(vc, va));
+        d2 = _mm256_or_si256(_mm256_subs_epu8(vb, vc), _mm256_subs_epu8(vc, vb));
+        m = _mm256_subs_epu8(_mm256_and_si256(d1, d2), thr);
+        _mm256_storeu_si256((__m256i *)(still + x), _mm256_cmpeq_epi8(m, zero));
+    }
+    still_scalar(a, b, c, still, x, width, threshold);
+
+    return erode_avx2(above, still, mask, width, x0, x1);
+}
+
+__attribute__((target("avx2")))
+static long bg_row_avx2(const UINT8 *c, short *mean, short *var, const UINT8 *above, UINT8 *still,
+                        UINT8 *mask, int width, const struct bg_consts *k, int x0, int x1)
+{
+    const __m256i sign = _mm256_set1_epi16((short)0x8000);
+    const __m256i half = _mm256_set1_epi16(64), cap = _mm256_set1_epi16(BG_DEV_CAP);
+    const __m256i t2q = _mm256_set1_epi16((short)k->t2q), vmin = _mm256_set1_epi16((short)k->vmin);
+    const __m256i rl = _mm256_set1_epi16((short)(1 << (k->learn - 1)));
+    const __m256i rh = _mm256_set1_epi16((short)(1 << (k->hold - 1)));
+    const __m128i sl = _mm_cvtsi32_si128(k->learn), sh = _mm_cvtsi32_si128(k->hold);
+    __m256i p, m, v, d, ad, a, e, fg;
+    int x, end = width & ~15;
+
+    // 16 pixels a step, the mean and variance are a 256-bit vector each
+    for(x=0; x < end; x += 16)
+    {
+        p = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(c + x)));
+        m = _mm256_loadu_si256((const __m256i *)(mean + x));
+        v = _mm256_loadu_si256((const __m256i *)(var + x));
+
+        d = _mm256_sub_epi16(_mm256_slli_epi16(p, 7), m);
+        ad = _mm256_srli_epi16(_mm256_add_epi16(_mm256_abs_epi16(d), half), 7);
+
+        fg = _mm256_cmpgt_epi16(_mm256_xor_si256(_mm256_mullo_epi16(ad, ad), sign),
+                                _mm256_xor_si256(_mm256_mulhi_epu16(v, t2q), sign));
+
+        a = _mm256_min_epi16(ad, cap);
+        e = _mm256_sub_epi16(_mm256_slli_epi16(_mm256_mullo_epi16(a, a), 4), v);
+
+        m = _mm256_add_epi16(m, _mm256_blendv_epi8(_mm256_sra_epi16(_mm256_adds_epi16(d, rl), sl),
+                                                   _mm256_sra_epi16(_mm256_adds_epi16(d, rh), sh), fg));
+        v = _mm256_add_epi16(v, _mm256_blendv_epi8(_mm256_sra_epi16(_mm256_adds_epi16(e, rl), sl),
+                                                   _mm256_sra_epi16(_mm256_adds_epi16(e, rh), sh), fg));
+        v = _mm256_max_epi16(v, vmin);
+
+        _mm256_storeu_si256((__m256i *)(mean + x), m);
+        _mm256_storeu_si256((__m256i *)(var + x), v);
+        _mm_storeu_si128((__m128i *)(still + x),
+                         _mm_xor_si128(_mm_packs_epi16(_mm256_castsi256_si128(fg), _mm256_extracti128_si256(fg, 1)),
+                                       _mm_set1_epi8(-1)));
+    }
+    bg_still_scalar(c, mean, var, still, x, width, k);
+
+    return erode_avx2(above, still, mask, width, x0, x1);
+}
+
+#endif
+
+
+#if defined(MOTION_NEON)
+
+static long erode_neon(const UINT8 *above, const UINT8 *still, UINT8 *mask, int width, int x0, int x1)
+{
+    uint8x16_t m;
+    uint64x2_t sum = vdupq_n_u64(0);
+    int x, end = width & ~15;
+
+    for(x=0; x < end; x += 16)
+    {
+        m = vmaxq_u8(vld1q_u8(above + x - 1), vld1q_u8(above + x));
+        m = vmaxq_u8(m, vld1q_u8(still + x - 1));
+        m = vmaxq_u8(m, vld1q_u8(still + x));
+        vst1q_u8(mask + x, vmvnq_u8(m));
+    }
+    erode_scalar(above, still, mask, x, width);
+
+    for(x=x0; x + 16 <= x1; x += 16)
+        sum = vpadalq_u32(sum, vpaddlq_u16(vpaddlq_u8(vld1q_u8(mask + x))));
+
+    return (long)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1)) + count_scalar(mask, x, x1);
+}
+
+static long row_neon(const UINT8 *a, const UINT8 *b, const UINT8 *c, const UINT8 *above, UINT8 *still,
+                     UINT8 *mask, int width, int threshold, int x0, int x1)
+{
+    const uint8x16_t thr = vdupq_n_u8((UINT8)threshold);
+    uint8x16_t vc, m;
+    int x, end = width & ~15;
+
+    for(x=0; x < end; x += 16)
+    {
+        vc = vld1q_u8(c + x);
+        m = vandq_u8(vabdq_u8(vld1q_u8(a + x), vc), vabdq_u8(vld1q_u8(b + x), vc));
+        vst1q_u8(still + x, vcleq_u8(m, thr));
+    }
+    still_scalar(a, b, c, still, x, width, threshold);
+
+    return erode_neon(above, still, mask, width, x0, x1);
+}
+
+static long bg_row_neon(const UINT8 *c, short *mean, short *var, const UINT8 *above, UINT8 *still,
+                        UINT8 *mask, int width, const struct bg_consts *k, int x0, int x1)
+{
+    const uint16x8_t cap = vdupq_n_u16(BG_DEV_CAP);
+    const uint16x4_t t2q = vdup_n_u16((unsigned short)k->t2q);
+    const int16x8_t vmin = vdupq_n_s16((short)k->vmin);
+    const int16x8_t rl = vdupq_n_s16((short)(1 << (k->learn - 1))), sl = vdupq_n_s16((short)-k->learn);
+    const int16x8_t rh = vdupq_n_s16((short)(1 << (k->hold - 1))), sh = vdupq_n_s16((short)-k->hold);
+    uint8x16_t px;
+    uint8x8_t fg8[2];
+    uint16x8_t ad, a, uv, fg;
+    int16x8_t p, m, v, d, r, s;
+    int x, h, end = width & ~15;
+
+    for(x=0; x < end; x += 16)
+    {
+        px = vld1q_u8(c + x);
+
+        for(h=0; h < 2; h++)
+        {
+            p = vreinterpretq_s16_u16(vmovl_u8(h ? vget_high_u8(px) : vget_low_u8(px)));
+            m = vld1q_s16(mean + x + 8 * h);
+            v = vld1q_s16(var + x + 8 * h);
+            uv = vreinterpretq_u16_s16(v);
+
+            d = vsubq_s16(vshlq_n_s16(p, 7), m);
+            ad = vrshrq_n_u16(vreinterpretq_u16_s16(vabsq_s16(d)), 7);
+            fg = vcgtq_u16(vmulq_u16(ad, ad), vcombine_u16(vshrn_n_u32(vmull_u16(vget_low_u16(uv), t2q), 16),
+                                                           vshrn_n_u32(vmull_u16(vget_high_u16(uv), t2q), 16)));
+
+            a = vminq_u16(ad, cap);
+            a = vshlq_n_u16(vmulq_u16(a, a), 4);
+
+            // a negative shift count is an arithmetic shift right
+            r = vbslq_s16(fg, rh, rl);
+            s = vbslq_s16(fg, sh, sl);
+            m = vaddq_s16(m, vshlq_s16(vqaddq_s16(d, r), s));
+            v = vaddq_s16(v, vshlq_s16(vqaddq_s16(vsubq_s16(vreinterpretq_s16_u16(a), v), r), s));
+            v = vmaxq_s16(v, vmin);
+
+            vst1q_s16(mean + x + 8 * h, m);
+            vst1q_s16(var + x + 8 * h, v);
+            fg8[h] = vmovn_u16(fg);
+        }
+
+        vst1q_u8(still + x, vmvnq_u8(vcombine_u8(fg8[0], fg8[1])));
+    }
+    bg_still_scalar(c, mean, var, still, x, width, k);
+
+    return erode_neon(above, still, mask, width, x0, x1);
+}
+
+#endif
+
+
+typedef long (*row_fn)(const UINT8 *a, const UINT8 *b, const UINT8 *c, const UINT8 *above, UINT8 *still,
+                       UINT8 *mask, int width, int threshold, int x0, int x1);
+
+typedef long (*bg_row_fn)(const UINT8 *c, short *mean, short *var, const UINT8 *above, UINT8 *still,
+                          UINT8 *mask, int width, const struct bg_consts *k, int x0, int x1);
+
+static const struct
+{
+    const char *name;
+    row_fn      row;
+    bg_row_fn   background;
+} kernels[MOTION_ISA_COUNT] =
+{
+    { "scalar", row_scalar, bg_row_scalar },
+#if defined(MOTION_X86)
+    { "sse2",   row_sse2,   bg_row_sse2 },
+    { "avx2",   row_avx2,   bg_row_avx2 },
+#else
+    { "sse2",   NULL,       NULL },
+    { "avx2",   NULL,       NULL },
+#endif
+#if defined(MOTION_NEON)
+    { "neon",   row_neon,   bg_row_neon }
+#else
+    { "neon",   NULL,       NULL }
+#endif
+};
+
+static int selected_isa = -1;
+
+
+int motion_isa_supported(int isa)
+{
+    if((isa < 0) || (isa >= MOTION_ISA_COUNT) || !kernels[isa].row)
+        return 0;
+
+#if defined(MOTION_X86)
+    __builtin_cpu_init();
+    if(isa == MOTION_ISA_SSE2) return __builtin_cpu_supports("sse2");
+    if(isa == MOTION_ISA_AVX2) return __builtin_cpu_supports("avx2");
+#endif
+
+    return 1;
+}
+
+int motion_kernel_select(int isa)
+{
+    if(!motion_isa_supported(isa))
+        return -1;
+
+    selected_isa = isa;
+    return 0;
+}
+
+int motion_kernel_isa(void)
+{
+    int isa;
+
+    // benign race, every thread resolves the same answer
+    if(selected_isa < 0)
+    {
+        for(isa = MOTION_ISA_COUNT - 1; isa > MOTION_ISA_SCALAR; isa--)
+            if(motion_isa_supported(isa))
+                break;
+
+        selected_isa = isa;
+    }
+
+    return selected_isa;
+}
+
+const char *motion_isa_name(int isa)
+{
+    if((isa < 0) || (isa >= MOTION_ISA_COUNT))
+        return "unknown";
+
+    return kernels[isa].name;
+}
+
+
+// the columns of the region clipped to the frame
+static void region_columns(int width, int roi_x, int roi_width, int *x0, int *x1)
+{
+    *x0 = (roi_x > 0) ? roi_x : 0;
+    *x1 = (roi_x + roi_width < width) ? roi_x + roi_width : width;
+    if(*x1 < *x0)
+        *x1 = *x0;
+}
+
+// count, mean and standard deviation of a mask with sum / 255 changes in the region
+static void region_stats(int height, int roi_y, int roi_height, int x0, int x1, long sum, struct motion_stats *stats)
+{
+    double n, p;
+    int rows;
+
+    // a mask of c 255s in n pixels has mean 255 c / n and variance 255^2 (c/n)(1 - c/n)
+    rows = ((roi_y + roi_height < height) ? roi_y + roi_height : height) - ((roi_y > 0) ? roi_y : 0);
+    n = (double)(x1 - x0) * ((rows > 0) ? rows : 0);
+    p = (n > 0.0) ? (double)(sum / 255) / n : 0.0;
+
+    stats->changes = sum / 255;
+    stats->mean = 255.0 * p;
+    stats->stddev = 255.0 * sqrt(p * (1.0 - p));
+}
+
+
+int motion_core_init(struct motion_core *core, int width, int height)
+{
+    int i;
+
+    memset(core, 0, sizeof(*core));
+    core->width = width;
+    core->height = height;
+
+    for(i=0; i < 2; i++)
+        if(!(core->still[i] = calloc(width + STILL_PAD, 1)))
+        {
+            motion_core_free(core);
+            return -1;
+        }
+
+    return 0;
+}
+
+void motion_core_free(struct motion_core *core)
+{
+    free(core->still[0]);
+    free(core->still[1]);
+    core->still[0] = core->still[1] = NULL;
+}
+
+void motion_detect(struct motion_core *core, const unsigned char *prev2, const unsigned char *prev,
+                   const unsigned char *cur, int stride, unsigned char *mask, int mask_stride, int threshold,
+                   int roi_x, int roi_y, int roi_width, int roi_height, struct motion_stats *stats)
+{
+    row_fn row = kernels[motion_kernel_isa()].row;
+    UINT8 *above = core->still[0] + 1, *still = core->still[1] + 1, *t;
+    long sum = 0;
+    int y, x0, x1;
+
+    threshold = (threshold < 0) ? 0 : (threshold > 255) ? 255 : threshold;
+    region_columns(core->width, roi_x, roi_width, &x0, &x1);
+
+    for(y=0; y < core->height; y++)
+    {
+        size_t offset = (size_t)y * stride;
+        int in = (y >= roi_y) && (y < roi_y + roi_height);
+
+        sum += row(prev2 + offset, prev + offset, cur + offset, y ? above : still, still,
+                   mask + (size_t)y * mask_stride, core->width, threshold, in ? x0 : 0, in ? x1 : 0);
+
+        t = above;
+        above = still;
+        still = t;
+    }
+
+    region_stats(core->height, roi_y, roi_height, x0, x1, sum, stats);
+}
+
+
+int motion_background_init(struct motion_background *bg, int width, int height)
+{
+    size_t pixels = (size_t)width * height;
+    int i;
+
+    memset(bg, 0, sizeof(*bg));
+    bg->width = width;
+    bg->height = height;
+    bg->sigmas = 2.5;
+    bg->min_sigma = 4.0;
+    bg->learn_shift = 5;
+    bg->hold_shift = 7;
+    bg->relearn = 0.5;
+
+    if(!(bg->mean = malloc(pixels * sizeof(short))) || !(bg->var = malloc(pixels * sizeof(short))))
+    {
+        motion_background_free(bg);
+        return -1;
+    }
+
+    for(i=0; i < 2; i++)
+        if(!(bg->still[i] = calloc(width + STILL_PAD, 1)))
+        {
+            motion_background_free(bg);
+            return -1;
+        }
+
+    return 0;
+}
+
+void motion_background_free(struct motion_background *bg)
+{
+    free(bg->mean);
+    free(bg->var);
+    free(bg->still[0]);
+    free(bg->still[1]);
+    bg->mean = bg->var = NULL;
+    bg->still[0] = bg->still[1] = NULL;
+}
+
+// the mean from a frame, and the variance too when it is a new model
+static void background_seed(struct motion_background *bg, const UINT8 *cur, int stride, int vmin, int reset_var)
+{
+    int x, y, v = (BG_SEED_VAR > vmin) ? BG_SEED_VAR : vmin;
+
+    for(y=0; y < bg->height; y++)
+    {
+        const UINT8 *c = cur + (size_t)y * stride;
+        short *mean = bg->mean + (size_t)y * bg->width, *var = bg->var + (size_t)y * bg->width;
+
+        for(x=0; x < bg->width; x++)
+        {
+            mean[x] = (short)(c[x] << 7);
+            if(reset_var)
+                var[x] = (short)v;
+        }
+    }
+}
+
+int motion_background_update(struct motion_background *bg, const unsigned char *cur, int stride,
+                             unsigned char *mask, int mask_stride, int roi_x, int roi_y, int roi_width,
+                             int roi_height, struct motion_stats *stats)
+{
+    bg_row_fn row = kernels[motion_kernel_isa()].background;
+    UINT8 *above = bg->still[0] + 1, *still = bg->still[1] + 1, *t;
+    struct bg_consts k;
+    double t2, vmin;
+    long sum = 0;
+    int y, x0, x1, relearn;
+
+    t2 = bg->sigmas * bg->sigmas * 4096.0;
+    vmin = bg->min_sigma * bg->min_sigma * 16.0;
+    k.t2q = (t2 < 0.0) ? 0 : (t2 > 65535.0) ? 65535 : (int)(t2 + 0.5);
+    k.vmin = (vmin < 0.0) ? 0 : (vmin > (BG_DEV_CAP * BG_DEV_CAP) << 4) ? (BG_DEV_CAP * BG_DEV_CAP) << 4 : (int)vmin;
+    k.learn = (bg->learn_shift < 1) ? 1 : (bg->learn_shift > 15) ? 15 : bg->learn_shift;
+    k.hold = (bg->hold_shift < 1) ? 1 : (bg->hold_shift > 15) ? 15 : bg->hold_shift;
+
+    region_columns(bg->width, roi_x, roi_width, &x0, &x1);
+
+    relearn = !bg->frames;
+    if(bg->frames)
+    {
+        for(y=0; y < bg->height; y++)
+        {
+            size_t offset = (size_t)y * bg->width;
+            int in = (y >= roi_y) && (y < roi_y + roi_height);
+
+            sum += row(cur + (size_t)y * stride, bg->mean + offset, bg->var + offset, y ? above : still, still,
+                       mask + (size_t)y * mask_stride, bg->width, &k, in ? x0 : 0, in ? x1 : 0);
+
+            t = above;
+            above = still;
+            still = t;
+        }
+
+        region_stats(bg->height, roi_y, roi_height, x0, x1, sum, stats);
+
+        // most of the region changing at once is the light, not motion
+        relearn = (stats->mean > 255.0 * bg->relearn);
+    }
+
+    // the first frame, or after a lighting change, becomes the background
+    if(relearn)
+    {
+        background_seed(bg, cur, stride, k.vmin, !bg->frames);
+        for(y=0; y < bg->height; y++)
+            memset(mask + (size_t)y * mask_stride, 0, bg->width);
+        region_stats(bg->height, roi_y, roi_height, x0, x1, 0, stats);
+    }
+
+    bg->frames++;
+    return relearn && (bg->frames > 1);
+}
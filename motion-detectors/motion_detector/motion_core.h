@@ -0,0 +1,118 @@
+/*
+ *  Three frame differencing core of the motion detector, in one pass
+ *
+ *  Computes the same motion mask as the OpenCV chain in motion_detector.cpp
+ *
+ *    absdiff(prevPrev, current, d1); absdiff(prev, current, d2);
+ *    bitwise_and(d1, d2, motion);
+ *    threshold(motion, motion, threshold, 255, THRESH_BINARY);
+ *    erode(motion, motion, 2x2 rectangle);
+ *
+ *  and the count, mean and standard deviation of the mask over a region of
+ *  interest, but reads each frame once and keeps the thresholded rows in
+ *  two small row buffers for the erosion.  As the mask is 0 or 255, the
+ *  mean and standard deviation follow from the count of changed pixels.
+ *
+ *  The background model is the alternative to differencing three frames:
+ *  a running mean and variance per pixel, updated every frame, against
+ *  which a pixel that is more than sigmas deviations off is moving.  It
+ *  sees objects too slow to show in three frames and, learning slower
+ *  where pixels are moving, keeps an object that stops for a while.  When
+ *  more than relearn of the region changes at once, as when a light goes
+ *  on, the mean is reset to the frame instead of reporting motion.  Its
+ *  mask gets the same 2x2 erosion and statistics as motion_detect().
+ *
+ *  Rows are done with SSE2, AVX2 or NEON, picked at run time as in
+ *  capture_common/yuv_convert.c, and every kernel gives the same mask and,
+ *  for the background, the same model.
+ */
+#ifndef MOTION_CORE_H
+#define MOTION_CORE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum motion_isa
+{
+    MOTION_ISA_SCALAR,
+    MOTION_ISA_SSE2,
+    MOTION_ISA_AVX2,
+    MOTION_ISA_NEON,
+    MOTION_ISA_COUNT
+};
+
+struct motion_core
+{
+    int            width;
+    int            height;
+    unsigned char *still[2];    // per row, 255 where the thresholded difference is 0
+};
+
+struct motion_stats
+{
+    long   changes;             // 255 pixels of the mask in the region
+    double mean;                // of the mask in the region, as meanStdDev()
+    double stddev;
+};
+
+struct motion_background
+{
+    int            width;
+    int            height;
+    short         *mean;        // width x height, gray level << 7
+    short         *var;         // width x height, gray level^2 << 4
+    unsigned char *still[2];
+    long           frames;      // 0 until the first frame seeds the model
+
+    // settings, defaults from motion_background_init(), may change between frames
+    double         sigmas;      // deviations off the mean that are moving, up to 4
+    double         min_sigma;   // floor of the deviation in gray levels, above the camera noise
+    int            learn_shift; // still pixels move 2^-learn_shift of the way to a new frame
+    int            hold_shift;  // moving pixels 2^-hold_shift, larger to hold on to slow objects
+    double         relearn;     // fraction of the region moving taken for a lighting change
+};
+
+// Row buffers for frames of width x height, allocated once.  Returns 0, or
+// -1 if out of memory.
+int motion_core_init(struct motion_core *core, int width, int height);
+void motion_core_free(struct motion_core *core);
+
+// Mask of the pixels that changed in both prev2 -> cur and prev -> cur by
+// more than threshold (0 to 255), eroded, and its statistics over the
+// region roi_x, roi_y, roi_width x roi_height.  The frames are 8-bit gray
+// with the same stride; the mask may not be one of them.
+void motion_detect(struct motion_core *core, const unsigned char *prev2, const unsigned char *prev,
+                   const unsigned char *cur, int stride, unsigned char *mask, int mask_stride, int threshold,
+                   int roi_x, int roi_y, int roi_width, int roi_height, struct motion_stats *stats);
+
+// Model for frames of width x height, allocated once.  Returns 0, or -1 if
+// out of memory.
+int motion_background_init(struct motion_background *bg, int width, int height);
+void motion_background_free(struct motion_background *bg);
+
+// Mask of the pixels of the 8-bit gray frame cur that are off the model,
+// eroded, and its statistics over the region as motion_detect(), then the
+// model learns the frame.  The first frame only seeds the model.  Returns 1
+// when the frame was taken for a lighting change and relearned, with an
+// empty mask, else 0.
+int motion_background_update(struct motion_background *bg, const unsigned char *cur, int stride,
+                             unsigned char *mask, int mask_stride, int roi_x, int roi_y, int roi_width,
+                             int roi_height, struct motion_stats *stats);
+
+// returns non-zero when the kernel can run on this CPU
+int motion_isa_supported(int isa);
+
+// returns 0 and selects isa, or -1 if it is not supported
+int motion_kernel_select(int isa);
+
+// currently selected kernel, resolving the default on first use
+int motion_kernel_isa(void);
+
+const char *motion_isa_name(int isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -10,6 +10,10 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#include "motion_core.h"
+#include "image_archiver.h"
 
 using namespace std;
 using namespace cv;
@@ -26,6 +30,10 @@ using namespace cv;
 #define DIRECTORY2 ("/mnt/data/collect/")
 #define FILE_FORMAT ("%d%h%Y_%H%M%S") // 1Jan1970/1Jan1970_12153
 #define EXTENSION (".png") // extension of the images
+#define PNG_COMPRESSION 1 // 0-9, 1 is several times faster than the default 3
+#define RAW_THEN_PNG 0 // write PPM in bursts and PNG when the archiver is idle
+#define ARCHIVE_QUEUE 64 // frames waiting to be written before saves are dropped
+#define PRE_TRIGGER_FRAMES 10 // frames before a motion event saved with it
 
 #define MAX_THRESHOLD 255
 #define MAX_DEVIATION 255 // Maximum allowable deviation of a pixel to count as "changed"
@@ -45,77 +53,21 @@ typedef struct {
   int numberOfChanges;
 } MotionDetectData_t;
 
-// Check if the directory exists, if not create it
-// This function will create a new directory if the image is the first
-// image taken for a specific day
-inline void directoryExistsOrCreate(const char* pzPath) {
-  DIR *pDir;    
-  if ( pzPath == NULL || (pDir = opendir (pzPath)) == NULL) { // directory doesn't exists -> create it
-    mkdir(pzPath, 0777);    
-  } else if (pDir != NULL) { // if directory exists we opened it and we have to close the directory again.
-    (void) closedir (pDir);
-  }
-}
-
-
-// When motion is detected we write the image to disk
-//    - Check if the directory exists where the image will be stored.
-//    - Build the directory and image names.
-inline bool saveImg(Mat image, const string directory,
-                    const string extension, const string fileFormat,
-                    const int sequence, int traceOn)
-{
-  stringstream ss;
-  time_t seconds;
-  struct tm * timeinfo;
-  char timeStr[80];
-  time(&seconds);
-
-  // Get the current time
-  timeinfo = localtime(&seconds);
-
-  // Create name for the date directory
-  directoryExistsOrCreate(directory.c_str());
-
-  // Create name for the image
-  strftime(timeStr, 80, fileFormat.c_str(), timeinfo);
-
-  ss.str("");
-  ss << directory << timeStr << "_" << sequence << extension;
-
-  if(traceOn)
-      cout << "Saving Image: " << ss.str() << endl;
-
-  return imwrite(ss.str().c_str(), image);
-}
-
-// Check if there is motion in the result matrix. Count the number of changes and return.
-inline MotionDetectData_t detectMotion(const Mat &motion, int max_deviation, int triggerCount) {
+// Check if there is motion from the statistics of the motion mask, which
+// motion_detect() gathers in the same pass that builds the mask.
+inline MotionDetectData_t detectMotion(const struct motion_stats &stats, int max_deviation, int triggerCount) {
 
-  int rows = motion.rows;
-  int cols = motion.cols;
-  
-  int min_x = motion.cols, max_x = 0;
-  int min_y = motion.rows, max_y = 0;
-  
-  // calculate the standard deviation
   MotionDetectData_t data;
-  data.mean = 0;
-  data.stddev = 0;
+  data.mean = Scalar(stats.mean);
+  data.stddev = Scalar(stats.stddev);
   data.numberOfChanges = 0;
   data.isMotion = false;
   
-  meanStdDev(motion, data.mean, data.stddev);
-  // if not to much changes then the motion is real
-  if (data.stddev[0] < max_deviation) {
-    // loop over image and detect changes
-    for (int j = 0; j < rows; j+=1) { // height
-      for (int i = 0; i < cols; i+=1) { // width
-        // check if at pixel (j,i) intensity is equal to 255 this means that the pixel is different in the sequence of images (prev_frame, current_frame, next_frame)
-        if ((motion.at<int>(j,i)) == 255) data.numberOfChanges++;        
-      }
-    }
-  }
+  // if not to much changes then the motion is real, the changes being the
+  // pixels that differ in the sequence of images (prev_frame, current_frame, next_frame)
+  if (data.stddev[0] < max_deviation)
+    data.numberOfChanges = stats.changes;
+
   data.isMotion = (data.numberOfChanges >= triggerCount);
   return data;
 }
@@ -131,18 +83,33 @@ int main (int argc, char * const argv[])
   Rect boundingR;
   vector<vector<Point> > contours;
   
-  // d1 and d2 for calculating the differences
-  // result, the result of and operation, calculated on d1 and d2
-  // number_of_changes, the amount of changes in the result matrix.
-  // color, the color for drawing the rectangle when something has changed.
-  Mat prevPrevFrame, prevFrame, currentFrame, result_saved, resultTracked, display, roi;  
-  Mat d1, d2, motion;
+  // gray, a ring of the last three gray frames, rotated by index so no
+  // frame is copied; current is the newest, prev and prevPrev the two before
+  // motion, the eroded AND of the thresholded differences, from motion_detect()
+  // d1 and d2, the differences themselves, only to show them
+  Mat gray[3], result_saved, resultTracked, display, roi;  
+  Mat d1, d2, motion, motionRGB;
+  int current = 0, prev = 0, prevPrev = 0;
+  struct motion_core core;
+  struct motion_stats motionStats;
+  struct motion_background background;
+  bool useBackground = false;
+  struct archiver_config archiverConfig;
+  struct image_archiver *archiver;
   MotionDetectData_t motionDetectData;
   int numberOfSequence = 0;
   unsigned int frameCnt = 0;
-
-  // Erode kernel
-  Mat kernel_ero = getStructuringElement(MORPH_RECT, Size(2, 2));
+  int opt;
+
+  // -b, a background model in place of differencing three frames
+  while ((opt = getopt(argc, argv, "b")) != -1) {
+    if (opt == 'b') {
+      useBackground = true;
+    } else {
+      cout << "Usage: motion_detector [-b]" << endl;
+      exit(EXIT_FAILURE);
+    }
+  }
   
   // Set up camera
   VideoCapture camera(DEVICE_ID);
@@ -153,52 +120,79 @@ int main (int argc, char * const argv[])
     exit(EXIT_SUCCESS);
   }
 
-  // Take image, initialize mats, and convert them to gray
+  // Take image, allocate every buffer once, and start the ring with it in gray
   camera >> result_saved;
-  prevPrevFrame = Mat::zeros(result_saved.size(), result_saved.type());
-  prevFrame = Mat::zeros(result_saved.size(), result_saved.type());
-  currentFrame = Mat::zeros(result_saved.size(), result_saved.type());
+  for (int i = 0; i < 3; i++)
+    gray[i].create(result_saved.size(), CV_8UC1);
+  motion.create(result_saved.size(), CV_8UC1);
+  motionRGB.create(result_saved.size(), result_saved.type());
+  if ((motion_core_init(&core, result_saved.cols, result_saved.rows) != 0) ||
+      (useBackground && (motion_background_init(&background, result_saved.cols, result_saved.rows) != 0))) {
+    cout << "Failed to allocate the motion detector" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // saves are copied to the archiver's buffers and written by its own thread
+  archiverConfig.queue = ARCHIVE_QUEUE;
+  archiverConfig.pre_trigger = PRE_TRIGGER_FRAMES;
+  archiverConfig.png_level = PNG_COMPRESSION;
+  archiverConfig.raw = RAW_THEN_PNG;
+  archiverConfig.file_format = FILE_FORMAT;
+  archiverConfig.extension = EXTENSION;
+  if (!(archiver = archiver_open(&archiverConfig, result_saved.cols, result_saved.rows, result_saved.type()))) {
+    cout << "Failed to start the image archiver" << endl;
+    exit(EXIT_FAILURE);
+  }
 #ifdef SHOW_DIFF
   display = Mat::zeros(Size(result_saved.cols * 2, result_saved.rows * 2), result_saved.type());
 #else
   display = Mat::zeros(Size(result_saved.cols * 2, result_saved.rows * 1), result_saved.type());
 #endif
   
-  result_saved.copyTo(prevFrame);
-  result_saved.copyTo(currentFrame);
-  
-  cvtColor(prevFrame, prevFrame, CV_RGB2GRAY);
-  cvtColor(currentFrame, currentFrame, CV_RGB2GRAY);
+  // the first frame is also prev and prevPrev until two more arrive
+  cvtColor(result_saved, gray[current], CV_RGB2GRAY);
   
-  cout << "Image Capture Resolution: " << currentFrame.cols << "x" << currentFrame.rows << endl;
+  cout << "Image Capture Resolution: " << gray[current].cols << "x" << gray[current].rows
+       << ", " << motion_isa_name(motion_kernel_isa()) << " motion kernel, "
+       << (useBackground ? "background model" : "three frame difference") << endl;
 
   // Setup display window	
   namedWindow(WINDOW_NAME, WINDOW_AUTOSIZE | CV_GUI_NORMAL); 
   createTrackbar("Threshold:", WINDOW_NAME, &currentThreshold, MAX_THRESHOLD, NULL);
   createTrackbar("Max Deviation:", WINDOW_NAME, &currentDeviation, MAX_DEVIATION, NULL);
-  createTrackbar("Pixels Changed:", WINDOW_NAME, &currentMotionTrigger, currentFrame.cols * currentFrame.rows, NULL);	
+  createTrackbar("Pixels Changed:", WINDOW_NAME, &currentMotionTrigger, gray[current].cols * gray[current].rows, NULL);	
   
   cvWaitKey (DELAY_IN_MSEC);
 
   // All settings have been set, now go in endless frame acquisition loop
   while (running)
   {
-    // Take a new image
+    // Take a new image into the oldest slot of the ring
     camera >> result_saved;
-    prevFrame.copyTo(prevPrevFrame);
-    currentFrame.copyTo(prevFrame);
-    result_saved.copyTo(currentFrame);
+    prevPrev = prev;
+    prev = current;
+    current = (current + 1) % 3;
     
-    cvtColor(currentFrame, currentFrame, CV_RGB2GRAY);
+    cvtColor(result_saved, gray[current], CV_RGB2GRAY);
     
-    // Calc differences between the images and do AND-operation threshold image
-    absdiff(prevPrevFrame, currentFrame, d1);
-    absdiff(prevFrame, currentFrame, d2);
-    bitwise_and(d1, d2, motion);
-    threshold(motion, motion, currentThreshold, 255, CV_THRESH_BINARY);
-    erode(motion, motion, kernel_ero);
+    if (useBackground) {
+      // Pixels off the running background, the threshold being the least
+      // deviation of a pixel, eroded, then the background learns the frame
+      background.min_sigma = currentThreshold;
+      if (motion_background_update(&background, gray[current].data, (int)gray[current].step,
+                                   motion.data, (int)motion.step,
+                                   CAM_WIDTH_OFFSET, 0, motion.cols - (CAM_WIDTH_OFFSET * 2), motion.rows,
+                                   &motionStats))
+        cout << "Lighting change, background relearned" << endl;
+    } else {
+      // Differences between the images, AND, threshold and erode in one pass,
+      // with the statistics of the region the changes are counted in
+      motion_detect(&core, gray[prevPrev].data, gray[prev].data, gray[current].data, (int)gray[current].step,
+                    motion.data, (int)motion.step, currentThreshold,
+                    CAM_WIDTH_OFFSET, 0, motion.cols - (CAM_WIDTH_OFFSET * 2), motion.rows, &motionStats);
+    }
     
-    motionDetectData = detectMotion(motion(Rect(CAM_WIDTH_OFFSET, 0, 640-(CAM_WIDTH_OFFSET * 2), 480)), currentDeviation, currentMotionTrigger);
+    motionDetectData = detectMotion(motionStats, currentDeviation, currentMotionTrigger);
 
     /* 
     * I think it's self-descriptive. We pick 4 different ROIs and copy
@@ -216,16 +210,18 @@ int main (int argc, char * const argv[])
     }
     
 #ifdef SHOW_DIFF
+    absdiff(gray[prevPrev], gray[current], d1);
+    absdiff(gray[prev], gray[current], d2);
     cvtColor(d1, d1, CV_GRAY2RGB);
     d1.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
     cvtColor(d2, d2, CV_GRAY2RGB);
     d2.copyTo(display(Rect(result_saved.cols * 1, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
-    cvtColor(motion, motion, CV_GRAY2RGB);
-    motion.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 1, result_saved.cols, result_saved.rows)));
+    cvtColor(motion, motionRGB, CV_GRAY2RGB);
+    motionRGB.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 1, result_saved.cols, result_saved.rows)));
     resultTracked.copyTo(display(Rect(result_saved.cols * 1, result_saved.rows * 1, result_saved.cols, result_saved.rows)));
 #else
-    cvtColor(motion, motion, CV_GRAY2RGB);
-    motion.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
+    cvtColor(motion, motionRGB, CV_GRAY2RGB);
+    motionRGB.copyTo(display(Rect(result_saved.cols * 0, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
     resultTracked.copyTo(display(Rect(result_saved.cols * 1, result_saved.rows * 0, result_saved.cols, result_saved.rows)));
 #endif
 
@@ -247,11 +243,10 @@ int main (int argc, char * const argv[])
     textOrg.y = 80;
     putText(display, drawnStringStream.str(), textOrg, FONT_HERSHEY_COMPLEX_SMALL, 1, Scalar::all(255), 2, 8);
 
-    // save detected frames
+    // save detected frames, and the ones just before the motion started
+    archiver_frame(archiver, result_saved, DIRECTORY, frameCnt, motionDetectData.isMotion, true);
     if (motionDetectData.isMotion) 
     {
-      //if (numberOfSequence > 0) saveImg(result_saved, DIRECTORY, EXTENSION, FILE_FORMAT, numberOfSequence, 1);
-      saveImg(result_saved, DIRECTORY, EXTENSION, FILE_FORMAT, frameCnt, 1);
       numberOfSequence++;
     } 
     else
@@ -262,7 +257,7 @@ int main (int argc, char * const argv[])
     // save every frame to compare detected frames to
     if((frameCnt % 10) ==  0)
     {
-      saveImg(result_saved, DIRECTORY2, EXTENSION, FILE_FORMAT, frameCnt, 0);
+      archiver_save(archiver, result_saved, DIRECTORY2, frameCnt, false);
     }
     
     imshow(WINDOW_NAME, display);
@@ -271,6 +266,10 @@ int main (int argc, char * const argv[])
   }
   
   camera.release();
+  archiver_close(archiver);
+  motion_core_free(&core);
+  if (useBackground)
+    motion_background_free(&background);
   
   return 0;
 }
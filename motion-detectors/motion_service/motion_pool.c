@@ -0,0 +1,339 @@
+/*
+ *  Multi-stream motion detection on a shared worker pool, see motion_pool.h
+ *
+ *  Locking: each stream's lock covers its mailbox, queued flag and
+ *  counters; the pool lock covers the run queue.  A stream lock may be held
+ *  while taking the pool lock, never the other way round.  The detector
+ *  state of a stream (ring, mask, row buffers) is only touched by the one
+ *  worker that has the stream off the run queue.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "motion_pool.h"
+
+typedef unsigned char UINT8;
+
+struct mp_stream
+{
+    char             name[MOTION_POOL_NAME];
+    int              width, height;
+
+    pthread_mutex_t  lock;
+    UINT8           *capture;           // filled by the capture side
+    UINT8           *pending;           // mailbox, newest frame
+    struct timespec  pending_time;
+    int              has_pending;
+    int              queued;            // on the run queue or being processed
+
+    // detector, owned by the worker processing the stream
+    UINT8           *ring[3];           // prevPrev, prev, current
+    long             seen;
+    int              in_motion;
+    UINT8           *mask;
+    struct motion_core core;
+
+    struct motion_pool_stats stats;
+};
+
+struct motion_pool
+{
+    struct motion_pool_config cfg;
+
+    struct mp_stream *streams;
+    int               nstreams;
+
+    pthread_mutex_t   lock;
+    pthread_cond_t    work;             // run queue non-empty or stopping
+    int              *queue;            // FIFO of stream numbers, each at most once
+    int               head, count;
+    int               stopping;
+
+    pthread_t        *threads;
+    int               nthreads;
+};
+
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *stop)
+{
+    return (stop->tv_sec - start->tv_sec) * 1000.0 + (stop->tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+// pool lock held
+static void enqueue(struct motion_pool *pool, int stream)
+{
+    pool->queue[(pool->head + pool->count) % pool->cfg.max_streams] = stream;
+    pool->count++;
+    pthread_cond_signal(&pool->work);
+}
+
+static void process(struct motion_pool *pool, int id)
+{
+    struct mp_stream *s = &pool->streams[id];
+    struct motion_stats ms;
+    struct timespec captured, done;
+    UINT8 *t;
+    int motion, first;
+    long changes;
+    double latency;
+
+    // the mailbox frame becomes the newest in the ring, the oldest goes back
+    // to the mailbox as a free buffer
+    pthread_mutex_lock(&s->lock);
+    t = s->ring[0];
+    s->ring[0] = s->ring[1];
+    s->ring[1] = s->ring[2];
+    s->ring[2] = s->pending;
+    s->pending = t;
+    s->has_pending = 0;
+    captured = s->pending_time;
+    pthread_mutex_unlock(&s->lock);
+
+    // the first frame is also prev and prevPrev until two more arrive
+    if(s->seen == 0)
+        memcpy(s->ring[0], s->ring[2], (size_t)s->width * s->height);
+    if(s->seen <= 1)
+        memcpy(s->ring[1], s->ring[2], (size_t)s->width * s->height);
+    s->seen++;
+
+    motion_detect(&s->core, s->ring[0], s->ring[1], s->ring[2], s->width, s->mask, s->width, pool->cfg.threshold,
+                  0, 0, s->width, s->height, &ms);
+
+    // if not to much changes then the motion is real
+    changes = (ms.stddev < pool->cfg.max_deviation) ? ms.changes : 0;
+    motion = (changes >= pool->cfg.trigger);
+    first = motion && !s->in_motion;
+    s->in_motion = motion;
+
+    if(motion && pool->cfg.on_motion)
+        pool->cfg.on_motion(pool->cfg.arg, id, &ms, first, s->ring[2], s->mask);
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    latency = elapsed_ms(&captured, &done);
+
+    // back on the queue behind the other streams if another frame came in
+    pthread_mutex_lock(&s->lock);
+    s->stats.processed++;
+    s->stats.changes = changes;
+    s->stats.motion_frames += motion;
+    s->stats.motion_events += first;
+    s->stats.latency_sum_ms += latency;
+    if(latency > s->stats.latency_max_ms)
+        s->stats.latency_max_ms = latency;
+
+    if(s->has_pending)
+    {
+        pthread_mutex_lock(&pool->lock);
+        enqueue(pool, id);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    else
+        s->queued = 0;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *worker(void *arg)
+{
+    struct motion_pool *pool = (struct motion_pool *)arg;
+    int id;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&pool->lock);
+        while(!pool->count && !pool->stopping)
+            pthread_cond_wait(&pool->work, &pool->lock);
+
+        if(pool->stopping)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+
+        id = pool->queue[pool->head];
+        pool->head = (pool->head + 1) % pool->cfg.max_streams;
+        pool->count--;
+        pthread_mutex_unlock(&pool->lock);
+
+        process(pool, id);
+    }
+
+    return NULL;
+}
+
+
+struct motion_pool *motion_pool_open(const struct motion_pool_config *cfg)
+{
+    struct motion_pool *pool;
+    int i;
+
+    if(cfg->max_streams <= 0)
+        return NULL;
+
+    if(!(pool = calloc(1, sizeof(*pool))))
+        return NULL;
+
+    pool->cfg = *cfg;
+    pool->nthreads = (cfg->workers > 0) ? cfg->workers : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(pool->nthreads <= 0)
+        pool->nthreads = 1;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+
+    // resolve the kernel once, before the workers all ask for it
+    motion_kernel_isa();
+
+    if(!(pool->streams = calloc(cfg->max_streams, sizeof(*pool->streams))) ||
+       !(pool->queue = calloc(cfg->max_streams, sizeof(int))) ||
+       !(pool->threads = calloc(pool->nthreads, sizeof(pthread_t))))
+    {
+        free(pool->streams);
+        free(pool->queue);
+        free(pool);
+        return NULL;
+    }
+
+    for(i=0; i < pool->nthreads; i++)
+        if(pthread_create(&pool->threads[i], NULL, worker, pool) != 0)
+        {
+            perror("pthread_create");
+            break;
+        }
+    pool->nthreads = i;
+
+    if(pool->nthreads == 0)
+    {
+        motion_pool_close(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int motion_pool_add_stream(struct motion_pool *pool, const char *name, int width, int height)
+{
+    struct mp_stream *s;
+    size_t bytes = (size_t)width * height;
+    int i, id;
+
+    if((pool->nstreams >= pool->cfg.max_streams) || (width <= 0) || (height <= 0))
+        return -1;
+
+    id = pool->nstreams;
+    s = &pool->streams[id];
+    memset(s, 0, sizeof(*s));
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    s->width = width;
+    s->height = height;
+
+    s->capture = malloc(bytes);
+    s->pending = malloc(bytes);
+    s->mask = malloc(bytes);
+    for(i=0; i < 3; i++)
+        s->ring[i] = malloc(bytes);
+
+    if(!s->capture || !s->pending || !s->mask || !s->ring[0] || !s->ring[1] || !s->ring[2] ||
+       (motion_core_init(&s->core, width, height) != 0))
+    {
+        free(s->capture);
+        free(s->pending);
+        free(s->mask);
+        for(i=0; i < 3; i++)
+            free(s->ring[i]);
+        motion_core_free(&s->core);
+        return -1;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    snprintf(s->stats.name, sizeof(s->stats.name), "%s", name);
+    s->stats.width = width;
+    s->stats.height = height;
+
+    pool->nstreams++;
+    return id;
+}
+
+unsigned char *motion_pool_frame(struct motion_pool *pool, int stream)
+{
+    return pool->streams[stream].capture;
+}
+
+int motion_pool_post(struct motion_pool *pool, int stream, const struct timespec *captured)
+{
+    struct mp_stream *s = &pool->streams[stream];
+    int dropped;
+    UINT8 *t;
+
+    pthread_mutex_lock(&s->lock);
+    dropped = s->has_pending;
+    t = s->pending;
+    s->pending = s->capture;
+    s->capture = t;
+    s->pending_time = *captured;
+    s->has_pending = 1;
+    s->stats.captured++;
+    s->stats.dropped += dropped;
+
+    if(!s->queued)
+    {
+        s->queued = 1;
+        pthread_mutex_lock(&pool->lock);
+        enqueue(pool, stream);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    return dropped;
+}
+
+void motion_pool_stats(struct motion_pool *pool, int stream, struct motion_pool_stats *stats, int reset_max)
+{
+    struct mp_stream *s = &pool->streams[stream];
+
+    pthread_mutex_lock(&s->lock);
+    *stats = s->stats;
+    if(reset_max)
+        s->stats.latency_max_ms = 0.0;
+    pthread_mutex_unlock(&s->lock);
+}
+
+int motion_pool_workers(struct motion_pool *pool)
+{
+    return pool->nthreads;
+}
+
+void motion_pool_close(struct motion_pool *pool)
+{
+    int i, j;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(i=0; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for(i=0; i < pool->nstreams; i++)
+    {
+        struct mp_stream *s = &pool->streams[i];
+
+        free(s->capture);
+        free(s->pending);
+        free(s->mask);
+        for(j=0; j < 3; j++)
+            free(s->ring[j]);
+        motion_core_free(&s->core);
+        pthread_mutex_destroy(&s->lock);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    free(pool->streams);
+    free(pool->queue);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,96 @@
+/*
+ *  Frame differencing motion detection for many streams on one worker pool
+ *
+ *  Each stream has a capture side, normally its own thread blocked in a
+ *  device or file read, and a detector side run by whichever worker of the
+ *  shared pool picks the stream up.  They meet in a one frame mailbox:
+ *
+ *    capture   fills the buffer from motion_pool_frame() with a gray frame
+ *              and calls motion_pool_post(), which never waits for the
+ *              detector; a frame still in the mailbox is replaced and
+ *              counted as dropped, so a stream that cannot keep up loses
+ *              its oldest frames instead of building a backlog
+ *    workers   take streams with a frame waiting from a FIFO run queue,
+ *              one frame per turn, so a slow stream holds one worker at a
+ *              time and the others keep serving the rest in order
+ *
+ *  Frames move between the capture buffer, the mailbox and the detector's
+ *  three frame ring by swapping pointers; nothing is copied or allocated
+ *  per frame.  The detector is motion_detect() from motion_core.h with the
+ *  deviation and trigger gate of motion_detector.cpp.
+ */
+#ifndef MOTION_POOL_H
+#define MOTION_POOL_H
+
+#include <time.h>
+
+#include "motion_core.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOTION_POOL_NAME (64)
+
+struct motion_pool;
+
+// Called on a worker for each frame with motion.  first is 1 when the
+// stream's previous frame had none.  gray and mask are width x height,
+// valid until the callback returns.
+typedef void (*motion_pool_callback)(void *arg, int stream, const struct motion_stats *stats, int first,
+                                     const unsigned char *gray, const unsigned char *mask);
+
+struct motion_pool_config
+{
+    int                  workers;        // 0 for one per CPU
+    int                  max_streams;
+    int                  threshold;      // per pixel difference, as currentThreshold
+    int                  max_deviation;  // mask standard deviation above which changes are ignored
+    int                  trigger;        // changed pixels that make a frame motion
+    motion_pool_callback on_motion;      // may be NULL
+    void                *arg;
+};
+
+// Counters since the stream was added
+struct motion_pool_stats
+{
+    char   name[MOTION_POOL_NAME];
+    int    width, height;
+    long   captured;                     // frames posted
+    long   processed;                    // frames through the detector
+    long   dropped;                      // frames replaced in the mailbox before a worker took them
+    long   motion_frames;
+    long   motion_events;                // runs of motion frames
+    long   changes;                      // of the last frame processed
+    double latency_sum_ms;               // post to detector done, over processed frames
+    double latency_max_ms;               // since the last motion_pool_stats() with reset_max
+};
+
+// NULL if out of memory
+struct motion_pool *motion_pool_open(const struct motion_pool_config *cfg);
+
+// Returns the stream number, or -1 if there are max_streams already or no memory
+int motion_pool_add_stream(struct motion_pool *pool, const char *name, int width, int height);
+
+// The capture buffer of a stream, width x height gray bytes, to be filled
+// before each motion_pool_post()
+unsigned char *motion_pool_frame(struct motion_pool *pool, int stream);
+
+// Publish the capture buffer as the stream's newest frame, captured at
+// CLOCK_MONOTONIC time *captured.  Returns 1 if it replaced a frame no
+// worker had taken, else 0.
+int motion_pool_post(struct motion_pool *pool, int stream, const struct timespec *captured);
+
+void motion_pool_stats(struct motion_pool *pool, int stream, struct motion_pool_stats *stats, int reset_max);
+
+int motion_pool_workers(struct motion_pool *pool);
+
+// Stop the workers once nothing posts any more, frames still in mailboxes
+// are not processed
+void motion_pool_close(struct motion_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,372 @@
+// motion_service.cpp
+//
+// The motion detector of motion_detector.cpp for several cameras at once,
+// headless.  Every stream gets a capture thread that only reads frames and
+// converts them to gray, and the frame differencing for all streams runs
+// on one shared pool of worker threads (motion_pool.h), so a slow or
+// stalled stream drops its own frames rather than holding up the others.
+//
+// Streams are given as
+//
+//   0, 1, ...              a camera, VideoCapture(device)
+//   synth, dir:, raw:      a capture_common frame source (frame_source.h)
+//   anything else          a video file, read at the rate it was recorded
+//                          at unless -f, and finished at its end
+//
+// Every interval it prints, per stream, the frames per second captured and
+// detected, frames dropped because the pool had not taken the previous one
+// yet, the latency from capture to detection, and the motion counts; with
+// -s the same table is kept in a file for other programs to read.
+//
+// Usage: motion_service [-w workers] [-t threshold] [-D max_deviation] [-T trigger]
+//                       [-W width] [-H height] [-i interval_sec] [-d duration_sec]
+//                       [-s stats_file] [-f] stream...
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <csignal>
+
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "opencv2/opencv.hpp"
+
+#include "motion_pool.h"
+#include "frame_source.h"
+#include "yuv_convert.h"
+
+using namespace std;
+using namespace cv;
+
+#define MAX_STREAMS 64
+
+int currentThreshold = 5;
+int currentDeviation = 3;
+int currentMotionTrigger = 10;
+
+volatile sig_atomic_t running = 1;
+
+struct Stream {
+  string spec;
+  int id;
+  int width, height;
+  struct frame_source *source;   // a frame source, or
+  VideoCapture camera;           // a device or file
+  Mat first;                     // frame read when opening, for the size
+  double period;                 // seconds between file frames, 0 to read as fast as possible
+  pthread_t thread;
+  volatile int ended;
+  struct motion_pool_stats last; // at the previous report
+  double maxLatency;             // over the whole run
+};
+
+static struct motion_pool *pool;
+
+
+static void stop(int sig)
+{
+  running = 0;
+}
+
+static void usage(void)
+{
+  cout << "Usage: motion_service [-w workers] [-t threshold] [-D max_deviation] [-T trigger]" << endl;
+  cout << "                      [-W width] [-H height] [-i interval_sec] [-d duration_sec]" << endl;
+  cout << "                      [-s stats_file] [-f] stream..." << endl;
+  cout << "  stream is a camera number, a frame source (synth[:pattern], dir:directory, raw:file)" << endl;
+  cout << "  or a video file" << endl;
+  exit(EXIT_FAILURE);
+}
+
+static void timespecAdd(struct timespec *t, double sec)
+{
+  long ns = (long)(sec * 1000000000.0);
+
+  t->tv_sec += ns / 1000000000L;
+  t->tv_nsec += ns % 1000000000L;
+  if (t->tv_nsec >= 1000000000L) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000000000L;
+  }
+}
+
+static double secondsSince(const struct timespec *start)
+{
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+// Called on a pool worker, report only the start of each run of motion
+static void onMotion(void *arg, int stream, const struct motion_stats *stats, int first,
+                     const unsigned char *gray, const unsigned char *mask)
+{
+  vector<Stream *> &streams = *(vector<Stream *> *)arg;
+
+  if (first)
+    printf("%s: motion, %ld pixels changed\n", streams[stream]->spec.c_str(), stats->changes);
+}
+
+static bool openStream(Stream *s, int width, int height, bool paced)
+{
+  struct v4l2_pix_format pix;
+  bool device = !s->spec.empty();
+
+  for (size_t i = 0; i < s->spec.size(); i++)
+    device = device && isdigit((unsigned char)s->spec[i]);
+
+  s->source = NULL;
+  s->period = 0.0;
+  s->ended = 0;
+
+  if (frame_source_is_spec(s->spec.c_str())) {
+    if (!(s->source = frame_source_open(s->spec.c_str(), width, height)))
+      return false;
+    frame_source_format(s->source, &pix);
+    s->width = pix.width;
+    s->height = pix.height;
+    return true;
+  }
+
+  if (device)
+    s->camera.open(atoi(s->spec.c_str()));
+  else
+    s->camera.open(s->spec);
+
+  if (!s->camera.isOpened() || !s->camera.read(s->first) || s->first.empty()) {
+    cout << "Failed to open " << s->spec << endl;
+    return false;
+  }
+
+  s->width = s->first.cols;
+  s->height = s->first.rows;
+
+  // a file stands in for a camera at its recorded rate
+  if (!device && paced && (s->camera.get(CAP_PROP_FPS) > 0.0))
+    s->period = 1.0 / s->camera.get(CAP_PROP_FPS);
+
+  return true;
+}
+
+// Capture only: read, convert to gray into the pool's buffer, post
+static void *captureThread(void *arg)
+{
+  Stream *s = (Stream *)arg;
+  struct timespec timestamp, deadline;
+  const void *p;
+  unsigned int size;
+  Mat frame;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  while (running) {
+    Mat gray(s->height, s->width, CV_8UC1, motion_pool_frame(pool, s->id));
+
+    if (s->source) {
+      if (!frame_source_read(s->source, &p, &size, &timestamp))
+        continue;
+      yuyv_to_y8((const unsigned char *)p, gray.data, s->width * s->height);
+    } else {
+      if (s->period > 0.0) {
+        timespecAdd(&deadline, s->period);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+      }
+
+      if (!s->first.empty()) {
+        frame = s->first;
+        s->first.release();
+      } else if (!s->camera.read(frame) || frame.empty()) {
+        break;
+      }
+      clock_gettime(CLOCK_MONOTONIC, &timestamp);
+
+      // the pool's buffers are the size of the first frame
+      if ((frame.cols != s->width) || (frame.rows != s->height))
+        continue;
+
+      if (frame.channels() == 3)
+        cvtColor(frame, gray, CV_BGR2GRAY);
+      else
+        frame.copyTo(gray);
+    }
+
+    motion_pool_post(pool, s->id, &timestamp);
+  }
+
+  s->ended = 1;
+  return NULL;
+}
+
+// One table to stdout, and to file if set: rates over the interval since
+// the last report, or over the whole run for the final one
+static void printReport(FILE *file, vector<Stream *> &streams, double interval, bool final)
+{
+  struct motion_pool_stats now;
+  char line[256], size[32];
+  long processed, dropped, captured;
+  double latency;
+
+  snprintf(line, sizeof(line), "%-24s %9s %7s %7s %8s %8s %8s %7s %7s %8s\n", "stream", "size", "fps in",
+           "fps out", "dropped", "lat ms", "max ms", "motion", "events", "changes");
+  fputs(line, stdout);
+  if (file)
+    fputs(line, file);
+
+  for (size_t i = 0; i < streams.size(); i++) {
+    Stream *s = streams[i];
+    const struct motion_pool_stats &from = s->last;
+
+    motion_pool_stats(pool, s->id, &now, 1);
+    if (now.latency_max_ms > s->maxLatency)
+      s->maxLatency = now.latency_max_ms;
+
+    captured = final ? now.captured : now.captured - from.captured;
+    processed = final ? now.processed : now.processed - from.processed;
+    dropped = final ? now.dropped : now.dropped - from.dropped;
+    latency = final ? now.latency_sum_ms : now.latency_sum_ms - from.latency_sum_ms;
+
+    snprintf(size, sizeof(size), "%dx%d", s->width, s->height);
+    snprintf(line, sizeof(line), "%-24.24s %9s %7.1lf %7.1lf %8ld %8.2lf %8.2lf %7ld %7ld %8ld%s\n",
+             s->spec.c_str(), size, captured / interval, processed / interval, dropped,
+             processed ? latency / processed : 0.0, final ? s->maxLatency : now.latency_max_ms,
+             now.motion_frames, now.motion_events, now.changes, s->ended ? " ended" : "");
+    fputs(line, stdout);
+    if (file)
+      fputs(line, file);
+
+    s->last = now;
+  }
+}
+
+// The interval's table, also kept in path if set, written aside and renamed
+// so a reader never sees half a table
+static void report(const char *path, vector<Stream *> &streams, double interval)
+{
+  string tmp = path ? string(path) + ".tmp" : string();
+  FILE *fp = NULL;
+
+  if (path && !(fp = fopen(tmp.c_str(), "w")))
+    perror(tmp.c_str());
+  if (fp)
+    fprintf(fp, "# %d workers, last %.1lf s\n", motion_pool_workers(pool), interval);
+
+  printReport(fp, streams, interval, false);
+
+  if (fp && ((fclose(fp) != 0) || (rename(tmp.c_str(), path) != 0)))
+    perror(path);
+}
+
+int main(int argc, char *argv[])
+{
+  struct motion_pool_config cfg;
+  struct timespec start, deadline;
+  vector<Stream *> streams;
+  const char *statsFile = NULL;
+  double interval = 1.0, duration = 0.0;
+  int width = 640, height = 480, opt, ended;
+  bool paced = true;
+
+  memset(&cfg, 0, sizeof(cfg));
+
+  while ((opt = getopt(argc, argv, "w:t:D:T:W:H:i:d:s:f")) != -1) {
+    switch (opt) {
+      case 'w': cfg.workers = atoi(optarg); break;
+      case 't': currentThreshold = atoi(optarg); break;
+      case 'D': currentDeviation = atoi(optarg); break;
+      case 'T': currentMotionTrigger = atoi(optarg); break;
+      case 'W': width = atoi(optarg); break;
+      case 'H': height = atoi(optarg); break;
+      case 'i': interval = atof(optarg); break;
+      case 'd': duration = atof(optarg); break;
+      case 's': statsFile = optarg; break;
+      case 'f': paced = false; break;
+      default: usage();
+    }
+  }
+
+  if ((optind >= argc) || (argc - optind > MAX_STREAMS) || (interval <= 0.0))
+    usage();
+
+  cfg.max_streams = argc - optind;
+  cfg.threshold = currentThreshold;
+  cfg.max_deviation = currentDeviation;
+  cfg.trigger = currentMotionTrigger;
+  cfg.on_motion = onMotion;
+  cfg.arg = &streams;
+
+  if (!(pool = motion_pool_open(&cfg))) {
+    cout << "Failed to start the worker pool" << endl;
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    Stream *s = new Stream();
+
+    s->spec = argv[i];
+    if (!openStream(s, width, height, paced) ||
+        ((s->id = motion_pool_add_stream(pool, s->spec.c_str(), s->width, s->height)) < 0)) {
+      cout << "Failed to add " << s->spec << endl;
+      exit(EXIT_FAILURE);
+    }
+    memset(&s->last, 0, sizeof(s->last));
+    s->maxLatency = 0.0;
+    streams.push_back(s);
+  }
+
+  cout << streams.size() << " streams on " << motion_pool_workers(pool) << " workers, "
+       << motion_isa_name(motion_kernel_isa()) << " motion kernel, threshold " << currentThreshold
+       << ", max deviation " << currentDeviation << ", trigger " << currentMotionTrigger << endl;
+
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  for (size_t i = 0; i < streams.size(); i++)
+    if (pthread_create(&streams[i]->thread, NULL, captureThread, streams[i]) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  deadline = start;
+
+  while (running) {
+    timespecAdd(&deadline, interval);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR && running);
+
+    report(statsFile, streams, interval);
+    cout << endl;
+
+    ended = 0;
+    for (size_t i = 0; i < streams.size(); i++)
+      ended += streams[i]->ended;
+
+    if ((ended == (int)streams.size()) || ((duration > 0.0) && (secondsSince(&start) >= duration)))
+      running = 0;
+  }
+
+  // capture threads finish their current read, then the pool can stop
+  for (size_t i = 0; i < streams.size(); i++)
+    pthread_join(streams[i]->thread, NULL);
+
+  cout << "Totals over " << secondsSince(&start) << " s" << endl;
+  printReport(NULL, streams, secondsSince(&start), true);
+
+  motion_pool_close(pool);
+  for (size_t i = 0; i < streams.size(); i++) {
+    if (streams[i]->source)
+      frame_source_close(streams[i]->source);
+    else
+      streams[i]->camera.release();
+    delete streams[i];
+  }
+
+  return 0;
+}
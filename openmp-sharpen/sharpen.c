@@ -4,22 +4,35 @@
 //
 // http://www.dspguide.com/pdfbook.htm
 //
+// The original test runs ITERATIONS frames with one frame per thread, which
+// raises throughput but leaves the time to sharpen any one frame serial.  The
+// rows and tiles modes spread each frame over the threads instead, and the
+// tune mode finds the fastest threads, schedule, chunk and tile shape for the
+// image size and saves it, see sharpen_tune.h.  With no mode given, a tuned
+// configuration for this size and core count is used if there is one.
+//
+// Usage: sharpen input_file.ppm output_file.ppm [tune | frames|rows|tiles [threads [schedule [chunk [tile_h tile_w]]]]]
+//
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <omp.h>
 
+#include "pnm_io.h"
+#include "sharpen_tune.h"
 
-//#define IMG_HEIGHT (240)
-//#define IMG_WIDTH (320)
-
-#define IMG_HEIGHT (960)
-#define IMG_WIDTH (1280)
 
 #define ITERATIONS (90)
 
+// frames timed for each configuration while tuning, at least
+#define TUNE_FRAMES (3)
+#define TUNE_MIN_MS (50.0)
+
+// FAST_IO maps the files with pnm_io, otherwise read() and write() a byte at a time
 #define FAST_IO
 
 typedef double FLOAT;
@@ -30,16 +43,10 @@ typedef unsigned char UINT8;
 
 // PPM Edge Enhancement Code
 //
-UINT8 header[22];
-UINT8 R[IMG_HEIGHT*IMG_WIDTH];
-UINT8 G[IMG_HEIGHT*IMG_WIDTH];
-UINT8 B[IMG_HEIGHT*IMG_WIDTH];
-UINT8 convR[IMG_HEIGHT*IMG_WIDTH];
-UINT8 convG[IMG_HEIGHT*IMG_WIDTH];
-UINT8 convB[IMG_HEIGHT*IMG_WIDTH];
-
-// PPM image array with channels
-UINT8 RGB[IMG_HEIGHT*IMG_WIDTH*3];
+struct pnm_image in_img, out_img;
+int img_width, img_height;
+UINT8 *R, *G, *B;
+UINT8 *convR, *convG, *convB;
 
 // controls sharpness
 // increase from K=4.0 and F=8.0 for sharper edges
@@ -50,88 +57,227 @@ UINT8 RGB[IMG_HEIGHT*IMG_WIDTH*3];
 FLOAT PSF[9] = {-K/F, -K/F, -K/F, -K/F, K+1.0, -K/F, -K/F, -K/F, -K/F};
 
 
-int main(int argc, char *argv[])
+// Sharpen rows i0 to i1-1 and columns j0 to j1-1 of all three channels
+static void sharpen_block(int i0, int i1, int j0, int j1)
 {
-    int fdin, fdout, bytesRead=0, bytesWritten=0, bytesLeft, i, j, iter, rc, pixel, readcnt=0, writecnt=0;
-    UINT64 microsecs=0, millisecs=0;
-    FLOAT temp, fstart, fnow;
-    struct timespec start, now;
-    int thread_count=4;
+    int i, j;
+    FLOAT temp;
 
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    fstart = (FLOAT)start.tv_sec  + (FLOAT)start.tv_nsec / 1000000000.0;
-    
-    if(argc < 3)
+    for(i=i0; i<i1; i++)
     {
-       printf("Usage: sharpen input_file.ppm output_file.ppm\n");
-       exit(-1);
+        for(j=j0; j<j1; j++)
+        {
+            temp=0;
+            temp += (PSF[0] * (FLOAT)R[((i-1)*img_width)+j-1]);
+            temp += (PSF[1] * (FLOAT)R[((i-1)*img_width)+j]);
+            temp += (PSF[2] * (FLOAT)R[((i-1)*img_width)+j+1]);
+            temp += (PSF[3] * (FLOAT)R[((i)*img_width)+j-1]);
+            temp += (PSF[4] * (FLOAT)R[((i)*img_width)+j]);
+            temp += (PSF[5] * (FLOAT)R[((i)*img_width)+j+1]);
+            temp += (PSF[6] * (FLOAT)R[((i+1)*img_width)+j-1]);
+            temp += (PSF[7] * (FLOAT)R[((i+1)*img_width)+j]);
+            temp += (PSF[8] * (FLOAT)R[((i+1)*img_width)+j+1]);
+	    if(temp<0.0) temp=0.0;
+	    if(temp>255.0) temp=255.0;
+	    convR[(i*img_width)+j]=(UINT8)temp;
+
+            temp=0;
+            temp += (PSF[0] * (FLOAT)G[((i-1)*img_width)+j-1]);
+            temp += (PSF[1] * (FLOAT)G[((i-1)*img_width)+j]);
+            temp += (PSF[2] * (FLOAT)G[((i-1)*img_width)+j+1]);
+            temp += (PSF[3] * (FLOAT)G[((i)*img_width)+j-1]);
+            temp += (PSF[4] * (FLOAT)G[((i)*img_width)+j]);
+            temp += (PSF[5] * (FLOAT)G[((i)*img_width)+j+1]);
+            temp += (PSF[6] * (FLOAT)G[((i+1)*img_width)+j-1]);
+            temp += (PSF[7] * (FLOAT)G[((i+1)*img_width)+j]);
+            temp += (PSF[8] * (FLOAT)G[((i+1)*img_width)+j+1]);
+	    if(temp<0.0) temp=0.0;
+	    if(temp>255.0) temp=255.0;
+	    convG[(i*img_width)+j]=(UINT8)temp;
+
+            temp=0;
+            temp += (PSF[0] * (FLOAT)B[((i-1)*img_width)+j-1]);
+            temp += (PSF[1] * (FLOAT)B[((i-1)*img_width)+j]);
+            temp += (PSF[2] * (FLOAT)B[((i-1)*img_width)+j+1]);
+            temp += (PSF[3] * (FLOAT)B[((i)*img_width)+j-1]);
+            temp += (PSF[4] * (FLOAT)B[((i)*img_width)+j]);
+            temp += (PSF[5] * (FLOAT)B[((i)*img_width)+j+1]);
+            temp += (PSF[6] * (FLOAT)B[((i+1)*img_width)+j-1]);
+            temp += (PSF[7] * (FLOAT)B[((i+1)*img_width)+j]);
+            temp += (PSF[8] * (FLOAT)B[((i+1)*img_width)+j+1]);
+	    if(temp<0.0) temp=0.0;
+	    if(temp>255.0) temp=255.0;
+	    convB[(i*img_width)+j]=(UINT8)temp;
+        }
+    }
+}
+
+// One frame spread over the threads as cfg says
+static void sharpen_frame(const struct sharpen_config *cfg)
+{
+    int i, ty, tx, ntiles_y, ntiles_x;
+
+    omp_set_schedule(cfg->schedule, cfg->chunk);
+
+    if(cfg->mode == MODE_ROWS)
+    {
+        // Skip first and last row, no neighbors to convolve with
+#pragma omp parallel for num_threads(cfg->threads) schedule(runtime)
+        for(i=1; i<img_height-1; i++)
+            sharpen_block(i, i+1, 1, img_width-1);
     }
     else
     {
-        if((fdin = open(argv[1], O_RDONLY, 0644)) < 0)
-        {
-            printf("Error opening %s\n", argv[1]);
-        }
-        //else
-        //    printf("File opened successfully\n");
+        ntiles_y=(img_height - 2 + cfg->tile_h - 1) / cfg->tile_h;
+        ntiles_x=(img_width - 2 + cfg->tile_w - 1) / cfg->tile_w;
 
-        if((fdout = open(argv[2], (O_RDWR | O_CREAT), 0666)) < 0)
+#pragma omp parallel for collapse(2) num_threads(cfg->threads) schedule(runtime)
+        for(ty=0; ty<ntiles_y; ty++)
         {
-            printf("Error opening %s\n", argv[1]);
+            for(tx=0; tx<ntiles_x; tx++)
+            {
+                int i0=1 + ty * cfg->tile_h, j0=1 + tx * cfg->tile_w;
+
+                sharpen_block(i0, (i0 + cfg->tile_h < img_height-1) ? i0 + cfg->tile_h : img_height-1,
+                              j0, (j0 + cfg->tile_w < img_width-1) ? j0 + cfg->tile_w : img_width-1);
+            }
         }
-        //else
-        //    printf("Output file=%s opened successfully\n", "sharpen.ppm");
     }
+}
+
+static FLOAT now_ms(void)
+{
+    struct timespec now;
 
-    bytesLeft=21;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (FLOAT)now.tv_sec * 1000.0 + (FLOAT)now.tv_nsec / 1000000.0;
+}
+
+// Tuner timing, the fastest of a few frames after one to warm up
+static double time_config(const struct sharpen_config *cfg)
+{
+    FLOAT start, first, ms, best=0.0;
+    int frames;
 
-    //printf("Reading header\n");
+    sharpen_frame(cfg);
 
-    // read in all data
-    do
+    first=now_ms();
+    for(frames=0; (frames < TUNE_FRAMES) || (now_ms() - first < TUNE_MIN_MS); frames++)
     {
-        //printf("bytesRead=%d, bytesLeft=%d\n", bytesRead, bytesLeft);
-        bytesRead=read(fdin, (void *)header, bytesLeft);
-        bytesLeft -= bytesRead;
-    } while(bytesLeft > 0);
+        start=now_ms();
+        sharpen_frame(cfg);
+        ms=now_ms() - start;
+        if((frames == 0) || (ms < best)) best=ms;
+    }
 
-    header[21]='\0';
+    return best;
+}
+
+static void usage(void)
+{
+    printf("Usage: sharpen input_file.ppm output_file.ppm [tune | frames|rows|tiles [threads [schedule [chunk [tile_h tile_w]]]]]\n");
+    printf("schedule is static, dynamic, guided or auto, chunk 0 for the default\n");
+    exit(-1);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int fdin, fdout, i, iter, rc, pixel, tune=0, cores=omp_get_num_procs();
+    UINT64 microsecs=0, millisecs=0;
+    FLOAT fstart, fnow;
+    struct timespec start, now;
+    struct sharpen_config cfg;
+    size_t npix;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    fstart = (FLOAT)start.tv_sec  + (FLOAT)start.tv_nsec / 1000000000.0;
+    
+    if(argc < 3)
+        usage();
 
-    printf("header = %s\n", header); 
+    // the original, 4 threads on whole frames
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.mode=MODE_FRAMES;
+    cfg.threads=4;
+    cfg.schedule=omp_sched_static;
+    cfg.tile_h=64;
+    cfg.tile_w=256;
 
+    if(argc > 3)
+    {
+        if(strcmp(argv[3], "tune") == 0)
+            tune=1;
+        else if((cfg.mode=sharpen_parse_mode(argv[3])) < 0)
+            usage();
+
+        if(argc > 4) cfg.threads=atoi(argv[4]);
+        if((argc > 5) && (sharpen_parse_schedule(argv[5], &cfg.schedule) != 0)) usage();
+        if(argc > 6) cfg.chunk=atoi(argv[6]);
+        // tile_h and tile_w come as a pair
+        if(argc == 8) usage();
+        if(argc > 8) { cfg.tile_h=atoi(argv[7]); cfg.tile_w=atoi(argv[8]); }
+
+        if((cfg.threads < 1) || (cfg.chunk < 0) || (cfg.tile_h < 1) || (cfg.tile_w < 1))
+            usage();
+    }
 
 #ifdef FAST_IO
 
-    bytesRead=0;
-    bytesLeft=IMG_HEIGHT*IMG_WIDTH*3;
-    readcnt=0;
-    printf("START: read %d, bytesRead=%d, bytesLeft=%d\n", readcnt, bytesRead, bytesLeft);
+    if(pnm_open(&in_img, argv[1]) != 0)
+        exit(-1);
+
+#else
+
+    if((fdin = open(argv[1], O_RDONLY, 0644)) < 0)
+    {
+        printf("Error opening %s\n", argv[1]);
+        exit(-1);
+    }
+
+    if(pnm_read_header(&in_img, fdin) != 0)
+    {
+        printf("%s is not a PPM\n", argv[1]);
+        exit(-1);
+    }
+
+#endif
 
-    // Read in RGB data in large chunks, requesting all and reading residual
-    do
+    if((in_img.channels != 3) || (in_img.maxval > 255) || (in_img.width < 3) || (in_img.height < 3))
     {
-        bytesRead=read(fdin, (void *)&RGB[bytesRead], bytesLeft);
-        bytesLeft -= bytesRead;
-        readcnt++;
+        printf("%s is not an 8-bit PPM\n", argv[1]);
+        exit(-1);
+    }
+
+    printf("header = %.*s\n", (int)in_img.header_len, in_img.header);
+
+    img_width=in_img.width;
+    img_height=in_img.height;
+    npix=(size_t)img_width * img_height;
 
-        printf("read %d, bytesRead=%d, bytesLeft=%d\n", readcnt, bytesRead, bytesLeft);
+    R=malloc(npix); G=malloc(npix); B=malloc(npix);
+    convR=malloc(npix); convG=malloc(npix); convB=malloc(npix);
+    if(!R || !G || !B || !convR || !convG || !convB)
+    {
+        perror("malloc");
+        exit(-1);
+    }
 
-    } while((bytesLeft > 0) && (readcnt < 3));
 
-    printf("END: read %d, bytesRead=%d, bytesLeft=%d\n", readcnt, bytesRead, bytesLeft);
+#ifdef FAST_IO
 
-    // create in memory copy from input by channel
-    for(i=0, pixel=0; i<IMG_HEIGHT*IMG_WIDTH; i++, pixel+=3)
+    // Pixels are mapped, not read, create in memory copy from input by channel
+    for(i=0, pixel=0; i<img_height*img_width; i++, pixel+=3)
     {
-        R[i]=RGB[pixel+0]; convR[i]=R[i];
-        G[i]=RGB[pixel+1]; convG[i]=G[i];
-        B[i]=RGB[pixel+2]; convB[i]=B[i];
+        R[i]=in_img.pixels[pixel+0]; convR[i]=R[i];
+        G[i]=in_img.pixels[pixel+1]; convG[i]=G[i];
+        B[i]=in_img.pixels[pixel+2]; convB[i]=B[i];
     }
 
 #else
 
     // Read RGB data - Very slow one byte at time!
-    for(i=0; i<IMG_HEIGHT*IMG_WIDTH; i++)
+    for(i=0; i<img_height*img_width; i++)
     {
         rc=read(fdin, (void *)&R[i], 1); convR[i]=R[i];
         rc=read(fdin, (void *)&G[i], 1); convG[i]=G[i];
@@ -140,114 +286,91 @@ int main(int argc, char *argv[])
 #endif
 
 
+    if(tune)
+    {
+        printf("tuning %dx%d on %d cores\n", img_width, img_height, cores);
+        sharpen_tune(&cfg, img_width, img_height, time_config, 1);
+
+        if(sharpen_cache_save(&cfg, img_width, img_height, cores) == 0)
+            printf("best saved to %s\n", sharpen_cache_path());
+    }
+    else if((argc == 3) && (sharpen_cache_load(&cfg, img_width, img_height, cores) == 0))
+        printf("tuned configuration from %s\n", sharpen_cache_path());
+
+    printf("%s: %d threads, %s schedule, chunk %d", sharpen_mode_name(cfg.mode), cfg.threads,
+           sharpen_schedule_name(cfg.schedule), cfg.chunk);
+    if(cfg.mode == MODE_TILES)
+        printf(", %dx%d tiles", cfg.tile_h, cfg.tile_w);
+    printf("\n");
+
+
     clock_gettime(CLOCK_MONOTONIC, &now);
     fnow = (FLOAT)now.tv_sec  + (FLOAT)now.tv_nsec / 1000000000.0;
     printf("\nstart test at %lf\n", fnow-fstart);
     clock_gettime(CLOCK_MONOTONIC, &start);
     fstart = (FLOAT)start.tv_sec  + (FLOAT)start.tv_nsec / 1000000000.0;
 
-#pragma omp parallel for num_threads(thread_count)
-    for(iter=0; iter < ITERATIONS; iter++)
+    if(cfg.mode == MODE_FRAMES)
     {
-        // Skip first and last row, no neighbors to convolve with
-        for(i=1; i<((IMG_HEIGHT)-1); i++)
-        {
+        omp_set_schedule(cfg.schedule, cfg.chunk);
 
-            // Skip first and last column, no neighbors to convolve with
-            for(j=1; j<((IMG_WIDTH)-1); j++)
-            {
-                temp=0;
-                temp += (PSF[0] * (FLOAT)R[((i-1)*IMG_WIDTH)+j-1]);
-                temp += (PSF[1] * (FLOAT)R[((i-1)*IMG_WIDTH)+j]);
-                temp += (PSF[2] * (FLOAT)R[((i-1)*IMG_WIDTH)+j+1]);
-                temp += (PSF[3] * (FLOAT)R[((i)*IMG_WIDTH)+j-1]);
-                temp += (PSF[4] * (FLOAT)R[((i)*IMG_WIDTH)+j]);
-                temp += (PSF[5] * (FLOAT)R[((i)*IMG_WIDTH)+j+1]);
-                temp += (PSF[6] * (FLOAT)R[((i+1)*IMG_WIDTH)+j-1]);
-                temp += (PSF[7] * (FLOAT)R[((i+1)*IMG_WIDTH)+j]);
-                temp += (PSF[8] * (FLOAT)R[((i+1)*IMG_WIDTH)+j+1]);
-	        if(temp<0.0) temp=0.0;
-	        if(temp>255.0) temp=255.0;
-	        convR[(i*IMG_WIDTH)+j]=(UINT8)temp;
-
-                temp=0;
-                temp += (PSF[0] * (FLOAT)G[((i-1)*IMG_WIDTH)+j-1]);
-                temp += (PSF[1] * (FLOAT)G[((i-1)*IMG_WIDTH)+j]);
-                temp += (PSF[2] * (FLOAT)G[((i-1)*IMG_WIDTH)+j+1]);
-                temp += (PSF[3] * (FLOAT)G[((i)*IMG_WIDTH)+j-1]);
-                temp += (PSF[4] * (FLOAT)G[((i)*IMG_WIDTH)+j]);
-                temp += (PSF[5] * (FLOAT)G[((i)*IMG_WIDTH)+j+1]);
-                temp += (PSF[6] * (FLOAT)G[((i+1)*IMG_WIDTH)+j-1]);
-                temp += (PSF[7] * (FLOAT)G[((i+1)*IMG_WIDTH)+j]);
-                temp += (PSF[8] * (FLOAT)G[((i+1)*IMG_WIDTH)+j+1]);
-	        if(temp<0.0) temp=0.0;
-	        if(temp>255.0) temp=255.0;
-	        convG[(i*IMG_WIDTH)+j]=(UINT8)temp;
-
-                temp=0;
-                temp += (PSF[0] * (FLOAT)B[((i-1)*IMG_WIDTH)+j-1]);
-                temp += (PSF[1] * (FLOAT)B[((i-1)*IMG_WIDTH)+j]);
-                temp += (PSF[2] * (FLOAT)B[((i-1)*IMG_WIDTH)+j+1]);
-                temp += (PSF[3] * (FLOAT)B[((i)*IMG_WIDTH)+j-1]);
-                temp += (PSF[4] * (FLOAT)B[((i)*IMG_WIDTH)+j]);
-                temp += (PSF[5] * (FLOAT)B[((i)*IMG_WIDTH)+j+1]);
-                temp += (PSF[6] * (FLOAT)B[((i+1)*IMG_WIDTH)+j-1]);
-                temp += (PSF[7] * (FLOAT)B[((i+1)*IMG_WIDTH)+j]);
-                temp += (PSF[8] * (FLOAT)B[((i+1)*IMG_WIDTH)+j+1]);
-	        if(temp<0.0) temp=0.0;
-	        if(temp>255.0) temp=255.0;
-	        convB[(i*IMG_WIDTH)+j]=(UINT8)temp;
-            }
+#pragma omp parallel for num_threads(cfg.threads) schedule(runtime)
+        for(iter=0; iter < ITERATIONS; iter++)
+        {
+            // Skip first and last row and column, no neighbors to convolve with
+            sharpen_block(1, img_height-1, 1, img_width-1);
         }
-
+    }
+    else
+    {
+        // one frame at a time, each spread over the threads
+        for(iter=0; iter < ITERATIONS; iter++)
+            sharpen_frame(&cfg);
     }
 
     clock_gettime(CLOCK_MONOTONIC, &now);
     fnow = (FLOAT)now.tv_sec  + (FLOAT)now.tv_nsec / 1000000000.0;
-    printf("stop test at %lf for %d frames, fps=%lf, pps=%lf\n\n", fnow-fstart, ITERATIONS, ITERATIONS/(fnow-fstart), (ITERATIONS*IMG_HEIGHT*IMG_WIDTH)/(fnow-fstart));
-
-    rc=write(fdout, (void *)header, 21);
+    printf("stop test at %lf for %d frames, fps=%lf, pps=%lf\n", fnow-fstart, ITERATIONS, ITERATIONS/(fnow-fstart), (ITERATIONS*(FLOAT)img_height*img_width)/(fnow-fstart));
+    if(cfg.mode != MODE_FRAMES)
+        printf("frame latency %lf msec\n", (fnow-fstart)*1000.0/ITERATIONS);
+    printf("\n");
 
 #ifdef FAST_IO
 
-    // create in memory copy from input by channel
-    for(i=0, pixel=0; i<IMG_HEIGHT*IMG_WIDTH; i++, pixel+=3)
+    // Output is mapped too, with the input header, written as it is filled in
+    if(pnm_create_like(&out_img, argv[2], &in_img) != 0)
+        exit(-1);
+
+    for(i=0, pixel=0; i<img_height*img_width; i++, pixel+=3)
     {
-        RGB[pixel+0]=convR[i];
-        RGB[pixel+1]=convG[i];
-        RGB[pixel+2]=convB[i];
+        out_img.pixels[pixel+0]=convR[i];
+        out_img.pixels[pixel+1]=convG[i];
+        out_img.pixels[pixel+2]=convB[i];
     }
 
-    bytesWritten=0;
-    bytesLeft=IMG_HEIGHT*IMG_WIDTH*3;
-    writecnt=0;
-    printf("START: write %d, bytesWritten=%d, bytesLeft=%d\n", writecnt, bytesWritten, bytesLeft);
-
-    // Write RGB data in large chunks, requesting all at once and writing residual
-    do
-    {
-        bytesWritten=write(fdout, (void *)&RGB[bytesWritten], bytesLeft);
-        bytesLeft -= bytesWritten;
-        writecnt++;
+    pnm_close(&out_img);
+    pnm_close(&in_img);
 
-        printf("write %d, bytesWritten=%d, bytesLeft=%d\n", writecnt, bytesWritten, bytesLeft);
+#else
 
-    } while((bytesLeft > 0) && (writecnt < 3));
+    if((fdout = open(argv[2], (O_RDWR | O_CREAT | O_TRUNC), 0666)) < 0)
+    {
+        printf("Error opening %s\n", argv[2]);
+        exit(-1);
+    }
 
-    printf("END: write %d, bytesWritten=%d, bytesLeft=%d\n", writecnt, bytesWritten, bytesLeft);
+    rc=write(fdout, (void *)in_img.header, in_img.header_len);
 
-#else
     // Write RGB data - very slow 1 byte at a time!
-    for(i=0; i<IMG_HEIGHT*IMG_WIDTH; i++)
+    for(i=0; i<img_height*img_width; i++)
     {
         rc=write(fdout, (void *)&convR[i], 1);
         rc=write(fdout, (void *)&convG[i], 1);
         rc=write(fdout, (void *)&convB[i], 1);
     }
-#endif
-
 
     close(fdin);
     close(fdout);
+#endif
  
 }
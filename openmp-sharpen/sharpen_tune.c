@@ -0,0 +1,198 @@
+// OpenMP configuration autotuner for sharpen.c, see sharpen_tune.h
+//
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sharpen_tune.h"
+
+#define MAX_CACHE_LINES (1024)
+
+static const char *mode_names[MODE_COUNT] = { "frames", "rows", "tiles" };
+
+// swept for each thread count
+static const omp_sched_t schedules[] = { omp_sched_static, omp_sched_dynamic, omp_sched_guided };
+static const int row_chunks[] = { 0, 1, 4, 16 };
+static const int tile_chunks[] = { 0, 1, 2 };
+
+// tile_h x tile_w, 0 width for full rows
+static const int tile_shapes[][2] = { {8, 0}, {32, 128}, {32, 512}, {64, 64}, {64, 256}, {128, 128} };
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof(a[0])))
+
+
+const char *sharpen_mode_name(int mode)
+{
+    return ((mode >= 0) && (mode < MODE_COUNT)) ? mode_names[mode] : "unknown";
+}
+
+const char *sharpen_schedule_name(omp_sched_t schedule)
+{
+    switch(schedule)
+    {
+        case omp_sched_static:  return "static";
+        case omp_sched_dynamic: return "dynamic";
+        case omp_sched_guided:  return "guided";
+        case omp_sched_auto:    return "auto";
+        default:                return "unknown";
+    }
+}
+
+int sharpen_parse_mode(const char *name)
+{
+    int mode;
+
+    for(mode=0; mode < MODE_COUNT; mode++)
+        if(strcmp(name, mode_names[mode]) == 0)
+            return mode;
+
+    return -1;
+}
+
+int sharpen_parse_schedule(const char *name, omp_sched_t *schedule)
+{
+    if(strcmp(name, "static") == 0)       *schedule = omp_sched_static;
+    else if(strcmp(name, "dynamic") == 0) *schedule = omp_sched_dynamic;
+    else if(strcmp(name, "guided") == 0)  *schedule = omp_sched_guided;
+    else if(strcmp(name, "auto") == 0)    *schedule = omp_sched_auto;
+    else return -1;
+
+    return 0;
+}
+
+const char *sharpen_cache_path(void)
+{
+    const char *path = getenv("SHARPEN_TUNE_CACHE");
+
+    return path ? path : SHARPEN_TUNE_CACHE;
+}
+
+
+static void try_config(struct sharpen_config *best, struct sharpen_config *cfg, sharpen_timer_t time_config,
+                       int verbose)
+{
+    cfg->ms = time_config(cfg);
+
+    if(verbose)
+        printf("%-6s %3d threads %-7s chunk %2d tile %4dx%-4d %8.3lf ms\n", sharpen_mode_name(cfg->mode),
+               cfg->threads, sharpen_schedule_name(cfg->schedule), cfg->chunk, cfg->tile_h, cfg->tile_w, cfg->ms);
+
+    if((best->ms == 0.0) || (cfg->ms < best->ms))
+        *best = *cfg;
+}
+
+void sharpen_tune(struct sharpen_config *best, int width, int height, sharpen_timer_t time_config, int verbose)
+{
+    struct sharpen_config cfg;
+    int cores = omp_get_num_procs(), threads, s, c, t;
+
+    memset(best, 0, sizeof(*best));
+
+    // powers of two below the core count, then the core count
+    for(threads=1; ; threads = (threads * 2 < cores) ? threads * 2 : cores)
+    {
+        for(s=0; s < COUNT(schedules); s++)
+        {
+            memset(&cfg, 0, sizeof(cfg));
+            cfg.mode = MODE_ROWS;
+            cfg.threads = threads;
+            cfg.schedule = schedules[s];
+
+            for(c=0; c < COUNT(row_chunks); c++)
+            {
+                cfg.chunk = row_chunks[c];
+                try_config(best, &cfg, time_config, verbose);
+            }
+
+            cfg.mode = MODE_TILES;
+            for(t=0; t < COUNT(tile_shapes); t++)
+            {
+                cfg.tile_h = tile_shapes[t][0];
+                cfg.tile_w = tile_shapes[t][1] ? tile_shapes[t][1] : width - 2;
+
+                // a tile bigger than the frame is the same as the rows above
+                if((cfg.tile_h > height - 2) || (cfg.tile_w > width - 2))
+                    continue;
+
+                for(c=0; c < COUNT(tile_chunks); c++)
+                {
+                    cfg.chunk = tile_chunks[c];
+                    try_config(best, &cfg, time_config, verbose);
+                }
+            }
+        }
+
+        if(threads == cores)
+            break;
+    }
+}
+
+
+int sharpen_cache_load(struct sharpen_config *cfg, int width, int height, int cores)
+{
+    FILE *fp;
+    char line[256], mode[16], schedule[16];
+    int w, h, n;
+
+    if(!(fp = fopen(sharpen_cache_path(), "r")))
+        return -1;
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        if(line[0] == '#')
+            continue;
+
+        memset(cfg, 0, sizeof(*cfg));
+        if((sscanf(line, "%d %d %d %15s %d %15s %d %d %d %lf", &w, &h, &n, mode, &cfg->threads, schedule,
+                   &cfg->chunk, &cfg->tile_h, &cfg->tile_w, &cfg->ms) == 10) &&
+           (w == width) && (h == height) && (n == cores) &&
+           ((cfg->mode = sharpen_parse_mode(mode)) >= 0) &&
+           (sharpen_parse_schedule(schedule, &cfg->schedule) == 0) && (cfg->threads > 0))
+        {
+            fclose(fp);
+            return 0;
+        }
+    }
+
+    fclose(fp);
+    return -1;
+}
+
+int sharpen_cache_save(const struct sharpen_config *cfg, int width, int height, int cores)
+{
+    FILE *fp;
+    char *lines[MAX_CACHE_LINES], line[256];
+    int nlines = 0, i, w, h, n;
+
+    // keep every other entry, replace this one
+    if((fp = fopen(sharpen_cache_path(), "r")))
+    {
+        while(fgets(line, sizeof(line), fp) && (nlines < MAX_CACHE_LINES))
+        {
+            if((line[0] == '#') ||
+               ((sscanf(line, "%d %d %d", &w, &h, &n) == 3) && (w == width) && (h == height) && (n == cores)))
+                continue;
+            lines[nlines++] = strdup(line);
+        }
+        fclose(fp);
+    }
+
+    if(!(fp = fopen(sharpen_cache_path(), "w")))
+    {
+        perror(sharpen_cache_path());
+        for(i=0; i < nlines; i++)
+            free(lines[i]);
+        return -1;
+    }
+
+    fprintf(fp, "# width height cores mode threads schedule chunk tile_h tile_w ms\n");
+    for(i=0; i < nlines; i++)
+    {
+        fputs(lines[i], fp);
+        free(lines[i]);
+    }
+    fprintf(fp, "%d %d %d %s %d %s %d %d %d %.3lf\n", width, height, cores, sharpen_mode_name(cfg->mode),
+            cfg->threads, sharpen_schedule_name(cfg->schedule), cfg->chunk, cfg->tile_h, cfg->tile_w, cfg->ms);
+
+    return (fclose(fp) == 0) ? 0 : -1;
+}
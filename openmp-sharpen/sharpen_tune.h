@@ -0,0 +1,60 @@
+// OpenMP configuration autotuner for sharpen.c
+//
+// A configuration is how one frame is spread over threads: whole frames per
+// thread (the original), rows, or 2-D tiles, with an OpenMP schedule kind and
+// chunk.  sharpen_tune() times a sweep of them and the best one for an image
+// size and core count is kept in a cache file, one line per size and cores:
+//
+//   # width height cores mode threads schedule chunk tile_h tile_w ms
+//   1280 960 4 tiles 4 dynamic 1 64 256 7.912
+//
+#ifndef SHARPEN_TUNE_H
+#define SHARPEN_TUNE_H
+
+#include <omp.h>
+
+// cache file in the current directory unless SHARPEN_TUNE_CACHE is set
+#define SHARPEN_TUNE_CACHE "sharpen-tune.cache"
+
+enum sharpen_mode
+{
+    MODE_FRAMES,        // parallel over repeated frames, one frame per thread
+    MODE_ROWS,          // parallel over the rows of each frame
+    MODE_TILES,         // parallel over 2-D tiles of each frame, collapse(2)
+    MODE_COUNT
+};
+
+struct sharpen_config
+{
+    int        mode;
+    int        threads;
+    omp_sched_t schedule;
+    int        chunk;       // 0 for the schedule's default
+    int        tile_h;      // MODE_TILES only
+    int        tile_w;
+    double     ms;          // measured per frame, 0 if not tuned
+};
+
+// time one configuration, milliseconds per frame
+typedef double (*sharpen_timer_t)(const struct sharpen_config *cfg);
+
+// Sweep threads, schedule, chunk and tile shape for a width x height frame,
+// printing each result when verbose.  Returns the fastest in best.
+void sharpen_tune(struct sharpen_config *best, int width, int height, sharpen_timer_t time_config, int verbose);
+
+// Returns 0 and the cached configuration for width x height on this many
+// cores, or -1 if there is none
+int sharpen_cache_load(struct sharpen_config *cfg, int width, int height, int cores);
+
+// Replaces the entry for width x height and cores, returns 0 or -1
+int sharpen_cache_save(const struct sharpen_config *cfg, int width, int height, int cores);
+
+const char *sharpen_cache_path(void);
+
+// names as used on the command line and in the cache file, parse returns -1 if unknown
+const char *sharpen_mode_name(int mode);
+const char *sharpen_schedule_name(omp_sched_t schedule);
+int sharpen_parse_mode(const char *name);
+int sharpen_parse_schedule(const char *name, omp_sched_t *schedule);
+
+#endif
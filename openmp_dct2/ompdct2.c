@@ -97,6 +97,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <time.h>
+#include <omp.h>
+
+#include "fast_dct.h"
 
 
 // As documented for DCT2 in Wikipedia
@@ -124,7 +128,6 @@
 void dct(double macroblock[8][8], double dct2[8][8])
 {
    int u,v,x,y;
-   //FILE * fp = fopen("dct2.csv", "w");
 	
     for (v=0; v<8; v++)
     {
@@ -147,9 +150,7 @@ void dct(double macroblock[8][8], double dct2[8][8])
             }
 
             dct2[v][u] = 0.25 * Cu * Cv * z;
-            //fprintf(fp, "\n %lf", dct2[v][u]);
         }
-        //fprintf(fp, "\n");
 
     }
 }
@@ -160,7 +161,6 @@ void dct(double macroblock[8][8], double dct2[8][8])
 void idct(double dct2[8][8], double idct2[8][8])
 {
     int u,v,x,y;
-    //FILE * fp = fopen("idct2.csv", "w");
 
     for (y=0; y<8; y++)
     {
@@ -185,9 +185,7 @@ void idct(double dct2[8][8], double idct2[8][8])
             }
             z /= 4.0;
             idct2[x][y] = z;
-            //fprintf(fp, "\n %lf", idct2[x][y]);
         }
-        //fprintf(fp, "\n");
     }
 }
 
@@ -210,11 +208,35 @@ void idct(double dct2[8][8], double idct2[8][8])
 //
 //      Adjust the iterations as is reasonable for your system!
 //
+// Each block of the emulated frame is the test macro-block with its own offset, so blocks differ.  The frame
+// is transformed with dct()/idct() above and with the AAN fast_dct8x8()/fast_idct8x8() from ../image_common,
+// 160 blocks (a row of blocks) per batch, both spread over the threads by block row, and the blocks/s and the
+// largest difference between the two are reported.
+//
+// Usage: ompdct2 [threads [iterations [fast_iterations]]]
+//
 #define MAX_ITERATIONS (3)
+#define FAST_ITERATIONS (90)
+
+#define BLOCKS_X (160)
+#define BLOCKS_Y (120)
+#define NUM_BLOCKS (BLOCKS_X*BLOCKS_Y)
+
+// frame as 64 floats per block, and the reference results as doubles
+float frame[NUM_BLOCKS][64], fast_dct2[NUM_BLOCKS][64], fast_idct2[NUM_BLOCKS][64];
+double ref_dct2[NUM_BLOCKS][8][8], ref_idct2[NUM_BLOCKS][8][8];
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
 
-int main()
+int main(int argc, char *argv[])
 {
-    int thread_count=4;
+    int thread_count=4, iterations=MAX_ITERATIONS, fast_iterations=FAST_ITERATIONS;
     double Macroblock[8][8] = { {101, 100,  94, 102,  97,  91,  88,  83},
                                 {101,  99,  98, 103,  93,  93, 107, 110},
                                 { 98,  97,  97,  97, 103, 101,  94, 100},
@@ -223,20 +245,41 @@ int main()
                                 { 99, 101, 105, 105, 116, 113,  87,  58},
                                 { 94,  69,  66,  66,  79,  70,  40,  26},
                                 { 59,  30,  33,  33,  32,  37,  45,  41} };
-    double dct2[8][8];
-    double idct2[8][8];
+    double start, ref_sec, fast_sec, err, max_dct_err=0.0, max_idct_err=0.0;
+    int b, x, y;
 
+    if(argc > 1) thread_count=atoi(argv[1]);
+    if(argc > 2) iterations=atoi(argv[2]);
+    if(argc > 3) fast_iterations=atoi(argv[3]);
+    if((thread_count < 1) || (iterations < 1) || (fast_iterations < 1))
+    {
+        printf("Usage: ompdct2 [threads [iterations [fast_iterations]]]\n");
+        exit(-1);
+    }
 
-#pragma omp parallel for num_threads(thread_count)
-    for(int frame_idx=0; frame_idx < MAX_ITERATIONS; frame_idx++)
+    for(b=0; b < NUM_BLOCKS; b++)
+        for(x=0; x < 8; x++)
+            for(y=0; y < 8; y++)
+                frame[b][x*8+y]=Macroblock[x][y] + (double)((b * 7) % 64) - 32.0;
+
+    start=now_sec();
+    for(int frame_idx=0; frame_idx < iterations; frame_idx++)
     {
         // Emulate a 1280x960 resolutioon image with one color channel - gray
-        for(int block_col_idx=0; block_col_idx < 160; block_col_idx++)
+#pragma omp parallel for num_threads(thread_count)
+        for(int block_row_idx=0; block_row_idx < BLOCKS_Y; block_row_idx++)
         {
-            for(int block_row_idx=0; block_row_idx < 120; block_row_idx++)
+            double block[8][8];
+
+            for(int block_col_idx=0; block_col_idx < BLOCKS_X; block_col_idx++)
             {
+                int idx=block_row_idx*BLOCKS_X + block_col_idx;
+
+                for(int i=0; i < 64; i++)
+                    block[i/8][i%8]=frame[idx][i];
+
                 // The DCT is used for image encoding (compression)
-                dct(Macroblock, dct2);
+                dct(block, ref_dct2[idx]);
 
 
                 // Many other steps would be here for compression formats like JPEG,
@@ -244,10 +287,53 @@ int main()
 
 
                 // The inverse DCT is used for image decoding (decompression)
-                idct(dct2, idct2);
+                idct(ref_dct2[idx], ref_idct2[idx]);
             }
         }
     }
+    ref_sec=now_sec() - start;
+
+    start=now_sec();
+    for(int frame_idx=0; frame_idx < fast_iterations; frame_idx++)
+    {
+#pragma omp parallel for num_threads(thread_count)
+        for(int block_row_idx=0; block_row_idx < BLOCKS_Y; block_row_idx++)
+        {
+            int idx=block_row_idx*BLOCKS_X;
+
+            fast_dct8x8(frame[idx], fast_dct2[idx], BLOCKS_X);
+            fast_idct8x8(fast_dct2[idx], fast_idct2[idx], BLOCKS_X);
+        }
+    }
+    fast_sec=now_sec() - start;
+
+    // dct() stores coefficient (u,v) at [v][u], the fast DCT at [u][v]
+    for(b=0; b < NUM_BLOCKS; b++)
+    {
+        for(x=0; x < 8; x++)
+        {
+            for(y=0; y < 8; y++)
+            {
+                if((err=fabs(fast_dct2[b][x*8+y] - ref_dct2[b][y][x])) > max_dct_err) max_dct_err=err;
+                if((err=fabs(fast_idct2[b][x*8+y] - ref_idct2[b][x][y])) > max_idct_err) max_idct_err=err;
+            }
+        }
+    }
+
+    printf("%d threads, %dx%d blocks per frame\n", thread_count, BLOCKS_X, BLOCKS_Y);
+    printf("reference: %d frames in %.3lf sec, %.0lf blocks/s, %.2lf fps\n", iterations, ref_sec,
+           (double)NUM_BLOCKS * iterations / ref_sec, iterations / ref_sec);
+    printf("fast AAN:  %d frames in %.3lf sec, %.0lf blocks/s, %.2lf fps, %.1lfx\n", fast_iterations, fast_sec,
+           (double)NUM_BLOCKS * fast_iterations / fast_sec, fast_iterations / fast_sec,
+           (fast_iterations / fast_sec) / (iterations / ref_sec));
+    printf("max error against reference: DCT %le, iDCT %le\n", max_dct_err, max_idct_err);
+
+    // coefficients reach 2^10 and floats keep 24 bits, so 1e-2 is generous
+    if((max_dct_err > 1.0e-2) || (max_idct_err > 1.0e-2))
+    {
+        printf("FAILED max error check\n");
+        exit(1);
+    }
 
     exit(0);
 }
@@ -0,0 +1,100 @@
+/*
+ *  Convolve a PPM with a PSF read from a file, see psf_conv.h
+ *
+ *  Usage: psf_apply input.ppm output.ppm psf_file [auto|direct|separable|fft]
+ *
+ *  e.g. psf_apply Cactus-120kpixel.ppm Cactus-sharpen.ppm psf/sharpen3x3.psf
+ *  gives the same output as sharpen_grid.  The border the PSF does not reach
+ *  is copied from the input.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "psf_conv.h"
+#include "pnm_io.h"
+
+typedef unsigned char UINT8;
+
+
+int main(int argc, char *argv[])
+{
+    struct pnm_image in, out;
+    struct psf psf;
+    UINT8 *src[3], *dst[3];
+    int c, method = PSF_AUTO;
+    struct timespec start, stop;
+    size_t n;
+
+    if(argc < 4)
+    {
+       printf("Usage: psf_apply input.ppm output.ppm psf_file [auto|direct|separable|fft]\n");
+       exit(-1);
+    }
+
+    if(argc > 4)
+    {
+        for(method=0; method < PSF_METHOD_COUNT; method++)
+            if(strcmp(argv[4], psf_method_name(method)) == 0)
+                break;
+        if(method == PSF_METHOD_COUNT)
+        {
+            printf("Unknown method %s, one of auto, direct, separable or fft\n", argv[4]);
+            exit(-1);
+        }
+    }
+
+    if((psf_load(&psf, argv[3]) != 0) || (pnm_open(&in, argv[1]) != 0))
+        exit(-1);
+
+    if((in.sample_bytes != 1) || (in.width < psf.width) || (in.height < psf.height))
+    {
+        printf("%s is not an 8-bit image of at least %dx%d\n", argv[1], psf.width, psf.height);
+        exit(-1);
+    }
+
+    n = (size_t)in.width * in.height;
+    for(c=0; c < in.channels; c++)
+    {
+        if(!(src[c] = malloc(n)) || !(dst[c] = malloc(n)))
+        {
+            perror("malloc");
+            exit(-1);
+        }
+    }
+    pnm_to_planes(&in, src);
+    pnm_to_planes(&in, dst);
+
+    if(method == PSF_AUTO)
+        method = psf_choose(&psf, in.width, in.height);
+
+    fprintf(stderr, "%dx%d %s PSF on %dx%d, %s, about %.1lf multiply-adds per pixel\n",
+            psf.width, psf.height, psf.separable ? "separable" : "non-separable",
+            in.width, in.height, psf_method_name(method), psf_cost(&psf, method, in.width, in.height));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(psf_convolve(&psf, method, (const UINT8 *const *)src, dst, in.channels, in.width, in.height) != 0)
+    {
+        fprintf(stderr, "convolution failed\n");
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    fprintf(stderr, "convolved in %.3lf ms\n", (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_nsec - start.tv_nsec) / 1000000.0);
+
+    if(pnm_create_like(&out, argv[2], &in) != 0)
+        exit(-1);
+    pnm_from_planes(&out, (const UINT8 *const *)dst);
+    pnm_close(&out);
+    pnm_close(&in);
+
+    for(c=0; c < in.channels; c++)
+    {
+        free(src[c]);
+        free(dst[c]);
+    }
+    psf_free(&psf);
+
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ *  Benchmark and bit-exact check for the fused PSF convolution kernels
+ *
+ *  Each image is sharpened with the original double precision loop from
+ *  sharpen.c, then with every kernel supported on this CPU over planar R/G/B
+ *  and over the interleaved RGB24 pixels, and every output is compared with
+ *  the original byte for byte.
+ *
+ *  Usage: psf_bench [iterations [image.ppm ...]]
+ *
+ *  Without images, random 1280x960 and 4000x3000 frames are used, the sizes of
+ *  the openmp-sharpen test image and of sharpen_grid.c.  Try
+ *  psf_bench 20 ../openmp-sharpen/Alaska-Bear-1280x960.ppm Cactus-120kpixel.ppm
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "psf_kernel.h"
+#include "pnm_io.h"
+
+typedef double FLOAT;
+typedef unsigned char UINT8;
+
+#define K 4.0
+
+FLOAT PSF[9] = {-K/8.0, -K/8.0, -K/8.0, -K/8.0, K+1.0, -K/8.0, -K/8.0, -K/8.0, -K/8.0};
+
+struct image
+{
+    int    width, height;
+    UINT8 *rgb;             // interleaved, as in the file
+    UINT8 *plane[3];        // R, G, B
+};
+
+
+// Reference, the loop from sharpen.c for one plane
+static void reference_plane(const UINT8 *R, UINT8 *convR, int width, int height)
+{
+    int i, j;
+    FLOAT temp;
+
+    for(i=1; i<((height)-1); i++)
+    {
+        for(j=1; j<((width)-1); j++)
+        {
+            temp=0;
+            temp += (PSF[0] * (FLOAT)R[((i-1)*width)+j-1]);
+            temp += (PSF[1] * (FLOAT)R[((i-1)*width)+j]);
+            temp += (PSF[2] * (FLOAT)R[((i-1)*width)+j+1]);
+            temp += (PSF[3] * (FLOAT)R[((i)*width)+j-1]);
+            temp += (PSF[4] * (FLOAT)R[((i)*width)+j]);
+            temp += (PSF[5] * (FLOAT)R[((i)*width)+j+1]);
+            temp += (PSF[6] * (FLOAT)R[((i+1)*width)+j-1]);
+            temp += (PSF[7] * (FLOAT)R[((i+1)*width)+j]);
+            temp += (PSF[8] * (FLOAT)R[((i+1)*width)+j+1]);
+	    if(temp<0.0) temp=0.0;
+	    if(temp>255.0) temp=255.0;
+	    convR[(i*width)+j]=(UINT8)temp;
+        }
+    }
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void alloc_image(struct image *img, int width, int height)
+{
+    size_t n = (size_t)width * height;
+    int c;
+
+    img->width = width;
+    img->height = height;
+    img->rgb = malloc(n * 3);
+    for(c=0; c<3; c++)
+        img->plane[c] = malloc(n);
+
+    if(!img->rgb || !img->plane[0] || !img->plane[1] || !img->plane[2])
+    {
+        fprintf(stderr, "Out of memory for %dx%d\n", width, height);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void free_image(struct image *img)
+{
+    int c;
+
+    free(img->rgb);
+    for(c=0; c<3; c++)
+        free(img->plane[c]);
+}
+
+static void split_planes(struct image *img)
+{
+    size_t i, n = (size_t)img->width * img->height;
+
+    for(i=0; i<n; i++)
+    {
+        img->plane[0][i] = img->rgb[3*i];
+        img->plane[1][i] = img->rgb[3*i+1];
+        img->plane[2][i] = img->rgb[3*i+2];
+    }
+}
+
+static int load_ppm(const char *name, struct image *img)
+{
+    struct pnm_image ppm;
+
+    if(pnm_open(&ppm, name) != 0)
+        return -1;
+
+    if((ppm.channels != 3) || (ppm.sample_bytes != 1) || (ppm.width < 3) || (ppm.height < 3))
+    {
+        fprintf(stderr, "%s: not an 8-bit P6 PPM\n", name);
+        pnm_close(&ppm);
+        return -1;
+    }
+
+    alloc_image(img, ppm.width, ppm.height);
+    memcpy(img->rgb, ppm.pixels, ppm.bytes);
+    pnm_to_planes(&ppm, img->plane);
+    pnm_close(&ppm);
+
+    return 0;
+}
+
+static void random_image(struct image *img, int width, int height)
+{
+    size_t i, n = (size_t)width * height * 3;
+
+    alloc_image(img, width, height);
+    for(i=0; i<n; i++)
+        img->rgb[i] = random() & 0xff;
+
+    split_planes(img);
+}
+
+static int compare(const char *what, int isa, const UINT8 *ref, const UINT8 *out, size_t n, size_t step)
+{
+    size_t i;
+
+    for(i=0; i<n; i++)
+    {
+        if(ref[i] != out[i*step])
+        {
+            printf("%-7s %-7s MISMATCH at %zu: expected %d got %d\n",
+                   psf_isa_name(isa), what, i, ref[i], out[i*step]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int bench_image(const char *name, struct image *img, int iterations)
+{
+    struct image ref, out;
+    size_t n = (size_t)img->width * img->height;
+    int isa, iter, c, failed=0;
+    double start, ref_ms, ms;
+    const UINT8 *src[3] = { img->plane[0], img->plane[1], img->plane[2] };
+
+    alloc_image(&ref, img->width, img->height);
+    alloc_image(&out, img->width, img->height);
+
+    printf("%s %dx%d, %d iterations\n", name, img->width, img->height, iterations);
+
+    // like sharpen.c, the border is the input unchanged
+    for(c=0; c<3; c++)
+        memcpy(ref.plane[c], img->plane[c], n);
+
+    start = now_sec();
+    for(iter=0; iter<iterations; iter++)
+        for(c=0; c<3; c++)
+            reference_plane(img->plane[c], ref.plane[c], img->width, img->height);
+    ref_ms = (now_sec() - start) * 1000.0 / iterations;
+    printf("%-7s %-7s %9.3lf ms/frame\n", "double", "planar", ref_ms);
+
+    for(isa=0; isa<PSF_ISA_COUNT; isa++)
+    {
+        if(psf_kernel_select(isa) != 0)
+        {
+            printf("%-7s not supported\n", psf_isa_name(isa));
+            continue;
+        }
+
+        // the kernels only write the interior, start every check from the border
+        for(c=0; c<3; c++)
+            memcpy(out.plane[c], img->plane[c], n);
+
+        start = now_sec();
+        for(iter=0; iter<iterations; iter++)
+            psf_sharpen_planes(src, out.plane, 3, img->width, 1, img->height-2, 1, img->width-2);
+        ms = (now_sec() - start) * 1000.0 / iterations;
+        printf("%-7s %-7s %9.3lf ms/frame %7.2lfx\n", psf_isa_name(isa), "planar", ms, ref_ms / ms);
+
+        for(c=0; c<3; c++)
+            failed |= compare("planar", isa, ref.plane[c], out.plane[c], n, 1);
+
+        memcpy(out.rgb, img->rgb, n * 3);
+
+        start = now_sec();
+        for(iter=0; iter<iterations; iter++)
+            psf_sharpen_rgb24(img->rgb, out.rgb, img->width * 3, 1, img->height-2, 1, img->width-2);
+        ms = (now_sec() - start) * 1000.0 / iterations;
+        printf("%-7s %-7s %9.3lf ms/frame %7.2lfx\n", psf_isa_name(isa), "rgb24", ms, ref_ms / ms);
+
+        for(c=0; c<3; c++)
+            failed |= compare("rgb24", isa, ref.plane[c], out.rgb + c, n, 3);
+    }
+
+    printf("\n");
+    free_image(&ref);
+    free_image(&out);
+
+    return failed;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct image img;
+    int iterations=10, i, failed=0;
+
+    if(argc > 1)
+        iterations = atoi(argv[1]);
+    if(iterations < 1)
+    {
+        printf("Usage: psf_bench [iterations [image.ppm ...]]\n");
+        exit(-1);
+    }
+
+    if(argc > 2)
+    {
+        for(i=2; i<argc; i++)
+        {
+            if(load_ppm(argv[i], &img) != 0)
+                exit(EXIT_FAILURE);
+            failed |= bench_image(argv[i], &img, iterations);
+            free_image(&img);
+        }
+    }
+    else
+    {
+        srandom(5763);
+        random_image(&img, 1280, 960);
+        failed |= bench_image("random", &img, iterations);
+        free_image(&img);
+
+        random_image(&img, 4000, 3000);
+        failed |= bench_image("random", &img, iterations);
+        free_image(&img);
+    }
+
+    printf("%s\n", failed ? "FAILED bit-exact check" : "all kernels bit-exact with the double precision PSF");
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
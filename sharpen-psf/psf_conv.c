@@ -0,0 +1,622 @@
+/*
+ *  General PSF convolution engine, see psf_conv.h
+ *
+ *  The FFT path is overlap-save: the image is cut into T x T input tiles that
+ *  overlap by the PSF size less one, each tile is transformed, multiplied by
+ *  the transform of the PSF and transformed back, and the (T-width+1) x
+ *  (T-height+1) outputs that did not wrap around the tile are kept.  Tiles
+ *  keep the working set in cache and the transforms small, where a transform
+ *  of the whole padded 12 MP frame would need hundreds of MB.
+ *
+ *  Two planes go through each complex transform, one as the real part and
+ *  one as the imaginary part.  The PSF is real, so the products do not mix
+ *  and the two results come back apart in the real and imaginary parts.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "psf_conv.h"
+
+// Added before truncating to 8 bits so a result that is an exact integer in
+// the direct loop, e.g. every sharpen.c output, is not truncated one lower
+// after the rounding error of another summation order
+#define PSF_ROUND_GUARD (1.0e-6)
+
+#define FFT_MIN_TILE (32)
+#define FFT_MAX_TILE (1024)
+
+
+static inline unsigned char clamp8(double v)
+{
+    if(v < 0.0) return 0;
+    if(v > 255.0) return 255;
+    return (unsigned char)v;
+}
+
+
+int psf_set(struct psf *psf, int width, int height, const double *taps)
+{
+    double *v, *u, norm, sigma, best, resid, total;
+    int i, j, iter, n = width * height;
+
+    memset(psf, 0, sizeof(*psf));
+
+    if((width < 1) || (height < 1) || !(width & 1) || !(height & 1) ||
+       (width > PSF_MAX_SIZE) || (height > PSF_MAX_SIZE))
+        return -1;
+
+    psf->width = width;
+    psf->height = height;
+    psf->taps = malloc(n * sizeof(double));
+    psf->row = malloc(width * sizeof(double));
+    psf->col = malloc(height * sizeof(double));
+    if(!psf->taps || !psf->row || !psf->col)
+    {
+        psf_free(psf);
+        return -1;
+    }
+    memcpy(psf->taps, taps, n * sizeof(double));
+
+    // Largest singular value and vectors by power iteration on K'K, starting
+    // from the largest row so the start is in the row space
+    v = psf->row;
+    u = psf->col;
+    for(i=0, best=-1.0, total=0.0; i < height; i++)
+    {
+        for(j=0, norm=0.0; j < width; j++)
+            norm += taps[i*width+j] * taps[i*width+j];
+        total += norm;
+        if(norm > best)
+        {
+            best = norm;
+            memcpy(v, &taps[i*width], width * sizeof(double));
+        }
+    }
+    if(total == 0.0)
+    {
+        psf_free(psf);
+        return -1;
+    }
+
+    for(iter=0; iter < 100; iter++)
+    {
+        for(i=0; i < height; i++)
+            for(j=0, u[i]=0.0; j < width; j++)
+                u[i] += taps[i*width+j] * v[j];
+        for(j=0, norm=0.0; j < width; j++)
+        {
+            for(i=0, v[j]=0.0; i < height; i++)
+                v[j] += taps[i*width+j] * u[i];
+            norm += v[j] * v[j];
+        }
+        for(j=0, norm=sqrt(norm); j < width; j++)
+            v[j] /= norm;
+    }
+
+    // u = K v = sigma * left singular vector, so K ~= u v'
+    for(i=0, sigma=0.0; i < height; i++)
+    {
+        for(j=0, u[i]=0.0; j < width; j++)
+            u[i] += taps[i*width+j] * v[j];
+        sigma += u[i] * u[i];
+    }
+
+    for(i=0, resid=0.0; i < height; i++)
+        for(j=0; j < width; j++)
+            resid += (taps[i*width+j] - u[i]*v[j]) * (taps[i*width+j] - u[i]*v[j]);
+
+    // rank 1 to within 1e-6 of the Frobenius norm
+    psf->separable = (resid <= 1.0e-12 * total);
+
+    return 0;
+}
+
+// next number in a PSF file, skipping whitespace and # comments
+static int psf_number(FILE *fp, double *value)
+{
+    int c;
+
+    while((c = fgetc(fp)) != EOF)
+    {
+        if(c == '#')
+            while(((c = fgetc(fp)) != EOF) && (c != '\n'));
+        else if((c != ' ') && (c != '\t') && (c != '\n') && (c != '\r'))
+            break;
+    }
+
+    ungetc(c, fp);
+    return (fscanf(fp, "%lf", value) == 1) ? 0 : -1;
+}
+
+int psf_load(struct psf *psf, const char *path)
+{
+    FILE *fp;
+    double w, h, *taps;
+    int i, rc;
+
+    memset(psf, 0, sizeof(*psf));
+
+    if(!(fp = fopen(path, "r")))
+    {
+        perror(path);
+        return -1;
+    }
+
+    if((psf_number(fp, &w) != 0) || (psf_number(fp, &h) != 0) ||
+       (w < 1) || (h < 1) || (w > PSF_MAX_SIZE) || (h > PSF_MAX_SIZE) ||
+       (w != (int)w) || (h != (int)h) || !((int)w & 1) || !((int)h & 1))
+    {
+        fprintf(stderr, "%s: needs an odd width and height up to %d\n", path, PSF_MAX_SIZE);
+        fclose(fp);
+        return -1;
+    }
+
+    if(!(taps = malloc((int)w * (int)h * sizeof(double))))
+    {
+        fclose(fp);
+        return -1;
+    }
+
+    for(i=0; i < (int)w * (int)h; i++)
+    {
+        if(psf_number(fp, &taps[i]) != 0)
+        {
+            fprintf(stderr, "%s: %.0lfx%.0lf PSF has only %d weights\n", path, w, h, i);
+            free(taps);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+
+    if((rc = psf_set(psf, (int)w, (int)h, taps)) != 0)
+        fprintf(stderr, "%s: all zero PSF\n", path);
+    free(taps);
+
+    return rc;
+}
+
+void psf_free(struct psf *psf)
+{
+    free(psf->taps);
+    free(psf->row);
+    free(psf->col);
+    memset(psf, 0, sizeof(*psf));
+}
+
+const char *psf_method_name(int method)
+{
+    static const char *names[PSF_METHOD_COUNT] = { "auto", "direct", "separable", "fft" };
+
+    return ((method >= 0) && (method < PSF_METHOD_COUNT)) ? names[method] : "unknown";
+}
+
+
+// Direct: one output row at a time, each tap adding a shifted input row into
+// a row of double accumulators, in the tap order of the sharpen.c loop
+static int conv_direct(const struct psf *psf, const unsigned char *src, unsigned char *dst,
+                       int width, int height)
+{
+    int rw = psf->width / 2, rh = psf->height / 2, ncols = width - 2 * rw;
+    int i, j, kx, ky;
+    double *acc, t;
+
+    if(!(acc = malloc(ncols * sizeof(double))))
+        return -1;
+
+    for(i=rh; i < height - rh; i++)
+    {
+        memset(acc, 0, ncols * sizeof(double));
+
+        for(ky=0; ky < psf->height; ky++)
+        {
+            const unsigned char *in = src + (size_t)(i + ky - rh) * width;
+
+            for(kx=0; kx < psf->width; kx++)
+            {
+                if((t = psf->taps[ky * psf->width + kx]) == 0.0)
+                    continue;
+                for(j=0; j < ncols; j++)
+                    acc[j] += t * (double)in[j + kx];
+            }
+        }
+
+        for(j=0; j < ncols; j++)
+            dst[(size_t)i * width + rw + j] = clamp8(acc[j] + PSF_ROUND_GUARD);
+    }
+
+    free(acc);
+    return 0;
+}
+
+// Separable: rows filtered into a ring of height rows, then each output row
+// is the column filter down the ring
+static int conv_separable(const struct psf *psf, const unsigned char *src, unsigned char *dst,
+                          int width, int height)
+{
+    int rw = psf->width / 2, rh = psf->height / 2, ncols = width - 2 * rw;
+    int i, j, k, next = 0;
+    double *ring, *acc, *r;
+
+    ring = malloc((size_t)psf->height * ncols * sizeof(double));
+    acc = malloc(ncols * sizeof(double));
+    if(!ring || !acc)
+    {
+        free(ring);
+        free(acc);
+        return -1;
+    }
+
+    for(i=rh; i < height - rh; i++)
+    {
+        // filter input rows up to i+rh into the ring, row n in slot n % height
+        for(; next <= i + rh; next++)
+        {
+            const unsigned char *in = src + (size_t)next * width;
+
+            r = ring + (size_t)(next % psf->height) * ncols;
+            memset(r, 0, ncols * sizeof(double));
+            for(k=0; k < psf->width; k++)
+                for(j=0; j < ncols; j++)
+                    r[j] += psf->row[k] * (double)in[j + k];
+        }
+
+        memset(acc, 0, ncols * sizeof(double));
+        for(k=0; k < psf->height; k++)
+        {
+            r = ring + (size_t)((i + k - rh) % psf->height) * ncols;
+            for(j=0; j < ncols; j++)
+                acc[j] += psf->col[k] * r[j];
+        }
+
+        for(j=0; j < ncols; j++)
+            dst[(size_t)i * width + rw + j] = clamp8(acc[j] + PSF_ROUND_GUARD);
+    }
+
+    free(ring);
+    free(acc);
+    return 0;
+}
+
+
+// Radix-2 FFT on split real and imaginary arrays, n a power of 2
+struct fft_plan
+{
+    int     n;
+    int    *rev;        // bit reversed index
+    double *cos;        // cos(2 pi k / n), k < n/2
+    double *sin;
+};
+
+static void fft_plan_free(struct fft_plan *p)
+{
+    free(p->rev);
+    free(p->cos);
+    free(p->sin);
+}
+
+static int fft_plan_init(struct fft_plan *p, int n)
+{
+    int i, bits, b;
+
+    p->n = n;
+    p->rev = malloc(n * sizeof(int));
+    p->cos = malloc((n / 2) * sizeof(double));
+    p->sin = malloc((n / 2) * sizeof(double));
+    if(!p->rev || !p->cos || !p->sin)
+    {
+        fft_plan_free(p);
+        return -1;
+    }
+
+    for(bits=0; (1 << bits) < n; bits++);
+    for(i=0; i < n; i++)
+    {
+        for(b=0, p->rev[i]=0; b < bits; b++)
+            p->rev[i] |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    for(i=0; i < n / 2; i++)
+    {
+        p->cos[i] = cos(2.0 * M_PI * i / n);
+        p->sin[i] = sin(2.0 * M_PI * i / n);
+    }
+
+    return 0;
+}
+
+// Transform each of rows rows of n points in place, sign -1 forward, +1 inverse (unscaled)
+static void fft_rows(const struct fft_plan *p, double *re, double *im, int rows, int sign)
+{
+    int n = p->n, len, half, step, i, k, a, b, r;
+    double wr, wi, tr, ti, t;
+
+    for(r=0; r < rows; r++, re += n, im += n)
+    {
+        for(i=0; i < n; i++)
+        {
+            if(i < p->rev[i])
+            {
+                t = re[i]; re[i] = re[p->rev[i]]; re[p->rev[i]] = t;
+                t = im[i]; im[i] = im[p->rev[i]]; im[p->rev[i]] = t;
+            }
+        }
+
+        for(len=2; len <= n; len <<= 1)
+        {
+            half = len / 2;
+            step = n / len;
+            for(i=0; i < n; i += len)
+            {
+                for(k=0; k < half; k++)
+                {
+                    wr = p->cos[k * step];
+                    wi = sign * p->sin[k * step];
+                    a = i + k;
+                    b = a + half;
+                    tr = re[b] * wr - im[b] * wi;
+                    ti = re[b] * wi + im[b] * wr;
+                    re[b] = re[a] - tr; im[b] = im[a] - ti;
+                    re[a] += tr;        im[a] += ti;
+                }
+            }
+        }
+    }
+}
+
+// Transform the n columns of an n x n tile, with whole rows as the butterfly
+// operands so the inner loop runs along contiguous memory
+static void fft_cols(const struct fft_plan *p, double *re, double *im, int sign)
+{
+    int n = p->n, len, half, step, i, k, j;
+    double wr, wi, tr, ti, t, *ra, *ia, *rb, *ib;
+
+    for(i=0; i < n; i++)
+    {
+        if(i < p->rev[i])
+        {
+            ra = re + (size_t)i * n; ia = im + (size_t)i * n;
+            rb = re + (size_t)p->rev[i] * n; ib = im + (size_t)p->rev[i] * n;
+            for(j=0; j < n; j++)
+            {
+                t = ra[j]; ra[j] = rb[j]; rb[j] = t;
+                t = ia[j]; ia[j] = ib[j]; ib[j] = t;
+            }
+        }
+    }
+
+    for(len=2; len <= n; len <<= 1)
+    {
+        half = len / 2;
+        step = n / len;
+        for(i=0; i < n; i += len)
+        {
+            for(k=0; k < half; k++)
+            {
+                wr = p->cos[k * step];
+                wi = sign * p->sin[k * step];
+                ra = re + (size_t)(i + k) * n; ia = im + (size_t)(i + k) * n;
+                rb = ra + (size_t)half * n;    ib = ia + (size_t)half * n;
+                for(j=0; j < n; j++)
+                {
+                    tr = rb[j] * wr - ib[j] * wi;
+                    ti = rb[j] * wi + ib[j] * wr;
+                    rb[j] = ra[j] - tr; ib[j] = ia[j] - ti;
+                    ra[j] += tr;        ia[j] += ti;
+                }
+            }
+        }
+    }
+}
+
+static int log2i(int n)
+{
+    int b;
+
+    for(b=0; (1 << b) < n; b++);
+    return b;
+}
+
+// Butterflies and multiplies per output pixel per plane for tile size t
+static double fft_tile_cost(const struct psf *psf, int t, int width, int height)
+{
+    int vw = t - psf->width + 1, vh = t - psf->height + 1;
+    int ow = width - psf->width + 1, oh = height - psf->height + 1;
+    double tiles, per_tile;
+
+    if((vw < 1) || (vh < 1) || (ow < 1) || (oh < 1))
+        return -1.0;
+
+    // forward rows and columns, inverse columns and the rows that are kept,
+    // plus the spectrum multiply, for two planes
+    tiles = (double)((ow + vw - 1) / vw) * ((oh + vh - 1) / vh);
+    per_tile = PSF_FFT_BUTTERFLY_COST * ((double)t / 2.0) * log2i(t) * (3.0 * t + vh) + 2.0 * t * t;
+
+    return tiles * per_tile / (2.0 * ow * oh);
+}
+
+// Tile size with the least work per pixel
+static int fft_tile_size(const struct psf *psf, int width, int height)
+{
+    int t, best = 0;
+    double c, best_cost = 0.0;
+
+    for(t=FFT_MIN_TILE; t <= FFT_MAX_TILE; t <<= 1)
+    {
+        c = fft_tile_cost(psf, t, width, height);
+        if((c > 0.0) && ((best == 0) || (c < best_cost)))
+        {
+            best = t;
+            best_cost = c;
+        }
+    }
+
+    return best;
+}
+
+static int conv_fft(const struct psf *psf, const unsigned char *const src[], unsigned char *const dst[],
+                    int nplanes, int width, int height)
+{
+    int rw = psf->width / 2, rh = psf->height / 2;
+    int t, vw, vh, tx, ty, x, y, ix, iy, kx, ky, plane, rc = -1;
+    double *re, *im, *gre, *gim, scale, r, i;
+    struct fft_plan plan;
+    size_t n;
+
+    if(!(t = fft_tile_size(psf, width, height)) || (fft_plan_init(&plan, t) != 0))
+        return -1;
+
+    n = (size_t)t * t;
+    vw = t - psf->width + 1;
+    vh = t - psf->height + 1;
+    scale = 1.0 / (double)n;
+
+    re = malloc(n * sizeof(double));
+    im = malloc(n * sizeof(double));
+    gre = calloc(n, sizeof(double));
+    gim = calloc(n, sizeof(double));
+    if(!re || !im || !gre || !gim)
+        goto out;
+
+    // PSF placed for circular convolution, g[rh-ky][rw-kx] = taps[ky][kx],
+    // and scaled by 1/n here rather than scaling every inverse transform
+    for(ky=0; ky < psf->height; ky++)
+        for(kx=0; kx < psf->width; kx++)
+            gre[(size_t)((rh - ky + t) % t) * t + ((rw - kx + t) % t)] = psf->taps[ky * psf->width + kx] * scale;
+    fft_rows(&plan, gre, gim, t, -1);
+    fft_cols(&plan, gre, gim, -1);
+
+    for(plane=0; plane < nplanes; plane += 2)
+    {
+        const unsigned char *a = src[plane], *b = (plane + 1 < nplanes) ? src[plane + 1] : NULL;
+
+        // output pixel (ty, tx) of the interior is tile pixel (rh, rw)
+        for(ty=rh; ty < height - rh; ty += vh)
+        {
+            for(tx=rw; tx < width - rw; tx += vw)
+            {
+                for(y=0; y < t; y++)
+                {
+                    iy = ty - rh + y;
+                    for(x=0; x < t; x++)
+                    {
+                        ix = tx - rw + x;
+                        if((iy < height) && (ix < width))
+                        {
+                            re[(size_t)y * t + x] = a[(size_t)iy * width + ix];
+                            im[(size_t)y * t + x] = b ? b[(size_t)iy * width + ix] : 0.0;
+                        }
+                        else
+                        {
+                            re[(size_t)y * t + x] = 0.0;
+                            im[(size_t)y * t + x] = 0.0;
+                        }
+                    }
+                }
+
+                fft_rows(&plan, re, im, t, -1);
+                fft_cols(&plan, re, im, -1);
+
+                for(x=0; x < (int)n; x++)
+                {
+                    r = re[x] * gre[x] - im[x] * gim[x];
+                    i = re[x] * gim[x] + im[x] * gre[x];
+                    re[x] = r;
+                    im[x] = i;
+                }
+
+                // only rows rh .. rh+vh-1 are kept, no need to finish the rest
+                fft_cols(&plan, re, im, 1);
+                fft_rows(&plan, re + (size_t)rh * t, im + (size_t)rh * t, vh, 1);
+
+                for(y=rh; (y < rh + vh) && (ty - rh + y < height - rh); y++)
+                {
+                    iy = ty - rh + y;
+                    for(x=rw; (x < rw + vw) && (tx - rw + x < width - rw); x++)
+                    {
+                        ix = tx - rw + x;
+                        dst[plane][(size_t)iy * width + ix] = clamp8(re[(size_t)y * t + x] + PSF_ROUND_GUARD);
+                        if(b)
+                            dst[plane + 1][(size_t)iy * width + ix] = clamp8(im[(size_t)y * t + x] + PSF_ROUND_GUARD);
+                    }
+                }
+            }
+        }
+    }
+    rc = 0;
+
+out:
+    free(re);
+    free(im);
+    free(gre);
+    free(gim);
+    fft_plan_free(&plan);
+
+    return rc;
+}
+
+
+double psf_cost(const struct psf *psf, int method, int width, int height)
+{
+    if(method == PSF_AUTO)
+        method = psf_choose(psf, width, height);
+
+    switch(method)
+    {
+        case PSF_DIRECT:
+            return (double)psf->width * psf->height;
+        case PSF_SEPARABLE:
+            return psf->separable ? (double)(psf->width + psf->height) : (double)psf->width * psf->height;
+        case PSF_FFT:
+            return fft_tile_cost(psf, fft_tile_size(psf, width, height), width, height);
+        default:
+            return -1.0;
+    }
+}
+
+int psf_choose(const struct psf *psf, int width, int height)
+{
+    int best = psf->separable ? PSF_SEPARABLE : PSF_DIRECT;
+    double fft = psf_cost(psf, PSF_FFT, width, height);
+
+    if((fft > 0.0) && (fft < psf_cost(psf, best, width, height)))
+        best = PSF_FFT;
+
+    return best;
+}
+
+int psf_convolve(const struct psf *psf, int method, const unsigned char *const src[],
+                 unsigned char *const dst[], int nplanes, int width, int height)
+{
+    int plane;
+
+    if((width < psf->width) || (height < psf->height))
+        return -1;
+
+    if(method == PSF_AUTO)
+        method = psf_choose(psf, width, height);
+    if((method == PSF_SEPARABLE) && !psf->separable)
+        method = PSF_DIRECT;
+
+    if(method == PSF_FFT)
+        return conv_fft(psf, src, dst, nplanes, width, height);
+
+    for(plane=0; plane < nplanes; plane++)
+    {
+        if(method == PSF_SEPARABLE)
+        {
+            if(conv_separable(psf, src[plane], dst[plane], width, height) != 0)
+                return -1;
+        }
+        else if(method == PSF_DIRECT)
+        {
+            if(conv_direct(psf, src[plane], dst[plane], width, height) != 0)
+                return -1;
+        }
+        else
+            return -1;
+    }
+
+    return 0;
+}
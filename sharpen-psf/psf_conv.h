@@ -0,0 +1,89 @@
+/*
+ *  General PSF convolution engine: direct, separable and FFT
+ *
+ *  psf_kernel.h handles the one fixed 3x3 sharpen PSF.  This takes any PSF of
+ *  odd width and height, e.g. loaded from a file for deblurring, and runs it
+ *  one of three ways:
+ *
+ *    PSF_DIRECT     width*height multiply-adds per pixel, in double precision
+ *                   and in the same order as the loop in sharpen.c, so a 3x3
+ *                   PSF gives the same output as sharpen.c
+ *    PSF_SEPARABLE  for a rank 1 PSF (found by SVD when it is set), a row
+ *                   pass and a column pass, width+height per pixel
+ *    PSF_FFT        overlap-save over square tiles with a radix-2 FFT, two
+ *                   planes per complex transform, O(log tile) per pixel no
+ *                   matter how big the PSF is
+ *
+ *  PSF_AUTO picks the cheapest with a cost model; psf_conv_bench measures
+ *  the actual crossover so PSF_FFT_BUTTERFLY_COST can be tuned per machine.
+ *
+ *  As in sharpen.c the PSF is applied as written (correlation, taps[0] is the
+ *  upper left neighbour), results are clamped to 0..255 and truncated, and
+ *  only the interior is written: the caller keeps the border, height/2 rows
+ *  and width/2 columns of it, which have no complete neighbourhood.
+ *
+ *  A PSF file is the width and height followed by width*height weights in
+ *  row order, whitespace separated, with # comments, e.g. psf/sharpen3x3.psf
+ */
+#ifndef PSF_CONV_H
+#define PSF_CONV_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PSF_MAX_SIZE (255)
+
+// Cost of one radix-2 butterfly relative to one multiply-add of the direct
+// loop, for the PSF_AUTO choice.  Measure with psf_conv_bench.
+#ifndef PSF_FFT_BUTTERFLY_COST
+#define PSF_FFT_BUTTERFLY_COST (10.0)
+#endif
+
+enum psf_method
+{
+    PSF_AUTO,
+    PSF_DIRECT,
+    PSF_SEPARABLE,
+    PSF_FFT,
+    PSF_METHOD_COUNT
+};
+
+struct psf
+{
+    int     width;          // odd
+    int     height;         // odd
+    double *taps;           // width*height, row order
+    int     separable;      // rank 1, taps[i*width+j] == col[i]*row[j]
+    double *col;            // height
+    double *row;            // width
+};
+
+// Copy width*height taps and check for separability.  Returns 0, or -1 for
+// an even or oversized shape or an all zero PSF.
+int psf_set(struct psf *psf, int width, int height, const double *taps);
+
+// Read a PSF file as described above, returns 0 or -1 with a message on stderr
+int psf_load(struct psf *psf, const char *path);
+
+void psf_free(struct psf *psf);
+
+// Cheapest method for a width x height image by the cost model
+int psf_choose(const struct psf *psf, int width, int height);
+
+// Estimated multiply-adds per output pixel of method on a width x height image
+double psf_cost(const struct psf *psf, int method, int width, int height);
+
+// Convolve nplanes planar 8-bit images of width x height (stride == width).
+// PSF_SEPARABLE falls back to PSF_DIRECT if the PSF is not separable.
+// Returns 0, or -1 if the image is smaller than the PSF or memory runs out.
+int psf_convolve(const struct psf *psf, int method, const unsigned char *const src[],
+                 unsigned char *const dst[], int nplanes, int width, int height);
+
+const char *psf_method_name(int method);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
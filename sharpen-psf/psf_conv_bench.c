@@ -0,0 +1,242 @@
+/*
+ *  Crossover benchmark for the general PSF convolution engine
+ *
+ *  For PSF sizes from 3x3 up to max_size, times direct, separable and FFT
+ *  convolution of the R, G and B planes of each image with two PSFs:
+ *
+ *    disk   a deblurring PSF, 2 at the centre less a disk blur, not separable
+ *    gauss  a Gaussian blur with sigma of a sixth of the size, separable
+ *
+ *  and reports the smallest size at which FFT beats direct for the disk and
+ *  separable for the Gaussian, next to the choice of the cost model.  Every
+ *  output is compared with direct; separable and FFT sum in another order,
+ *  so a few pixels may truncate one level apart.
+ *
+ *  Usage: psf_conv_bench [max_size [image.ppm ...]]
+ *
+ *  Without images, Cactus-120kpixel.ppm and ../openmp-sharpen/Alaska-Bear-1280x960.ppm
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "psf_conv.h"
+#include "pnm_io.h"
+
+typedef unsigned char UINT8;
+
+#define MIN_SEC (0.25)
+
+static const int sizes[] = { 3, 5, 7, 9, 11, 13, 15, 19, 23, 27, 31, 41, 51, 63, 79, 99, 127 };
+#define NUM_SIZES ((int)(sizeof(sizes) / sizeof(sizes[0])))
+
+static const char *default_images[] = { "Cactus-120kpixel.ppm", "../openmp-sharpen/Alaska-Bear-1280x960.ppm" };
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+static void disk_psf(struct psf *psf, int k)
+{
+    double *taps = malloc(k * k * sizeof(double)), r = k / 2, n = 0.0;
+    int i, j;
+
+    for(i=0; i < k; i++)
+        for(j=0; j < k; j++)
+            n += taps[i*k+j] = (((i-r)*(i-r) + (j-r)*(j-r)) <= r*r) ? 1.0 : 0.0;
+    for(i=0; i < k*k; i++)
+        taps[i] = -taps[i] / n;
+    taps[(k/2)*k + k/2] += 2.0;
+
+    psf_set(psf, k, k, taps);
+    free(taps);
+}
+
+static void gauss_psf(struct psf *psf, int k)
+{
+    double *taps = malloc(k * k * sizeof(double)), *g = malloc(k * sizeof(double));
+    double sigma = k / 6.0, sum = 0.0;
+    int i, j;
+
+    for(i=0; i < k; i++)
+        sum += g[i] = exp(-(i - k/2) * (i - k/2) / (2.0 * sigma * sigma));
+    for(i=0; i < k; i++)
+        for(j=0; j < k; j++)
+            taps[i*k+j] = g[i] * g[j] / (sum * sum);
+
+    psf_set(psf, k, k, taps);
+    free(taps);
+    free(g);
+}
+
+// ms per frame of three planes, repeating for at least MIN_SEC
+static double time_method(const struct psf *psf, int method, const UINT8 *const src[], UINT8 *const dst[],
+                          int width, int height)
+{
+    double start = now_sec(), elapsed;
+    int runs = 0;
+
+    do
+    {
+        if(psf_convolve(psf, method, src, dst, 3, width, height) != 0)
+        {
+            printf("%s convolution failed\n", psf_method_name(method));
+            exit(EXIT_FAILURE);
+        }
+        runs++;
+    } while((elapsed = now_sec() - start) < MIN_SEC);
+
+    return elapsed * 1000.0 / runs;
+}
+
+// largest difference from ref, and how many pixels differ
+static int compare(UINT8 *const ref[], UINT8 *const out[], size_t n, size_t *ndiff)
+{
+    size_t i;
+    int c, d, worst = 0;
+
+    *ndiff = 0;
+    for(c=0; c < 3; c++)
+    {
+        for(i=0; i < n; i++)
+        {
+            d = abs((int)ref[c][i] - (int)out[c][i]);
+            if(d)
+            {
+                (*ndiff)++;
+                if(d > worst) worst = d;
+            }
+        }
+    }
+
+    return worst;
+}
+
+static void bench_image(const char *name, int max_size)
+{
+    struct pnm_image img;
+    struct psf psf;
+    UINT8 *src[3], *ref[3], *out[3];
+    size_t n, ndiff;
+    int c, s, kind, worst, cross[2] = { 0, 0 }, model[2] = { 0, 0 };
+    double direct, fast, fft;
+
+    if(pnm_open(&img, name) != 0)
+        exit(EXIT_FAILURE);
+    if((img.channels != 3) || (img.sample_bytes != 1))
+    {
+        printf("%s is not an 8-bit P6 PPM\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    n = (size_t)img.width * img.height;
+    for(c=0; c < 3; c++)
+    {
+        src[c] = malloc(n);
+        ref[c] = malloc(n);
+        out[c] = malloc(n);
+        if(!src[c] || !ref[c] || !out[c])
+        {
+            perror("malloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+    pnm_to_planes(&img, src);
+
+    printf("%s %dx%d\n", name, img.width, img.height);
+    printf("%-6s %5s %10s %10s %10s %9s %7s %s\n", "psf", "size", "direct ms", "sep ms", "fft ms",
+           "fft/best", "model", "max diff (pixels)");
+
+    for(kind=0; kind < 2; kind++)
+    {
+        for(s=0; (s < NUM_SIZES) && (sizes[s] <= max_size); s++)
+        {
+            if((sizes[s] > img.width) || (sizes[s] > img.height))
+                break;
+
+            if(kind == 0)
+                disk_psf(&psf, sizes[s]);
+            else
+                gauss_psf(&psf, sizes[s]);
+
+            // the border is the input unchanged, as in sharpen.c
+            for(c=0; c < 3; c++)
+            {
+                memcpy(ref[c], src[c], n);
+                memcpy(out[c], src[c], n);
+            }
+
+            direct = time_method(&psf, PSF_DIRECT, (const UINT8 *const *)src, ref, img.width, img.height);
+            fast = direct;
+            printf("%-6s %2dx%-2d %10.2lf", kind ? "gauss" : "disk", sizes[s], sizes[s], direct);
+
+            if(psf.separable)
+            {
+                fast = time_method(&psf, PSF_SEPARABLE, (const UINT8 *const *)src, out, img.width, img.height);
+                printf(" %10.2lf", fast);
+            }
+            else
+                printf(" %10s", "-");
+
+            fft = time_method(&psf, PSF_FFT, (const UINT8 *const *)src, out, img.width, img.height);
+            worst = compare(ref, out, n, &ndiff);
+
+            printf(" %10.2lf %9.2lf %7s %d (%zu)\n", fft, fft / fast,
+                   psf_method_name(psf_choose(&psf, img.width, img.height)), worst, ndiff);
+
+            // first size where FFT wins, and where the model starts choosing it
+            if(!cross[kind] && (fft < fast))
+                cross[kind] = sizes[s];
+            if(!model[kind] && (psf_choose(&psf, img.width, img.height) == PSF_FFT))
+                model[kind] = sizes[s];
+
+            psf_free(&psf);
+        }
+    }
+
+    printf("crossover, disk: FFT faster than direct from %dx%d, cost model chooses FFT from %dx%d\n",
+           cross[0], cross[0], model[0], model[0]);
+    printf("crossover, gauss: FFT faster than separable from %dx%d, cost model chooses FFT from %dx%d\n",
+           cross[1], cross[1], model[1], model[1]);
+    printf("(0x0 is no crossover up to %dx%d)\n\n", max_size, max_size);
+
+    for(c=0; c < 3; c++)
+    {
+        free(src[c]);
+        free(ref[c]);
+        free(out[c]);
+    }
+    pnm_close(&img);
+}
+
+
+int main(int argc, char *argv[])
+{
+    int max_size = 31, i;
+
+    if(argc > 1)
+        max_size = atoi(argv[1]);
+    if(max_size < 3)
+    {
+        printf("Usage: psf_conv_bench [max_size [image.ppm ...]]\n");
+        exit(-1);
+    }
+
+    printf("PSF_FFT_BUTTERFLY_COST %.2lf\n\n", (double)PSF_FFT_BUTTERFLY_COST);
+
+    if(argc > 2)
+        for(i=2; i < argc; i++)
+            bench_image(argv[i], max_size);
+    else
+        for(i=0; i < (int)(sizeof(default_images) / sizeof(default_images[0])); i++)
+            bench_image(default_images[i], max_size);
+
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ *  Fused 3x3 PSF convolution kernels, see psf_kernel.h
+ *
+ *  Each kernel convolves n consecutive bytes of one row, reading the same
+ *  channel of the neighbouring pixels step bytes to either side (1 for planar
+ *  data, 3 for RGB24).  The taps are compile-time constants, so the nine
+ *  multiply-adds unroll with the weights folded in and zero taps dropped.
+ *  Vector kernels finish the last few bytes of a row with the scalar kernel.
+ */
+#include <stddef.h>
+
+#include "psf_kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PSF_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PSF_NEON
+#include <arm_neon.h>
+#endif
+
+// 16-bit lanes are enough while sum(|tap|) * 255 fits, see psf_kernel.h
+static const short psf_taps[9] = PSF_TAPS;
+
+static void row_scalar(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                       unsigned char *out, int n, int step)
+{
+    int k, sum;
+
+    for(k=0; k < n; k++)
+    {
+        sum  = psf_taps[0] * above[k-step] + psf_taps[1] * above[k] + psf_taps[2] * above[k+step];
+        sum += psf_taps[3] * row[k-step]   + psf_taps[4] * row[k]   + psf_taps[5] * row[k+step];
+        sum += psf_taps[6] * below[k-step] + psf_taps[7] * below[k] + psf_taps[8] * below[k+step];
+
+        if(sum < 0) sum = 0;
+        sum >>= PSF_SHIFT;
+        out[k] = (sum > 255) ? 255 : sum;
+    }
+}
+
+
+#if defined(PSF_X86)
+
+#define TAP_SSE2(acc, p, t) \
+    if(psf_taps[t]) acc = _mm_add_epi16(acc, _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(p)), zero), \
+                                                              _mm_set1_epi16(psf_taps[t])))
+
+// 8 outputs in 16-bit lanes, clamped at 0 and shifted, not yet packed
+__attribute__((target("sse2")))
+static inline __m128i sum8_sse2(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                                int step)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc = zero;
+
+    TAP_SSE2(acc, above - step, 0); TAP_SSE2(acc, above, 1); TAP_SSE2(acc, above + step, 2);
+    TAP_SSE2(acc, row - step, 3);   TAP_SSE2(acc, row, 4);   TAP_SSE2(acc, row + step, 5);
+    TAP_SSE2(acc, below - step, 6); TAP_SSE2(acc, below, 7); TAP_SSE2(acc, below + step, 8);
+
+    return _mm_srai_epi16(_mm_max_epi16(acc, zero), PSF_SHIFT);
+}
+
+__attribute__((target("sse2")))
+static void row_sse2(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                     unsigned char *out, int n, int step)
+{
+    int k;
+
+    for(k=0; k + 16 <= n; k+=16)
+    {
+        __m128i lo = sum8_sse2(above + k, row + k, below + k, step);
+        __m128i hi = sum8_sse2(above + k + 8, row + k + 8, below + k + 8, step);
+
+        _mm_storeu_si128((__m128i *)(out + k), _mm_packus_epi16(lo, hi));
+    }
+
+    row_scalar(above + k, row + k, below + k, out + k, n - k, step);
+}
+
+
+#define TAP_AVX2(acc, p, t) \
+    if(psf_taps[t]) acc = _mm256_add_epi16(acc, _mm256_mullo_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(p))), \
+                                                                    _mm256_set1_epi16(psf_taps[t])))
+
+__attribute__((target("avx2")))
+static inline __m256i sum16_avx2(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                                 int step)
+{
+    __m256i acc = _mm256_setzero_si256();
+
+    TAP_AVX2(acc, above - step, 0); TAP_AVX2(acc, above, 1); TAP_AVX2(acc, above + step, 2);
+    TAP_AVX2(acc, row - step, 3);   TAP_AVX2(acc, row, 4);   TAP_AVX2(acc, row + step, 5);
+    TAP_AVX2(acc, below - step, 6); TAP_AVX2(acc, below, 7); TAP_AVX2(acc, below + step, 8);
+
+    return _mm256_srai_epi16(_mm256_max_epi16(acc, _mm256_setzero_si256()), PSF_SHIFT);
+}
+
+__attribute__((target("avx2")))
+static void row_avx2(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                     unsigned char *out, int n, int step)
+{
+    int k;
+
+    for(k=0; k + 32 <= n; k+=32)
+    {
+        __m256i lo = sum16_avx2(above + k, row + k, below + k, step);
+        __m256i hi = sum16_avx2(above + k + 16, row + k + 16, below + k + 16, step);
+
+        // packus works within 128-bit lanes, put the quadwords back in order
+        _mm256_storeu_si256((__m256i *)(out + k),
+                            _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xd8));
+    }
+
+    row_scalar(above + k, row + k, below + k, out + k, n - k, step);
+}
+
+#endif
+
+
+#if defined(PSF_NEON)
+
+#define TAP_NEON(acc, p, t) \
+    if(psf_taps[t]) acc = vmlaq_n_s16(acc, vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p))), psf_taps[t])
+
+static void row_neon(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                     unsigned char *out, int n, int step)
+{
+    int k;
+
+    for(k=0; k + 8 <= n; k+=8)
+    {
+        int16x8_t acc = vdupq_n_s16(0);
+
+        TAP_NEON(acc, above + k - step, 0); TAP_NEON(acc, above + k, 1); TAP_NEON(acc, above + k + step, 2);
+        TAP_NEON(acc, row + k - step, 3);   TAP_NEON(acc, row + k, 4);   TAP_NEON(acc, row + k + step, 5);
+        TAP_NEON(acc, below + k - step, 6); TAP_NEON(acc, below + k, 7); TAP_NEON(acc, below + k + step, 8);
+
+        acc = vmaxq_s16(acc, vdupq_n_s16(0));
+#if PSF_SHIFT > 0
+        acc = vshrq_n_s16(acc, PSF_SHIFT);
+#endif
+        vst1_u8(out + k, vqmovun_s16(acc));
+    }
+
+    row_scalar(above + k, row + k, below + k, out + k, n - k, step);
+}
+
+#endif
+
+
+typedef void (*row_fn)(const unsigned char *above, const unsigned char *row, const unsigned char *below,
+                       unsigned char *out, int n, int step);
+
+static const struct
+{
+    const char *name;
+    row_fn      row;
+} kernels[PSF_ISA_COUNT] =
+{
+    { "scalar", row_scalar },
+#if defined(PSF_X86)
+    { "sse2",   row_sse2 },
+    { "avx2",   row_avx2 },
+#else
+    { "sse2",   NULL },
+    { "avx2",   NULL },
+#endif
+#if defined(PSF_NEON)
+    { "neon",   row_neon }
+#else
+    { "neon",   NULL }
+#endif
+};
+
+static int selected_isa = -1;
+
+
+int psf_isa_supported(int isa)
+{
+    if((isa < 0) || (isa >= PSF_ISA_COUNT) || !kernels[isa].row)
+        return 0;
+
+#if defined(PSF_X86)
+    __builtin_cpu_init();
+    if(isa == PSF_ISA_SSE2) return __builtin_cpu_supports("sse2");
+    if(isa == PSF_ISA_AVX2) return __builtin_cpu_supports("avx2");
+#endif
+
+    return 1;
+}
+
+int psf_kernel_select(int isa)
+{
+    if(!psf_isa_supported(isa))
+        return -1;
+
+    selected_isa = isa;
+    return 0;
+}
+
+int psf_kernel_isa(void)
+{
+    int isa;
+
+    // benign race, every thread resolves the same answer
+    if(selected_isa < 0)
+    {
+        for(isa = PSF_ISA_COUNT - 1; isa > PSF_ISA_SCALAR; isa--)
+            if(psf_isa_supported(isa))
+                break;
+
+        selected_isa = isa;
+    }
+
+    return selected_isa;
+}
+
+const char *psf_isa_name(int isa)
+{
+    if((isa < 0) || (isa >= PSF_ISA_COUNT))
+        return "unknown";
+
+    return kernels[isa].name;
+}
+
+void psf_sharpen_rgb24(const unsigned char *src, unsigned char *dst, int stride,
+                       int row0, int nrows, int col0, int ncols)
+{
+    row_fn row = kernels[psf_kernel_isa()].row;
+    size_t off;
+    int i;
+
+    for(i=row0; i < row0 + nrows; i++)
+    {
+        off = (size_t)i * stride + (size_t)col0 * 3;
+        row(src + off - stride, src + off, src + off + stride, dst + off, ncols * 3, 3);
+    }
+}
+
+void psf_sharpen_planes(const unsigned char *const src[], unsigned char *const dst[], int nplanes,
+                        int stride, int row0, int nrows, int col0, int ncols)
+{
+    row_fn row = kernels[psf_kernel_isa()].row;
+    size_t off;
+    int i, p;
+
+    // row by row across the planes, so each pass over memory does every channel
+    for(i=row0; i < row0 + nrows; i++)
+    {
+        off = (size_t)i * stride + col0;
+        for(p=0; p < nplanes; p++)
+            row(src[p] + off - stride, src[p] + off, src[p] + off + stride, dst[p] + off, ncols, 1);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ *  Fused 3x3 PSF convolution kernels with run time dispatch
+ *
+ *  The PSF is fixed when this is compiled: PSF_TAPS are the nine weights in
+ *  units of 1/(1 << PSF_SHIFT), so the sharpen PSF from sharpen.c,
+ *
+ *    {-K/8, -K/8, -K/8, -K/8, K+1, -K/8, -K/8, -K/8, -K/8} with K=4
+ *
+ *  is {-1, -1, -1, -1, 10, -1, -1, -1, -1} >> 1.  Every product and partial
+ *  sum of the double precision loop is then exact, so computing
+ *
+ *    out = min(max(sum(tap * pixel), 0) >> PSF_SHIFT, 255)
+ *
+ *  in 16-bit integer lanes, with saturating packs for the clamp, gives output
+ *  bit-exact with the original if(temp<0.0) / if(temp>255.0) / (UINT8) code.
+ *
+ *  All three colour channels are done in one pass: interleaved RGB24 rows are
+ *  convolved as bytes with neighbours 3 apart, planar R/G/B rows one plane
+ *  after the other while the three rows are still in cache.  Like the original
+ *  loops, only the interior is written; the caller keeps the border pixels.
+ */
+#ifndef PSF_KERNEL_H
+#define PSF_KERNEL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Override with -DPSF_TAPS=... -DPSF_SHIFT=n; sum(|tap|) must stay <= 128
+#ifndef PSF_TAPS
+#define PSF_TAPS  {-1, -1, -1, -1, 10, -1, -1, -1, -1}
+#define PSF_SHIFT 1
+#endif
+
+enum psf_isa
+{
+    PSF_ISA_SCALAR,
+    PSF_ISA_SSE2,
+    PSF_ISA_AVX2,
+    PSF_ISA_NEON,
+    PSF_ISA_COUNT
+};
+
+// Interleaved RGB24 image, width pixels by height rows, stride in bytes.
+// Sharpens pixels [row0, row0+nrows) x [col0, col0+ncols), which must not
+// include the outermost row or column.
+void psf_sharpen_rgb24(const unsigned char *src, unsigned char *dst, int stride,
+                       int row0, int nrows, int col0, int ncols);
+
+// nplanes planar images, e.g. R, G and B, with the same stride and region
+void psf_sharpen_planes(const unsigned char *const src[], unsigned char *const dst[], int nplanes,
+                        int stride, int row0, int nrows, int col0, int ncols);
+
+// returns non-zero when the kernel can run on this CPU
+int psf_isa_supported(int isa);
+
+// returns 0 and selects isa, or -1 if it is not supported
+int psf_kernel_select(int isa);
+
+// currently selected kernel, resolving the default on first use
+int psf_kernel_isa(void);
+
+const char *psf_isa_name(int isa);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,145 +4,66 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include "psf_kernel.h"
+#include "pnm_io.h"
 
-#define IMG_HEIGHT (300)
-#define IMG_WIDTH (400)
 
-typedef double FLOAT;
-
-typedef unsigned int UINT32;
-typedef unsigned long long int UINT64;
 typedef unsigned char UINT8;
 
 // PPM Edge Enhancement Code
 //
-UINT8 header[22];
-UINT8 R[IMG_HEIGHT*IMG_WIDTH];
-UINT8 G[IMG_HEIGHT*IMG_WIDTH];
-UINT8 B[IMG_HEIGHT*IMG_WIDTH];
-UINT8 convR[IMG_HEIGHT*IMG_WIDTH];
-UINT8 convG[IMG_HEIGHT*IMG_WIDTH];
-UINT8 convB[IMG_HEIGHT*IMG_WIDTH];
-
-#define K 4.0
-
-FLOAT PSF[9] = {-K/8.0, -K/8.0, -K/8.0, -K/8.0, K+1.0, -K/8.0, -K/8.0, -K/8.0, -K/8.0};
+// R, G, B and convR, convG, convB planes, sized from the image header
+UINT8 *src[3];
+UINT8 *dst[3];
 
 
 int main(int argc, char *argv[])
 {
-    int fdin, fdout, bytesRead=0, bytesLeft, i, j;
-    UINT64 microsecs=0, millisecs=0;
-    FLOAT temp;
+    struct pnm_image in, out;
+    int c;
     
     if(argc < 3)
     {
        printf("Usage: sharpen input_file.ppm output_file.ppm\n");
        exit(-1);
     }
-    else
-    {
-        if((fdin = open(argv[1], O_RDONLY, 0644)) < 0)
-        {
-            printf("Error opening %s\n", argv[1]);
-        }
-        //else
-        //    printf("File opened successfully\n");
-
-        if((fdout = open(argv[2], (O_RDWR | O_CREAT), 0666)) < 0)
-        {
-            printf("Error opening %s\n", argv[1]);
-        }
-        //else
-        //    printf("Output file=%s opened successfully\n", "sharpen.ppm");
-    }
-
-    bytesLeft=21;
 
-    //printf("Reading header\n");
+    if(pnm_open(&in, argv[1]) != 0)
+        exit(-1);
 
-    do
+    if((in.channels != 3) || (in.maxval > 255))
     {
-        //printf("bytesRead=%d, bytesLeft=%d\n", bytesRead, bytesLeft);
-        bytesRead=read(fdin, (void *)header, bytesLeft);
-        bytesLeft -= bytesRead;
-    } while(bytesLeft > 0);
-
-    header[21]='\0';
-
-    //printf("header = %s\n", header); 
-
-    // Read RGB data
-    for(i=0; i<IMG_HEIGHT*IMG_WIDTH; i++)
-    {
-        read(fdin, (void *)&R[i], 1); convR[i]=R[i];
-        read(fdin, (void *)&G[i], 1); convG[i]=G[i];
-        read(fdin, (void *)&B[i], 1); convB[i]=B[i];
+        printf("%s is not an 8-bit PPM\n", argv[1]);
+        exit(-1);
     }
 
-    // Skip first and last row, no neighbors to convolve with
-    for(i=1; i<((IMG_HEIGHT)-1); i++)
+    // Read RGB data, as planes
+    for(c=0; c<3; c++)
     {
-
-        // Skip first and last column, no neighbors to convolve with
-        for(j=1; j<((IMG_WIDTH)-1); j++)
+        if(!(src[c]=malloc((size_t)in.width * in.height)) || !(dst[c]=malloc((size_t)in.width * in.height)))
         {
-            temp=0;
-            temp += (PSF[0] * (FLOAT)R[((i-1)*IMG_WIDTH)+j-1]);
-            temp += (PSF[1] * (FLOAT)R[((i-1)*IMG_WIDTH)+j]);
-            temp += (PSF[2] * (FLOAT)R[((i-1)*IMG_WIDTH)+j+1]);
-            temp += (PSF[3] * (FLOAT)R[((i)*IMG_WIDTH)+j-1]);
-            temp += (PSF[4] * (FLOAT)R[((i)*IMG_WIDTH)+j]);
-            temp += (PSF[5] * (FLOAT)R[((i)*IMG_WIDTH)+j+1]);
-            temp += (PSF[6] * (FLOAT)R[((i+1)*IMG_WIDTH)+j-1]);
-            temp += (PSF[7] * (FLOAT)R[((i+1)*IMG_WIDTH)+j]);
-            temp += (PSF[8] * (FLOAT)R[((i+1)*IMG_WIDTH)+j+1]);
-	    if(temp<0.0) temp=0.0;
-	    if(temp>255.0) temp=255.0;
-	    convR[(i*IMG_WIDTH)+j]=(UINT8)temp;
-
-            temp=0;
-            temp += (PSF[0] * (FLOAT)G[((i-1)*IMG_WIDTH)+j-1]);
-            temp += (PSF[1] * (FLOAT)G[((i-1)*IMG_WIDTH)+j]);
-            temp += (PSF[2] * (FLOAT)G[((i-1)*IMG_WIDTH)+j+1]);
-            temp += (PSF[3] * (FLOAT)G[((i)*IMG_WIDTH)+j-1]);
-            temp += (PSF[4] * (FLOAT)G[((i)*IMG_WIDTH)+j]);
-            temp += (PSF[5] * (FLOAT)G[((i)*IMG_WIDTH)+j+1]);
-            temp += (PSF[6] * (FLOAT)G[((i+1)*IMG_WIDTH)+j-1]);
-            temp += (PSF[7] * (FLOAT)G[((i+1)*IMG_WIDTH)+j]);
-            temp += (PSF[8] * (FLOAT)G[((i+1)*IMG_WIDTH)+j+1]);
-	    if(temp<0.0) temp=0.0;
-	    if(temp>255.0) temp=255.0;
-	    convG[(i*IMG_WIDTH)+j]=(UINT8)temp;
-
-            temp=0;
-            temp += (PSF[0] * (FLOAT)B[((i-1)*IMG_WIDTH)+j-1]);
-            temp += (PSF[1] * (FLOAT)B[((i-1)*IMG_WIDTH)+j]);
-            temp += (PSF[2] * (FLOAT)B[((i-1)*IMG_WIDTH)+j+1]);
-            temp += (PSF[3] * (FLOAT)B[((i)*IMG_WIDTH)+j-1]);
-            temp += (PSF[4] * (FLOAT)B[((i)*IMG_WIDTH)+j]);
-            temp += (PSF[5] * (FLOAT)B[((i)*IMG_WIDTH)+j+1]);
-            temp += (PSF[6] * (FLOAT)B[((i+1)*IMG_WIDTH)+j-1]);
-            temp += (PSF[7] * (FLOAT)B[((i+1)*IMG_WIDTH)+j]);
-            temp += (PSF[8] * (FLOAT)B[((i+1)*IMG_WIDTH)+j+1]);
-	    if(temp<0.0) temp=0.0;
-	    if(temp>255.0) temp=255.0;
-	    convB[(i*IMG_WIDTH)+j]=(UINT8)temp;
+            perror("malloc");
+            exit(-1);
         }
     }
+    pnm_to_planes(&in, src);
+    pnm_to_planes(&in, dst);
 
-    write(fdout, (void *)header, 21);
-
-    // Write RGB data
-    for(i=0; i<IMG_HEIGHT*IMG_WIDTH; i++)
-    {
-        write(fdout, (void *)&convR[i], 1);
-        write(fdout, (void *)&convG[i], 1);
-        write(fdout, (void *)&convB[i], 1);
-    }
+    // Skip first and last row and column, no neighbors to convolve with.
+    // All three channels in one pass, bit-exact with the double precision PSF.
+    psf_sharpen_planes((const UINT8 *const *)src, dst, 3, in.width, 1, in.height-2, 1, in.width-2);
 
+    // Write RGB data, with the input header
+    if(pnm_create_like(&out, argv[2], &in) != 0)
+        exit(-1);
+    pnm_from_planes(&out, (const UINT8 *const *)dst);
 
-    close(fdin);
-    close(fdout);
+    pnm_close(&out);
+    pnm_close(&in);
  
+    for(c=0; c<3; c++)
+    {
+        free(src[c]);
+        free(dst[c]);
+    }
 }
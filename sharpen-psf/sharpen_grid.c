@@ -1,239 +1,331 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <pthread.h>
 #include <sched.h>
+#include <time.h>
 
+#include "psf_kernel.h"
+#include "pnm_io.h"
 
-#define IMG_HEIGHT (3000)
-#define IMG_WIDTH (4000)
-#define NUM_ROW_THREADS (6)
-#define NUM_COL_THREADS (8)
-#define IMG_H_SLICE (IMG_HEIGHT/NUM_ROW_THREADS)
-#define IMG_W_SLICE (IMG_WIDTH/NUM_COL_THREADS)
 
+// Tiles are sharpened by a pool of threads created once, each with its own
+// deque of tiles.  A thread works from the bottom of its own deque and, when
+// that is empty, steals from the top of the others, so a thread that is
+// preempted or slowed down does not hold up the whole frame.
 
-typedef double FLOAT;
+#define MAX_THREADS (256)
+#define DEFAULT_RUNS (1000)
+#define DEFAULT_TILE_W (512)
 
-pthread_t threads[NUM_ROW_THREADS*NUM_COL_THREADS];
+typedef unsigned long long int UINT64;
+typedef unsigned char UINT8;
 
-typedef struct _threadArgs
+typedef struct _tile
 {
-    int thread_idx;
     int i;
     int j;
     int h;
     int w;
-} threadArgsType;
+} tileType;
 
-threadArgsType threadarg[NUM_ROW_THREADS*NUM_COL_THREADS];
-pthread_attr_t fifo_sched_attr;
-pthread_attr_t orig_sched_attr;
-struct sched_param fifo_param;
+// owner pops from bottom, thieves take from top
+typedef struct _tileDeque
+{
+    pthread_mutex_t lock;
+    int *idx;
+    int top;
+    int bottom;
+} tileDequeType;
 
-typedef unsigned int UINT32;
-typedef unsigned long long int UINT64;
-typedef unsigned char UINT8;
+typedef struct _threadArgs
+{
+    int thread_idx;
+    UINT64 tiles;
+    UINT64 steals;
+    tileDequeType deque;
+} threadArgsType;
+
+pthread_t threads[MAX_THREADS];
+threadArgsType threadarg[MAX_THREADS];
+pthread_barrier_t start_barrier, done_barrier;
+int num_threads, num_tiles, stopping=0;
+tileType *tiles;
 
 // PPM Edge Enhancement Code
-UINT8 header[22];
-UINT8 R[IMG_HEIGHT][IMG_WIDTH];
-UINT8 G[IMG_HEIGHT][IMG_WIDTH];
-UINT8 B[IMG_HEIGHT][IMG_WIDTH];
-UINT8 convR[IMG_HEIGHT][IMG_WIDTH];
-UINT8 convG[IMG_HEIGHT][IMG_WIDTH];
-UINT8 convB[IMG_HEIGHT][IMG_WIDTH];
+struct pnm_image in_img, out_img;
+int img_width, img_height;
+const UINT8 *src[3];
+UINT8 *dst[3];
+
 
-#define K 4.0
+static int pop_bottom(tileDequeType *dq)
+{
+    int tile=-1;
 
-FLOAT PSF[9] = {-K/8.0, -K/8.0, -K/8.0, -K/8.0, K+1.0, -K/8.0, -K/8.0, -K/8.0, -K/8.0};
-//FLOAT PSF[9] = {-K/80.0, -K/80.0, -K/80.0, -K/80.0, K+10.0, -K/80.0, -K/80.0, -K/80.0, -K/80.0};
+    pthread_mutex_lock(&dq->lock);
+    if(dq->bottom > dq->top)
+        tile=dq->idx[--dq->bottom];
+    pthread_mutex_unlock(&dq->lock);
 
+    return tile;
+}
 
-void *sharpen_thread(void *threadptr)
+static int steal_top(tileDequeType *dq)
+{
+    int tile=-1;
+
+    pthread_mutex_lock(&dq->lock);
+    if(dq->bottom > dq->top)
+        tile=dq->idx[dq->top++];
+    pthread_mutex_unlock(&dq->lock);
+
+    return tile;
+}
+
+// next tile for thread self, its own first, then the others starting with its neighbour
+static int next_tile(threadArgsType *self)
 {
-    threadArgsType thargs=*((threadArgsType *)threadptr);
-    int i=thargs.i;
-    int j=thargs.j;
-    FLOAT temp=0;
+    int tile, victim, n;
 
-    //printf("i=%d, j=%d, h=%d, w=%d\n", thargs.i, thargs.j, thargs.h, thargs.w);
+    if((tile=pop_bottom(&self->deque)) >= 0)
+        return tile;
 
-    for(i=thargs.i; i<(thargs.i+thargs.h); i++)
+    for(n=1; n<num_threads; n++)
     {
-        for(j=thargs.j; j<(thargs.j+thargs.w); j++)
+        victim=(self->thread_idx + n) % num_threads;
+        if((tile=steal_top(&threadarg[victim].deque)) >= 0)
         {
-            temp=0;
-            temp += (PSF[0] * (FLOAT)R[(i-1)][j-1]);
-            temp += (PSF[1] * (FLOAT)R[(i-1)][j]);
-            temp += (PSF[2] * (FLOAT)R[(i-1)][j+1]);
-            temp += (PSF[3] * (FLOAT)R[(i)][j-1]);
-            temp += (PSF[4] * (FLOAT)R[(i)][j]);
-            temp += (PSF[5] * (FLOAT)R[(i)][j+1]);
-            temp += (PSF[6] * (FLOAT)R[(i+1)][j-1]);
-            temp += (PSF[7] * (FLOAT)R[(i+1)][j]);
-            temp += (PSF[8] * (FLOAT)R[(i+1)][j+1]);
-	    if(temp<0.0) temp=0.0;
-	    if(temp>255.0) temp=255.0;
-	    convR[i][j]=(UINT8)temp;
-
-            temp=0;
-            temp += (PSF[0] * (FLOAT)G[(i-1)][j-1]);
-            temp += (PSF[1] * (FLOAT)G[(i-1)][j]);
-            temp += (PSF[2] * (FLOAT)G[(i-1)][j+1]);
-            temp += (PSF[3] * (FLOAT)G[(i)][j-1]);
-            temp += (PSF[4] * (FLOAT)G[(i)][j]);
-            temp += (PSF[5] * (FLOAT)G[(i)][j+1]);
-            temp += (PSF[6] * (FLOAT)G[(i+1)][j-1]);
-            temp += (PSF[7] * (FLOAT)G[(i+1)][j]);
-            temp += (PSF[8] * (FLOAT)G[(i+1)][j+1]);
-	    if(temp<0.0) temp=0.0;
-	    if(temp>255.0) temp=255.0;
-	    convG[i][j]=(UINT8)temp;
-
-            temp=0;
-            temp += (PSF[0] * (FLOAT)B[(i-1)][j-1]);
-            temp += (PSF[1] * (FLOAT)B[(i-1)][j]);
-            temp += (PSF[2] * (FLOAT)B[(i-1)][j+1]);
-            temp += (PSF[3] * (FLOAT)B[(i)][j-1]);
-            temp += (PSF[4] * (FLOAT)B[(i)][j]);
-            temp += (PSF[5] * (FLOAT)B[(i)][j+1]);
-            temp += (PSF[6] * (FLOAT)B[(i+1)][j-1]);
-            temp += (PSF[7] * (FLOAT)B[(i+1)][j]);
-            temp += (PSF[8] * (FLOAT)B[(i+1)][j+1]);
-	    if(temp<0.0) temp=0.0;
-	    if(temp>255.0) temp=255.0;
-	    convB[i][j]=(UINT8)temp;
+            self->steals++;
+            return tile;
         }
+    }
+
+    return -1;
+}
+
+void *sharpen_thread(void *threadptr)
+{
+    threadArgsType *thargs=(threadArgsType *)threadptr;
+    tileType *t;
+    int tile;
 
+    for(;;)
+    {
+        pthread_barrier_wait(&start_barrier);
+        if(stopping)
+            break;
+
+        while((tile=next_tile(thargs)) >= 0)
+        {
+            t=&tiles[tile];
+
+            // all three channels of the tile in one pass, bit-exact with the double precision PSF
+            psf_sharpen_planes(src, dst, 3, img_width, t->i, t->h, t->j, t->w);
+            thargs->tiles++;
+        }
+
+        pthread_barrier_wait(&done_barrier);
     }
 
     pthread_exit((void **)0);
 }
 
 
-int main(int argc, char *argv[])
+// Interior of the image, skipping first and last row and column, cut into tiles
+static void make_tiles(int tile_w, int tile_h)
 {
-    int fdin, fdout, bytesRead=0, bytesLeft, i, j, idx, jdx;
-    UINT64 microsecs=0, millisecs=0;
-    unsigned int thread_idx;
-    FLOAT temp;
-    int runs=0;
-    
-    if(argc < 3)
+    int i, j, n=0;
+
+    num_tiles=(((img_height-2) + tile_h - 1) / tile_h) * (((img_width-2) + tile_w - 1) / tile_w);
+    if(!(tiles=malloc(num_tiles * sizeof(tileType))))
     {
-       printf("Usage: sharpen input_file.ppm output_file.ppm\n");
-       exit(-1);
+        perror("malloc");
+        exit(-1);
     }
-    else
+
+    for(i=1; i<img_height-1; i+=tile_h)
     {
-        if((fdin = open(argv[1], O_RDONLY, 0644)) < 0)
+        for(j=1; j<img_width-1; j+=tile_w)
         {
-            printf("Error opening %s\n", argv[1]);
+            tiles[n].i=i;
+            tiles[n].j=j;
+            tiles[n].h=((i + tile_h) > (img_height-1)) ? (img_height-1 - i) : tile_h;
+            tiles[n].w=((j + tile_w) > (img_width-1)) ? (img_width-1 - j) : tile_w;
+            n++;
         }
-        //else
-        //    printf("File opened successfully\n");
+    }
+}
 
-        if((fdout = open(argv[2], (O_RDWR | O_CREAT), 0666)) < 0)
-        {
-            printf("Error opening %s\n", argv[1]);
-        }
-        //else
-        //    printf("Output file=%s opened successfully\n", "sharpen.ppm");
+// Deal each thread a contiguous band of tiles, so it starts on rows it shares cache lines with
+static void deal_tiles(void)
+{
+    int thread_idx, first, last, n;
+    tileDequeType *dq;
+
+    for(thread_idx=0; thread_idx<num_threads; thread_idx++)
+    {
+        first=(int)(((UINT64)num_tiles * thread_idx) / num_threads);
+        last=(int)(((UINT64)num_tiles * (thread_idx + 1)) / num_threads);
+        dq=&threadarg[thread_idx].deque;
+
+        // last tile on the bottom, popped first by the owner; thieves take from the far end
+        pthread_mutex_lock(&dq->lock);
+        dq->top=0;
+        dq->bottom=0;
+        for(n=last-1; n>=first; n--)
+            dq->idx[dq->bottom++]=n;
+        pthread_mutex_unlock(&dq->lock);
     }
+}
 
-    bytesLeft=21;
+// Default tile height keeps a tile's input and output rows of all three planes within half of L2
+static int default_tile_h(int tile_w)
+{
+    long l2=sysconf(_SC_LEVEL2_CACHE_SIZE);
+    int h;
 
-    //printf("Reading header\n");
+    if(l2 <= 0) l2=256*1024;
 
-    do
-    {
-        //printf("bytesRead=%d, bytesLeft=%d\n", bytesRead, bytesLeft);
-        bytesRead=read(fdin, (void *)header, bytesLeft);
-        bytesLeft -= bytesRead;
+    h=(int)((l2 / 2) / (6 * (tile_w + 2))) - 2;
+    if(h < 8) h=8;
+
+    return h;
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
 
-    } while(bytesLeft > 0);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
 
-    header[21]='\0';
 
-    //printf("header = %s\n", header); 
+int main(int argc, char *argv[])
+{
+    int c;
+    unsigned int thread_idx;
+    int runs=0, num_runs=DEFAULT_RUNS, tile_w=DEFAULT_TILE_W, tile_h=0;
+    size_t npix;
+    double start, elapsed;
+    UINT64 total_steals=0;
 
-    // Read RGB data
-    for(i=0; i<IMG_HEIGHT; i++)
+    if(argc < 3)
     {
-        for(j=0; j<IMG_WIDTH; j++)
-        {
-            read(fdin, (void *)&R[i][j], 1); convR[i][j]=R[i][j];
-            read(fdin, (void *)&G[i][j], 1); convG[i][j]=G[i][j];
-            read(fdin, (void *)&B[i][j], 1); convB[i][j]=B[i][j];
-        }
+       printf("Usage: sharpen_grid input_file.ppm output_file.ppm [threads [tile_w tile_h [runs]]]\n");
+       exit(-1);
     }
-    printf("source file %s read\n", argv[1]);
-    close(fdin);
+    // one thread per online CPU unless told otherwise
+    num_threads=(argc > 3) ? atoi(argv[3]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if(argc > 5) { tile_w=atoi(argv[4]); tile_h=atoi(argv[5]); }
+    if(argc > 6) num_runs=atoi(argv[6]);
 
+    if((num_threads < 1) || (num_threads > MAX_THREADS) || (tile_w < 1) || (tile_h < 0) || (num_runs < 1))
+    {
+       printf("Usage: sharpen_grid input_file.ppm output_file.ppm [threads [tile_w tile_h [runs]]]\n");
+       exit(-1);
+    }
+    if(tile_h == 0) tile_h=default_tile_h(tile_w);
 
-    for(runs=0; runs < 1000; runs++)
+    if(pnm_open(&in_img, argv[1]) != 0)
+        exit(-1);
+    if((in_img.channels != 3) || (in_img.sample_bytes != 1) || (in_img.width < 3) || (in_img.height < 3))
     {
+        printf("%s is not an 8-bit P6 PPM\n", argv[1]);
+        exit(-1);
+    }
+    img_width=in_img.width;
+    img_height=in_img.height;
+
+    //printf("header = %s\n", in_img.header);
 
-    for(thread_idx=0; thread_idx<(NUM_ROW_THREADS*NUM_COL_THREADS); thread_idx++)
+    // Split RGB data into planes, the border of dst is the input unchanged
+    npix=(size_t)img_width * img_height;
+    for(c=0; c<3; c++)
     {
+        src[c]=malloc(npix);
+        dst[c]=malloc(npix);
+        if(!src[c] || !dst[c])
+        {
+            perror("malloc");
+            exit(-1);
+        }
+    }
 
-        if(thread_idx == 0) {idx=1; jdx=1;}
-        if(thread_idx == 1) {idx=1; jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 2) {idx=1; jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 3) {idx=1; jdx=(thread_idx*(IMG_W_SLICE-1));}
+    pnm_to_planes(&in_img, (UINT8 *const *)src);
+    pnm_to_planes(&in_img, dst);
+    printf("source file %s read, %dx%d\n", argv[1], img_width, img_height);
 
-        if(thread_idx == 4) {idx=IMG_H_SLICE; jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 5) {idx=IMG_H_SLICE; jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 6) {idx=IMG_H_SLICE; jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 7) {idx=IMG_H_SLICE; jdx=(thread_idx*(IMG_W_SLICE-1));}
+    make_tiles(tile_w, tile_h);
+    printf("%d threads, %d tiles of %dx%d, %s kernel\n", num_threads, num_tiles, tile_w, tile_h,
+           psf_isa_name(psf_kernel_isa()));
 
-        if(thread_idx == 8) {idx=(2*(IMG_H_SLICE-1)); jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 9) {idx=(2*(IMG_H_SLICE-1)); jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 10) {idx=(2*(IMG_H_SLICE-1)); jdx=(thread_idx*(IMG_W_SLICE-1));}
-        if(thread_idx == 11) {idx=(2*(IMG_H_SLICE-1)); jdx=(thread_idx*(IMG_W_SLICE-1));}
+    // threads are created once and wait at start_barrier for each frame
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    pthread_barrier_init(&done_barrier, NULL, num_threads + 1);
 
-        //printf("idx=%d, jdx=%d\n", idx, jdx);
+    for(thread_idx=0; thread_idx<num_threads; thread_idx++)
+    {
+        threadarg[thread_idx].thread_idx=thread_idx;
+        pthread_mutex_init(&threadarg[thread_idx].deque.lock, NULL);
+        if(!(threadarg[thread_idx].deque.idx=malloc(num_tiles * sizeof(int))))
+        {
+            perror("malloc");
+            exit(-1);
+        }
 
-        threadarg[thread_idx].i=idx;      
-        threadarg[thread_idx].h=IMG_H_SLICE-1;        
-        threadarg[thread_idx].j=jdx;        
-        threadarg[thread_idx].w=IMG_W_SLICE-1;
+        //printf("create thread_idx=%d\n", thread_idx);
+        if(pthread_create(&threads[thread_idx], (void *)0, sharpen_thread, (void *)&threadarg[thread_idx]) != 0)
+        {
+            perror("pthread_create");
+            exit(-1);
+        }
+    }
 
-        //printf("create thread_idx=%d\n", thread_idx);    
-        pthread_create(&threads[thread_idx], (void *)0, sharpen_thread, (void *)&threadarg[thread_idx]);
+    start=now_sec();
 
+    for(runs=0; runs < num_runs; runs++)
+    {
+        deal_tiles();
+        pthread_barrier_wait(&start_barrier);
+        pthread_barrier_wait(&done_barrier);
     }
 
-    for(thread_idx=0; thread_idx<(NUM_ROW_THREADS*NUM_COL_THREADS); thread_idx++)
+    elapsed=now_sec() - start;
+
+    stopping=1;
+    pthread_barrier_wait(&start_barrier);
+    for(thread_idx=0; thread_idx<num_threads; thread_idx++)
     {
-            //printf("join thread_idx=%d\n", thread_idx);    
+            //printf("join thread_idx=%d\n", thread_idx);
             if((pthread_join(threads[thread_idx], (void **)0)) < 0)
                 perror("pthread_join");
     }
 
-    printf("frame %d completed\n", runs);
+    printf("%d frames completed in %.3lf sec, %.3lf ms/frame, %.1lf MPix/s\n", num_runs, elapsed,
+           elapsed * 1000.0 / num_runs, ((double)npix * num_runs) / elapsed / 1.0e6);
 
+    for(thread_idx=0; thread_idx<num_threads; thread_idx++)
+    {
+        printf("thread %3u: %8llu tiles %8llu steals\n", thread_idx,
+               threadarg[thread_idx].tiles, threadarg[thread_idx].steals);
+        total_steals+=threadarg[thread_idx].steals;
     }
+    printf("%llu of %llu tiles stolen\n", total_steals, (UINT64)num_tiles * num_runs);
 
     printf("starting sink file %s write\n", argv[2]);
-    write(fdout, (void *)header, 21);
+    if(pnm_create_like(&out_img, argv[2], &in_img) != 0)
+        exit(-1);
 
     // Write RGB data
-    for(i=0; i<IMG_HEIGHT; i++)
-    {
-        for(j=0; j<IMG_WIDTH; j+=1)
-        {
-            write(fdout, (void *)&convR[i][j], 1);
-            write(fdout, (void *)&convG[i][j], 1);
-            write(fdout, (void *)&convB[i][j], 1);
-        }
-    }
-
+    pnm_from_planes(&out_img, (const UINT8 *const *)dst);
+    pnm_close(&out_img);
+    pnm_close(&in_img);
 
     printf("sink file %s written\n", argv[2]);
-    close(fdout);
- 
+
 }
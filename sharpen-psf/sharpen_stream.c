@@ -0,0 +1,318 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "psf_kernel.h"
+#include "pnm_io.h"
+
+
+// Streaming PSF sharpen for images too big to hold in memory
+//
+// The PPM is read in strips of rows by a reader thread, sharpened a strip at
+// a time by the main thread and written by a writer thread, so read, compute
+// and write overlap.  Each input strip carries the row above and below it,
+// copied from the previous strip rather than read again, so any strip can be
+// convolved on its own.  Memory is a few strips of width*3 bytes per row, no
+// matter how many rows the image has.
+//
+// Output is byte-identical to sharpen_grid: the first and last rows and
+// columns are copied, the interior is the fused 3-channel PSF kernel.
+
+#define DEFAULT_STRIP_ROWS (32)
+#define DEFAULT_BUFFERS (3)
+#define MAX_BUFFERS (16)
+
+typedef unsigned long long int UINT64;
+typedef unsigned char UINT8;
+
+typedef struct _strip
+{
+    UINT8 *data;
+    int row;        // first image row the strip outputs
+    int nrows;      // rows it outputs, 0 marks the end of the image
+} stripType;
+
+// bounded FIFO of strips between two threads
+typedef struct _stripQueue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    stripType *slot[MAX_BUFFERS];
+    int head;
+    int count;
+} stripQueueType;
+
+stripType in_strip[MAX_BUFFERS], out_strip[MAX_BUFFERS];
+stripQueueType free_in, full_in, free_out, full_out;
+
+// PPM Edge Enhancement Code
+struct pnm_image img;
+int img_width, img_height;
+size_t stride;
+int strip_rows=DEFAULT_STRIP_ROWS, num_buffers=DEFAULT_BUFFERS;
+int fdin, fdout;
+UINT8 *carry;       // last two rows read, the halo of the next strip
+
+
+static void queue_init(stripQueueType *q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+    q->head=0;
+    q->count=0;
+}
+
+static void queue_put(stripQueueType *q, stripType *s)
+{
+    pthread_mutex_lock(&q->lock);
+    q->slot[(q->head + q->count) % MAX_BUFFERS]=s;
+    q->count++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static stripType *queue_get(stripQueueType *q)
+{
+    stripType *s;
+
+    pthread_mutex_lock(&q->lock);
+    while(q->count == 0)
+        pthread_cond_wait(&q->cond, &q->lock);
+    s=q->slot[q->head];
+    q->head=(q->head + 1) % MAX_BUFFERS;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+
+    return s;
+}
+
+static void io_all(int fd, UINT8 *buf, size_t len, int writing)
+{
+    size_t done=0;
+    ssize_t n;
+
+    while(done < len)
+    {
+        n=writing ? write(fd, buf+done, len-done) : read(fd, buf+done, len-done);
+        if(n <= 0)
+        {
+            perror(writing ? "write" : "read");
+            exit(-1);
+        }
+        done+=n;
+    }
+}
+
+static double now_sec(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+
+// Strip buffer row k holds image row (strip->row - 1 + k), for rows strip->row-1 .. strip->row+nrows
+void *reader_thread(void *arg)
+{
+    stripType *s;
+    int row, last;
+
+    for(row=0; row<img_height; row+=strip_rows)
+    {
+        s=queue_get(&free_in);
+        s->row=row;
+        s->nrows=((row + strip_rows) > img_height) ? (img_height - row) : strip_rows;
+
+        // last image row the strip needs, one below its output if there is one
+        last=((row + s->nrows) < img_height) ? (row + s->nrows) : (img_height - 1);
+
+        if(row == 0)
+            io_all(fdin, s->data + stride, (size_t)(last + 1) * stride, 0);
+        else
+        {
+            memcpy(s->data, carry, 2 * stride);
+            if(last > row)
+                io_all(fdin, s->data + 2 * stride, (size_t)(last - row) * stride, 0);
+        }
+
+        // rows last-1 and last start the next strip
+        memcpy(carry, s->data + (size_t)(last - row) * stride, 2 * stride);
+
+        queue_put(&full_in, s);
+    }
+
+    s=queue_get(&free_in);
+    s->nrows=0;
+    queue_put(&full_in, s);
+
+    pthread_exit((void **)0);
+}
+
+void *writer_thread(void *arg)
+{
+    stripType *s;
+
+    while((s=queue_get(&full_out))->nrows > 0)
+    {
+        io_all(fdout, s->data, (size_t)s->nrows * stride, 1);
+        queue_put(&free_out, s);
+    }
+
+    pthread_exit((void **)0);
+}
+
+static void sharpen_strip(stripType *in, stripType *out)
+{
+    const UINT8 *src=in->data + stride;     // image row in->row
+    int k, first=0, last=in->nrows;
+
+    out->row=in->row;
+    out->nrows=in->nrows;
+
+    // first and last image rows have no neighbors to convolve with, copy them
+    if(in->row == 0)
+    {
+        memcpy(out->data, src, stride);
+        first=1;
+    }
+    if(in->row + in->nrows == img_height)
+    {
+        last--;
+        memcpy(out->data + (size_t)last * stride, src + (size_t)last * stride, stride);
+    }
+
+    // and the first and last columns
+    for(k=first; k<last; k++)
+    {
+        memcpy(out->data + (size_t)k * stride, src + (size_t)k * stride, 3);
+        memcpy(out->data + (size_t)k * stride + stride - 3, src + (size_t)k * stride + stride - 3, 3);
+    }
+
+    // all three channels in one pass, bit-exact with the double precision PSF
+    if(last > first)
+        psf_sharpen_rgb24(src, out->data, (int)stride, first, last - first, 1, img_width - 2);
+}
+
+
+int main(int argc, char *argv[])
+{
+    pthread_t reader, writer;
+    stripType *in, *out;
+    int i;
+    double start, elapsed;
+    size_t memory;
+
+    if(argc < 3)
+    {
+       printf("Usage: sharpen_stream input_file.ppm output_file.ppm [strip_rows [buffers]]\n");
+       exit(-1);
+    }
+
+    if(argc > 3) strip_rows=atoi(argv[3]);
+    if(argc > 4) num_buffers=atoi(argv[4]);
+    if((strip_rows < 1) || (num_buffers < 2) || (num_buffers > MAX_BUFFERS-1))
+    {
+       printf("Usage: sharpen_stream input_file.ppm output_file.ppm [strip_rows [buffers]]\n");
+       printf("strip_rows >= 1, 2 <= buffers <= %d\n", MAX_BUFFERS-1);
+       exit(-1);
+    }
+
+    // - for stdin and stdout, e.g. to sharpen a mosaic as it is decompressed
+    if(strcmp(argv[1], "-") == 0)
+        fdin=0;
+    else if((fdin = open(argv[1], O_RDONLY, 0644)) < 0)
+    {
+        printf("Error opening %s\n", argv[1]);
+        exit(-1);
+    }
+
+    if(strcmp(argv[2], "-") == 0)
+        fdout=1;
+    else if((fdout = open(argv[2], (O_WRONLY | O_CREAT | O_TRUNC), 0666)) < 0)
+    {
+        printf("Error opening %s\n", argv[2]);
+        exit(-1);
+    }
+
+    // just the header, the pixels are streamed
+    if((pnm_read_header(&img, fdin) != 0) || (img.channels != 3) || (img.sample_bytes != 1) ||
+       (img.width < 3) || (img.height < 3))
+    {
+        fprintf(stderr, "%s is not an 8-bit P6 PPM\n", argv[1]);
+        exit(-1);
+    }
+    img_width=img.width;
+    img_height=img.height;
+
+    stride=(size_t)img_width * 3;
+    if(strip_rows > img_height) strip_rows=img_height;
+
+    queue_init(&free_in); queue_init(&full_in);
+    queue_init(&free_out); queue_init(&full_out);
+
+    // one more input strip than output, the reader keeps one for the end marker
+    carry=malloc(2 * stride);
+    memory=2 * stride;
+    for(i=0; i<num_buffers; i++)
+    {
+        in_strip[i].data=malloc((size_t)(strip_rows + 2) * stride);
+        out_strip[i].data=malloc((size_t)strip_rows * stride);
+        if(!in_strip[i].data || !out_strip[i].data || !carry)
+        {
+            perror("malloc");
+            exit(-1);
+        }
+        memory+=(size_t)((2 * strip_rows) + 2) * stride;
+
+        queue_put(&free_in, &in_strip[i]);
+        queue_put(&free_out, &out_strip[i]);
+    }
+
+    fprintf(stderr, "%dx%d in strips of %d rows, %d buffers, %.1lf MB, %s kernel\n",
+            img_width, img_height, strip_rows, num_buffers, (double)memory / (1024.0 * 1024.0),
+            psf_isa_name(psf_kernel_isa()));
+
+    io_all(fdout, img.header, img.header_len, 1);
+
+    start=now_sec();
+
+    pthread_create(&reader, (void *)0, reader_thread, (void *)0);
+    pthread_create(&writer, (void *)0, writer_thread, (void *)0);
+
+    while((in=queue_get(&full_in))->nrows > 0)
+    {
+        out=queue_get(&free_out);
+        sharpen_strip(in, out);
+        queue_put(&free_in, in);
+        queue_put(&full_out, out);
+    }
+
+    out=queue_get(&free_out);
+    out->nrows=0;
+    queue_put(&full_out, out);
+
+    pthread_join(reader, (void **)0);
+    pthread_join(writer, (void **)0);
+
+    elapsed=now_sec() - start;
+    fprintf(stderr, "sharpened in %.3lf sec, %.1lf MPix/s\n", elapsed,
+            ((double)img_width * img_height) / elapsed / 1.0e6);
+
+    close(fdin);
+    close(fdout);
+
+    for(i=0; i<num_buffers; i++)
+    {
+        free(in_strip[i].data);
+        free(out_strip[i].data);
+    }
+    free(carry);
+
+    return 0;
+}
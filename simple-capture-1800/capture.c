@@ -33,17 +33,19 @@
 
 #include <time.h>
 
+#include "frame_writer.h"
+#include "frame_source.h"
+#include "capture_format.h"
+#include "frame_trace.h"
+
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 
+// default resolution, -S WxH and -P choose the format at run time
 #define HRES 640
 #define VRES 480
-#define HRES_STR "640"
-#define VRES_STR "480"
 
 //#define HRES 320
 //#define VRES 240
-//#define HRES_STR "320"
-//#define VRES_STR "240"
 
 #define START_UP_FRAMES (8)
 #define LAST_FRAMES (1)
@@ -84,13 +86,35 @@ struct buffer          *buffers;
 static unsigned int     n_buffers;
 static int              out_buf;
 static int              force_format=1;
+static int              hres=HRES, vres=VRES;
+static unsigned int     pixfmt=V4L2_PIX_FMT_YUYV;
+static struct work_pool work;           // working buffers, sized once the format is negotiated
 
 static int              frame_count = (FRAMES_TO_ACQUIRE);
+static char            *source_spec;
+static struct frame_source *source;    // replaces the device when set
+
+// Per-frame timing, filled in as each frame moves through and printed at the end
+static struct frame_trace trace;
+static struct frame_trace_record *trace_rec;   // frame in progress, NULL once the trace is full
+static char            *trace_name;
 
 
 static double fnow=0.0, fstart=0.0, fstop=0.0;
 static struct timespec time_now, time_start, time_stop;
 
+// Asynchronous frame writer, NULL to write each frame synchronously from process_image()
+static struct frame_writer *writer;
+static struct frame_writer_config writer_cfg = {
+        .nbuffers = 32,
+        .buffer_bytes = 0,                      // set once the format is negotiated
+        .batch = 4,
+        .threads = 2,
+        .direct = 0,
+        .sync = 1,
+        .container = NULL
+};
+
 static void errno_exit(const char *s)
 {
         fprintf(stderr, "%s error %d, %s\n", s, errno, strerror(errno));
@@ -110,24 +134,47 @@ static int xioctl(int fh, int request, void *arg)
         return r;
 }
 
-char ppm_header[]="P6\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
+char ppm_header[64];
 char ppm_dumpname[]="frames/test0000.ppm";
 
 static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
+
+    if(trace_rec)
+        trace_rec->process_ns = frame_trace_now();
    
     snprintf(&ppm_dumpname[11], 9, "%04d", tag);
     strncat(&ppm_dumpname[15], ".ppm", 5);
-    dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&ppm_header[14], " sec ", 5);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&ppm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
+    hlen=capture_pnm_header(ppm_header, sizeof(ppm_header), 1, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
 
-    // subtract 1 from sizeof header because it includes the null terminator for the string
-    written=write(dumpfd, ppm_header, sizeof(ppm_header)-1);
+    if(writer)
+    {
+        struct frame_writer_buf wbuf;
+
+        // the copy is all the capture thread does, the writer threads open/write/sync
+        if(frame_writer_get(writer, &wbuf) != 0)
+        {
+            printf("Frame %u dropped, all writer buffers in flight\n", tag);
+            return;
+        }
+
+        memcpy(wbuf.data, ppm_header, hlen);
+        memcpy(wbuf.data + hlen, p, size);
+        frame_writer_put(writer, &wbuf, ppm_dumpname, tag, hlen + size);
+        if(trace_rec)
+            trace_rec->write_ns = frame_trace_now();
+
+        clock_gettime(CLOCK_MONOTONIC, &time_now);
+        fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
+        printf("Frame queued for writing at %lf, %d, bytes\n", (fnow-fstart), size);
+        return;
+    }
+
+    dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
+
+    written=write(dumpfd, ppm_header, hlen);
 
     total=0;
 
@@ -142,28 +189,53 @@ static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec
     printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), total);
 
     close(dumpfd);
+    if(trace_rec)
+        trace_rec->write_ns = frame_trace_now();
     
 }
 
 
-char pgm_header[]="P5\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
+char pgm_header[64];
 char pgm_dumpname[]="frames/test0000.pgm";
 
 static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
+
+    if(trace_rec)
+        trace_rec->process_ns = frame_trace_now();
    
     snprintf(&pgm_dumpname[11], 9, "%04d", tag);
     strncat(&pgm_dumpname[15], ".pgm", 5);
-    dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&pgm_header[14], " sec ", 5);
-    snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&pgm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
+    hlen=capture_pnm_header(pgm_header, sizeof(pgm_header), 0, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
+
+    if(writer)
+    {
+        struct frame_writer_buf wbuf;
 
-    // subtract 1 from sizeof header because it includes the null terminator for the string
-    written=write(dumpfd, pgm_header, sizeof(pgm_header)-1);
+        // the copy is all the capture thread does, the writer threads open/write/sync
+        if(frame_writer_get(writer, &wbuf) != 0)
+        {
+            printf("Frame %u dropped, all writer buffers in flight\n", tag);
+            return;
+        }
+
+        memcpy(wbuf.data, pgm_header, hlen);
+        memcpy(wbuf.data + hlen, p, size);
+        frame_writer_put(writer, &wbuf, pgm_dumpname, tag, hlen + size);
+        if(trace_rec)
+            trace_rec->write_ns = frame_trace_now();
+
+        clock_gettime(CLOCK_MONOTONIC, &time_now);
+        fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
+        printf("Frame queued for writing at %lf, %d, bytes\n", (fnow-fstart), size);
+        return;
+    }
+
+    dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
+
+    written=write(dumpfd, pgm_header, hlen);
 
     total=0;
 
@@ -178,10 +250,62 @@ static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec
     printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), total);
 
     close(dumpfd);
+    if(trace_rec)
+        trace_rec->write_ns = frame_trace_now();
     
 }
 
 
+char jpg_dumpname[]="frames/test0000.jpg";
+
+// MJPEG frames are complete JPEG images, so they are written as they came from the camera
+static void dump_jpg(const void *p, int size, unsigned int tag)
+{
+    int written, total, dumpfd;
+
+    if(trace_rec)
+        trace_rec->process_ns = frame_trace_now();
+
+    snprintf(&jpg_dumpname[11], 9, "%04d", tag);
+    strncat(&jpg_dumpname[15], ".jpg", 5);
+
+    if(writer)
+    {
+        struct frame_writer_buf wbuf;
+
+        if(frame_writer_get(writer, &wbuf) != 0)
+        {
+            printf("Frame %u dropped, all writer buffers in flight\n", tag);
+            return;
+        }
+
+        memcpy(wbuf.data, p, size);
+        frame_writer_put(writer, &wbuf, jpg_dumpname, tag, size);
+        if(trace_rec)
+            trace_rec->write_ns = frame_trace_now();
+        return;
+    }
+
+    dumpfd = open(jpg_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
+
+    total=0;
+
+    do
+    {
+        written=write(dumpfd, (const unsigned char *)p + total, size - total);
+        total+=written;
+    } while(total < size);
+
+    clock_gettime(CLOCK_MONOTONIC, &time_now);
+    fnow = (double)time_now.tv_sec + (double)time_now.tv_nsec / 1000000000.0;
+    printf("Frame written to flash at %lf, %d, bytes\n", (fnow-fstart), total);
+
+    close(dumpfd);
+    if(trace_rec)
+        trace_rec->write_ns = frame_trace_now();
+}
+
+
 void yuv2rgb_float(float y, float u, float v, 
                    unsigned char *r, unsigned char *g, unsigned char *b)
 {
@@ -246,7 +370,7 @@ void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned c
 // always ignore first 8 frames
 int framecnt=-8;
 
-unsigned char bigbuffer[(1280*960)];
+unsigned char *bigbuffer;    // from work, sized for the negotiated format
 
 static void process_image(const void *p, int size)
 {
@@ -260,6 +384,9 @@ static void process_image(const void *p, int size)
 
     framecnt++;
     printf("frame %d: ", framecnt);
+
+    if(trace_rec)
+        trace_rec->frame = framecnt;
     
     if(framecnt == 0) 
     {
@@ -326,6 +453,12 @@ static void process_image(const void *p, int size)
         printf("Dump RGB as-is size %d\n", size);
         dump_ppm(p, size, framecnt, &frame_time);
     }
+
+    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG)
+    {
+        printf("Dump MJPEG as-is size %d\n", size);
+        dump_jpg(p, size, framecnt);
+    }
     else
     {
         printf("ERROR - unknown dump format\n");
@@ -336,11 +469,41 @@ static void process_image(const void *p, int size)
 }
 
 
+// Start the trace record of a frame just dequeued, driver_ns is its capture timestamp
+static void trace_dequeue(int64_t driver_ns, unsigned int sequence)
+{
+    if((trace_rec = frame_trace_next(&trace)) != NULL)
+    {
+        trace_rec->dequeue_ns = frame_trace_now();
+        trace_rec->driver_ns = driver_ns;
+        trace_rec->sequence = sequence;
+    }
+}
+
+static int64_t timeval_ns(const struct timeval *tv)
+{
+    return (int64_t)tv->tv_sec * 1000000000LL + (int64_t)tv->tv_usec * 1000LL;
+}
+
 static int read_frame(void)
 {
     struct v4l2_buffer buf;
     unsigned int i;
 
+    if(source)
+    {
+        const void *p;
+        unsigned int size;
+        struct timespec timestamp;
+
+        if(!frame_source_read(source, &p, &size, &timestamp))
+            return 0;
+
+        trace_dequeue((int64_t)timestamp.tv_sec * 1000000000LL + timestamp.tv_nsec, trace.hdr.count);
+        process_image(p, size);
+        return 1;
+    }
+
     switch (io)
     {
 
@@ -363,6 +526,7 @@ static int read_frame(void)
                 }
             }
 
+            trace_dequeue(0, trace.hdr.count);
             process_image(buffers[0].start, buffers[0].length);
             break;
 
@@ -394,6 +558,7 @@ static int read_frame(void)
 
             assert(buf.index < n_buffers);
 
+            trace_dequeue(timeval_ns(&buf.timestamp), buf.sequence);
             process_image(buffers[buf.index].start, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -430,6 +595,7 @@ static int read_frame(void)
 
             assert(i < n_buffers);
 
+            trace_dequeue(timeval_ns(&buf.timestamp), buf.sequence);
             process_image((void *)buf.m.userptr, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
@@ -489,13 +655,15 @@ static void mainloop(void)
             int r;
 
             FD_ZERO(&fds);
-            FD_SET(fd, &fds);
+            if(!source)
+                FD_SET(fd, &fds);
 
             /* Timeout. */
             tv.tv_sec = 2;
             tv.tv_usec = 0;
 
-            r = select(fd + 1, &fds, NULL, NULL, &tv);
+            // replayed frames have no descriptor, the source paces them
+            r = source ? 1 : select(fd + 1, &fds, NULL, NULL, &tv);
 
             if (-1 == r)
             {
@@ -847,13 +1015,13 @@ static void init_device(void)
     if (force_format)
     {
         printf("FORCING FORMAT\n");
-        fmt.fmt.pix.width       = HRES;
-        fmt.fmt.pix.height      = VRES;
+        fmt.fmt.pix.width       = hres;
+        fmt.fmt.pix.height      = vres;
 
         // Specify the Pixel Coding Formate here
 
-        // This one works for Logitech C200
-        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        // YUYV works for Logitech C200, -P asks for another
+        fmt.fmt.pix.pixelformat = pixfmt;
 
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_VYUY;
@@ -869,6 +1037,11 @@ static void init_device(void)
                 errno_exit("VIDIOC_S_FMT");
 
         /* Note VIDIOC_S_FMT may change width and height. */
+        if((fmt.fmt.pix.width != (unsigned int)hres) || (fmt.fmt.pix.height != (unsigned int)vres) ||
+           (fmt.fmt.pix.pixelformat != pixfmt))
+            printf("Driver chose %ux%u %s instead of %dx%d %s\n",
+                   fmt.fmt.pix.width, fmt.fmt.pix.height, capture_pixfmt_name(fmt.fmt.pix.pixelformat),
+                   hres, vres, capture_pixfmt_name(pixfmt));
     }
     else
     {
@@ -935,6 +1108,38 @@ static void open_device(void)
         }
 }
 
+static void open_source(void)
+{
+    if(!(source = frame_source_open(source_spec, hres, vres)))
+        exit(EXIT_FAILURE);
+
+    // what init_device() would have negotiated with the camera
+    CLEAR(fmt);
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    frame_source_format(source, &fmt.fmt.pix);
+
+    if(pixfmt != V4L2_PIX_FMT_YUYV)
+        printf("Frame sources are YUYV, -P %s ignored\n", capture_pixfmt_name(pixfmt));
+
+    printf("Replaying %s as %dx%d YUYV\n", frame_source_name(source),
+           fmt.fmt.pix.width, fmt.fmt.pix.height);
+}
+
+// Working buffers are sized from the negotiated format, after init_device() or open_source()
+static void alloc_work_buffers(void)
+{
+    size_t bytes = capture_work_bytes(&fmt.fmt.pix);
+
+    if((work_pool_init(&work, bytes) != 0) || !(bigbuffer = work_pool_alloc(&work, bytes)))
+    {
+        fprintf(stderr, "Out of memory for %zu byte working buffer\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Capturing %ux%u %s, %zu byte working buffer\n", fmt.fmt.pix.width, fmt.fmt.pix.height,
+           capture_pixfmt_name(fmt.fmt.pix.pixelformat), bytes);
+}
+
 static void usage(FILE *fp, int argc, char **argv)
 {
         fprintf(fp,
@@ -947,13 +1152,30 @@ static void usage(FILE *fp, int argc, char **argv)
                  "-r | --read          Use read() calls\n"
                  "-u | --userp         Use application allocated buffers\n"
                  "-o | --output        Outputs stream to stdout\n"
-                 "-f | --format        Force format to 640x480 GREY\n"
+                 "-f | --format        Force the -S/-P format on the device [default]\n"
                  "-c | --count         Number of frames to grab [%i]\n"
+                 "-s | --source spec   Replay frames instead of a device:\n"
+                 "                     raw:file[@fps], dir:directory[@fps],\n"
+                 "                     synth[:bars|ramp|noise|box][@fps]\n"
+                 "-w | --writer        Write frames asynchronously (%s)\n"
+                 "-b | --batch n       Frames per writer submission [%d]\n"
+                 "-C | --container f   Append frames as records to file f, see frame_unpack\n"
+                 "-O | --direct        Open frame files with O_DIRECT\n"
+                 "-T | --trace file    Save the binary frame timing trace, see frame_trace_dump\n"
+                 "-S | --size WxH      Resolution to request [%dx%d]\n"
+                 "-P | --pixfmt name   yuyv, grey, rgb24 or mjpeg [%s]\n"
                  "",
-                 argv[0], dev_name, frame_count);
+                 argv[0], dev_name, frame_count,
+#if defined(USE_IO_URING)
+                 "io_uring",
+#else
+                 "pwritev thread pool",
+#endif
+                 writer_cfg.batch,
+                 hres, vres, capture_pixfmt_name(pixfmt));
 }
 
-static const char short_options[] = "d:hmruofc:";
+static const char short_options[] = "d:hmruofc:wb:C:Os:T:S:P:";
 
 static const struct option
 long_options[] = {
@@ -965,11 +1187,21 @@ long_options[] = {
         { "output", no_argument,       NULL, 'o' },
         { "format", no_argument,       NULL, 'f' },
         { "count",  required_argument, NULL, 'c' },
+        { "source", required_argument, NULL, 's' },
+        { "size",   required_argument, NULL, 'S' },
+        { "pixfmt", required_argument, NULL, 'P' },
+        { "trace",  required_argument, NULL, 'T' },
+        { "writer", no_argument,       NULL, 'w' },
+        { "batch",  required_argument, NULL, 'b' },
+        { "container", required_argument, NULL, 'C' },
+        { "direct", no_argument,       NULL, 'O' },
         { 0, 0, 0, 0 }
 };
 
 int main(int argc, char **argv)
 {
+    int use_writer = 0;
+
     if(argc > 1)
         dev_name = argv[1];
     else
@@ -1027,28 +1259,114 @@ int main(int argc, char **argv)
                         errno_exit(optarg);
                 break;
 
+            case 's':
+                source_spec = optarg;
+                break;
+
+            case 'S':
+                if(capture_parse_size(optarg, &hres, &vres) != 0)
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'P':
+                if(!(pixfmt = capture_parse_pixfmt(optarg)))
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'T':
+                trace_name = optarg;
+                break;
+
+            case 'w':
+                use_writer++;
+                break;
+
+            case 'b':
+                writer_cfg.batch = atoi(optarg);
+                use_writer++;
+                break;
+
+            case 'C':
+                writer_cfg.container = optarg;
+                use_writer++;
+                break;
+
+            case 'O':
+                writer_cfg.direct = 1;
+                use_writer++;
+                break;
+
             default:
                 usage(stderr, argc, argv);
                 exit(EXIT_FAILURE);
         }
     }
 
-    // initialization of V4L2
-    open_device();
-    init_device();
+    if(frame_trace_init(&trace, frame_count, 1000000000LL / FRAMES_PER_SEC) != 0)
+    {
+        fprintf(stderr, "Out of memory for the frame trace\n");
+        exit(EXIT_FAILURE);
+    }
 
-    start_capturing();
+    // initialization of V4L2, or of the replayed frame source
+    if(source_spec)
+        open_source();
+    else
+    {
+        open_device();
+        init_device();
+
+        start_capturing();
+    }
+
+    alloc_work_buffers();
+
+    if(use_writer)
+    {
+        // header plus the largest image written, for the negotiated format
+        writer_cfg.buffer_bytes = 64 + capture_work_bytes(&fmt.fmt.pix);
+
+        if(!(writer = frame_writer_open(&writer_cfg)))
+        {
+            fprintf(stderr, "Cannot start frame writer\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Writing frames with %s, batch %d%s%s\n", frame_writer_backend(writer), writer_cfg.batch,
+               writer_cfg.direct ? ", O_DIRECT" : "", writer_cfg.container ? ", container" : "");
+    }
 
     // service loop frame read
     mainloop();
 
     // shutdown of frame acquisition service
-    stop_capturing();
+    if(!source)
+        stop_capturing();
 
     printf("Total capture time=%lf, for %d frames, %lf FPS\n", (fstop-fstart), CAPTURE_FRAMES+1, ((double)CAPTURE_FRAMES / (fstop-fstart)));
 
-    uninit_device();
-    close_device();
+    // waits for queued frames to reach storage
+    if(writer)
+        frame_writer_close(writer);
+
+    frame_trace_print_stats(&trace);
+    if(trace_name && (frame_trace_write(&trace, trace_name) == 0))
+        printf("Frame trace saved to %s\n", trace_name);
+    frame_trace_free(&trace);
+
+    if(source)
+        frame_source_close(source);
+    else
+    {
+        uninit_device();
+        close_device();
+    }
+    work_pool_destroy(&work);
     fprintf(stderr, "\n");
     return 0;
 }
@@ -13,6 +13,8 @@
  * see http://linuxtv.org/docs.php for more information
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,13 +34,21 @@
 #include <linux/videodev2.h>
 
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "frame_ring.h"
+#include "yuv_convert.h"
+#include "frame_source.h"
+#include "capture_format.h"
+#include "mjpeg_decode.h"
 
 #define CLEAR(x) memset(&(x), 0, sizeof(x))
 #define COLOR_CONVERT
+
+// default resolution, -S WxH and -P choose the format at run time
 #define HRES 320
 #define VRES 240
-#define HRES_STR "320"
-#define VRES_STR "240"
 
 // Format is used by a number of functions, so made as a file global
 static struct v4l2_format fmt;
@@ -65,7 +75,14 @@ struct buffer          *buffers;
 static unsigned int     n_buffers;
 static int              out_buf;
 static int              force_format=1;
+static int              hres=HRES, vres=VRES;
+static unsigned int     pixfmt=V4L2_PIX_FMT_YUYV;
+static struct work_pool work;           // working buffers, sized once the format is negotiated
 static int              frame_count = 30;
+static char            *source_spec;
+static struct frame_source *source;    // replaces the device when set
+static int              decode_workers=2;       // MJPEG decode threads, 0 saves the JPEG as-is
+static struct mjpeg_decoder *decoder;
 
 static void errno_exit(const char *s)
 {
@@ -86,22 +103,19 @@ static int xioctl(int fh, int request, void *arg)
         return r;
 }
 
-char ppm_header[]="P6\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
+char ppm_header[64];
 char ppm_dumpname[]="test00000000.ppm";
 
 static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
    
     snprintf(&ppm_dumpname[4], 9, "%08d", tag);
     strncat(&ppm_dumpname[12], ".ppm", 5);
     dumpfd = open(ppm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&ppm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&ppm_header[14], " sec ", 5);
-    snprintf(&ppm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&ppm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-    written=write(dumpfd, ppm_header, sizeof(ppm_header));
+    hlen=capture_pnm_header(ppm_header, sizeof(ppm_header), 1, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
+    written=write(dumpfd, ppm_header, hlen);
 
     total=0;
 
@@ -118,22 +132,19 @@ static void dump_ppm(const void *p, int size, unsigned int tag, struct timespec
 }
 
 
-char pgm_header[]="P5\n#9999999999 sec 9999999999 msec \n"HRES_STR" "VRES_STR"\n255\n";
+char pgm_header[64];
 char pgm_dumpname[]="test00000000.pgm";
 
 static void dump_pgm(const void *p, int size, unsigned int tag, struct timespec *time)
 {
-    int written, i, total, dumpfd;
+    int written, i, total, dumpfd, hlen;
    
     snprintf(&pgm_dumpname[4], 9, "%08d", tag);
     strncat(&pgm_dumpname[12], ".pgm", 5);
     dumpfd = open(pgm_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
 
-    snprintf(&pgm_header[4], 11, "%010d", (int)time->tv_sec);
-    strncat(&pgm_header[14], " sec ", 5);
-    snprintf(&pgm_header[19], 11, "%010d", (int)((time->tv_nsec)/1000000));
-    strncat(&pgm_header[29], " msec \n"HRES_STR" "VRES_STR"\n255\n", 19);
-    written=write(dumpfd, pgm_header, sizeof(pgm_header));
+    hlen=capture_pnm_header(pgm_header, sizeof(pgm_header), 0, time, fmt.fmt.pix.width, fmt.fmt.pix.height);
+    written=write(dumpfd, pgm_header, hlen);
 
     total=0;
 
@@ -183,6 +194,9 @@ void yuv2rgb_float(float y, float u, float v,
 //      YUV422, which we assume here, where there are 2 bytes for each pixel, with two Y samples for one U & V,
 //              or as the name implies, 4Y and 2 UV pairs
 //      YUV420, where for every 4 Ys, there is a single UV pair, 1.5 bytes for each pixel or 36 bytes for 24 pixels
+//
+// The vector kernels in capture_common/yuv_convert.c used by process_image() are bit-exact
+// with this function.
 
 void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned char *b)
 {
@@ -211,15 +225,64 @@ void yuv2rgb(int y, int u, int v, unsigned char *r, unsigned char *g, unsigned c
 }
 
 
+char jpg_dumpname[]="test00000000.jpg";
+
+// MJPEG frames are complete JPEG images, so they are written as they came from the camera
+static void dump_jpg(const void *p, int size, unsigned int tag)
+{
+    int written, total, dumpfd;
+
+    snprintf(&jpg_dumpname[4], 9, "%08d", tag);
+    strncat(&jpg_dumpname[12], ".jpg", 5);
+    dumpfd = open(jpg_dumpname, O_WRONLY | O_NONBLOCK | O_CREAT, 00666);
+
+    total=0;
+
+    do
+    {
+        written=write(dumpfd, (const unsigned char *)p + total, size - total);
+        total+=written;
+    } while(total < size);
+
+    printf("wrote %d bytes\n", total);
+
+    close(dumpfd);
+}
+
 
 unsigned int framecnt=0;
-unsigned char bigbuffer[(1280*960)];
+unsigned char *bigbuffer;    // from work, sized for the negotiated format
+
+#if defined(COLOR_CONVERT)
+#define YUYV_DUMP_FORMAT V4L2_PIX_FMT_RGB24
+#else
+#define YUYV_DUMP_FORMAT V4L2_PIX_FMT_GREY
+#endif
+
+// Convert a YUYV frame into the image that is dumped, returns bytes written to out
+static int convert_yuyv(const unsigned char *pptr, int size, unsigned char *out)
+{
+#if defined(COLOR_CONVERT)
+    // Pixels are YU and YV alternating, so YUYV which is 4 bytes
+    // We want RGB, so RGBRGB which is 6 bytes
+    //
+    yuyv_to_rgb24(pptr, out, size/2);
+
+    return ((size*6)/4);
+#else
+    // Pixels are YU and YV alternating, so YUYV which is 4 bytes
+    // We want Y, so YY which is 2 bytes
+    //
+    yuyv_to_y8(pptr, out, size/2);
+
+    return (size/2);
+#endif
+}
 
 static void process_image(const void *p, int size)
 {
-    int i, newi, newsize=0;
+    int newsize=0;
     struct timespec frame_time;
-    int y_temp, y2_temp, u_temp, v_temp;
     unsigned char *pptr = (unsigned char *)p;
 
     // record when process was called
@@ -243,32 +306,12 @@ static void process_image(const void *p, int size)
 
 #if defined(COLOR_CONVERT)
         printf("Dump YUYV converted to RGB size %d\n", size);
-       
-        // Pixels are YU and YV alternating, so YUYV which is 4 bytes
-        // We want RGB, so RGBRGB which is 6 bytes
-        //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+6)
-        {
-            y_temp=(int)pptr[i]; u_temp=(int)pptr[i+1]; y2_temp=(int)pptr[i+2]; v_temp=(int)pptr[i+3];
-            yuv2rgb(y_temp, u_temp, v_temp, &bigbuffer[newi], &bigbuffer[newi+1], &bigbuffer[newi+2]);
-            yuv2rgb(y2_temp, u_temp, v_temp, &bigbuffer[newi+3], &bigbuffer[newi+4], &bigbuffer[newi+5]);
-        }
-
-        dump_ppm(bigbuffer, ((size*6)/4), framecnt, &frame_time);
+        newsize=convert_yuyv(pptr, size, bigbuffer);
+        dump_ppm(bigbuffer, newsize, framecnt, &frame_time);
 #else
         printf("Dump YUYV converted to YY size %d\n", size);
-       
-        // Pixels are YU and YV alternating, so YUYV which is 4 bytes
-        // We want Y, so YY which is 2 bytes
-        //
-        for(i=0, newi=0; i<size; i=i+4, newi=newi+2)
-        {
-            // Y1=first byte and Y2=third byte
-            bigbuffer[newi]=pptr[i];
-            bigbuffer[newi+1]=pptr[i+2];
-        }
-
-        dump_pgm(bigbuffer, (size/2), framecnt, &frame_time);
+        newsize=convert_yuyv(pptr, size, bigbuffer);
+        dump_pgm(bigbuffer, newsize, framecnt, &frame_time);
 #endif
 
     }
@@ -278,6 +321,20 @@ static void process_image(const void *p, int size)
         printf("Dump RGB as-is size %d\n", size);
         dump_ppm(p, size, framecnt, &frame_time);
     }
+
+    else if((fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG) && decoder)
+    {
+        // decoded on the worker pool, dumped in order by deliver_decoded()
+        printf("Decode MJPEG size %d\n", size);
+        if(mjpeg_decoder_submit(decoder, p, size, framecnt, &frame_time) != 0)
+            printf("MJPEG decoder busy, frame %d dropped\n", framecnt);
+    }
+
+    else if(fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG)
+    {
+        printf("Dump MJPEG as-is size %d\n", size);
+        dump_jpg(p, size, framecnt);
+    }
     else
     {
         printf("ERROR - unknown dump format\n");
@@ -289,11 +346,116 @@ static void process_image(const void *p, int size)
 }
 
 
+// Pipelined capture
+//
+// With -p the acquire, convert and write work is split over three pinned
+// threads so that a slow write to flash never holds a driver buffer:
+//
+//   acquire: select()/DQBUF, copy into raw_ring slot, QBUF right away
+//   convert: raw_ring slot -> YUYV to RGB/Y -> out_ring slot
+//   write:   out_ring slot -> dump_ppm()/dump_pgm()
+//
+// When the raw ring is full the acquire stage drops the frame and counts it
+// rather than blocking, so the driver is always kept supplied with buffers.
+
+#define PIPE_SLOTS (8)
+#define NUM_STAGES (3)
+#define STAGE_ACQUIRE (0)
+#define STAGE_CONVERT (1)
+#define STAGE_WRITE   (2)
+
+struct stage_stats
+{
+    const char    *name;
+    unsigned long  frames;
+    unsigned long  drops;
+    double         min_ms;      // service time in the stage
+    double         max_ms;
+    double         sum_ms;
+    double         lat_max_ms;  // acquire to end of stage
+    double         lat_sum_ms;
+};
+
+static int                pipeline=0;
+static int                stage_cpu[NUM_STAGES] = {-1, -1, -1};
+static struct frame_ring  raw_ring, out_ring;
+static struct stage_stats stats[NUM_STAGES] =
+{
+    {"acquire", 0, 0, 1.0e9, 0.0, 0.0, 0.0, 0.0},
+    {"convert", 0, 0, 1.0e9, 0.0, 0.0, 0.0, 0.0},
+    {"write",   0, 0, 1.0e9, 0.0, 0.0, 0.0, 0.0}
+};
+
+static double delta_ms(struct timespec *stop, struct timespec *start)
+{
+    return ((double)(stop->tv_sec - start->tv_sec) * 1000.0) +
+           ((double)(stop->tv_nsec - start->tv_nsec) / 1000000.0);
+}
+
+static void stage_account(struct stage_stats *st, struct timespec *start, struct timespec *acquired)
+{
+    struct timespec now;
+    double service, latency;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    service=delta_ms(&now, start);
+    latency=delta_ms(&now, acquired);
+
+    st->frames++;
+    st->sum_ms += service;
+    if(service < st->min_ms) st->min_ms=service;
+    if(service > st->max_ms) st->max_ms=service;
+    st->lat_sum_ms += latency;
+    if(latency > st->lat_max_ms) st->lat_max_ms=latency;
+}
+
+// Acquire stage frame handler, called by read_frame() before the buffer is requeued
+static void acquire_image(const void *p, int size)
+{
+    struct frame_slot *slot;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    framecnt++;
+
+    if(!(slot=frame_ring_producer_slot(&raw_ring)) || (size > (int)slot->capacity))
+    {
+        stats[STAGE_ACQUIRE].drops++;
+        return;
+    }
+
+    slot->acquired=start;
+    clock_gettime(CLOCK_REALTIME, &slot->frame_time);
+    slot->tag=framecnt;
+    slot->pixelformat=fmt.fmt.pix.pixelformat;
+    slot->size=size;
+    memcpy(slot->data, p, size);
+
+    frame_ring_publish(&raw_ring);
+    stage_account(&stats[STAGE_ACQUIRE], &start, &slot->acquired);
+}
+
+static void (*frame_handler)(const void *p, int size) = process_image;
+
+
 static int read_frame(void)
 {
     struct v4l2_buffer buf;
     unsigned int i;
 
+    if(source)
+    {
+        const void *p;
+        unsigned int size;
+        struct timespec timestamp;
+
+        if(!frame_source_read(source, &p, &size, &timestamp))
+            return 0;
+
+        frame_handler(p, size);
+        return 1;
+    }
+
     switch (io)
     {
 
@@ -316,7 +478,7 @@ static int read_frame(void)
                 }
             }
 
-            process_image(buffers[0].start, buffers[0].length);
+            frame_handler(buffers[0].start, buffers[0].length);
             break;
 
         case IO_METHOD_MMAP:
@@ -347,7 +509,7 @@ static int read_frame(void)
 
             assert(buf.index < n_buffers);
 
-            process_image(buffers[buf.index].start, buf.bytesused);
+            frame_handler(buffers[buf.index].start, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
                     errno_exit("VIDIOC_QBUF");
@@ -383,7 +545,7 @@ static int read_frame(void)
 
             assert(i < n_buffers);
 
-            process_image((void *)buf.m.userptr, buf.bytesused);
+            frame_handler((void *)buf.m.userptr, buf.bytesused);
 
             if (-1 == xioctl(fd, VIDIOC_QBUF, &buf))
                     errno_exit("VIDIOC_QBUF");
@@ -395,64 +557,408 @@ static int read_frame(void)
 }
 
 
+// Frame scheduler
+//
+// mainloop() releases the acquire service on absolute CLOCK_MONOTONIC deadlines,
+// one camera frame period apart, so the rate does not drift with the time spent
+// processing.  At each release every frame the driver has ready is dequeued and
+// all but the newest requeued at once, which keeps the driver's buffers cycling.
+// With decimation only every Nth release processes its frame, e.g. -R 30 -D 30
+// takes 1 Hz out of a 30 Hz stream.  A frame source without @fps is not
+// timed, its frames are taken as fast as they are read.
+//
+static int              rate_hz=30;     // camera frame rate, one release per frame
+static int              decimate=1;     // process one release out of this many
+static int              fifo_prio=0;    // SCHED_FIFO priority for the service, 0 leaves it as is
+static int              service_cpu=-1; // CPU for the service, -1 leaves it as is
+
+struct sched_stats
+{
+    unsigned long releases;
+    unsigned long processed;
+    unsigned long requeued;     // older frames found at a release, not processed
+    unsigned long empty;        // releases with no frame ready
+    unsigned long overruns;     // releases that ended after the next deadline
+    unsigned long missed;       // deadlines skipped after an overrun
+    double        late_min, late_max, late_sum;     // wake up after deadline, ms
+};
+
+static struct sched_stats sched;
+
+// no frame at all for this long ends the program, as the old 2 s select() did
+#define WATCHDOG_NS (2000000000L)
+
+
+static void discard_image(const void *p, int size)
+{
+}
+
+static void timespec_add_ns(struct timespec *t, long ns)
+{
+    t->tv_nsec += ns;
+    while(t->tv_nsec >= 1000000000L)
+    {
+        t->tv_nsec -= 1000000000L;
+        t->tv_sec++;
+    }
+}
+
+static int timespec_before(struct timespec *a, struct timespec *b)
+{
+    return (a->tv_sec < b->tv_sec) || ((a->tv_sec == b->tv_sec) && (a->tv_nsec < b->tv_nsec));
+}
+
+// Run the calling thread under SCHED_FIFO on the chosen CPU, if asked to
+static void set_service_policy(void)
+{
+    struct sched_param param;
+    cpu_set_t cpuset;
+    int rc;
+
+    if(service_cpu >= 0)
+    {
+        CPU_ZERO(&cpuset);
+        CPU_SET(service_cpu, &cpuset);
+        if((rc=pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset)) != 0)
+            fprintf(stderr, "service affinity to CPU %d: %s\n", service_cpu, strerror(rc));
+    }
+
+    if(fifo_prio > 0)
+    {
+        param.sched_priority = fifo_prio;
+        if((rc=pthread_setschedparam(pthread_self(), SCHED_FIFO, &param)) != 0)
+            fprintf(stderr, "SCHED_FIFO priority %d: %s (needs root or CAP_SYS_NICE)\n", fifo_prio, strerror(rc));
+    }
+}
+
+// Wait up to one period for the device to have a frame, 0 on timeout
+static int wait_frame(long period_ns)
+{
+    fd_set fds;
+    struct timeval tv;
+    int r;
+
+    if(source)
+        return 1;
+
+    do
+    {
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        tv.tv_sec = period_ns / 1000000000L;
+        tv.tv_usec = (period_ns % 1000000000L) / 1000;
+
+        r = select(fd + 1, &fds, NULL, NULL, &tv);
+    } while((r == -1) && (errno == EINTR));
+
+    if(r == -1)
+        errno_exit("select");
+
+    return r;
+}
+
+// Dequeue every frame the driver has ready, requeue all but the newest and pass
+// that one to frame_handler when process is set.  Returns 1 if a frame was taken.
+static int read_latest_frame(int process)
+{
+    struct v4l2_buffer buf, next;
+    void (*handler)(const void *p, int size) = frame_handler;
+    int r;
+
+    // read() and replayed sources have no queue to look into, take one frame
+    if(source || (io != IO_METHOD_MMAP))
+    {
+        if(!process)
+            frame_handler = discard_image;
+        r = read_frame();
+        frame_handler = handler;
+        return r;
+    }
+
+    CLEAR(buf);
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_MMAP;
+
+    if(-1 == xioctl(fd, VIDIOC_DQBUF, &buf))
+    {
+        if((errno == EAGAIN) || (errno == EIO))
+            return 0;
+        errno_exit("VIDIOC_DQBUF");
+    }
+
+    for(;;)
+    {
+        CLEAR(next);
+        next.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        next.memory = V4L2_MEMORY_MMAP;
+
+        if(-1 == xioctl(fd, VIDIOC_DQBUF, &next))
+        {
+            if((errno == EAGAIN) || (errno == EIO))
+                break;
+            errno_exit("VIDIOC_DQBUF");
+        }
+
+        if(-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+            errno_exit("VIDIOC_QBUF");
+        sched.requeued++;
+        buf = next;
+    }
+
+    assert(buf.index < n_buffers);
+
+    if(process)
+        frame_handler(buffers[buf.index].start, buf.bytesused);
+
+    if(-1 == xioctl(fd, VIDIOC_QBUF, &buf))
+        errno_exit("VIDIOC_QBUF");
+
+    return 1;
+}
+
+static void print_sched_stats(void)
+{
+    printf("\nscheduler: %d Hz, decimate %d, %lu releases, %lu processed, %lu requeued, %lu empty\n",
+           rate_hz, decimate, sched.releases, sched.processed, sched.requeued, sched.empty);
+    printf("overruns %lu, deadlines missed %lu, release latency ms min %.3lf avg %.3lf max %.3lf\n",
+           sched.overruns, sched.missed, sched.late_min,
+           sched.releases ? sched.late_sum / sched.releases : 0.0, sched.late_max);
+}
+
+
 static void mainloop(void)
 {
     unsigned int count;
-    struct timespec read_delay;
-    struct timespec time_error;
+    long period_ns = 1000000000L / rate_hz;
+    struct timespec deadline, next, now, last_frame, watchdog;
+    double late;
+    int taken;
+    // an unpaced source is read as fast as it goes, with no deadlines
+    int timed = !source || frame_source_paced(source);
 
-    read_delay.tv_sec=0;
-    read_delay.tv_nsec=30000;
+    set_service_policy();
+    memset(&sched, 0, sizeof(sched));
 
     count = frame_count;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    last_frame = deadline;
 
     while (count > 0)
     {
-        for (;;)
+        if(timed)
         {
-            fd_set fds;
-            struct timeval tv;
-            int r;
-
-            FD_ZERO(&fds);
-            FD_SET(fd, &fds);
+            // absolute deadline, so processing time does not accumulate as drift
+            timespec_add_ns(&deadline, period_ns);
 
-            /* Timeout. */
-            tv.tv_sec = 2;
-            tv.tv_usec = 0;
+            while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
 
-            r = select(fd + 1, &fds, NULL, NULL, &tv);
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            late = ((double)(now.tv_sec - deadline.tv_sec) * 1000.0) +
+                   ((double)(now.tv_nsec - deadline.tv_nsec) / 1000000.0);
+            if(sched.releases == 0 || late < sched.late_min) sched.late_min = late;
+            if(late > sched.late_max) sched.late_max = late;
+            sched.late_sum += late;
+        }
 
-            if (-1 == r)
+        if((sched.releases++ % decimate) == 0)
+        {
+            // a release that processes waits up to a period if the camera is a bit
+            // behind, then gives up until the next deadline
+            taken = read_latest_frame(1) || (wait_frame(period_ns) && read_latest_frame(1));
+            if(taken)
             {
-                if (EINTR == errno)
-                    continue;
-                errno_exit("select");
+                sched.processed++;
+                count--;
             }
+        }
+        else
+            taken = read_latest_frame(0);
 
-            if (0 == r)
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if(taken)
+            last_frame = now;
+        else
+        {
+            sched.empty++;
+            watchdog = last_frame;
+            timespec_add_ns(&watchdog, WATCHDOG_NS);
+            if(timespec_before(&watchdog, &now))
             {
                 fprintf(stderr, "select timeout\n");
                 exit(EXIT_FAILURE);
             }
+        }
 
-            if (read_frame())
-            {
-                if(nanosleep(&read_delay, &time_error) != 0)
-                    perror("nanosleep");
-                else
-                    printf("time_error.tv_sec=%ld, time_error.tv_nsec=%ld\n", time_error.tv_sec, time_error.tv_nsec);
+        if(!timed)
+            continue;
 
-                count--;
-                break;
+        // overrun, skip the releases already missed rather than run them back to back
+        next = deadline;
+        timespec_add_ns(&next, period_ns);
+        if(timespec_before(&next, &now))
+        {
+            sched.overruns++;
+            while(timespec_before(&next, &now))
+            {
+                deadline = next;
+                timespec_add_ns(&next, period_ns);
+                sched.missed++;
             }
+        }
+    }
+
+    print_sched_stats();
+}
+
+static void *acquire_thread(void *arg)
+{
+    mainloop();
+    frame_ring_close(&raw_ring);
+    return NULL;
+}
 
-            /* EAGAIN - continue select loop unless count done. */
-            if(count <= 0) break;
+static void *convert_thread(void *arg)
+{
+    struct frame_slot *in, *out;
+    struct timespec start, acquired;
+
+    while((in=frame_ring_wait(&raw_ring)))
+    {
+        out=frame_ring_wait_space(&out_ring);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if(in->pixelformat == V4L2_PIX_FMT_YUYV)
+        {
+            out->size=convert_yuyv(in->data, in->size, out->data);
+            out->pixelformat=YUYV_DUMP_FORMAT;
+        }
+        else
+        {
+            memcpy(out->data, in->data, in->size);
+            out->size=in->size;
+            out->pixelformat=in->pixelformat;
         }
 
-        if(count <= 0) break;
+        out->tag=in->tag;
+        out->frame_time=in->frame_time;
+        out->acquired=acquired=in->acquired;
+
+        frame_ring_release(&raw_ring);
+        frame_ring_publish(&out_ring);
+        stage_account(&stats[STAGE_CONVERT], &start, &acquired);
     }
+
+    frame_ring_close(&out_ring);
+    return NULL;
+}
+
+static void *write_thread(void *arg)
+{
+    struct frame_slot *slot;
+    struct timespec start, acquired;
+
+    while((slot=frame_ring_wait(&out_ring)))
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if(slot->pixelformat == V4L2_PIX_FMT_GREY)
+            dump_pgm(slot->data, slot->size, slot->tag, &slot->frame_time);
+        else if(slot->pixelformat == V4L2_PIX_FMT_RGB24)
+            dump_ppm(slot->data, slot->size, slot->tag, &slot->frame_time);
+        else if(slot->pixelformat == V4L2_PIX_FMT_MJPEG)
+            dump_jpg(slot->data, slot->size, slot->tag);
+        else
+            printf("ERROR - unknown dump format\n");
+
+        acquired=slot->acquired;
+        frame_ring_release(&out_ring);
+        stage_account(&stats[STAGE_WRITE], &start, &acquired);
+    }
+
+    return NULL;
+}
+
+static void start_stage(pthread_t *thread, void *(*stage_fn)(void *), int stage)
+{
+    pthread_attr_t attr;
+    cpu_set_t cpuset;
+    int cpu=stage_cpu[stage], rc;
+
+    if(cpu < 0)
+        cpu = stage % sysconf(_SC_NPROCESSORS_ONLN);
+
+    pthread_attr_init(&attr);
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+
+    if((rc=pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset)) != 0)
+        fprintf(stderr, "%s stage affinity to CPU %d: %s\n", stats[stage].name, cpu, strerror(rc));
+
+    if((rc=pthread_create(thread, &attr, stage_fn, NULL)) != 0)
+    {
+        errno=rc;
+        errno_exit("pthread_create");
+    }
+
+    pthread_attr_destroy(&attr);
+    printf("%s stage on CPU %d\n", stats[stage].name, cpu);
+}
+
+static void print_ring_stats(const char *name, struct frame_ring *r)
+{
+    printf("%s ring: %u slots, max depth %u, avg depth %.2lf\n", name, r->nslots, r->max_depth,
+           r->depth_samples ? ((double)r->depth_sum / (double)r->depth_samples) : 0.0);
+}
+
+static void print_pipeline_stats(void)
+{
+    int i;
+
+    printf("\n%-8s %7s %6s %9s %9s %9s %11s %11s\n",
+           "stage", "frames", "drops", "min ms", "avg ms", "max ms", "avg lat ms", "max lat ms");
+
+    for(i=0; i<NUM_STAGES; i++)
+    {
+        struct stage_stats *st=&stats[i];
+        double n = st->frames ? (double)st->frames : 1.0;
+
+        printf("%-8s %7lu %6lu %9.3lf %9.3lf %9.3lf %11.3lf %11.3lf\n",
+               st->name, st->frames, st->drops, st->frames ? st->min_ms : 0.0,
+               st->sum_ms/n, st->max_ms, st->lat_sum_ms/n, st->lat_max_ms);
+    }
+
+    print_ring_stats("raw", &raw_ring);
+    print_ring_stats("out", &out_ring);
+}
+
+static void run_pipeline(void)
+{
+    pthread_t threads[NUM_STAGES];
+    size_t raw_bytes = fmt.fmt.pix.sizeimage;
+
+    // YUYV to RGB is the largest output, 6 bytes for every 4 in
+    if((frame_ring_init(&raw_ring, PIPE_SLOTS, raw_bytes) != 0) ||
+       (frame_ring_init(&out_ring, PIPE_SLOTS, (raw_bytes*6)/4) != 0))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    frame_handler=acquire_image;
+
+    // start consumers first so the acquire stage never waits on them
+    start_stage(&threads[STAGE_WRITE], write_thread, STAGE_WRITE);
+    start_stage(&threads[STAGE_CONVERT], convert_thread, STAGE_CONVERT);
+    start_stage(&threads[STAGE_ACQUIRE], acquire_thread, STAGE_ACQUIRE);
+
+    pthread_join(threads[STAGE_ACQUIRE], NULL);
+    pthread_join(threads[STAGE_CONVERT], NULL);
+    pthread_join(threads[STAGE_WRITE], NULL);
+
+    print_pipeline_stats();
+
+    frame_ring_destroy(&raw_ring);
+    frame_ring_destroy(&out_ring);
 }
 
 static void stop_capturing(void)
@@ -669,6 +1175,24 @@ static void init_userp(unsigned int buffer_size)
         }
 }
 
+// Errors ignored, not every driver lets the frame interval be set
+static void set_frame_rate(void)
+{
+    struct v4l2_streamparm parm;
+
+    CLEAR(parm);
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    parm.parm.capture.timeperframe.numerator = 1;
+    parm.parm.capture.timeperframe.denominator = rate_hz;
+
+    if (-1 == xioctl(fd, VIDIOC_S_PARM, &parm))
+        return;
+
+    if (parm.parm.capture.timeperframe.numerator)
+        printf("Frame interval %u/%u s\n", parm.parm.capture.timeperframe.numerator,
+               parm.parm.capture.timeperframe.denominator);
+}
+
 static void init_device(void)
 {
     struct v4l2_capability cap;
@@ -758,13 +1282,13 @@ static void init_device(void)
     if (force_format)
     {
         printf("FORCING FORMAT\n");
-        fmt.fmt.pix.width       = HRES;
-        fmt.fmt.pix.height      = VRES;
+        fmt.fmt.pix.width       = hres;
+        fmt.fmt.pix.height      = vres;
 
         // Specify the Pixel Coding Formate here
 
-        // This one work for Logitech C200
-        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        // YUYV works for Logitech C200, -P asks for another
+        fmt.fmt.pix.pixelformat = pixfmt;
 
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_UYVY;
         //fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_VYUY;
@@ -779,7 +1303,17 @@ static void init_device(void)
         if (-1 == xioctl(fd, VIDIOC_S_FMT, &fmt))
                 errno_exit("VIDIOC_S_FMT");
 
+        // UVC cameras only reach 720p at 30 fps over USB2 with MJPEG, and some
+        // default to a lower rate for it, so ask for the rate the service runs at
+        if (fmt.fmt.pix.pixelformat == V4L2_PIX_FMT_MJPEG)
+            set_frame_rate();
+
         /* Note VIDIOC_S_FMT may change width and height. */
+        if((fmt.fmt.pix.width != (unsigned int)hres) || (fmt.fmt.pix.height != (unsigned int)vres) ||
+           (fmt.fmt.pix.pixelformat != pixfmt))
+            printf("Driver chose %ux%u %s instead of %dx%d %s\n",
+                   fmt.fmt.pix.width, fmt.fmt.pix.height, capture_pixfmt_name(fmt.fmt.pix.pixelformat),
+                   hres, vres, capture_pixfmt_name(pixfmt));
     }
     else
     {
@@ -846,6 +1380,74 @@ static void open_device(void)
         }
 }
 
+static void open_source(void)
+{
+    if(!(source = frame_source_open(source_spec, hres, vres)))
+        exit(EXIT_FAILURE);
+
+    // what init_device() would have negotiated with the camera
+    CLEAR(fmt);
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    frame_source_format(source, &fmt.fmt.pix);
+
+    if(pixfmt != V4L2_PIX_FMT_YUYV)
+        printf("Frame sources are YUYV, -P %s ignored\n", capture_pixfmt_name(pixfmt));
+
+    printf("Replaying %s as %dx%d YUYV\n", frame_source_name(source),
+           fmt.fmt.pix.width, fmt.fmt.pix.height);
+}
+
+// Working buffers are sized from the negotiated format, after init_device() or open_source()
+static void alloc_work_buffers(void)
+{
+    size_t bytes = capture_work_bytes(&fmt.fmt.pix);
+
+    if((work_pool_init(&work, bytes) != 0) || !(bigbuffer = work_pool_alloc(&work, bytes)))
+    {
+        fprintf(stderr, "Out of memory for %zu byte working buffer\n", bytes);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Capturing %ux%u %s, %zu byte working buffer\n", fmt.fmt.pix.width, fmt.fmt.pix.height,
+           capture_pixfmt_name(fmt.fmt.pix.pixelformat), bytes);
+}
+
+// Decoded MJPEG frames arrive here on the decoder's delivery thread, in capture order
+static void deliver_decoded(const unsigned char *image, int size, unsigned int tag,
+                            struct timespec *frame_time, void *arg)
+{
+#if defined(COLOR_CONVERT)
+    dump_ppm(image, size, tag, frame_time);
+#else
+    dump_pgm(image, size, tag, frame_time);
+#endif
+}
+
+// MJPEG from the device is decoded by a pool of workers, so 1280x720 at 30 fps
+// keeps up even though one libjpeg decode can take most of a frame period
+static void open_decoder(void)
+{
+    struct mjpeg_decoder_config cfg;
+
+    if((fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_MJPEG) || (decode_workers < 1) || pipeline)
+        return;
+
+    CLEAR(cfg);
+    cfg.workers = decode_workers;
+    cfg.slots = 2 * decode_workers;
+    cfg.max_jpeg = fmt.fmt.pix.sizeimage;
+    cfg.width = fmt.fmt.pix.width;
+    cfg.height = fmt.fmt.pix.height;
+#if defined(COLOR_CONVERT)
+    cfg.components = 3;
+#else
+    cfg.components = 1;
+#endif
+
+    decoder = mjpeg_decoder_open(&cfg, deliver_decoded, NULL);
+    printf("Decoding MJPEG on %d workers\n", decode_workers);
+}
+
 static void usage(FILE *fp, int argc, char **argv)
 {
         fprintf(fp,
@@ -858,13 +1460,39 @@ static void usage(FILE *fp, int argc, char **argv)
                  "-r | --read          Use read() calls\n"
                  "-u | --userp         Use application allocated buffers\n"
                  "-o | --output        Outputs stream to stdout\n"
-                 "-f | --format        Force format to 640x480 GREY\n"
+                 "-f | --format        Force the -S/-P format on the device [default]\n"
                  "-c | --count         Number of frames to grab [%i]\n"
+                 "-s | --source spec   Replay frames instead of a device:\n"
+                 "                     raw:file[@fps], dir:directory[@fps],\n"
+                 "                     synth[:bars|ramp|noise|box][@fps]\n"
+                 "-p | --pipeline      Acquire, convert and write on separate threads\n"
+                 "-a | --affinity list CPUs for acquire,convert,write stages [0,1,2]\n"
+                 "-R | --rate hz       Camera frame rate the service is released at [%d]\n"
+                 "-D | --decimate n    Process one frame in n, e.g. -R 30 -D 30 for 1 Hz [%d]\n"
+                 "-F | --fifo prio     Run the acquire service under SCHED_FIFO at prio\n"
+                 "-C | --cpu n         Run the acquire service on CPU n\n"
+                 "-S | --size WxH      Resolution to request [%dx%d]\n"
+                 "-P | --pixfmt name   yuyv, grey, rgb24 or mjpeg [%s]\n"
+                 "-j | --jobs n        MJPEG decode workers, 0 saves the JPEG as-is [%d]\n"
                  "",
-                 argv[0], dev_name, frame_count);
+                 argv[0], dev_name, frame_count, rate_hz, decimate,
+                 hres, vres, capture_pixfmt_name(pixfmt), decode_workers);
 }
 
-static const char short_options[] = "d:hmruofc:";
+// comma separated CPU list for the acquire, convert and write stages
+static void parse_affinity(char *list)
+{
+    int stage;
+    char *next=list;
+
+    for(stage=0; (stage < NUM_STAGES) && (*next != '\0'); stage++)
+    {
+        stage_cpu[stage]=strtol(next, &next, 0);
+        if(*next == ',') next++;
+    }
+}
+
+static const char short_options[] = "d:hmruofc:pa:s:R:D:F:C:S:P:j:";
 
 static const struct option
 long_options[] = {
@@ -876,6 +1504,16 @@ long_options[] = {
         { "output", no_argument,       NULL, 'o' },
         { "format", no_argument,       NULL, 'f' },
         { "count",  required_argument, NULL, 'c' },
+        { "source", required_argument, NULL, 's' },
+        { "size",   required_argument, NULL, 'S' },
+        { "pixfmt", required_argument, NULL, 'P' },
+        { "jobs",   required_argument, NULL, 'j' },
+        { "rate",   required_argument, NULL, 'R' },
+        { "decimate", required_argument, NULL, 'D' },
+        { "fifo",   required_argument, NULL, 'F' },
+        { "cpu",    required_argument, NULL, 'C' },
+        { "pipeline", no_argument,     NULL, 'p' },
+        { "affinity", required_argument, NULL, 'a' },
         { 0, 0, 0, 0 }
 };
 
@@ -937,19 +1575,98 @@ int main(int argc, char **argv)
                         errno_exit(optarg);
                 break;
 
+            case 's':
+                source_spec = optarg;
+                break;
+
+            case 'S':
+                if(capture_parse_size(optarg, &hres, &vres) != 0)
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'P':
+                if(!(pixfmt = capture_parse_pixfmt(optarg)))
+                {
+                    usage(stderr, argc, argv);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'j':
+                decode_workers = atoi(optarg);
+                break;
+
+            case 'R':
+                rate_hz = atoi(optarg);
+                break;
+
+            case 'D':
+                decimate = atoi(optarg);
+                break;
+
+            case 'F':
+                fifo_prio = atoi(optarg);
+                break;
+
+            case 'C':
+                service_cpu = atoi(optarg);
+                break;
+
+            case 'p':
+                pipeline++;
+                break;
+
+            case 'a':
+                parse_affinity(optarg);
+                break;
+
             default:
                 usage(stderr, argc, argv);
                 exit(EXIT_FAILURE);
         }
     }
 
-    open_device();
-    init_device();
-    start_capturing();
-    mainloop();
-    stop_capturing();
-    uninit_device();
-    close_device();
+    if((rate_hz < 1) || (decimate < 1))
+    {
+        usage(stderr, argc, argv);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("YUYV conversion kernel %s\n", yuv_isa_name(yuv_convert_isa()));
+
+    if(source_spec)
+        open_source();
+    else
+    {
+        open_device();
+        init_device();
+        start_capturing();
+    }
+
+    alloc_work_buffers();
+    open_decoder();
+
+    if(pipeline)
+        run_pipeline();
+    else
+        mainloop();
+
+    // delivers the frames still being decoded before the buffers go away
+    if(decoder)
+        mjpeg_decoder_close(decoder);
+
+    if(source)
+        frame_source_close(source);
+    else
+    {
+        stop_capturing();
+        uninit_device();
+        close_device();
+    }
+    work_pool_destroy(&work);
     fprintf(stderr, "\n");
     return 0;
 }